@@ -0,0 +1,191 @@
+/**
+ * Bandwidth of the copy strategies CopyRingBuffer picks between, and how
+ * much each disturbs the cache for everything else.
+ *
+ * Copies blocks into (writes) or out of (reads) a ring much larger than the
+ * last level cache. With the late consumer, the ring is drained milliseconds
+ * later, as a buffer with a slow reader would be. With the immediate one, the
+ * other side touches each block as soon as it's copied: a write's block is
+ * read back, and a read's block was just written, so whatever a copy keeps
+ * out of the cache has to come back from memory. Every 64 blocks it times a
+ * scan of a small hot array standing in for another thread's working set:
+ * the more a copy pollutes the cache, the longer the scan. Each strategy,
+ * consumer and block size prints one row, as CSV (the default) or JSON lines.
+ *
+ * Usage: bench_copy_engine [--format=csv|json] [--block-sizes=4096,...]
+ *            [--consumers=late,immediate] [--total-mb=N] [--ring-mb=N]
+ *            [--hot-kb=N]
+ */
+#include <snake_charmer/copy_engine.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace snake_charmer;
+
+namespace {
+
+const size_t BLOCKS_PER_SCAN = 64;
+// where the scans' sums go, so they can't be optimised away
+volatile long scan_sum = 0;
+
+struct Config {
+    std::string strategy;
+    std::string consumer;
+    size_t block_size;
+    size_t total_bytes;
+};
+
+struct Result {
+    double gb_per_sec;
+    double scan_ns;
+};
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start < list.size()) {
+        const size_t end = std::min(list.find(',', start), list.size());
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+std::vector<size_t> split_sizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    for(const std::string& item : split(list)) {
+        sizes.push_back(std::strtoull(item.c_str(), NULL, 10));
+    }
+    return sizes;
+}
+
+// Read a line of every 64 bytes, as a consumer would
+long touch(const char* bytes, const size_t size) {
+    long sum = 0;
+    for(size_t n = 0; n < size; n += 64) {
+        sum += bytes[n];
+    }
+    return sum;
+}
+
+Result run(const Config& config, std::vector<char>& ring, const std::vector<char>& hot) {
+    std::vector<char> block(config.block_size, 1);
+    size_t offset = 0;
+    size_t blocks = 0;
+    double scan_ns = 0;
+    const bool is_write = config.strategy.compare(0, 6, "write_") == 0;
+    const bool immediate = config.consumer == "immediate";
+    const auto start = std::chrono::steady_clock::now();
+    for(size_t done = 0; done < config.total_bytes; done += config.block_size, blocks++) {
+        char* slot = ring.data() + offset;
+        if(immediate && !is_write) {
+            // the writer just filled it
+            memset(slot, static_cast<int>(blocks), config.block_size);
+        }
+        if(config.strategy == "write_memcpy") {
+            memcpy(slot, block.data(), config.block_size);
+        } else if(config.strategy == "write_streaming") {
+            copy_streaming(slot, block.data(), config.block_size);
+        } else if(config.strategy == "read_memcpy") {
+            memcpy(block.data(), slot, config.block_size);
+        } else {
+            copy_prefetching(block.data(), slot, config.block_size);
+        }
+        if(immediate && is_write) {
+            // the reader drains it straight away
+            scan_sum += touch(slot, config.block_size);
+        }
+        offset = (offset + config.block_size) % (ring.size() - config.block_size);
+        if(blocks % BLOCKS_PER_SCAN == 0) {
+            const auto scan_start = std::chrono::steady_clock::now();
+            scan_sum += touch(hot.data(), hot.size());
+            scan_ns += std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - scan_start).count();
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return Result{config.total_bytes / elapsed.count() / 1e9,
+        scan_ns / ((blocks + BLOCKS_PER_SCAN - 1) / BLOCKS_PER_SCAN)};
+}
+
+void print_result(const std::string& format, const Config& config, const Result& result) {
+    if(format == "json") {
+        printf("{\"strategy\": \"%s\", \"consumer\": \"%s\", \"block_size\": %zu, "
+            "\"gb_per_sec\": %.3f, \"hot_scan_ns\": %.0f}\n",
+            config.strategy.c_str(), config.consumer.c_str(), config.block_size,
+            result.gb_per_sec, result.scan_ns);
+    } else {
+        printf("%s,%s,%zu,%.3f,%.0f\n",
+            config.strategy.c_str(), config.consumer.c_str(), config.block_size,
+            result.gb_per_sec, result.scan_ns);
+    }
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string format = "csv";
+    std::string block_sizes = "4096,16384,65536,262144,1048576,4194304,16777216";
+    std::string consumers = "late,immediate";
+    size_t total_mb = 2048;
+    size_t ring_mb = 256;
+    size_t hot_kb = 1024;
+    for(int n = 1; n < argc; n++) {
+        const std::string arg = argv[n];
+        const size_t equals = arg.find('=');
+        const std::string key = arg.substr(0, equals);
+        const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        if(key == "--format") {
+            format = value;
+        } else if(key == "--block-sizes") {
+            block_sizes = value;
+        } else if(key == "--consumers") {
+            consumers = value;
+        } else if(key == "--total-mb") {
+            total_mb = std::strtoull(value.c_str(), NULL, 10);
+        } else if(key == "--ring-mb") {
+            ring_mb = std::strtoull(value.c_str(), NULL, 10);
+        } else if(key == "--hot-kb") {
+            hot_kb = std::strtoull(value.c_str(), NULL, 10);
+        } else {
+            fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if(format != "csv" && format != "json") {
+        fprintf(stderr, "--format must be csv or json\n");
+        return 1;
+    }
+    for(const std::string& consumer : split(consumers)) {
+        if(consumer != "late" && consumer != "immediate") {
+            fprintf(stderr, "--consumers must be late and/or immediate\n");
+            return 1;
+        }
+    }
+
+    std::vector<char> ring(ring_mb << 20, 2);
+    const std::vector<char> hot(hot_kb << 10, 3);
+    if(format == "csv") {
+        printf("strategy,consumer,block_size,gb_per_sec,hot_scan_ns\n");
+    }
+    for(const size_t block_size : split_sizes(block_sizes)) {
+        if(block_size == 0 || block_size >= ring.size()) {
+            continue;
+        }
+        for(const std::string& consumer : split(consumers)) {
+            for(const char* strategy :
+                    {"write_memcpy", "write_streaming", "read_memcpy", "read_prefetching"}) {
+                const Config config{strategy, consumer, block_size,
+                    std::max(total_mb << 20, block_size)};
+                print_result(format, config, run(config, ring, hot));
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+/**
+ * Throughput of the ring buffers across element sizes, grab sizes, slack,
+ * reader counts and thread pinning.
+ *
+ * One writer thread fills the buffer for --duration-ms while the readers
+ * drain it. Each configuration prints one row, as CSV (the default) or JSON
+ * lines, with the messages (elements) and bytes consumed per second summed
+ * over all readers. In broadcast mode every reader consumes every element.
+ *
+ * Usage: bench_throughput [--format=csv|json] [--duration-ms=N] [--quick]
+ *            [--buffers=copy,copy_spsc,direct,direct_broadcast]
+ *            [--elem-sizes=8,...] [--elems-per-op=1,...]
+ *            [--slack-factors=4,...] [--readers=1,...] [--pinned=0,1]
+ */
+#include <snake_charmer/copy_ring_buffer.h>
+#include <snake_charmer/direct_ring_buffer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+using namespace snake_charmer;
+
+namespace {
+
+// bytes per grab above which a configuration is skipped, to bound memory
+const size_t MAX_BYTES_PER_OP = 16 << 20;
+const std::chrono::milliseconds POLL_TIMEOUT(1);
+
+struct Config {
+    std::string buffer;
+    size_t elem_size;
+    size_t elems_per_op;
+    // as for RingBuffer, which already scales it by elems_per_op
+    size_t slack;
+    size_t readers;
+    bool pinned;
+    std::chrono::milliseconds duration;
+};
+
+struct Result {
+    size_t elems;
+    double seconds;
+};
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start <= list.size()) {
+        const size_t end = std::min(list.find(',', start), list.size());
+        if(end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+std::vector<size_t> split_sizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    for(const std::string& item : split(list)) {
+        sizes.push_back(std::strtoull(item.c_str(), NULL, 10));
+    }
+    return sizes;
+}
+
+void pin_thread(const bool pinned, const size_t cpu) {
+#ifdef __linux__
+    if(!pinned) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu % std::thread::hardware_concurrency(), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)pinned;
+    (void)cpu;
+#endif
+}
+
+Result run_copy(const Config& config) {
+    const CopyMode mode = config.buffer == "copy_spsc" ? CopyMode::SPSC : CopyMode::Locked;
+    CopyRingBuffer ring_buffer(
+        config.elem_size, config.elems_per_op, config.elems_per_op, config.slack, "off", mode);
+    const size_t op_bytes = config.elem_size * config.elems_per_op;
+    std::atomic<bool> writer_done(false);
+    std::atomic<size_t> elems_read(0);
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + config.duration;
+
+    std::vector<std::thread> readers;
+    for(size_t id = 0; id < config.readers; id++) {
+        readers.emplace_back([&, id]() {
+            pin_thread(config.pinned, id + 1);
+            std::vector<char> dest(op_bytes);
+            size_t elems = 0;
+            while(true) {
+                if(ring_buffer.read(dest.data(), config.elems_per_op, POLL_TIMEOUT) == 0) {
+                    elems += config.elems_per_op;
+                } else if(writer_done.load()) {
+                    break;
+                }
+            }
+            elems_read += elems;
+        });
+    }
+    pin_thread(config.pinned, 0);
+    std::vector<char> source(op_bytes, 1);
+    while(std::chrono::steady_clock::now() < deadline) {
+        ring_buffer.write(source.data(), config.elems_per_op, POLL_TIMEOUT);
+    }
+    writer_done.store(true);
+    for(std::thread& reader : readers) {
+        reader.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return Result{elems_read.load(), elapsed.count()};
+}
+
+Result run_direct(const Config& config) {
+    const ReadMode read_mode = config.buffer == "direct_broadcast"
+        ? ReadMode::Broadcast : ReadMode::Distribute;
+    DirectRingBuffer ring_buffer(
+        config.elem_size, config.elems_per_op, config.elems_per_op, config.slack, "off",
+        config.readers, read_mode);
+    const size_t op_bytes = config.elem_size * config.elems_per_op;
+    std::atomic<bool> writer_done(false);
+    std::atomic<size_t> elems_read(0);
+    std::vector<size_t> ids;
+    for(size_t id = 0; id < config.readers; id++) {
+        ids.push_back(ring_buffer.add_reader());
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + config.duration;
+
+    std::vector<std::thread> readers;
+    for(size_t id = 0; id < config.readers; id++) {
+        readers.emplace_back([&, id]() {
+            pin_thread(config.pinned, id + 1);
+            size_t elems = 0;
+            char* elem_ptr;
+            while(true) {
+                if(ring_buffer.grab_read(elem_ptr, config.elems_per_op, ids[id], POLL_TIMEOUT) == 0) {
+                    ring_buffer.release_read(ids[id]);
+                    elems += config.elems_per_op;
+                } else if(writer_done.load()) {
+                    break;
+                }
+            }
+            elems_read += elems;
+        });
+    }
+    pin_thread(config.pinned, 0);
+    // the writer produces the data in place, as a zero-copy producer would
+    std::vector<char> source(op_bytes, 1);
+    char* elem_ptr;
+    while(std::chrono::steady_clock::now() < deadline) {
+        if(ring_buffer.grab_write(elem_ptr, config.elems_per_op) == 0) {
+            memcpy(elem_ptr, source.data(), op_bytes);
+            ring_buffer.release_write();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    writer_done.store(true);
+    for(std::thread& reader : readers) {
+        reader.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return Result{elems_read.load(), elapsed.count()};
+}
+
+void print_header(const std::string& format) {
+    if(format == "csv") {
+        printf("buffer,elem_size,elems_per_op,slack,readers,pinned,elems,seconds,msgs_per_sec,gb_per_sec\n");
+    }
+}
+
+void print_result(const std::string& format, const Config& config, const Result& result) {
+    const double msgs_per_sec = result.elems / result.seconds;
+    const double gb_per_sec = msgs_per_sec * config.elem_size / 1e9;
+    if(format == "json") {
+        printf("{\"buffer\": \"%s\", \"elem_size\": %zu, \"elems_per_op\": %zu, \"slack\": %zu, "
+            "\"readers\": %zu, \"pinned\": %s, \"elems\": %zu, \"seconds\": %.6f, "
+            "\"msgs_per_sec\": %.1f, \"gb_per_sec\": %.4f}\n",
+            config.buffer.c_str(), config.elem_size, config.elems_per_op, config.slack,
+            config.readers, config.pinned ? "true" : "false", result.elems, result.seconds,
+            msgs_per_sec, gb_per_sec);
+    } else {
+        printf("%s,%zu,%zu,%zu,%zu,%d,%zu,%.6f,%.1f,%.4f\n",
+            config.buffer.c_str(), config.elem_size, config.elems_per_op, config.slack,
+            config.readers, config.pinned ? 1 : 0, result.elems, result.seconds,
+            msgs_per_sec, gb_per_sec);
+    }
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string format = "csv";
+    std::string duration_ms = "200";
+    std::string buffers = "copy,copy_spsc,direct,direct_broadcast";
+    std::string elem_sizes = "8,64,512,4096,65536,1048576";
+    std::string elems_per_op = "1,16";
+    std::string slack_factors = "4";
+    std::string readers = "1,2,4,8,16";
+    std::string pinned = "0,1";
+    for(int n = 1; n < argc; n++) {
+        const std::string arg = argv[n];
+        const size_t equals = arg.find('=');
+        const std::string key = arg.substr(0, equals);
+        const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        if(key == "--format") {
+            format = value;
+        } else if(key == "--duration-ms") {
+            duration_ms = value;
+        } else if(key == "--buffers") {
+            buffers = value;
+        } else if(key == "--elem-sizes") {
+            elem_sizes = value;
+        } else if(key == "--elems-per-op") {
+            elems_per_op = value;
+        } else if(key == "--slack-factors") {
+            slack_factors = value;
+        } else if(key == "--readers") {
+            readers = value;
+        } else if(key == "--pinned") {
+            pinned = value;
+        } else if(key == "--quick") {
+            duration_ms = "50";
+            elem_sizes = "64,65536";
+            readers = "1,4";
+            pinned = "0";
+        } else {
+            fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if(format != "csv" && format != "json") {
+        fprintf(stderr, "--format must be csv or json\n");
+        return 1;
+    }
+    const std::chrono::milliseconds duration(std::strtoull(duration_ms.c_str(), NULL, 10));
+
+    print_header(format);
+    for(const std::string& buffer : split(buffers)) {
+        for(const size_t elem_size : split_sizes(elem_sizes)) {
+            for(const size_t per_op : split_sizes(elems_per_op)) {
+                if(elem_size * per_op > MAX_BYTES_PER_OP) {
+                    continue;
+                }
+                for(const size_t slack_factor : split_sizes(slack_factors)) {
+                    for(const size_t num_readers : split_sizes(readers)) {
+                        if(buffer == "copy_spsc" && num_readers != 1) {
+                            continue;
+                        }
+                        for(const size_t pin : split_sizes(pinned)) {
+                            const Config config{buffer, elem_size, per_op,
+                                slack_factor, num_readers, pin != 0, duration};
+                            Result result;
+                            if(buffer == "copy" || buffer == "copy_spsc") {
+                                result = run_copy(config);
+                            } else if(buffer == "direct" || buffer == "direct_broadcast") {
+                                result = run_direct(config);
+                            } else {
+                                fprintf(stderr, "unknown buffer %s\n", buffer.c_str());
+                                return 1;
+                            }
+                            print_result(format, config, result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
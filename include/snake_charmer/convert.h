@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+namespace snake_charmer {
+
+/**
+ * Format of the samples making up an element, e.g. one real or imaginary
+ * part of an IQ sample
+ *
+ * BFloat16 is the top half of a Float32, rounded to nearest even.
+ */
+enum SampleFormat {
+    Int8 = 0,
+    Int16 = 1,
+    Float32 = 2,
+    BFloat16 = 3
+};
+
+/**
+ * Conversion applied while copying samples
+ *
+ * from format of the source samples
+ * to format of the destination samples
+ * scale factor applied to every sample, e.g. 1.0f / 32768 to normalise
+ * Int16 samples to [-1, 1). Conversions to integers round to nearest even
+ * and saturate.
+ * byteswap if true, the source samples are in the opposite byte order, e.g.
+ * big endian samples from the network
+ */
+struct SampleConversion {
+    SampleFormat from;
+    SampleFormat to;
+    float scale;
+    bool byteswap;
+};
+
+/**
+ * Get the size of one sample of format in bytes, or 0 if it isn't a format
+ */
+size_t get_sample_size(const SampleFormat format);
+
+/**
+ * Copy num_samples samples from src to dst, converting them
+ *
+ * Converts in blocks small enough to stay in L1 cache, so the data only
+ * crosses memory once. The kernels are the widest this CPU supports (see
+ * get_conversion_isa()).
+ *
+ * Returns 0 if successful.
+ * Returns EINVAL if either format isn't a SampleFormat
+ */
+int convert_samples(
+    char* dst,
+    const char* src,
+    const size_t num_samples,
+    const SampleConversion& conversion
+);
+
+/**
+ * Get the instruction set the conversion kernels use: "avx512", "avx2",
+ * "neon" or "scalar"
+ */
+std::string get_conversion_isa();
+
+/**
+ * Choose the conversion kernels by instruction set, e.g. to compare them
+ *
+ * Returns 0 if successful.
+ * Returns EINVAL if isa isn't one of those above
+ * Returns ENOTSUP if this CPU or build can't run it
+ */
+int set_conversion_isa(const std::string& isa);
+
+}; // namespace snake_charmer
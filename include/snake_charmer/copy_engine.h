@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace snake_charmer {
+
+/**
+ * Copies for blocks too large to be worth caching, used by CopyRingBuffer
+ * above its copy threshold
+ */
+
+/**
+ * Copy bytes from src to dst with non-temporal stores, so dst doesn't
+ * displace the rest of the last level cache. For destinations nothing reads
+ * soon, e.g. a buffer the consumer drains milliseconds later. The stores are
+ * fenced before returning, so a release afterwards publishes them.
+ *
+ * Falls back to memcpy where there are no streaming stores (non-x86).
+ */
+void copy_streaming(char* dst, const char* src, const size_t bytes);
+
+/**
+ * Copy bytes from src to dst, prefetching src a page ahead of the copy, for
+ * large sources that aren't cached, e.g. a buffer being drained long after
+ * it was written
+ */
+void copy_prefetching(char* dst, const char* src, const size_t bytes);
+
+}; // namespace snake_charmer
@@ -1,26 +1,50 @@
-#include <condition_variable>
+#include "convert.h"
 #include "ring_buffer.h"
 
 namespace snake_charmer {
 
+/**
+ * Synchronization used by a CopyRingBuffer
+ *
+ * Locked supports any number of concurrent writers and readers, and
+ * serializes them with buf_mutex. Only Condvar waits hold buf_mutex while
+ * they sleep.
+ *
+ * SPSC supports exactly one writer thread and one reader thread. The
+ * indices are handed off with acquire/release atomics, and buf_mutex is only
+ * taken when a caller actually has to block.
+ */
+enum CopyMode {
+    Locked = 0,
+    SPSC = 1
+};
+
 class CopyRingBuffer : public RingBuffer {
     public:
         const static std::chrono::microseconds DEFAULT_TIMEOUT;
+        const static size_t DEFAULT_COPY_THRESHOLD;
         CopyRingBuffer(
                 const size_t elem_size,
                 const size_t max_elems_per_write,
                 const size_t max_elems_per_read,
                 const size_t slack,
-                std::string loglevel
+                std::string loglevel,
+                const CopyMode mode = CopyMode::Locked,
+                const PageSize page_size = PageSize::StandardPages,
+                const WaitStrategy wait_strategy = WaitStrategy::Condvar,
+                const OverflowPolicy overflow = OverflowPolicy::Block
         );
         /**
          * Write elem_size bytes to the buffer via memcpy
          *
          * elem_ptr pointer from where elements will be copied
          * elems_this_write number of elements to write
+         * timeout number of microseconds to wait for space; unused with
+         * OverflowPolicy::Overwrite, which never waits
          *
          * Returns 0 if successful.
-         * Returns ENOBUFS if buffer full
+         * Returns ENOBUFS if buffer full (OverflowPolicy::Block only)
+         * Returns EMSGSIZE if elems_this_write > max_elems_per_write
          */
         int write(
             const char* elem_ptr,
@@ -39,6 +63,7 @@ class CopyRingBuffer : public RingBuffer {
          *
          * Returns 0 if successful.
          * Returns ENOMSG if buffer empty
+         * Returns EMSGSIZE if elems_this_read > max_elems_per_read
          */
         int read(
             char* elem_ptr,
@@ -47,13 +72,157 @@ class CopyRingBuffer : public RingBuffer {
             const int64_t advance_size = -1
         );
 
+        /**
+         * As above, reporting elements lost to OverflowPolicy::Overwrite
+         *
+         * elems_skipped set to the number of elements overwritten before
+         * they could be read, directly before the elements read. In Locked
+         * mode with several readers, it counts skips since any reader's last
+         * read.
+         *
+         * With OverflowPolicy::Block it's always 0.
+         */
+        int read(
+            char* elem_ptr,
+            const size_t elems_this_read,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout = DEFAULT_TIMEOUT,
+            const int64_t advance_size = -1
+        );
+
+        /**
+         * As above, converting the samples making up each element while
+         * copying them in, e.g. from a radio's big endian Int16 IQ to
+         * Float32. elem_ptr holds elements of conversion.from samples, each
+         * with as many samples as an element of the buffer holds of
+         * conversion.to samples.
+         *
+         * Returns EINVAL if a format isn't a SampleFormat, or elem_size isn't
+         * a whole number of conversion.to samples
+         */
+        int write(
+            const char* elem_ptr,
+            const size_t elems_this_write,
+            const SampleConversion& conversion,
+            const std::chrono::microseconds& timeout = DEFAULT_TIMEOUT
+        );
+
+        /**
+         * As read() above, converting the samples while copying them out.
+         * conversion.from is the format of the buffer's samples, and
+         * conversion.to the format to read them as.
+         *
+         * Returns EINVAL if a format isn't a SampleFormat, or elem_size isn't
+         * a whole number of conversion.from samples
+         */
+        int read(
+            char* elem_ptr,
+            const size_t elems_this_read,
+            const SampleConversion& conversion,
+            const std::chrono::microseconds& timeout = DEFAULT_TIMEOUT
+        );
+
+        size_t get_elems_avail_to_read();
+        size_t get_elems_avail_to_write();
+
+        /**
+         * Get the synchronization mode chosen at construction
+         */
+        CopyMode get_mode();
+
+        /**
+         * Get what a write does when the buffer is full
+         */
+        OverflowPolicy get_overflow_policy();
+
+        /**
+         * Grow or shrink the buffer to the size for slack (see RingBuffer),
+         * keeping the unread elements. Reads and writes wait for it under
+         * buf_mutex.
+         *
+         * Returns 0 if successful.
+         * Returns ENOBUFS if the unread elements don't fit in the new size
+         * Returns ENOTSUP in SPSC mode, whose reader and writer don't take
+         * buf_mutex, or if not on unix
+         * Returns errno if the new buffer can't be mapped
+         */
+        int resize(const size_t slack);
+
+        /**
+         * Set the bytes per write or read from which copies bypass the
+         * cache (see copy_engine.h): writes use streaming stores, and reads
+         * prefetch ahead. A block that size will have left the core's cache
+         * before the other side gets to it anyway. SIZE_MAX turns it off.
+         */
+        void set_copy_threshold(const size_t bytes);
+        size_t get_copy_threshold();
+
     private:
-        // thread safety
-        std::condition_variable buf_cv;
-        
-        // writer/reader indices
-        size_t write_index;
-        size_t read_index;
+        /**
+         * Copy elems elements from src to dst, converting their samples
+         * unless conversion is null
+         *
+         * into_buffer true if dst is in the buffer, false if src is
+         */
+        void copy_elems(
+            char* dst,
+            const char* src,
+            const size_t elems,
+            const SampleConversion* conversion,
+            const bool into_buffer
+        );
+        /**
+         * Returns true if the buffer's elements are whole numbers of
+         * buffer_format samples, and conversion's formats are valid
+         */
+        bool check_conversion(
+            const SampleConversion& conversion,
+            const SampleFormat buffer_format
+        );
+        int write_locked(
+            const char* elem_ptr,
+            const size_t elems_this_write,
+            const SampleConversion* conversion,
+            const std::chrono::microseconds& timeout
+        );
+        int write_spsc(
+            const char* elem_ptr,
+            const size_t elems_this_write,
+            const SampleConversion* conversion,
+            const std::chrono::microseconds& timeout
+        );
+        int read_locked(
+            char* elem_ptr,
+            const size_t elems_this_read,
+            const SampleConversion* conversion,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout,
+            const int64_t advance_size
+        );
+        int read_spsc(
+            char* elem_ptr,
+            const size_t elems_this_read,
+            const SampleConversion* conversion,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout,
+            const int64_t advance_size
+        );
+
+        const CopyMode mode;
+        const OverflowPolicy overflow;
+
+        // writer/reader indices, each on its own cache line so the producer
+        // and consumer don't false-share in SPSC mode
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_index;
+        // With OverflowPolicy::Overwrite in SPSC mode, 1 more than the last
+        // element the writer has started copying in. A reader that finds it
+        // more than num_elems past what it copied out knows its copy is torn.
+        std::atomic<size_t> write_claim;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_index;
+        // With OverflowPolicy::Overwrite in Locked mode, elements the writer
+        // pushed read_index past since the last read; guarded by buf_mutex
+        size_t pending_skip;
+        std::atomic<size_t> copy_threshold;
 };
 
 }; // namespace snake_charmer
@@ -0,0 +1,385 @@
+#pragma once
+
+/**
+ * C++20 coroutine support, built as the separate snake_charmer_coroutines
+ * library so that the core library stays on C++11. Linux only, since it's
+ * built on the eventfds from RingBuffer::enable_event_fds().
+ */
+#if __cplusplus < 202002L
+  #error "snake_charmer/coroutine.h needs C++20"
+#endif
+
+#include "copy_ring_buffer.h"
+#include "direct_ring_buffer.h"
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace snake_charmer {
+
+class Executor;
+
+/**
+ * A coroutine run by an Executor
+ *
+ * Tasks start suspended, and run once spawned onto an Executor, which owns
+ * them from then on.
+ */
+class Task {
+    public:
+        struct promise_type {
+            Task get_return_object() {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            };
+            std::suspend_always initial_suspend() noexcept { return {}; };
+            // the executor destroys the frame once it sees it's done
+            std::suspend_always final_suspend() noexcept { return {}; };
+            void return_void() {};
+            void unhandled_exception() {
+                exception = std::current_exception();
+            };
+
+            Executor* executor = nullptr;
+            std::exception_ptr exception;
+        };
+
+        Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {};
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() {
+            if(handle) {
+                handle.destroy();
+            }
+        };
+
+    private:
+        friend class Executor;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {};
+
+        std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * A coroutine suspended until a buffer it's waiting on can satisfy it
+ */
+struct BufferWaiter {
+    virtual ~BufferWaiter() = default;
+
+    /**
+     * Retry the operation the coroutine is waiting on
+     *
+     * Returns true if it's complete, and the coroutine can resume
+     */
+    virtual bool try_complete() = 0;
+
+    std::coroutine_handle<> handle;
+};
+
+/**
+ * Runs Tasks on the calling thread, resuming each when the buffer it's
+ * waiting on has data or space
+ *
+ * Rather than parking a thread per stream in a blocking grab, a Task
+ * co_awaits one of the awaitables below. If the grab would fail, the Task
+ * is suspended and the executor waits on the buffer's eventfd (see
+ * RingBuffer::enable_event_fds(), which it calls with thresholds of 1 if
+ * they aren't already enabled) in an epoll loop, along with every other
+ * suspended Task's. A few executors, one per core, can serve thousands of
+ * streams.
+ *
+ * An executor isn't thread-safe, except for stop(): tasks are spawned and
+ * run on the thread calling run(). Buffers can be written and read by other
+ * threads, but the tasks waiting on any one buffer must all be on the same
+ * executor, since the executor clears the buffer's eventfds. Buffers must
+ * outlive the tasks waiting on them.
+ */
+class Executor {
+    public:
+        /**
+         * Throws std::runtime_error if epoll or eventfd fail
+         */
+        explicit Executor(std::string loglevel = "");
+        /**
+         * Destroys the tasks that haven't finished
+         */
+        ~Executor();
+
+        /**
+         * Queue task to start on the next run()
+         */
+        void spawn(Task task);
+
+        /**
+         * Run the tasks until they have all finished or stop() is called
+         *
+         * Returns 0 if every task finished.
+         * Returns ECANCELED if stop() was called. Unfinished tasks carry on
+         * with the next run().
+         * Returns errno if epoll_wait() fails
+         *
+         * Rethrows the first exception a task doesn't catch, after
+         * destroying that task.
+         */
+        int run();
+
+        /**
+         * Make run() return, from any thread
+         */
+        void stop();
+
+        /**
+         * Get the number of tasks that haven't finished
+         */
+        size_t get_num_tasks();
+
+        /**
+         * Suspend waiter until buffer has data (readable) or space to retry
+         * it. For the awaitables.
+         */
+        void wait(RingBuffer& buffer, const bool readable, BufferWaiter& waiter);
+        /**
+         * Resume handle on the next pass, after the other ready tasks
+         */
+        void schedule(std::coroutine_handle<> handle);
+
+    private:
+        // waiters on one of a buffer's eventfds
+        struct FdWaiters {
+            RingBuffer* buffer;
+            bool readable;
+            std::vector<BufferWaiter*> waiters;
+        };
+
+        /**
+         * Resume handle, destroying it if it finished
+         */
+        void resume(std::coroutine_handle<> handle);
+        /**
+         * Clear fd, then resume the waiters on it that can now complete.
+         * Once none are left, fd is forgotten: its buffer may be destroyed,
+         * and another buffer's eventfd given the same number.
+         */
+        void wake(const int fd);
+
+        const int epoll_fd;
+        // signalled by stop()
+        const int stop_fd;
+        std::deque<std::coroutine_handle<>> ready;
+        std::unordered_map<int, FdWaiters> waiting;
+        // tasks not yet finished, to destroy any left over
+        std::vector<std::coroutine_handle<Task::promise_type>> tasks;
+        std::exception_ptr exception;
+        std::shared_ptr<spdlog::logger> logger;
+};
+
+/**
+ * Result of co_awaiting a grab
+ *
+ * rc 0 if successful, otherwise as for the blocking grab, except that it
+ * never times out with ENOMSG or ENOBUFS
+ * elem_ptr pointer in the buffer, if successful
+ * elems_grabbed number of elements grabbed, if successful
+ */
+struct GrabResult {
+    int rc;
+    char* elem_ptr;
+    size_t elems_grabbed;
+};
+
+/**
+ * Base of the awaitables: tries the operation without waiting, and only
+ * suspends if it has to wait for data or space
+ */
+template<typename Derived, typename Result>
+class BufferAwaitable : public BufferWaiter {
+    public:
+        BufferAwaitable(RingBuffer& buffer, const bool readable) :
+                buffer(buffer),
+                readable(readable) {};
+
+        bool await_ready() {
+            return try_complete();
+        };
+
+        void await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+            this->handle = handle;
+            handle.promise().executor->wait(buffer, readable, *this);
+        };
+
+        Result await_resume() {
+            return static_cast<Derived*>(this)->get_result();
+        };
+
+        bool try_complete() override {
+            rc = static_cast<Derived*>(this)->attempt();
+            return rc != (readable ? ENOMSG : ENOBUFS);
+        };
+
+    protected:
+        RingBuffer& buffer;
+        const bool readable;
+        int rc;
+};
+
+/**
+ * co_await grab_read(buffer, n, id) grabs n elements for reading, suspending
+ * the task until they're available. Release with buffer.release_read(id).
+ */
+class GrabReadAwaitable : public BufferAwaitable<GrabReadAwaitable, GrabResult> {
+    public:
+        GrabReadAwaitable(DirectRingBuffer& buffer, const size_t elems, const size_t id) :
+                BufferAwaitable(buffer, true),
+                direct_buffer(buffer),
+                elems(elems),
+                id(id),
+                elem_ptr(nullptr) {};
+
+        int attempt() {
+            return direct_buffer.grab_read(elem_ptr, elems, id, std::chrono::microseconds(0));
+        };
+
+        GrabResult get_result() {
+            return GrabResult{rc, elem_ptr, rc == 0 ? elems : 0};
+        };
+
+    private:
+        DirectRingBuffer& direct_buffer;
+        const size_t elems;
+        const size_t id;
+        char* elem_ptr;
+};
+
+/**
+ * co_await grab_write(buffer, n[, id]) grabs n elements for writing,
+ * suspending the task until there's space. Release with
+ * buffer.release_write().
+ */
+class GrabWriteAwaitable : public BufferAwaitable<GrabWriteAwaitable, GrabResult> {
+    public:
+        GrabWriteAwaitable(DirectRingBuffer& buffer, const size_t elems, const size_t id) :
+                BufferAwaitable(buffer, false),
+                direct_buffer(buffer),
+                elems(elems),
+                id(id),
+                elem_ptr(nullptr) {};
+
+        int attempt() {
+            return id == BUILTIN_WRITER
+                ? direct_buffer.grab_write(elem_ptr, elems)
+                : direct_buffer.grab_write(elem_ptr, elems, id);
+        };
+
+        GrabResult get_result() {
+            return GrabResult{rc, elem_ptr, rc == 0 ? elems : 0};
+        };
+
+        // the writer used by the grab_write() overload without an id
+        static const size_t BUILTIN_WRITER = SIZE_MAX;
+
+    private:
+        DirectRingBuffer& direct_buffer;
+        const size_t elems;
+        const size_t id;
+        char* elem_ptr;
+};
+
+/**
+ * co_await copy_read(buffer, ptr, n) copies n elements out of a CopyRingBuffer,
+ * suspending the task until they're available. Returns as
+ * CopyRingBuffer::read(), except that it never times out.
+ */
+class CopyReadAwaitable : public BufferAwaitable<CopyReadAwaitable, int> {
+    public:
+        CopyReadAwaitable(CopyRingBuffer& buffer, char* elem_ptr, const size_t elems) :
+                BufferAwaitable(buffer, true),
+                copy_buffer(buffer),
+                elem_ptr(elem_ptr),
+                elems(elems) {};
+
+        int attempt() {
+            return copy_buffer.read(elem_ptr, elems, std::chrono::microseconds(0));
+        };
+
+        int get_result() {
+            return rc;
+        };
+
+    private:
+        CopyRingBuffer& copy_buffer;
+        char* const elem_ptr;
+        const size_t elems;
+};
+
+/**
+ * co_await copy_write(buffer, ptr, n) copies n elements into a CopyRingBuffer,
+ * suspending the task until there's space. Returns as
+ * CopyRingBuffer::write(), except that it never times out.
+ */
+class CopyWriteAwaitable : public BufferAwaitable<CopyWriteAwaitable, int> {
+    public:
+        CopyWriteAwaitable(CopyRingBuffer& buffer, const char* elem_ptr, const size_t elems) :
+                BufferAwaitable(buffer, false),
+                copy_buffer(buffer),
+                elem_ptr(elem_ptr),
+                elems(elems) {};
+
+        int attempt() {
+            return copy_buffer.write(elem_ptr, elems, std::chrono::microseconds(0));
+        };
+
+        int get_result() {
+            return rc;
+        };
+
+    private:
+        CopyRingBuffer& copy_buffer;
+        const char* const elem_ptr;
+        const size_t elems;
+};
+
+inline GrabReadAwaitable grab_read(DirectRingBuffer& buffer, const size_t elems, const size_t id) {
+    return GrabReadAwaitable(buffer, elems, id);
+}
+
+inline GrabWriteAwaitable grab_write(DirectRingBuffer& buffer, const size_t elems) {
+    return GrabWriteAwaitable(buffer, elems, GrabWriteAwaitable::BUILTIN_WRITER);
+}
+
+inline GrabWriteAwaitable grab_write(DirectRingBuffer& buffer, const size_t elems, const size_t id) {
+    return GrabWriteAwaitable(buffer, elems, id);
+}
+
+inline CopyReadAwaitable copy_read(CopyRingBuffer& buffer, char* elem_ptr, const size_t elems) {
+    return CopyReadAwaitable(buffer, elem_ptr, elems);
+}
+
+inline CopyWriteAwaitable copy_write(CopyRingBuffer& buffer, const char* elem_ptr, const size_t elems) {
+    return CopyWriteAwaitable(buffer, elem_ptr, elems);
+}
+
+/**
+ * co_await yield_task() lets the executor's other ready tasks run, for a task
+ * that always finds data and so never suspends otherwise
+ */
+struct YieldAwaitable {
+    bool await_ready() {
+        return false;
+    };
+    void await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+        handle.promise().executor->schedule(handle);
+    };
+    void await_resume() {};
+};
+
+inline YieldAwaitable yield_task() {
+    return YieldAwaitable();
+}
+
+}; // namespace snake_charmer
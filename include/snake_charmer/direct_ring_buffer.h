@@ -1,88 +1,279 @@
+#pragma once
+
 #include "ring_buffer.h"
-#include <condition_variable>
-#include <vector>
-#include <map>
+#include "tags.h"
+#include <atomic>
 #include <memory>
 
 
 namespace snake_charmer {
 
-enum IndexFunction {
-    Write = 0,
-    Read = 1
+/**
+ * Defines read/write indices for use within a Buffer
+ * .start is the first item being accessed
+ * .end is 1 more than the last item being accessed
+ *
+ * Each BufferIndex occupies its own cache line, so that readers updating
+ * their own index don't false-share with one another.
+ */
+struct alignas(CACHE_LINE_SIZE) BufferIndex {
+    BufferIndex() :
+        start(0), end(0), in_use(false), owner(0), hold_start(0), window_end(0) {};
+    std::atomic<size_t> start;
+    std::atomic<size_t> end;
+    std::atomic<bool> in_use;
+    // process that owns this index, for buffers shared between processes,
+    // or DirectRingBuffer::FREE_OWNER once it can be reused
+    std::atomic<int64_t> owner;
+    // when the outstanding grab was made, if hold timing is on
+    std::atomic<int64_t> hold_start;
+    // 1 more than the last element a reader's outstanding grab exposes.
+    // Past .end for a window that advances less than it exposes.
+    std::atomic<size_t> window_end;
 };
 
 /**
- * Defines read/write indices for use within a Buffer
- * .first is the first item being accessed
- * .second is 1 more than the last item being accessed
+ * Indices shared by the readers and writers of a DirectRingBuffer
+ *
+ * These are kept together in one block, followed by the reader and then the
+ * writer BufferIndex slots, so that the whole block can live in shared memory.
+ *
+ * To prevent the readers and writers from conflicting, we need to track the
+ * min and max indices of the readers and writers. Each is updated by
+ * different threads, so they are kept on separate cache lines.
+ *   min_write_index: 1 more than the last element released by the writers,
+ *                    with everything before it released
+ *   max_write_index: 1 more than the last element claimed by a writer
+ *   min_read_index: first element that may still be held by a reader
+ *   max_read_index: 1 more than the last element claimed by a reader
+ *                   (Distribute mode only)
  */
-struct BufferIndex {
-    BufferIndex(
-        const size_t id,
-        const size_t start,
-        const size_t end,
-        const IndexFunction function,
-        const bool in_use
-    ) : 
-        id(id), start(start), end(end), function(function), in_use(in_use)
+struct DirectRingBufferIndices {
+    DirectRingBufferIndices() :
+        min_write_index(0), max_write_index(0), write_shrinks(0),
+        min_read_index(0), max_read_index(0),
+        num_readers(0), num_writers(0)
     {};
-    size_t id;
-    size_t start;
-    size_t end;
-    IndexFunction function;
-    bool in_use;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> min_write_index;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> max_write_index;
+    // partial releases that moved max_write_index back
+    std::atomic<size_t> write_shrinks;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> min_read_index;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> max_read_index;
+    // Reader and writer slots handed out so far
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> num_readers;
+    std::atomic<size_t> num_writers;
+    // the built-in writer's grab
+    BufferIndex write_index;
+    alignas(CACHE_LINE_SIZE) WaitState wait_state;
 };
 
-using BufferIndexPtr = std::shared_ptr<BufferIndex>;
-using BufferIndices = std::map<size_t, BufferIndexPtr>;
 
+/**
+ * How elements are handed to the readers of a DirectRingBuffer
+ *
+ * Distribute shares one read index between all readers, so each element is
+ * grabbed by exactly one reader (work distribution).
+ *
+ * Broadcast gives every reader its own cursor, so each reader grabs every
+ * element (fan-out). The writer is gated by the slowest reader.
+ */
+enum ReadMode {
+    Distribute = 0,
+    Broadcast = 1
+};
 
 /**
- * Single-writer, multi-reader
+ * Multi-writer, multi-reader
+ *
+ * Readers live in a fixed array of BufferIndex slots, indexed by the ID
+ * returned from add_reader(). grab_read/release_read don't take buf_mutex:
+ * in Distribute mode a reader claims its range by atomically advancing
+ * max_read_index, and in Broadcast mode it advances its own cursor.
+ * min_read_index is advanced by whichever reader releases, from a scan of
+ * the reader slots.
+ *
+ * Writers work the same way. Each writer reserves a disjoint range by
+ * atomically advancing max_write_index, fills it, and releases it, in any
+ * order relative to the other writers. min_write_index, the limit of what
+ * readers can grab, only advances past a range once every range before it
+ * has been released too. The grab_write/release_write calls without an ID
+ * use a built-in writer, for the common single-writer case.
+ *
+ * buf_mutex is only taken when a grab_read has to wait out its timeout
+ * with WaitStrategy::Condvar.
+ *
+ * With OverflowPolicy::Overwrite, writers only wait for each other, never
+ * for the readers. A grab_read that finds its next element already
+ * overwritten skips ahead to the oldest element still intact, and the
+ * overloads taking elems_skipped say how many elements were lost. Readers
+ * work on the buffer in place, so a writer can also overrun a grab while
+ * it's held; release_read() reports that with EOVERFLOW.
+ *
+ * After enable_tags(), writers can attach Tags to elements of their grabs,
+ * and a reader gets the tags of the elements it has grabbed from
+ * get_tags(). Each writer appends to its own ring of tags, in index order,
+ * and only drops tags below min_read_index, so the grabs themselves are all
+ * the synchronization the tags need.
  */
 class DirectRingBuffer : public RingBuffer {
     public:
+        const static size_t DEFAULT_MAX_READERS;
+        const static size_t DEFAULT_MAX_WRITERS;
         DirectRingBuffer(
                 const size_t elem_size,
                 const size_t max_elems_per_write,
                 const size_t max_elems_per_read,
                 const size_t slack,
-                std::string loglevel
+                std::string loglevel,
+                const size_t max_readers = DEFAULT_MAX_READERS,
+                const ReadMode read_mode = ReadMode::Distribute,
+                const size_t max_writers = DEFAULT_MAX_WRITERS,
+                const PageSize page_size = PageSize::StandardPages,
+                const WaitStrategy wait_strategy = WaitStrategy::Condvar,
+                const OverflowPolicy overflow = OverflowPolicy::Block
         );
 
         /**
          * Add a reader
          *
+         * In Broadcast mode, the reader starts at the writer's current
+         * position: it sees everything released after it was added.
+         *
          * Returns a BufferIndex ID which is to be used in subsequent grab/release
          * calls
+         * Throws std::runtime_error if max_readers have already been added
          */
         size_t add_reader();
 
+        /**
+         * Add a writer, for use when several threads write concurrently
+         *
+         * Returns a BufferIndex ID which is to be used in subsequent grab/release
+         * calls
+         * Throws std::runtime_error if max_writers have already been added
+         */
+        size_t add_writer();
+
+        /**
+         * Grab a portion of the buffer for writing, using the built-in writer
+         *
+         * elem_ptr pointer in buffer which you can then edit
+         * elems_this_write number of elements you are responsible for writing
+         *
+         * Returns 0 if successful.
+         * Returns ENOBUFS if buffer full. With OverflowPolicy::Overwrite,
+         * only if other writers' outstanding grabs fill it.
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if elems_this_write > max_elems_per_write
+         */
+        int grab_write(
+            char*& elem_ptr,
+            const size_t elems_this_write
+        );
+
         /**
          * Grab a portion of the buffer for writing
          *
          * elem_ptr pointer in buffer which you can then edit
          * elems_this_write number of elements you are responsible for writing
+         * id BufferIndex ID from add_writer()
          *
          * Returns 0 if successful.
          * Returns ENOBUFS if buffer full
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if elems_this_write > max_elems_per_write
          */
         int grab_write(
             char*& elem_ptr,
-            const size_t elems_this_write
+            const size_t elems_this_write,
+            const size_t id
         );
 
         /**
-         * Release a portion of the buffer for writing
+         * Grab as much of the buffer for writing as is free, up to
+         * max_elems_this_write, using the built-in writer
          *
-         * id BufferIndex ID corresponding to prior grab call
+         * elem_ptr pointer in buffer which you can then edit
+         * elems_grabbed set to the number of elements grabbed, at least 1
+         * max_elems_this_write most elements to grab
          *
          * Returns 0 if successful.
+         * Returns ENOBUFS if buffer full
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if max_elems_this_write > max_elems_per_write
+         */
+        int grab_write_upto(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_write
+        );
+
+        /**
+         * Grab as much of the buffer for writing as is free, up to
+         * max_elems_this_write
+         *
+         * id BufferIndex ID from add_writer()
+         * other parameters and return codes as above, plus
          * Returns ENXIO if BufferIndex provided isn't valid
          */
+        int grab_write_upto(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_write,
+            const size_t id
+        );
+
+        /**
+         * Release a portion of the buffer for writing, using the built-in
+         * writer
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         */
         int release_write();
 
+        /**
+         * Release a portion of the buffer for writing. The elements become
+         * readable once every portion grabbed before it is released too.
+         *
+         * id BufferIndex ID corresponding to prior grab call
+         *
+         * Returns 0 if successful.
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if there is no outstanding grab
+         */
+        int release_write(
+            const size_t id
+        );
+
+        /**
+         * Release the first elems_used elements of the prior grab, using the
+         * built-in writer, and hand the rest back. For when how much was
+         * written is only known afterwards.
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         * Returns EINVAL if elems_used is more than was grabbed
+         * Returns EAGAIN if another writer has since grabbed the space after
+         * this grab, so it can't be handed back. The grab is still
+         * outstanding, and must be released in full.
+         */
+        int release_write_partial(
+            const size_t elems_used
+        );
+
+        /**
+         * As above, for the writer id
+         *
+         * Returns ENXIO if BufferIndex provided isn't valid
+         */
+        int release_write_partial(
+            const size_t elems_used,
+            const size_t id
+        );
+
         /**
          * Grab a portion of the buffer for reading
          *
@@ -92,11 +283,96 @@ class DirectRingBuffer : public RingBuffer {
          * timeout number of microseconds to wait for data
          *
          * Returns 0 if successful.
-         * Returns ENOBUFS if buffer full
+         * Returns ENOMSG if insufficient data arrived before the timeout
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if elems_this_read > max_elems_per_read
          */
         int grab_read(
             char*& elem_ptr,
-            const size_t elems_this_write,
+            const size_t elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * As above, reporting elements lost to OverflowPolicy::Overwrite
+         *
+         * elems_skipped set to the number of overwritten elements skipped
+         * directly before this grab, always 0 with OverflowPolicy::Block.
+         * In Distribute mode they're counted by whichever reader skipped
+         * them.
+         */
+        int grab_read(
+            char*& elem_ptr,
+            const size_t elems_this_read,
+            const size_t id,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Grab as much of the buffer for reading as is available, up to
+         * max_elems_this_read
+         *
+         * elem_ptr pointer in buffer which you can then read
+         * elems_grabbed set to the number of elements grabbed, at least 1
+         * max_elems_this_read most elements to grab
+         * id BufferIndex ID that must be provided to subsequent release call
+         * timeout number of microseconds to wait for any data
+         *
+         * Returns 0 if successful.
+         * Returns ENOMSG if no data arrived before the timeout
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if max_elems_this_read > max_elems_per_read
+         */
+        int grab_read_upto(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * As above, with elems_skipped as for grab_read()
+         */
+        int grab_read_upto(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_read,
+            const size_t id,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Grab a window of window_elems elements for reading that only
+         * advances the read index by advance_elems when released, for
+         * overlapping reads without copies (e.g. 50% overlapped FFTs)
+         *
+         * The window is contiguous through the mirrored mapping. The
+         * elements past advance_elems stay in the buffer and are exposed
+         * again by the next window. In Distribute mode, the next window can
+         * be grabbed by another reader while this one is still held, and
+         * the shared elements are kept until every window holding them has
+         * been released.
+         *
+         * elem_ptr pointer in buffer which you can then read
+         * window_elems number of elements exposed
+         * advance_elems number of elements consumed on release
+         * id BufferIndex ID that must be provided to subsequent release call
+         * timeout number of microseconds to wait for data
+         *
+         * Returns 0 if successful.
+         * Returns EINVAL if advance_elems is 0 or more than window_elems
+         * Other return codes as for grab_read()
+         */
+        int grab_read_window(
+            char*& elem_ptr,
+            const size_t window_elems,
+            const size_t advance_elems,
             const size_t id,
             const std::chrono::microseconds& timeout
         );
@@ -108,30 +384,342 @@ class DirectRingBuffer : public RingBuffer {
          *
          * Returns 0 if successful.
          * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if there is no outstanding grab
+         * Returns EOVERFLOW if, with OverflowPolicy::Overwrite, a writer
+         * overwrote part of the grab before it was released, so what was
+         * read from it may be torn. The grab is released all the same.
          */
         int release_read(
             const size_t id
         );
 
+        /**
+         * Get the number of elements available to read. In Broadcast mode
+         * this is what the slowest reader has left to read.
+         */
         size_t get_elems_avail_to_read();
+        /**
+         * Get the number of elements available to read by the reader id
+         */
+        size_t get_elems_avail_to_read(const size_t id);
         size_t get_elems_avail_to_write();
 
+        /**
+         * Get the index of the next element to be grabbed by a reader in
+         * Distribute mode, or by the slowest reader in Broadcast mode.
+         * Indices count every element written since the buffer was created.
+         */
+        size_t get_read_index();
+
+        /**
+         * Get the index of the first element of reader id's outstanding grab
+         *
+         * Returns 0 if successful.
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if there is no outstanding grab
+         */
+        int get_read_grab_index(
+            const size_t id,
+            size_t& index
+        );
+
+        /**
+         * Get how elements are handed to the readers
+         */
+        ReadMode get_read_mode();
+
+        /**
+         * Get what a grab_write does when the buffer is full
+         */
+        OverflowPolicy get_overflow_policy();
+
+        /**
+         * Get the maximum number of readers that can be added
+         */
+        size_t get_max_readers();
+
+        /**
+         * Get the maximum number of writers that can be added
+         */
+        size_t get_max_writers();
+
+        /**
+         * Remove a reader, so it no longer holds back the writer. Its ID may
+         * be handed out again by a later add_reader(). Must not be called
+         * while the reader has a grab outstanding, unless its thread is gone.
+         *
+         * Returns 0 if successful.
+         * Returns ENXIO if BufferIndex provided isn't valid
+         */
+        int remove_reader(
+            const size_t id
+        );
+
+        /**
+         * Start keeping tags, up to capacity (rounded up to a power of two)
+         * per writer. Call before the writers start adding tags.
+         *
+         * Returns 0 if successful.
+         * Returns EALREADY if tags were already enabled
+         * Returns ENOTSUP if the buffer's indices are shared, e.g. by a
+         * SharedDirectRingBuffer
+         */
+        int enable_tags(const size_t capacity);
+
+        /**
+         * Tag an element of the built-in writer's outstanding grab. The
+         * tag is readable once the grab is released.
+         *
+         * offset position of the element in the grab
+         * key application-defined meaning of the tag
+         * value up to 8 bytes of any trivially copyable type
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         * Returns EINVAL if offset is outside the grab, or before the
+         * element of this writer's previous tag
+         * Returns ENOBUFS if the writer's tags readers may still need fill
+         * the capacity
+         * Returns ENOTSUP if tags weren't enabled
+         */
+        template<typename T>
+        int add_tag(
+            const size_t offset,
+            const uint64_t key,
+            const T& value
+        ) {
+            return add_tag_value(offset, key, to_tag_value(value), indices->write_index);
+        };
+
+        /**
+         * As above, for the writer id
+         *
+         * Returns ENXIO if BufferIndex provided isn't valid
+         */
+        template<typename T>
+        int add_tag(
+            const size_t offset,
+            const uint64_t key,
+            const T& value,
+            const size_t id
+        ) {
+            if(id >= indices->num_writers.load(std::memory_order_acquire)) {
+                return ENXIO; // invalid ID
+            }
+            return add_tag_value(offset, key, to_tag_value(value), writers[id]);
+        };
+
+        /**
+         * Get the tags on the elements of reader id's outstanding grab, in
+         * index order. Tags on the same element keep the order they were
+         * added in by each writer.
+         *
+         * tags set to the tags; valid until the reader's next get_tags()
+         *
+         * Returns 0 if successful.
+         * Returns ENXIO if BufferIndex provided isn't valid
+         * Returns EBUSY if there is no outstanding grab
+         * Returns ENOTSUP if tags weren't enabled
+         */
+        int get_tags(
+            const size_t id,
+            TagRange& tags
+        );
+
+        /**
+         * Grow or shrink the buffer online to the size for slack (see
+         * RingBuffer), keeping the unread elements and every reader's place
+         *
+         * The resize waits up to timeout for outstanding grabs to be
+         * released, then copies the unread elements to a new mapping.
+         * Meanwhile new read grabs wait, and new write grabs fail with
+         * ENOBUFS as if the buffer were full. Pointers from grabs before the
+         * resize are invalid after it.
+         *
+         * Returns 0 if successful.
+         * Returns ETIMEDOUT if grabs were still outstanding after the
+         * timeout. The buffer is unchanged.
+         * Returns ENOBUFS if the unread elements don't fit in the new size
+         * Returns ENOTSUP if the buffer is shared with other processes, or
+         * not on unix
+         * Returns errno if the new buffer can't be mapped
+         */
+        int resize(
+            const size_t slack,
+            const std::chrono::microseconds& timeout
+        );
+
+    protected:
+        /**
+         * Constructor for subclasses whose elements are split over
+         * num_planes planes sharing the indices (see RingBuffer). Grabs
+         * point into plane 0.
+         */
+        DirectRingBuffer(
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const size_t max_readers,
+                const ReadMode read_mode,
+                const size_t max_writers,
+                const PageSize page_size,
+                const WaitStrategy wait_strategy,
+                const OverflowPolicy overflow,
+                const size_t num_planes
+        );
+
+        /**
+         * Constructor for subclasses that keep the buffer and its indices in
+         * a file they manage, e.g. shared memory.
+         *
+         * backing_fd, backing_offset see RingBuffer
+         * indices_block get_indices_size() bytes, aligned to CACHE_LINE_SIZE,
+         * holding the DirectRingBufferIndices and slots
+         * init_indices if true, construct the indices in indices_block;
+         * otherwise they were constructed by another DirectRingBuffer
+         *
+         * These buffers always use OverflowPolicy::Block.
+         */
+        DirectRingBuffer(
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const size_t max_readers,
+                const ReadMode read_mode,
+                const size_t max_writers,
+                const int backing_fd,
+                const size_t backing_offset,
+                char* indices_block,
+                const bool init_indices,
+                const WaitStrategy wait_strategy
+        );
+
+        /**
+         * Release the outstanding grab of a writer that will never finish
+         * it, e.g. because its process died. The grab is handed back if
+         * nothing was grabbed after it. Otherwise later writers may already
+         * have released past it, so its elements are zeroed, counted in
+         * RingBufferStats::elems_lost, and released.
+         *
+         * Returns the number of elements lost.
+         */
+        size_t release_abandoned_write(BufferIndex& index);
+
+        /**
+         * Advance min_write_index to the oldest element still held by a writer
+         */
+        void update_min_write_index();
+
+        /**
+         * Advance min_read_index to the oldest element still held by a reader
+         */
+        void update_min_read_index();
+
+        /**
+         * Get the size of the block holding the indices and slots
+         */
+        static size_t get_indices_size(
+                const size_t max_readers,
+                const size_t max_writers
+        );
+
+        // owner of a slot that add_reader() or add_writer() may reuse
+        const static int64_t FREE_OWNER;
+
+        const ReadMode read_mode;
+        const OverflowPolicy overflow;
+        const size_t max_readers;
+        const size_t max_writers;
+        // null when the indices live in memory owned by a subclass
+        std::unique_ptr<char[]> indices_storage;
+        DirectRingBufferIndices* indices;
+        // reader/writer slots, indexed by ID, following the indices
+        BufferIndex* readers;
+        BufferIndex* writers;
+
     private:
+        /**
+         * Point indices, readers, writers and wait_state into indices_block,
+         * and construct them there if init_indices
+         */
+        void set_indices(char* indices_block, const bool init_indices);
+        /**
+         * Claim a slot among the first count whose owner is FREE_OWNER, by
+         * a compare-exchange of its owner to 0
+         *
+         * Returns true if one was claimed, with its ID in id
+         */
+        bool claim_free_slot(BufferIndex* slots, const size_t count, size_t& id);
+        /**
+         * Grab between min_elems_this_write and max_elems_this_write, as
+         * many as are free
+         */
+        int grab_write(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t min_elems_this_write,
+            const size_t max_elems_this_write,
+            BufferIndex& index
+        );
+        int release_write(
+            BufferIndex& index
+        );
+        int release_write_partial(
+            const size_t elems_used,
+            BufferIndex& index
+        );
+        /**
+         * Grab between min_elems_this_read and max_elems_this_read, as many
+         * as are available, advancing the read index by at most max_advance
+         */
+        int grab_read(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t min_elems_this_read,
+            const size_t max_elems_this_read,
+            const size_t max_advance,
+            const size_t id,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout
+        );
+        /**
+         * Get the oldest element a writer can't be overwriting, with
+         * OverflowPolicy::Overwrite
+         */
+        size_t get_oldest_intact_index();
+        /**
+         * Get the writer ID of index for the trace
+         */
+        uint32_t get_trace_id(const BufferIndex& index);
+        /**
+         * Get the TagRing of writer index: the built-in writer's is first
+         */
+        size_t get_tag_ring(const BufferIndex& index);
+        int add_tag_value(
+            const size_t offset,
+            const uint64_t key,
+            const uint64_t value,
+            BufferIndex& index
+        );
+
+        // In Broadcast mode, a reader's .end is its cursor: the next element
+        // it will grab. PENDING_CURSOR marks a reader that is being added.
+        const static size_t PENDING_CURSOR;
+        // .end of a reader that has been removed
+        const static size_t REMOVED_INDEX;
 
-        // thread safety
-        std::condition_variable buf_cv;
-        BufferIndexPtr write_index;
-        // To support concurrent readers that use grab/release
-        // to directly access the buffer, we provide a list of readers
-        // define what portions of the buffer are currently in use.
-        BufferIndices indices;
-        size_t next_id;
-        
-        // To prevent the readers and writers from conflicting, we need to
-        // track the min and max indices of the readers and writers
-        size_t min_read_index;
-        size_t max_read_index;
-        
+        std::unique_ptr<TagStore> tag_storage;
+        // tag_storage once enabled
+        std::atomic<TagStore*> tag_store;
+        // Odd while resize() is waiting for grabs or remapping. Grabs load
+        // it before sizing their range and check it again once .in_use is
+        // set, so either they see the resize or the resize waits for them.
+        std::atomic<size_t> resize_epoch;
+        std::mutex resize_mutex;
 };
 
 }; // namespace snake_charmer
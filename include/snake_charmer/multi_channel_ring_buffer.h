@@ -0,0 +1,191 @@
+#pragma once
+
+#include "direct_ring_buffer.h"
+
+
+namespace snake_charmer {
+
+/**
+ * How a MultiChannelRingBuffer lays out its channels
+ *
+ * Planar gives each channel a buffer of its own, so a grab's samples of one
+ * channel are contiguous, e.g. to run a filter per channel.
+ *
+ * Interleaved stores one sample of every channel per element, so a grab's
+ * samples of one instant are contiguous, e.g. to form a beam from them.
+ */
+enum ChannelLayout {
+    Planar = 0,
+    Interleaved = 1
+};
+
+/**
+ * One channel of a MultiChannelRingBuffer grab: its first sample, and the
+ * bytes from each sample to the next
+ */
+struct ChannelView {
+    char* data;
+    // the sample size when Planar, the sample size * channels when Interleaved
+    size_t stride;
+
+    /**
+     * Get sample n of the grab
+     */
+    char* sample(const size_t n) const {
+        return data + n * stride;
+    };
+};
+
+/**
+ * DirectRingBuffer of phase-coherent channels that share one index
+ *
+ * Each element is one sample of every channel, so a single grab/release
+ * covers every channel, and the channels can't drift apart. A grab fills in
+ * a ChannelView per channel. Planar channels are each double-mapped
+ * straight after one another, so every channel's grab is contiguous and
+ * sample n of every channel is at the same offset in its plane.
+ *
+ * Readers, writers, read modes, overflow policies and resizing all work as
+ * for DirectRingBuffer, counting elements rather than samples. Grabs made
+ * through the DirectRingBuffer interface point at channel 0.
+ */
+class MultiChannelRingBuffer : public DirectRingBuffer {
+    public:
+        /**
+         * Constructor.
+         *
+         * num_channels number of channels
+         * sample_size size of one sample of one channel in bytes
+         * layout whether channels are Planar or Interleaved
+         * other parameters see DirectRingBuffer, counting elements of one
+         * sample per channel
+         *
+         * Throws std::runtime_error if num_channels or sample_size is 0, or
+         * the buffer can't be mapped
+         */
+        MultiChannelRingBuffer(
+                const size_t num_channels,
+                const size_t sample_size,
+                const ChannelLayout layout,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const size_t max_readers = DEFAULT_MAX_READERS,
+                const ReadMode read_mode = ReadMode::Distribute,
+                const size_t max_writers = DEFAULT_MAX_WRITERS,
+                const PageSize page_size = PageSize::StandardPages,
+                const WaitStrategy wait_strategy = WaitStrategy::Condvar,
+                const OverflowPolicy overflow = OverflowPolicy::Block
+        );
+
+        /**
+         * Grab a portion of every channel for writing, using the built-in
+         * writer
+         *
+         * channels get_num_channels() views, set to the grab in each channel
+         * other parameters and return codes see DirectRingBuffer
+         */
+        int grab_write(
+            ChannelView* channels,
+            const size_t elems_this_write
+        );
+
+        /**
+         * As above, for the writer id
+         */
+        int grab_write(
+            ChannelView* channels,
+            const size_t elems_this_write,
+            const size_t id
+        );
+
+        /**
+         * Grab as much of every channel for writing as is free, up to
+         * max_elems_this_write, using the built-in writer
+         *
+         * channels get_num_channels() views, set to the grab in each channel
+         * other parameters and return codes see DirectRingBuffer
+         */
+        int grab_write_upto(
+            ChannelView* channels,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_write
+        );
+
+        /**
+         * As above, for the writer id
+         */
+        int grab_write_upto(
+            ChannelView* channels,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_write,
+            const size_t id
+        );
+
+        /**
+         * Grab a portion of every channel for reading
+         *
+         * channels get_num_channels() views, set to the grab in each channel
+         * other parameters and return codes see DirectRingBuffer
+         */
+        int grab_read(
+            ChannelView* channels,
+            const size_t elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * As above, reporting elements lost to OverflowPolicy::Overwrite
+         */
+        int grab_read(
+            ChannelView* channels,
+            const size_t elems_this_read,
+            const size_t id,
+            size_t& elems_skipped,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Grab as much of every channel for reading as is available, up to
+         * max_elems_this_read
+         *
+         * channels get_num_channels() views, set to the grab in each channel
+         * other parameters and return codes see DirectRingBuffer
+         */
+        int grab_read_upto(
+            ChannelView* channels,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Get the number of channels
+         */
+        size_t get_num_channels();
+
+        /**
+         * Get the size of one sample of one channel in bytes
+         */
+        size_t get_sample_size();
+
+        /**
+         * Get whether channels are Planar or Interleaved
+         */
+        ChannelLayout get_layout();
+
+    private:
+        /**
+         * Point channels at the grab starting at elem_ptr in channel 0
+         */
+        void set_channels(ChannelView* channels, char* elem_ptr);
+
+        const size_t num_channels;
+        const size_t sample_size;
+        const ChannelLayout layout;
+};
+
+}; // namespace snake_charmer
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "direct_ring_buffer.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+namespace snake_charmer {
+
+/**
+ * Packets a PacketIngest receives per syscall by default
+ */
+constexpr size_t DEFAULT_PACKETS_PER_BATCH = 64;
+
+/**
+ * Receives fixed-size datagrams from a socket straight into a DirectRingBuffer
+ *
+ * Each ingest() grabs write space for a batch of packets and fills it with a
+ * single recvmmsg(). Every packet is scattered into two places: its header
+ * into a side array (see get_header()), and its payload into the ring buffer,
+ * directly after the previous packet's payload. Only the payloads of the
+ * packets actually received are committed, so the stream in the buffer is
+ * the concatenated payloads with no copies in user space.
+ *
+ * Packets that aren't exactly header_size + payload_size bytes are dropped
+ * and counted in get_packets_dropped().
+ *
+ * Committing part of a grab requires that no other writer grabs concurrently
+ * (see release_write_partial()), so the ingest should be the buffer's only
+ * writer. If another writer does get in the way, the unused tail of the grab
+ * is zeroed and committed.
+ *
+ * Only supported on linux.
+ */
+class PacketIngest {
+    public:
+        /**
+         * ring_buffer buffer to fill; must outlive the ingest
+         * socket_fd bound datagram socket; the caller keeps ownership
+         * header_size bytes at the start of each packet to strip
+         * payload_size bytes following the header, a multiple of the
+         * buffer's elem_size
+         * max_packets_per_batch most packets received per syscall
+         * busy_poll_us if non-zero, spin on the socket instead of sleeping,
+         * and ask the kernel to busy-poll the device queue for this many
+         * microseconds (SO_BUSY_POLL)
+         *
+         * Throws std::runtime_error if payload_size isn't a non-zero multiple
+         * of elem_size, a payload doesn't fit in max_elems_per_write, or
+         * there are no writer slots left.
+         */
+        PacketIngest(
+                DirectRingBuffer& ring_buffer,
+                const int socket_fd,
+                const size_t header_size,
+                const size_t payload_size,
+                const size_t max_packets_per_batch = DEFAULT_PACKETS_PER_BATCH,
+                const unsigned int busy_poll_us = 0,
+                std::string loglevel = ""
+        );
+
+        /**
+         * Receive one batch of packets into the ring buffer
+         *
+         * packets_received number of payloads committed to the buffer
+         * timeout number of microseconds to wait for the first packet
+         *
+         * Returns 0 if successful.
+         * Returns ENOMSG if no packets arrived before the timeout
+         * Returns ENOBUFS if there isn't space in the buffer for a packet
+         * Returns errno if receiving fails
+         */
+        int ingest(
+            size_t& packets_received,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Get the header of packet n of the last batch
+         *
+         * Valid until the next ingest().
+         */
+        const char* get_header(const size_t n);
+
+        /**
+         * Get the number of elements in each packet's payload
+         */
+        size_t get_elems_per_packet();
+
+        /**
+         * Get the total number of packets committed to the buffer
+         */
+        size_t get_packets_received();
+
+        /**
+         * Get the total number of packets dropped for being the wrong size
+         */
+        size_t get_packets_dropped();
+
+    private:
+        /**
+         * Wait for the socket to become readable
+         *
+         * Returns true if it did before the timeout
+         */
+        bool wait_readable(const std::chrono::microseconds& timeout);
+
+        /**
+         * Release the grab, committing only its first elems_used elements
+         */
+        int commit(
+            char* elem_ptr,
+            const size_t elems_grabbed,
+            const size_t elems_used
+        );
+
+        DirectRingBuffer& ring_buffer;
+        const int socket_fd;
+        const size_t header_size;
+        const size_t payload_size;
+        const size_t elems_per_packet;
+        const size_t max_packets_per_batch;
+        const bool busy_poll;
+        size_t writer_id;
+        std::vector<char> headers;
+        // scatter lists for recvmmsg, header and payload for each packet
+        std::vector<struct iovec> iovecs;
+        std::vector<struct mmsghdr> messages;
+        std::atomic<size_t> packets_received;
+        std::atomic<size_t> packets_dropped;
+        std::shared_ptr<spdlog::logger> logger;
+};
+
+}; // namespace snake_charmer
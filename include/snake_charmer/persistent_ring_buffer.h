@@ -0,0 +1,140 @@
+#pragma once
+
+#include "shared_ring_buffer.h"
+#include <string>
+
+
+namespace snake_charmer {
+
+/**
+ * DirectRingBuffer persisted in a file, e.g. on NVMe or tmpfs, so that a
+ * restarted process can reopen it and resume where it left off
+ *
+ * The file holds a control block (a SharedRingBufferHeader followed by the
+ * DirectRingBufferIndices and reader/writer slots), then the data, laid out
+ * as for a SharedDirectRingBuffer. Both are mapped shared, so the page cache
+ * writes them back with no extra copies; sync() forces that, e.g. before
+ * acknowledging data upstream.
+ *
+ * Reader and writer IDs persist along with their positions: add them when
+ * the file is created, and reuse the same IDs once is_resumed(). Grabs a
+ * previous process never released are recovered on reopening:
+ *  - read grabs are handed back, so their elements are read again. In
+ *    Distribute mode, elements other readers released after them are read
+ *    again too.
+ *  - write grabs are handed back if nothing was grabbed after them.
+ *    Otherwise later writers may already have committed past them, so
+ *    they're zeroed, counted in RingBufferStats::elems_lost, and released
+ *    (see DirectRingBuffer::release_abandoned_write()).
+ *
+ * A file whose creation was interrupted is created again if it was being
+ * created with the same parameters. Otherwise it has to be deleted.
+ *
+ * Only one process may have the file open at a time; use a
+ * SharedDirectRingBuffer to share a buffer between live processes. Like
+ * one, it can't be resized, tagged or signal eventfds, and always uses
+ * OverflowPolicy::Block.
+ *
+ * Only supported on unix.
+ */
+class PersistentDirectRingBuffer : public DirectRingBuffer {
+    public:
+        const static uint64_t MAGIC;
+        const static uint64_t VERSION;
+
+        /**
+         * Create a persistent ring buffer at path, or reopen the one there
+         *
+         * path file to keep the buffer in, created if it doesn't exist
+         * other parameters see DirectRingBuffer. When reopening, they must
+         * match those the file was created with.
+         *
+         * Throws std::runtime_error if path is open in another
+         * PersistentDirectRingBuffer, holds something other than a ring
+         * buffer created with the same parameters (including one whose
+         * creation with other parameters was interrupted), or can't be
+         * mapped.
+         */
+        PersistentDirectRingBuffer(
+                const std::string& path,
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const size_t max_readers = DEFAULT_MAX_READERS,
+                const ReadMode read_mode = ReadMode::Distribute,
+                const size_t max_writers = DEFAULT_MAX_WRITERS,
+                const WaitStrategy wait_strategy = WaitStrategy::Futex
+        );
+
+        /**
+         * The file is kept, along with any grabs still outstanding, which
+         * are recovered when it's reopened.
+         */
+        ~PersistentDirectRingBuffer();
+
+        /**
+         * Write the data and indices back to the file, waiting until they're
+         * on the device
+         *
+         * Returns 0 if successful.
+         * Returns errno if msync() fails
+         */
+        int sync();
+
+        /**
+         * Returns true if the buffer was reopened rather than created
+         */
+        bool is_resumed();
+
+        /**
+         * Get the path of the file
+         */
+        std::string get_path();
+
+    private:
+        /**
+         * File opened and locked ahead of constructing the DirectRingBuffer
+         */
+        struct Mapping {
+            int fd;
+            char* control;
+            size_t control_size;
+            bool created;
+        };
+
+        PersistentDirectRingBuffer(
+                const std::string& path,
+                const Mapping& mapping,
+                std::string loglevel,
+                const WaitStrategy wait_strategy
+        );
+
+        static Mapping open_mapping(
+                const std::string& path,
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                const size_t max_readers,
+                const ReadMode read_mode,
+                const size_t max_writers
+        );
+        static size_t get_control_size(
+                const size_t max_readers,
+                const size_t max_writers
+        );
+        static SharedRingBufferHeader* get_header(const Mapping& mapping);
+
+        /**
+         * Hand back the grabs a previous process left outstanding
+         */
+        void recover_grabs();
+
+        const std::string path;
+        const Mapping mapping;
+        SharedRingBufferHeader* header;
+};
+
+}; // namespace snake_charmer
@@ -0,0 +1,282 @@
+#pragma once
+
+#include "direct_ring_buffer.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace snake_charmer {
+
+/**
+ * Slack of each edge of a Pipeline by default, see RingBuffer
+ */
+constexpr size_t DEFAULT_EDGE_SLACK = 8;
+
+/**
+ * Per-block statistics, from Pipeline::get_stats()
+ */
+struct BlockStats {
+    // work() calls that returned 0
+    uint64_t work_calls;
+    // summed over the inputs
+    uint64_t elems_consumed;
+    // summed over the outputs
+    uint64_t elems_produced;
+    // time spent in work()
+    std::chrono::nanoseconds busy_time;
+
+    /**
+     * Elements produced per second of work(), or consumed for a sink
+     */
+    double get_throughput() const {
+        const double seconds = busy_time.count() / 1e9;
+        if(seconds == 0) {
+            return 0;
+        }
+        return (elems_produced > 0 ? elems_produced : elems_consumed) / seconds;
+    };
+};
+
+/**
+ * A processing step in a Pipeline
+ *
+ * Blocks run at fixed rates: every work() call consumes exactly
+ * input_elems elements from each input and produces exactly output_elems
+ * elements into each output, so a block decimating by 4 would have
+ * input_elems = 4 * output_elems. The pipeline only calls work() once every
+ * input has input_elems elements and every output has room for
+ * output_elems, and never calls the same block from two threads at once.
+ *
+ * Subclasses implement work().
+ */
+class PipelineBlock {
+    public:
+        /**
+         * name for logs and statistics
+         * input_elem_sizes element size of each input, in bytes
+         * output_elem_sizes element size of each output, in bytes
+         * input_elems elements consumed from each input per work() call
+         * output_elems elements produced into each output per work() call
+         */
+        PipelineBlock(
+                const std::string& name,
+                const std::vector<size_t>& input_elem_sizes,
+                const std::vector<size_t>& output_elem_sizes,
+                const size_t input_elems,
+                const size_t output_elems
+        );
+        virtual ~PipelineBlock();
+
+        /**
+         * Process one batch
+         *
+         * inputs input_elems elements from each input, in place in its
+         * buffer
+         * outputs space for output_elems elements in each output
+         *
+         * Returns 0 if the outputs were filled.
+         * Returns ENOMSG if nothing was produced this time (the inputs are
+         * still consumed), e.g. a source with no data ready yet
+         * Returns ENODATA if nothing was produced and the block is done,
+         * e.g. a source that reached the end of its input
+         * Any other return stops the pipeline with that error
+         */
+        virtual int work(
+            const std::vector<const char*>& inputs,
+            const std::vector<char*>& outputs
+        ) = 0;
+
+        const std::string& get_name();
+        size_t get_num_inputs();
+        size_t get_num_outputs();
+
+    private:
+        friend class Pipeline;
+
+        struct Input {
+            DirectRingBuffer* ring_buffer;
+            size_t reader_id;
+            // the block feeding this input, and which of its outputs
+            PipelineBlock* source;
+            size_t source_output;
+        };
+
+        /**
+         * Destroys a ring buffer constructed in its Output's storage
+         */
+        struct RingBufferDeleter {
+            void operator()(DirectRingBuffer* ring_buffer) const {
+                ring_buffer->~DirectRingBuffer();
+            }
+        };
+
+        struct Output {
+            // DirectRingBuffer is over-aligned, which new only honours from
+            // C++17, so it's constructed at an aligned address in here
+            std::unique_ptr<char[]> ring_buffer_storage;
+            std::unique_ptr<DirectRingBuffer, RingBufferDeleter> ring_buffer;
+            // the blocks fed by this output
+            std::vector<PipelineBlock*> sinks;
+            size_t slack;
+        };
+
+        const std::string name;
+        const std::vector<size_t> input_elem_sizes;
+        const std::vector<size_t> output_elem_sizes;
+        const size_t input_elems;
+        const size_t output_elems;
+        std::vector<Input> inputs;
+        std::vector<Output> outputs;
+        // pointers handed to work()
+        std::vector<const char*> input_ptrs;
+        std::vector<char*> output_ptrs;
+        // set by the worker that is running the block
+        std::atomic<bool> running;
+        // set while the block is in a worker's deque
+        std::atomic<bool> queued;
+        std::atomic<bool> finished;
+        std::atomic<uint64_t> work_calls;
+        std::atomic<uint64_t> elems_consumed;
+        std::atomic<uint64_t> elems_produced;
+        std::atomic<int64_t> busy_ns;
+};
+
+/**
+ * Runs a graph of PipelineBlocks connected by DirectRingBuffer edges on a
+ * work-stealing thread pool
+ *
+ * Declare the graph with connect(), then start() it. Each output becomes one
+ * DirectRingBuffer: in ReadMode::Distribute if it feeds one block, or
+ * ReadMode::Broadcast if it fans out to several, so blocks read their inputs
+ * and write their outputs in place.
+ *
+ * Each worker thread keeps a deque of blocks to try. It runs blocks from
+ * the back of its own deque, and when that's empty, steals from the front of
+ * the others'. After a block runs, its neighbours are queued on the same
+ * worker, so data tends to stay in one core's cache. Workers with nothing to
+ * do scan the graph for ready blocks, then sleep briefly.
+ *
+ * The pipeline finishes once every source has returned ENODATA and every
+ * block downstream has consumed all it can.
+ */
+class Pipeline {
+    public:
+        /**
+         * num_threads number of workers; 0 for one per hardware thread
+         * cpus if not empty, pin worker n to cpus[n % cpus.size()] (linux
+         * only)
+         */
+        Pipeline(
+                const size_t num_threads = 0,
+                const std::vector<int>& cpus = std::vector<int>(),
+                std::string loglevel = ""
+        );
+
+        /**
+         * Stops the pipeline if it's running. The blocks must outlive it.
+         */
+        ~Pipeline();
+
+        /**
+         * Connect output from_output of from to input to_input of to
+         *
+         * slack as for RingBuffer, with from's elements per work() call as
+         * max_elems_per_write and to's as max_elems_per_read. Every edge
+         * from the same output shares one buffer, sized by the first
+         * connection.
+         *
+         * Throws std::runtime_error if a port doesn't exist, the element
+         * sizes differ, the input is already connected, or the pipeline
+         * has started.
+         */
+        void connect(
+            PipelineBlock& from,
+            const size_t from_output,
+            PipelineBlock& to,
+            const size_t to_input,
+            const size_t slack = DEFAULT_EDGE_SLACK
+        );
+
+        /**
+         * Create the buffers and start the workers
+         *
+         * Throws std::runtime_error if a block has an unconnected port, or
+         * the pipeline has already started.
+         */
+        void start();
+
+        /**
+         * Wait for the pipeline to finish, or timeout
+         *
+         * Returns 0 if it finished.
+         * Returns ETIMEDOUT if it was still running after the timeout
+         * Returns the error a block's work() returned, if one did
+         */
+        int wait(const std::chrono::milliseconds& timeout);
+
+        /**
+         * Stop the workers, after the blocks they are running return
+         *
+         * Returns the error a block's work() returned, if one did, or 0
+         */
+        int stop();
+
+        /**
+         * Get the statistics of block
+         */
+        BlockStats get_stats(PipelineBlock& block);
+
+    private:
+        struct Worker {
+            std::mutex deque_mutex;
+            std::deque<PipelineBlock*> ready;
+            std::thread thread;
+        };
+
+        void run(const size_t id);
+        /**
+         * Find a block to try: from the back of the worker's own deque, the
+         * front of another's, or failing that, a scan of every block
+         */
+        PipelineBlock* find_work(const size_t id);
+        void push(const size_t id, PipelineBlock* block);
+        /**
+         * Returns true if block has enough input and output space to run
+         */
+        bool is_ready(PipelineBlock& block);
+        /**
+         * Returns true if block will never be ready again
+         */
+        bool is_done(PipelineBlock& block);
+        /**
+         * Run block once if it's ready and no other worker is running it
+         *
+         * Returns true if it consumed or produced anything
+         */
+        bool try_run(PipelineBlock& block);
+        /**
+         * Mark blocks finished, and the pipeline once they all are
+         */
+        void update_finished();
+        void pin_thread(const size_t id);
+
+        const std::vector<int> cpus;
+        std::vector<PipelineBlock*> blocks;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> started;
+        std::atomic<bool> stopping;
+        std::atomic<int> error;
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+        bool done;
+        std::shared_ptr<spdlog::logger> logger;
+};
+
+}; // namespace snake_charmer
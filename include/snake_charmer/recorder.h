@@ -0,0 +1,125 @@
+#pragma once
+
+#include "direct_ring_buffer.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace snake_charmer {
+
+/**
+ * Disk writes a Recorder keeps in flight by default
+ */
+constexpr size_t DEFAULT_QUEUE_DEPTH = 4;
+
+/**
+ * Drains a DirectRingBuffer to a file
+ *
+ * The recorder adds queue_depth readers, each serviced by its own thread that
+ * grabs elems_per_write elements and writes them straight from the ring
+ * buffer's mapping, releasing the grab only once the write has completed.
+ * Nothing is copied into a staging buffer, and with several grabs outstanding
+ * the disk always has queue_depth writes queued.
+ *
+ * Elements land in the file at their position in the stream, counted from the
+ * read index when the recorder started, so grabs completing out of order
+ * still produce a contiguous file. The recorder must be the buffer's only
+ * consumer, and the buffer must be in ReadMode::Distribute.
+ *
+ * If direct_io is set and every write is a multiple of 4096 bytes, the file
+ * is opened with O_DIRECT to bypass the page cache. Filesystems that refuse
+ * O_DIRECT fall back to buffered writes.
+ *
+ * Only supported on unix.
+ */
+class Recorder {
+    public:
+        /**
+         * Start recording
+         *
+         * ring_buffer buffer to drain; must outlive the recorder
+         * path file to write, truncated if it exists
+         * elems_per_write number of elements in each disk write
+         * queue_depth number of disk writes in flight
+         * direct_io whether to try bypassing the page cache
+         *
+         * Throws std::runtime_error if the buffer is in ReadMode::Broadcast,
+         * elems_per_write is 0 or more than max_elems_per_read, queue_depth
+         * is 0, the file can't be opened, or there aren't queue_depth reader
+         * slots left.
+         */
+        Recorder(
+                DirectRingBuffer& ring_buffer,
+                const std::string& path,
+                const size_t elems_per_write,
+                const size_t queue_depth = DEFAULT_QUEUE_DEPTH,
+                const bool direct_io = true,
+                std::string loglevel = ""
+        );
+
+        /**
+         * Stops recording if stop() wasn't called
+         */
+        ~Recorder();
+
+        /**
+         * Stop recording
+         *
+         * Waits for the outstanding writes, then writes whatever was released
+         * to the buffer before the call, including a tail shorter than
+         * elems_per_write, and syncs the file. Call once the writers are done.
+         *
+         * Returns 0 if successful.
+         * Returns the errno of the first failed write otherwise.
+         */
+        int stop();
+
+        /**
+         * Get the number of bytes written to the file so far
+         */
+        size_t get_bytes_written();
+
+        /**
+         * Returns true if the file was opened with O_DIRECT
+         */
+        bool is_direct_io();
+
+        /**
+         * Returns the errno of the first failed write, or 0
+         *
+         * The recorder keeps draining the buffer after a failure, so the
+         * writers aren't blocked, but the file is incomplete.
+         */
+        int get_error();
+
+    private:
+        void open_file(const bool direct_io);
+        void run(const size_t id);
+
+        /**
+         * Write elems elements from elem_ptr at stream index index
+         *
+         * Returns 0 if successful, errno otherwise.
+         */
+        int write_elems(const char* elem_ptr, const size_t elems, const size_t index);
+
+        DirectRingBuffer& ring_buffer;
+        const std::string path;
+        const size_t elem_size;
+        const size_t elems_per_write;
+        // stream index of the first element in the file
+        const size_t base_index;
+        int buffered_fd;
+        int direct_fd;
+        std::vector<size_t> reader_ids;
+        std::vector<std::thread> workers;
+        std::atomic<bool> stopping;
+        bool stopped;
+        std::atomic<size_t> bytes_written;
+        std::atomic<int> error;
+        std::shared_ptr<spdlog::logger> logger;
+};
+
+}; // namespace snake_charmer
@@ -1,13 +1,361 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <memory>
+#include <thread>
+#include <string>
+#include <vector>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_sinks.h>
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+#include "trace.h"
+
+/**
+ * Logging on the grab/release/read/write paths. Configuring with
+ * -DSNAKE_CHARMER_HOT_PATH_LOGGING=OFF compiles it out entirely; the return
+ * codes, get_stats() and the trace still report what happened.
+ */
+#ifdef SNAKE_CHARMER_NO_HOT_PATH_LOGGING
+  #define SNAKE_CHARMER_HOT_LOG(logger, level, ...) do {} while(0)
+#else
+  #define SNAKE_CHARMER_HOT_LOG(logger, level, ...) (logger)->level(__VA_ARGS__)
+#endif
 
 
 namespace snake_charmer {
 
+/**
+ * Size used to keep independently-updated indices on separate cache lines
+ */
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Spins a WaitStrategy::SpinYield wait makes before it starts yielding
+ */
+constexpr size_t SPIN_LIMIT = 1000;
+
+/**
+ * Pages backing the double-mapped buffer
+ *
+ * Huge pages cut TLB misses when sweeping through large buffers. If the
+ * requested huge pages aren't available, the buffer falls back to standard
+ * pages; get_page_size() reports what is actually in use.
+ */
+enum PageSize {
+    StandardPages = 0,
+    HugePages2MB = 1,
+    HugePages1GB = 2
+};
+
+/**
+ * How a caller blocks while it waits for data or space
+ *
+ * Condvar sleeps on buf_cv. The cheapest on CPU, but slowest to wake.
+ * Spin busy-waits with a pause instruction. The lowest latency, for
+ * callers with a core of their own.
+ * SpinYield spins for SPIN_LIMIT iterations, then yields between checks.
+ * Futex sleeps in the kernel on a word bumped by each notify, waking faster
+ * than Condvar and across processes. Linux only; elsewhere it falls back to
+ * SpinYield.
+ *
+ * Timeouts are measured with a monotonic clock whichever is chosen.
+ */
+enum WaitStrategy {
+    Condvar = 0,
+    Spin = 1,
+    SpinYield = 2,
+    Futex = 3
+};
+
+/**
+ * What a writer does when the buffer is full
+ *
+ * Block fails the write with ENOBUFS once its timeout expires, so the
+ * readers never lose data.
+ *
+ * Overwrite never waits for the readers: the writer overruns the oldest
+ * unread elements, for producers that can't be back-pressured. Readers skip
+ * ahead past whatever was overwritten, and are told exactly how many
+ * elements they skipped. Overwritten elements are counted in
+ * RingBufferStats::elems_overwritten.
+ */
+enum OverflowPolicy {
+    Block = 0,
+    Overwrite = 1
+};
+
+/**
+ * State shared between a buffer's waiters and notifiers. It lives with the
+ * indices when they are shared between processes.
+ */
+struct WaitState {
+    WaitState() : futex_word(0), waiters(0) {};
+    // bumped by each notify while something sleeps on it
+    std::atomic<uint32_t> futex_word;
+    // callers sleeping in a Condvar or Futex wait
+    std::atomic<uint32_t> waiters;
+};
+
+/**
+ * The eventfds from RingBuffer::enable_event_fds() and when to signal them.
+ * Each is signalled at most once until it's cleared, so a busy buffer makes
+ * one write() per wakeup rather than one per release.
+ */
+struct EventFds {
+    EventFds(const size_t read_threshold, const size_t write_threshold) :
+            read_fd(-1),
+            write_fd(-1),
+            read_threshold(read_threshold),
+            write_threshold(write_threshold),
+            read_signalled(false),
+            write_signalled(false) {};
+    ~EventFds();
+
+    int read_fd;
+    int write_fd;
+    const size_t read_threshold;
+    const size_t write_threshold;
+    std::atomic<bool> read_signalled;
+    std::atomic<bool> write_signalled;
+};
+
+/**
+ * Hint to the CPU that this is a spin-wait loop
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#elif defined(_MSC_VER)
+    _mm_pause();
+#endif
+}
+
+/**
+ * Buckets in a Histogram. Bucket n counts durations from 2^n up to
+ * 2^(n+1) nanoseconds, except bucket 0, which also counts 0, and the last,
+ * which counts everything longer.
+ */
+constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+/**
+ * Durations grouped into power-of-two buckets
+ */
+struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+
+    /**
+     * Get the number of durations recorded
+     */
+    uint64_t get_count() const {
+        uint64_t count = 0;
+        for(size_t n = 0; n < HISTOGRAM_BUCKETS; n++) {
+            count += counts[n];
+        }
+        return count;
+    }
+
+    /**
+     * Get an upper bound on the q quantile (0 to 1) of the durations, or 0
+     * if none were recorded
+     */
+    std::chrono::nanoseconds get_quantile(const double q) const {
+        const uint64_t count = get_count();
+        uint64_t seen = 0;
+        for(size_t n = 0; n < HISTOGRAM_BUCKETS; n++) {
+            seen += counts[n];
+            if(count > 0 && seen >= q * count) {
+                return std::chrono::nanoseconds(int64_t(2) << n);
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+};
+
+/**
+ * Snapshot of a ring buffer's statistics, from RingBuffer::get_stats()
+ *
+ * The counters are updated independently, so a snapshot taken while the
+ * buffer is in use is only approximately consistent.
+ */
+struct RingBufferStats {
+    // most elements ever written but not yet read
+    size_t fill_high_water;
+    // grabs or writes that returned ENOBUFS
+    uint64_t buffer_full_count;
+    // grabs or reads that returned ENOMSG
+    uint64_t buffer_empty_count;
+    uint64_t bytes_written;
+    // summed over readers, so a Broadcast element counts once per reader
+    uint64_t bytes_read;
+    // times buf_mutex was already held when a call needed it
+    uint64_t mutex_contention_count;
+    // elements skipped by readers because they were overwritten unread
+    uint64_t elems_overwritten;
+    // grabs released after a writer had overwritten them, with EOVERFLOW
+    uint64_t torn_read_count;
+    // elements of grabs abandoned by their writer, e.g. because its process
+    // died, that had to be zeroed and released
+    uint64_t elems_lost;
+    // time from grab to release, when enabled by set_hold_timing()
+    Histogram hold_time;
+    // time spent blocked waiting for space or data
+    Histogram wait_time;
+};
+
+/**
+ * Histogram that can be recorded into concurrently
+ */
+struct AtomicHistogram {
+    AtomicHistogram() {
+        reset();
+    }
+
+    void record(const std::chrono::steady_clock::duration& duration) {
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            duration).count();
+        size_t bucket = 0;
+        if(ns > 1) {
+#ifdef _MSC_VER
+            unsigned long msb;
+            _BitScanReverse64(&msb, ns);
+            bucket = msb;
+#else
+            bucket = 63 - __builtin_clzll(ns);
+#endif
+        }
+        if(bucket >= HISTOGRAM_BUCKETS) {
+            bucket = HISTOGRAM_BUCKETS - 1;
+        }
+        counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(Histogram& histogram) const {
+        for(size_t n = 0; n < HISTOGRAM_BUCKETS; n++) {
+            histogram.counts[n] = counts[n].load(std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for(size_t n = 0; n < HISTOGRAM_BUCKETS; n++) {
+            counts[n].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Counters behind RingBufferStats. They're only ever updated with relaxed
+ * atomics, and writer-side and reader-side counters are kept on separate
+ * cache lines so that collecting them doesn't make the two sides contend.
+ */
+struct RingBufferCounters {
+    RingBufferCounters() {
+        reset();
+    }
+
+    void add_written(const size_t bytes) {
+        bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void record_fill(const size_t fill) {
+        size_t high_water = fill_high_water.load(std::memory_order_relaxed);
+        while(fill > high_water && !fill_high_water.compare_exchange_weak(
+                high_water, fill, std::memory_order_relaxed)) {
+        }
+    }
+
+    void add_read(const size_t bytes) {
+        bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void count_full() {
+        buffer_full_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_empty() {
+        buffer_empty_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_overwritten(const size_t elems) {
+        elems_overwritten.fetch_add(elems, std::memory_order_relaxed);
+    }
+
+    void count_torn_read() {
+        torn_read_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_lost(const size_t elems) {
+        elems_lost.fetch_add(elems, std::memory_order_relaxed);
+    }
+
+    void count_contention() {
+        mutex_contention_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(RingBufferStats& stats) const {
+        stats.fill_high_water = fill_high_water.load(std::memory_order_relaxed);
+        stats.buffer_full_count = buffer_full_count.load(std::memory_order_relaxed);
+        stats.buffer_empty_count = buffer_empty_count.load(std::memory_order_relaxed);
+        stats.bytes_written = bytes_written.load(std::memory_order_relaxed);
+        stats.bytes_read = bytes_read.load(std::memory_order_relaxed);
+        stats.mutex_contention_count = mutex_contention_count.load(std::memory_order_relaxed);
+        stats.elems_overwritten = elems_overwritten.load(std::memory_order_relaxed);
+        stats.torn_read_count = torn_read_count.load(std::memory_order_relaxed);
+        stats.elems_lost = elems_lost.load(std::memory_order_relaxed);
+        hold_time.snapshot(stats.hold_time);
+        wait_time.snapshot(stats.wait_time);
+    }
+
+    void reset() {
+        bytes_written.store(0, std::memory_order_relaxed);
+        fill_high_water.store(0, std::memory_order_relaxed);
+        buffer_full_count.store(0, std::memory_order_relaxed);
+        bytes_read.store(0, std::memory_order_relaxed);
+        buffer_empty_count.store(0, std::memory_order_relaxed);
+        elems_overwritten.store(0, std::memory_order_relaxed);
+        torn_read_count.store(0, std::memory_order_relaxed);
+        elems_lost.store(0, std::memory_order_relaxed);
+        mutex_contention_count.store(0, std::memory_order_relaxed);
+        hold_time.reset();
+        wait_time.reset();
+    }
+
+    // writer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> bytes_written;
+    std::atomic<size_t> fill_high_water;
+    std::atomic<uint64_t> buffer_full_count;
+    std::atomic<uint64_t> elems_lost;
+    // reader side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> buffer_empty_count;
+    std::atomic<uint64_t> elems_overwritten;
+    std::atomic<uint64_t> torn_read_count;
+    // only touched on slow paths, or when timing holds
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> mutex_contention_count;
+    AtomicHistogram hold_time;
+    AtomicHistogram wait_time;
+};
+
+/**
+ * Get the logger called name at loglevel, which defaults to "error"
+ *
+ * Everything asking for the same name and level shares one logger, and all
+ * loggers share one stdout sink.
+ */
+std::shared_ptr<spdlog::logger> get_logger(
+    const std::string& name,
+    const std::string& loglevel
+);
+
 /**
  * Generic ring buffer.
  *
@@ -52,6 +400,9 @@ class RingBuffer {
          * @param max_elems_per_write the maximum number of elements written per write
          * @param max_elems_per_read the maximum number of elements read per read
          * @param slack amount of "slack" in the buffer
+         * @param page_size pages to back the buffer with. The buffer size and
+         * overlap are rounded to this page size.
+         * @param wait_strategy how callers block while waiting
          *
          */
         RingBuffer(
@@ -59,9 +410,11 @@ class RingBuffer {
                 const size_t max_elems_per_write,
                 const size_t max_elems_per_read,
                 const size_t slack,
-                const std::string loglevel
+                const std::string loglevel,
+                const PageSize page_size = PageSize::StandardPages,
+                const WaitStrategy wait_strategy = WaitStrategy::Condvar
         );
-        ~RingBuffer();
+        virtual ~RingBuffer();
         
         /**
          * Get the buffer size in units of elem_size
@@ -76,6 +429,17 @@ class RingBuffer {
         char* _direct(const size_t byte_offset);
         # endif
 
+        /**
+         * Get the size in bytes of the pages backing the buffer
+         */
+        size_t get_page_size();
+
+        /**
+         * Get how callers block while waiting. This may differ from what was
+         * requested, if it isn't supported.
+         */
+        WaitStrategy get_wait_strategy();
+
         /**
          * Get the size of elements in bytes
          */
@@ -91,23 +455,437 @@ class RingBuffer {
         */
         size_t get_max_elems_per_read();
 
+        /**
+         * Get a snapshot of the buffer's statistics. Collecting them takes
+         * no locks, so this can be polled while the buffer is in use.
+         */
+        RingBufferStats get_stats();
+
+        /**
+         * Zero the buffer's statistics
+         */
+        void reset_stats();
+
+        /**
+         * Enable timing how long grabs are held before they're released,
+         * reported in RingBufferStats::hold_time. Off by default, since it
+         * reads the clock on every grab and release.
+         */
+        void set_hold_timing(const bool enabled);
+
+        /**
+         * Start recording grab, release and timeout events into a trace of
+         * the last capacity events (rounded up to a power of two). Recording
+         * takes no locks, so it can stay on in production.
+         *
+         * Returns 0 if successful.
+         * Returns EALREADY if the trace was already started
+         */
+        int enable_trace(const size_t capacity);
+
+        /**
+         * Get the events in the trace, oldest first, or none if it wasn't
+         * started
+         */
+        std::vector<TraceEvent> get_trace();
+
+        /**
+         * Write the events in the trace to path, one per line as
+         * "timestamp event id index count"
+         *
+         * Returns 0 if successful.
+         * Returns errno if path can't be written.
+         */
+        int dump_trace(const std::string& path);
+
+        /**
+         * Get the number of elements available to read, up to
+         * max_elems_per_read
+         */
+        virtual size_t get_elems_avail_to_read() = 0;
+        /**
+         * Get the number of elements there is space to write, up to
+         * max_elems_per_write
+         */
+        virtual size_t get_elems_avail_to_write() = 0;
+
+        /**
+         * Create eventfds that an epoll or other event loop can wait on
+         * alongside sockets and timers, instead of a thread blocking in a
+         * grab or read per buffer (linux only)
+         *
+         * get_read_fd() becomes readable once get_elems_avail_to_read()
+         * reaches read_threshold, and get_write_fd() once
+         * get_elems_avail_to_write() reaches write_threshold. They're
+         * signalled from whichever thread's release crosses the threshold.
+         * After a wakeup, call clear_read_fd() (or clear_write_fd()), then
+         * read (or write) until below the threshold: anything released
+         * after the clear signals the fd again.
+         *
+         * Returns 0 if successful.
+         * Returns EALREADY if the fds were already created
+         * Returns EINVAL if a threshold is 0 or more than max_elems_per_read
+         * (or max_elems_per_write)
+         * Returns ENOTSUP if not on linux, or the buffer is shared with other
+         * processes, whose releases can't signal this process's fds
+         * Returns errno if eventfd() fails
+         */
+        int enable_event_fds(const size_t read_threshold = 1, const size_t write_threshold = 1);
+
+        /**
+         * Get the fd signalled when there's data to read, or -1 if
+         * enable_event_fds() hasn't been called
+         */
+        int get_read_fd();
+        /**
+         * Get the fd signalled when there's space to write, or -1 if
+         * enable_event_fds() hasn't been called
+         */
+        int get_write_fd();
+
+        /**
+         * Reset get_read_fd() after it woke an event loop, so the next
+         * release that leaves read_threshold elements signals it again
+         */
+        void clear_read_fd();
+        /**
+         * Reset get_write_fd() after it woke an event loop, so the next
+         * release that leaves write_threshold elements of space signals it
+         * again
+         */
+        void clear_write_fd();
+
     protected:
+        /**
+         * Constructor for subclasses that need control over the number of
+         * elements in the buffer.
+         *
+         * @param min_num_elems the minimum number of elements in the buffer
+         * @param power_of_two if true, the number of elements is a power of
+         * two and the buffer holds exactly that many, so subclasses can
+         * index it with a mask instead of a modulo
+         * @param num_planes number of buffers mapped back to back, each with
+         * its own overlap, that share the indices: element n of plane p is
+         * at get_plane_stride() * p bytes from element n of plane 0
+         *
+         * Throws std::runtime_error if num_planes isn't 1 on Windows
+         */
+        RingBuffer(
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                const std::string loglevel,
+                const size_t min_num_elems,
+                const bool power_of_two,
+                const PageSize page_size,
+                const WaitStrategy wait_strategy,
+                const size_t num_planes = 1
+        );
+
+        /**
+         * Constructor for subclasses whose buffer is backed by a file they
+         * manage, e.g. shared memory. The buffer uses standard pages and
+         * starts at backing_offset within backing_fd, which is grown to fit
+         * if needed. backing_fd isn't closed.
+         *
+         * The buffer may be shared with other processes, which can't wake a
+         * Condvar wait, so Condvar is replaced by Futex. Subclasses should
+         * point wait_state into the shared memory.
+         */
+        RingBuffer(
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                const std::string loglevel,
+                const int backing_fd,
+                const size_t backing_offset,
+                const WaitStrategy wait_strategy
+        );
+
+        /**
+         * Block until ready() returns true or timeout expires, for use by
+         * lock-free paths that only need buf_mutex when they have to wait.
+         * Returns false immediately for a zero timeout.
+         */
+        template<typename Predicate>
+        bool wait_until_ready(
+            Predicate ready,
+            const std::chrono::microseconds& timeout
+        );
+        /**
+         * As above, for callers holding buf_mutex in lock. Returns with
+         * lock held and ready() true, or false once timeout expires.
+         * Callers must update what ready() checks under buf_mutex, then
+         * call notify_waiters_locked().
+         */
+        template<typename Predicate>
+        bool wait_until_ready(
+            std::unique_lock<std::mutex>& lock,
+            Predicate ready,
+            const std::chrono::microseconds& timeout
+        );
+        /**
+         * Wake anything in wait_until_ready(), taking buf_mutex only if
+         * something is waiting
+         */
+        void notify_waiters();
+        /**
+         * Wake anything in wait_until_ready(), for callers holding buf_mutex
+         */
+        void notify_waiters_locked();
+        /**
+         * Move the buffer to a new mapping sized for new_slack, copying the
+         * elements with absolute indices in [start, end) to their places in
+         * it. The caller must make sure nothing accesses the buffer
+         * meanwhile.
+         *
+         * Returns 0 if successful.
+         * Returns ENOBUFS if [start, end) doesn't fit in the new size
+         * Returns ENOTSUP if the buffer is shared with other processes, or
+         * not on unix
+         * Returns errno if the new buffer can't be mapped, leaving the old
+         * one in place
+         */
+        int remap(const size_t new_slack, const size_t start, const size_t end);
+        /**
+         * Get the bytes from an element of one plane to the same element of
+         * the next. Changed by remap(), so only stable while a grab is held
+         * or buf_mutex is locked.
+         */
+        size_t get_plane_stride() {
+            return buf_size.load(std::memory_order_relaxed)
+                + buf_overlap.load(std::memory_order_relaxed);
+        };
+        /**
+         * Get the address of the element at absolute index in the first
+         * plane. Stable under the same conditions as get_plane_stride().
+         */
+        char* get_elem_ptr(const size_t index) {
+            return buf_ptr.load(std::memory_order_relaxed)
+                + (index * elem_size) % buf_size.load(std::memory_order_relaxed);
+        };
+        /**
+         * Lock buf_mutex, counting the times it's already held
+         */
+        std::unique_lock<std::mutex> lock_buffer();
+        /**
+         * Get the time a grab starts, or 0 if hold timing is off
+         */
+        int64_t get_hold_start();
+        /**
+         * Record the hold time of a grab that started at hold_start
+         */
+        void record_hold(const int64_t hold_start);
+        /**
+         * Record an event in the trace, if it was started
+         */
+        void trace_event(
+            const TraceEventType type,
+            const uint32_t id,
+            const size_t index,
+            const size_t count
+        ) {
+            // only pay for the acquire once tracing has started
+            if(trace.load(std::memory_order_relaxed) != nullptr) {
+                trace.load(std::memory_order_acquire)->record(type, id, index, count);
+            }
+        };
+
         const size_t elem_size;
         const size_t max_elems_per_write;
         const size_t max_elems_per_read;
-        const size_t slack;
+        // changed by remap()
+        size_t slack;
+        const size_t num_planes;
         
-        size_t num_elems;
-        char* buf_ptr;
+        // Changed by remap() while no grab is held. It publishes num_elems
+        // last with release, once the data is in the new mapping, so
+        // get_elems_avail_to_read/write and the like can read it at any time.
+        // Grabs load all four relaxed: the resize epoch or buf_mutex orders
+        // them.
+        std::atomic<size_t> num_elems;
+        size_t page_size_bytes;
+        std::atomic<char*> buf_ptr;
 #ifdef _WIN32
         void* secondary_view;
 #endif
-        size_t buf_size;
-        size_t buf_overlap;
+        std::atomic<size_t> buf_size;
+        std::atomic<size_t> buf_overlap;
         
         std::mutex buf_mutex;
+        std::condition_variable buf_cv;
+        WaitStrategy wait_strategy;
+        WaitState local_wait_state;
+        // &local_wait_state, unless a subclass shares it between processes
+        WaitState* wait_state;
+        // indices may be updated by other processes
+        const bool cross_process;
+        RingBufferCounters counters;
+        std::atomic<bool> hold_timing;
+        std::unique_ptr<TraceRing> trace_storage;
+        // trace_storage once started
+        std::atomic<TraceRing*> trace;
+        std::unique_ptr<EventFds> event_fds_storage;
+        // event_fds_storage once created
+        std::atomic<EventFds*> event_fds;
         std::shared_ptr<spdlog::logger> logger;
-        std::shared_ptr<spdlog::sinks::stdout_sink_mt> log_sink;
+
+    private:
+        /**
+         * Set wait_strategy, falling back if requested isn't supported
+         */
+        void set_wait_strategy(const WaitStrategy requested);
+        template<typename Predicate>
+        bool wait_until_deadline(
+            Predicate ready,
+            const std::chrono::steady_clock::time_point& deadline
+        );
+        /**
+         * Sleep until wait_state->futex_word no longer holds expected, a
+         * notify, or timeout
+         */
+        void futex_wait(
+            const uint32_t expected,
+            const std::chrono::steady_clock::duration& timeout
+        );
+        void futex_wake();
+        /**
+         * Signal the eventfds whose thresholds have been reached, if they
+         * aren't signalled already
+         */
+        void signal_event_fds(EventFds& events);
+        /**
+         * The sizes and address of a mapping, before it's published
+         */
+        struct Geometry {
+            size_t num_elems;
+            size_t buf_size;
+            size_t buf_overlap;
+            char* buf_ptr;
+        };
+        /**
+         * Get the sizes of a buffer of at least min_num_elems for
+         * page_size_bytes, with buf_ptr still unset
+         */
+        Geometry get_sizes(const size_t min_num_elems, const bool power_of_two);
+        /**
+         * Store geometry in num_elems, buf_size, buf_overlap and buf_ptr,
+         * num_elems last
+         */
+        void publish(const Geometry& geometry);
+#ifdef __unix__
+        /**
+         * Map geometry.buf_size bytes of fd starting at offset twice, back to
+         * back, setting geometry.buf_ptr, growing fd to fit if needed. Each
+         * further plane maps the next buf_size bytes of fd the same way,
+         * straight after.
+         * Returns false (with errno set) if it can't be mapped.
+         */
+        bool map_buffer(const int fd, const size_t offset, Geometry& geometry);
+#endif
 };
 
+template<typename Predicate>
+bool RingBuffer::wait_until_ready(
+        Predicate ready,
+        const std::chrono::microseconds& timeout
+    ) {
+    if(timeout.count() <= 0) {
+        return false;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const bool is_ready = wait_until_deadline(ready, start + timeout);
+    counters.wait_time.record(std::chrono::steady_clock::now() - start);
+    return is_ready;
+}
+
+template<typename Predicate>
+bool RingBuffer::wait_until_ready(
+        std::unique_lock<std::mutex>& lock,
+        Predicate ready,
+        const std::chrono::microseconds& timeout
+    ) {
+    if(ready() || timeout.count() <= 0) {
+        return ready();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + timeout;
+    bool is_ready;
+    if(wait_strategy == WaitStrategy::Condvar) {
+        // woken by notify_waiters_locked()
+        is_ready = buf_cv.wait_until(lock, deadline, ready);
+    } else {
+        // the other strategies wait without buf_mutex, so other callers can
+        // make progress meanwhile
+        while(true) {
+            lock.unlock();
+            wait_until_deadline(ready, deadline);
+            lock.lock();
+            is_ready = ready();
+            if(is_ready || std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+        }
+    }
+    counters.wait_time.record(std::chrono::steady_clock::now() - start);
+    return is_ready;
+}
+
+template<typename Predicate>
+bool RingBuffer::wait_until_deadline(
+        Predicate ready,
+        const std::chrono::steady_clock::time_point& deadline
+    ) {
+    bool is_ready = false;
+    size_t spins = 0;
+    switch(wait_strategy) {
+        case WaitStrategy::Spin:
+        case WaitStrategy::SpinYield:
+            while(!(is_ready = ready())) {
+                // the clock costs more than a check, so only read it now and then
+                if(++spins % 64 == 0 && std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+                if(wait_strategy == WaitStrategy::SpinYield && spins > SPIN_LIMIT) {
+                    std::this_thread::yield();
+                } else {
+                    cpu_relax();
+                }
+            }
+            return is_ready;
+        case WaitStrategy::Futex:
+            // register before re-checking, so that a notify_waiters() racing
+            // with this check is guaranteed to bump futex_word (paired with
+            // the fence there)
+            wait_state->waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while(true) {
+                // read the word before checking, so a notify after the check
+                // changes it and futex_wait() returns at once
+                const uint32_t word = wait_state->futex_word.load(std::memory_order_acquire);
+                is_ready = ready();
+                const auto remaining = deadline - std::chrono::steady_clock::now();
+                if(is_ready || remaining.count() <= 0) {
+                    break;
+                }
+                futex_wait(word, remaining);
+            }
+            wait_state->waiters.fetch_sub(1);
+            return is_ready;
+        case WaitStrategy::Condvar:
+        default:
+            break;
+    }
+    std::unique_lock<std::mutex> lock = lock_buffer();
+    // register before re-checking, so that a notify_waiters() racing with
+    // this check is guaranteed to see us (paired with the fence there)
+    wait_state->waiters.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    is_ready = buf_cv.wait_until(lock, deadline, ready);
+    wait_state->waiters.fetch_sub(1);
+    return is_ready;
+}
+
 }; // snake_charmer
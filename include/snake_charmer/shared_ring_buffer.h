@@ -0,0 +1,231 @@
+#pragma once
+
+#include "direct_ring_buffer.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+namespace snake_charmer {
+
+/**
+ * Sizing of a SharedDirectRingBuffer, at the start of its shared memory so
+ * that other processes can attach by name alone.
+ *
+ * magic is stored last by the creator, once the indices are initialized.
+ */
+struct alignas(CACHE_LINE_SIZE) SharedRingBufferHeader {
+    std::atomic<uint64_t> magic;
+    uint64_t version;
+    uint64_t elem_size;
+    uint64_t max_elems_per_write;
+    uint64_t max_elems_per_read;
+    uint64_t slack;
+    uint64_t max_readers;
+    uint64_t max_writers;
+    uint64_t read_mode;
+    uint64_t buf_size;
+    uint64_t num_elems;
+    int64_t creator_pid;
+};
+
+/**
+ * DirectRingBuffer in named POSIX shared memory, shared between processes
+ *
+ * The shared memory holds a control block (SharedRingBufferHeader followed
+ * by the DirectRingBufferIndices and reader/writer slots), then the data,
+ * which each process double-maps itself. Since all the indices live in the
+ * control block, and readers and writers are added without buf_mutex, any
+ * process that attaches can grab and release exactly as in a single process,
+ * with zero copies.
+ *
+ * Each reader and writer slot records the process that added it, so that
+ * reap_dead_peers() can detect peers that died without cleaning up. The
+ * process's start time is recorded along with its pid, so a later process
+ * given the same pid isn't taken for it. Slots that are removed or reaped
+ * are reused by later add_reader() and add_writer() calls. The built-in
+ * writer belongs to the creating process.
+ *
+ * Waits use WaitStrategy::Futex on a word in the control block by default,
+ * since another process can't notify buf_cv. Each process chooses its own
+ * wait strategy.
+ *
+ * get_stats() only counts the calls made through this process's object.
+ *
+ * Only supported on unix.
+ */
+class SharedDirectRingBuffer : public DirectRingBuffer {
+    public:
+        const static uint64_t MAGIC;
+        const static uint64_t VERSION;
+
+        /**
+         * Create a shared ring buffer
+         *
+         * name POSIX shared memory name, e.g. "/capture"
+         * other parameters see DirectRingBuffer
+         *
+         * The shared memory is unlinked when this object is destroyed;
+         * processes already attached keep their mappings.
+         *
+         * Throws std::runtime_error if name already exists, e.g. left behind
+         * by a creator that crashed, or it can't be mapped.
+         */
+        SharedDirectRingBuffer(
+                const std::string& name,
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const size_t max_readers = DEFAULT_MAX_READERS,
+                const ReadMode read_mode = ReadMode::Distribute,
+                const size_t max_writers = DEFAULT_MAX_WRITERS,
+                const WaitStrategy wait_strategy = WaitStrategy::Futex
+        );
+
+        /**
+         * Attach to a shared ring buffer created by another process
+         *
+         * name POSIX shared memory name given to the creator
+         * wait_strategy how this process blocks while waiting
+         *
+         * Throws std::runtime_error if name doesn't exist, isn't fully
+         * created yet, or was created by an incompatible version.
+         */
+        SharedDirectRingBuffer(
+                const std::string& name,
+                std::string loglevel,
+                const WaitStrategy wait_strategy = WaitStrategy::Futex
+        );
+
+        /**
+         * Readers and writers added through this object are removed, so they
+         * don't hold back the remaining processes. Write grabs still
+         * outstanding are released as reap_dead_peers() does.
+         */
+        ~SharedDirectRingBuffer();
+
+        /**
+         * Add a reader owned by this process. See DirectRingBuffer.
+         */
+        size_t add_reader();
+
+        /**
+         * Add a writer owned by this process. See DirectRingBuffer.
+         */
+        size_t add_writer();
+
+        /**
+         * Remove a reader, so it no longer holds back the writers. See
+         * DirectRingBuffer.
+         */
+        int remove_reader(const size_t id);
+
+        /**
+         * Grab a portion of the buffer for reading. See DirectRingBuffer.
+         *
+         * Returns EPIPE instead of ENOMSG if there is no live writer left to
+         * provide more data.
+         */
+        int grab_read(
+            char*& elem_ptr,
+            const size_t elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Grab as much of the buffer for reading as is available. See
+         * DirectRingBuffer.
+         *
+         * Returns EPIPE instead of ENOMSG if there is no live writer left to
+         * provide more data.
+         */
+        int grab_read_upto(
+            char*& elem_ptr,
+            size_t& elems_grabbed,
+            const size_t max_elems_this_read,
+            const size_t id,
+            const std::chrono::microseconds& timeout
+        );
+
+        /**
+         * Release the slots of processes that have died.
+         *
+         * A dead reader is removed, releasing anything it had grabbed. A dead
+         * writer's outstanding grab is handed back if nothing was grabbed
+         * after it; otherwise it's zeroed, counted in
+         * RingBufferStats::elems_lost, and released (see
+         * DirectRingBuffer::release_abandoned_write()). Either way the slots
+         * are freed for reuse.
+         *
+         * Returns the number of slots released.
+         */
+        size_t reap_dead_peers();
+
+        /**
+         * Returns true if any process that can write to the buffer is alive
+         */
+        bool is_writer_alive();
+
+        /**
+         * Get the name of the shared memory
+         */
+        std::string get_name();
+
+    private:
+        /**
+         * Shared memory opened ahead of constructing the DirectRingBuffer
+         */
+        struct Mapping {
+            int fd;
+            char* control;
+            size_t control_size;
+            bool created;
+        };
+
+        SharedDirectRingBuffer(
+                const std::string& name,
+                const Mapping& mapping,
+                std::string loglevel,
+                const WaitStrategy wait_strategy
+        );
+
+        static Mapping create_mapping(
+                const std::string& name,
+                const size_t elem_size,
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                const size_t max_readers,
+                const ReadMode read_mode,
+                const size_t max_writers
+        );
+        static Mapping attach_mapping(const std::string& name);
+        static size_t get_control_size(
+                const size_t max_readers,
+                const size_t max_writers
+        );
+        static SharedRingBufferHeader* get_header(const Mapping& mapping);
+
+        /**
+         * Get the owner recorded in the slots of process pid: the pid, with
+         * the low 31 bits of its start time above it
+         */
+        static int64_t get_owner(const int64_t pid);
+
+        /**
+         * Returns true if the process owner is still alive
+         */
+        static bool is_alive(const int64_t owner);
+
+        const std::string name;
+        const Mapping mapping;
+        SharedRingBufferHeader* header;
+        // slots added through this object
+        std::vector<size_t> own_readers;
+        std::vector<size_t> own_writers;
+};
+
+}; // namespace snake_charmer
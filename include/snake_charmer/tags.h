@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+
+namespace snake_charmer {
+
+/**
+ * Metadata attached to one element of a DirectRingBuffer, e.g. a sample
+ * timestamp or a retune
+ *
+ * index absolute index of the element
+ * key what the tag means; the values are up to the application
+ * value up to 8 bytes of any trivially copyable type, see get_value()
+ */
+struct Tag {
+    size_t index;
+    uint64_t key;
+    uint64_t value;
+
+    /**
+     * Get the value as the type it was added as
+     */
+    template<typename T>
+    T get_value() const {
+        static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(uint64_t),
+            "Tag values must be trivially copyable and at most 8 bytes");
+        T typed;
+        memcpy(&typed, &value, sizeof(T));
+        return typed;
+    }
+};
+
+/**
+ * Pack value into the bytes of Tag::value
+ */
+template<typename T>
+uint64_t to_tag_value(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(uint64_t),
+        "Tag values must be trivially copyable and at most 8 bytes");
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
+
+/**
+ * Tags in a read grab, in index order, for range-based for loops
+ */
+struct TagRange {
+    TagRange() : first(nullptr), last(nullptr) {};
+    const Tag* begin() const { return first; };
+    const Tag* end() const { return last; };
+    size_t size() const { return last - first; };
+    bool empty() const { return first == last; };
+
+    const Tag* first;
+    const Tag* last;
+};
+
+/**
+ * One writer's tags, in index order
+ *
+ * Only the writer appends, so head needs no read-modify-write. Each slot
+ * carries the position it was written at, set last, so a reader racing the
+ * writer's reuse of a slot can tell (the same scheme as TraceRing).
+ */
+class TagRing {
+    public:
+        /**
+         * capacity number of tags kept, rounded up to a power of two
+         */
+        explicit TagRing(const size_t capacity) :
+                mask(round_up(capacity) - 1),
+                slots(new Slot[mask + 1]),
+                head(0),
+                tail(0)
+        {
+            for(size_t n = 0; n <= mask; n++) {
+                slots[n].position.store(EMPTY, std::memory_order_relaxed);
+            }
+        };
+
+        /**
+         * Append a tag, first dropping the tags below drop_below, which no
+         * reader can grab any more
+         *
+         * Returns 0 if successful.
+         * Returns EINVAL if index is before the last tag's
+         * Returns ENOBUFS if the ring is full of tags readers may still need
+         */
+        int push(
+                const size_t index,
+                const uint64_t key,
+                const uint64_t value,
+                const size_t drop_below
+        ) {
+            const size_t position = head.load(std::memory_order_relaxed);
+            size_t oldest = tail.load(std::memory_order_relaxed);
+            if(position > oldest
+                    && slots[(position - 1) & mask].index.load(std::memory_order_relaxed) > index) {
+                return EINVAL;
+            }
+            while(oldest < position
+                    && slots[oldest & mask].index.load(std::memory_order_relaxed) < drop_below) {
+                oldest++;
+            }
+            tail.store(oldest, std::memory_order_release);
+            if(position - oldest > mask) {
+                return ENOBUFS;
+            }
+            Slot& slot = slots[position & mask];
+            slot.position.store(EMPTY, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.index.store(index, std::memory_order_relaxed);
+            slot.key.store(key, std::memory_order_relaxed);
+            slot.value.store(value, std::memory_order_relaxed);
+            slot.position.store(position, std::memory_order_release);
+            head.store(position + 1, std::memory_order_release);
+            return 0;
+        };
+
+        /**
+         * Remove the tags at or after index, which were never released.
+         * Writer only.
+         */
+        void truncate(const size_t index) {
+            size_t position = head.load(std::memory_order_relaxed);
+            const size_t oldest = tail.load(std::memory_order_relaxed);
+            while(position > oldest
+                    && slots[(position - 1) & mask].index.load(std::memory_order_relaxed) >= index) {
+                position--;
+            }
+            head.store(position, std::memory_order_release);
+        };
+
+        /**
+         * Append the tags in [start, end) to tags
+         *
+         * The range must have been released by the writer, and be held by
+         * the caller's grab, so the writer won't drop its tags meanwhile.
+         */
+        void collect(const size_t start, const size_t end, std::vector<Tag>& tags) const {
+            const size_t stop = head.load(std::memory_order_acquire);
+            size_t low = std::min(tail.load(std::memory_order_acquire), stop);
+            size_t high = stop;
+            // Find the first tag at or after start. A slot the writer has
+            // reused held a tag that was dropped, so it sorts as older.
+            Tag tag;
+            while(low < high) {
+                const size_t middle = low + (high - low) / 2;
+                if(!read(middle, tag) || tag.index < start) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            for(size_t position = low; position < stop; position++) {
+                if(!read(position, tag)) {
+                    continue; // overwritten, only possible with OverflowPolicy::Overwrite
+                }
+                if(tag.index >= end) {
+                    break;
+                }
+                tags.push_back(tag);
+            }
+        };
+
+        size_t get_capacity() const {
+            return mask + 1;
+        };
+
+    private:
+        struct Slot {
+            std::atomic<size_t> position;
+            std::atomic<size_t> index;
+            std::atomic<uint64_t> key;
+            std::atomic<uint64_t> value;
+        };
+
+        /**
+         * Read the tag at position
+         *
+         * Returns false if the slot has since been reused
+         */
+        bool read(const size_t position, Tag& tag) const {
+            const Slot& slot = slots[position & mask];
+            if(slot.position.load(std::memory_order_acquire) != position) {
+                return false;
+            }
+            tag.index = slot.index.load(std::memory_order_relaxed);
+            tag.key = slot.key.load(std::memory_order_relaxed);
+            tag.value = slot.value.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.position.load(std::memory_order_relaxed) == position;
+        };
+
+        static size_t round_up(const size_t capacity) {
+            size_t rounded = 1;
+            while(rounded < capacity) {
+                rounded <<= 1;
+            }
+            return rounded;
+        };
+
+        // position of a slot that is empty or being written
+        const static size_t EMPTY = SIZE_MAX;
+
+        const size_t mask;
+        std::unique_ptr<Slot[]> slots;
+        // 1 more than the last tag, and the oldest tag kept
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+};
+
+/**
+ * The tags of a DirectRingBuffer: a TagRing per writer, so that writers
+ * never contend, and a scratch vector per reader that get_tags() collects
+ * into, so that steady-state reads don't allocate
+ */
+struct TagStore {
+    TagStore(const size_t capacity, const size_t num_rings, const size_t num_readers) :
+            reader_tags(num_readers)
+    {
+        for(size_t n = 0; n < num_rings; n++) {
+            rings.emplace_back(new TagRing(capacity));
+        }
+    };
+
+    std::vector<std::unique_ptr<TagRing>> rings;
+    std::vector<std::vector<Tag>> reader_tags;
+};
+
+}; // namespace snake_charmer
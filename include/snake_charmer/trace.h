@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#elif defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+
+namespace snake_charmer {
+
+/**
+ * Event recorded in a TraceRing
+ *
+ * CopyRingBuffer writes and reads are recorded as releases, since they grab
+ * and release in one call.
+ */
+enum TraceEventType {
+    GrabWrite = 0,
+    ReleaseWrite = 1,
+    GrabRead = 2,
+    ReleaseRead = 3,
+    // ENOBUFS
+    WriteFull = 4,
+    // ENOMSG
+    ReadEmpty = 5
+};
+
+/**
+ * ID recorded for events that don't belong to a reader or writer slot, e.g.
+ * the built-in writer
+ */
+constexpr uint32_t TRACE_NO_ID = UINT32_MAX;
+
+/**
+ * Event copied out of a TraceRing
+ *
+ * timestamp cycle counter (TSC on x86, the virtual counter on aarch64), or
+ * steady_clock nanoseconds where there isn't one
+ * id reader or writer ID, or TRACE_NO_ID
+ * index absolute index of the first element
+ * count number of elements
+ */
+struct TraceEvent {
+    uint64_t timestamp;
+    TraceEventType type;
+    uint32_t id;
+    uint64_t index;
+    uint64_t count;
+};
+
+/**
+ * Read the cheapest monotonic timestamp available
+ */
+inline uint64_t read_timestamp() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_MSC_VER)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * Fixed-size ring of the most recent events, recorded without locks
+ *
+ * Each record claims a position by bumping head, so any number of threads can
+ * record at once. A slot's sequence is odd while a record is written into it
+ * and even once it's complete, and a writer takes the slot with a
+ * compare-exchange, so two writers a lap apart can't interleave their
+ * fields. A record is dropped if its slot is still being written, which
+ * only happens when the ring laps a stalled writer, or already holds a
+ * later record.
+ */
+class TraceRing {
+    public:
+        /**
+         * capacity number of events kept, rounded up to a power of two
+         */
+        explicit TraceRing(const size_t capacity) :
+                mask(round_up(capacity) - 1),
+                records(new Record[mask + 1]),
+                head(0)
+        {
+            for(size_t n = 0; n <= mask; n++) {
+                records[n].sequence.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        void record(
+                const TraceEventType type,
+                const uint32_t id,
+                const uint64_t index,
+                const uint64_t count
+        ) {
+            const uint64_t position = head.fetch_add(1, std::memory_order_relaxed);
+            Record& slot = records[position & mask];
+            uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+            do {
+                if((sequence & 1) != 0 || sequence >= complete(position)) {
+                    return;
+                }
+            } while(!slot.sequence.compare_exchange_weak(
+                sequence, complete(position) - 1, std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.timestamp.store(read_timestamp(), std::memory_order_relaxed);
+            slot.type_and_id.store(
+                (static_cast<uint64_t>(type) << 32) | id, std::memory_order_relaxed);
+            slot.index.store(index, std::memory_order_relaxed);
+            slot.count.store(count, std::memory_order_relaxed);
+            slot.sequence.store(complete(position), std::memory_order_release);
+        };
+
+        /**
+         * Copy out the complete events still in the ring, oldest first
+         */
+        std::vector<TraceEvent> snapshot() const {
+            std::vector<TraceEvent> events;
+            const uint64_t end = head.load(std::memory_order_acquire);
+            const uint64_t start = end > mask + 1 ? end - (mask + 1) : 0;
+            events.reserve(end - start);
+            for(uint64_t position = start; position < end; position++) {
+                const Record& slot = records[position & mask];
+                for(;;) {
+                    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+                    if(sequence == complete(position) - 1) {
+                        std::this_thread::yield(); // wait for the record to be complete
+                        continue;
+                    }
+                    if(sequence != complete(position)) {
+                        break; // dropped, or already overwritten
+                    }
+                    TraceEvent event;
+                    event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+                    const uint64_t type_and_id = slot.type_and_id.load(std::memory_order_relaxed);
+                    event.type = static_cast<TraceEventType>(type_and_id >> 32);
+                    event.id = static_cast<uint32_t>(type_and_id);
+                    event.index = slot.index.load(std::memory_order_relaxed);
+                    event.count = slot.count.load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    // otherwise it was overwritten while being read, so look again
+                    if(slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                        events.push_back(event);
+                        break;
+                    }
+                }
+            }
+            return events;
+        };
+
+        size_t get_capacity() const {
+            return mask + 1;
+        };
+
+    private:
+        struct Record {
+            std::atomic<uint64_t> sequence;
+            std::atomic<uint64_t> timestamp;
+            std::atomic<uint64_t> type_and_id;
+            std::atomic<uint64_t> index;
+            std::atomic<uint64_t> count;
+        };
+
+        /**
+         * Sequence of a slot once the record at position is complete
+         */
+        static uint64_t complete(const uint64_t position) {
+            return (position + 1) << 1;
+        };
+
+        static size_t round_up(const size_t capacity) {
+            size_t rounded = 1;
+            while(rounded < capacity) {
+                rounded <<= 1;
+            }
+            return rounded;
+        };
+
+        const size_t mask;
+        std::unique_ptr<Record[]> records;
+        std::atomic<uint64_t> head;
+};
+
+}; // namespace snake_charmer
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "ring_buffer.h"
+
+
+namespace snake_charmer {
+
+/**
+ * Capacity policy for a TypedRingBuffer whose number of elements is chosen at
+ * runtime from slack, rounded up to a power of two.
+ */
+struct DynamicCapacity {
+    static constexpr bool is_fixed() { return false; };
+    static constexpr size_t capacity() { return 0; };
+};
+
+/**
+ * Capacity policy for a TypedRingBuffer that holds exactly N elements, so the
+ * index mask is a compile-time constant.
+ */
+template<size_t N>
+struct FixedCapacity {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+    static constexpr bool is_fixed() { return true; };
+    static constexpr size_t capacity() { return N; };
+};
+
+/**
+ * View of contiguous elements within a TypedRingBuffer
+ */
+template<typename T>
+struct Span {
+    Span() : data(nullptr), size(0) {};
+    Span(T* data, const size_t size) : data(data), size(size) {};
+    T* begin() const { return data; };
+    T* end() const { return data + size; };
+    T& operator[](const size_t n) const { return data[n]; };
+    T* data;
+    size_t size;
+};
+
+/**
+ * Single-writer, single-reader ring buffer of elements of type T
+ *
+ * Layered over the same double-mapped allocation as the other ring buffers,
+ * but with the element size known at compile time and the number of elements
+ * a power of two, so locating an element is a mask and a multiply by a
+ * constant rather than a division. Grabs return typed Spans, and the indices
+ * are handed off between the writer and reader with acquire/release atomics.
+ * buf_mutex is only taken when a grab_read has to wait out its timeout
+ * with WaitStrategy::Condvar.
+ *
+ * T must be trivially copyable, since elements are handed out as raw memory
+ * in the mapping.
+ */
+template<typename T, typename Policy = DynamicCapacity>
+class TypedRingBuffer : public RingBuffer {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "TypedRingBuffer elements must be trivially copyable");
+    public:
+        /**
+         * Constructor.
+         *
+         * With DynamicCapacity, the buffer holds at least
+         * slack * max_elems_per_read + max_elems_per_write elements.
+         * With FixedCapacity<N>, it holds exactly N elements; slack is only
+         * checked against N.
+         *
+         * Throws std::runtime_error if FixedCapacity<N> is too small for the
+         * slack, or doesn't fill a whole number of pages of page_size.
+         */
+        TypedRingBuffer(
+                const size_t max_elems_per_write,
+                const size_t max_elems_per_read,
+                const size_t slack,
+                std::string loglevel,
+                const PageSize page_size = PageSize::StandardPages,
+                const WaitStrategy wait_strategy = WaitStrategy::Condvar
+        ) :
+                RingBuffer(
+                    sizeof(T), max_elems_per_write, max_elems_per_read, slack, loglevel,
+                    Policy::is_fixed() ? Policy::capacity()
+                        : slack * max_elems_per_read + max_elems_per_write,
+                    true, page_size, wait_strategy
+                ),
+                mask(num_elems.load() - 1),
+                write_index(0),
+                elems_grabbed_write(0),
+                cached_read_index(0),
+                write_hold_start(0),
+                read_index(0),
+                elems_grabbed_read(0),
+                cached_write_index(0),
+                read_hold_start(0)
+        {
+            if(Policy::is_fixed() && num_elems.load() != Policy::capacity()) {
+                throw std::runtime_error(fmt::format(
+                    "FixedCapacity {} of {} byte elements isn't a whole number of pages",
+                    Policy::capacity(), sizeof(T)));
+            }
+            if(slack * max_elems_per_read + max_elems_per_write > num_elems.load()) {
+                throw std::runtime_error(fmt::format(
+                    "FixedCapacity {} is too small for the requested slack",
+                    Policy::capacity()));
+            }
+        };
+
+        /**
+         * Grab a portion of the buffer for writing
+         *
+         * elems span in buffer which you can then edit
+         * elems_this_write number of elements you are responsible for writing
+         *
+         * Returns 0 if successful.
+         * Returns ENOBUFS if buffer full
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if elems_this_write > max_elems_per_write
+         */
+        int grab_write(
+            Span<T>& elems,
+            const size_t elems_this_write
+        ) {
+            return grab_write(elems, elems_this_write, elems_this_write);
+        };
+
+        /**
+         * Grab as much of the buffer for writing as is free, up to
+         * max_elems_this_write
+         *
+         * elems span in buffer which you can then edit, of at least 1
+         * element
+         *
+         * Returns the same codes as grab_write
+         */
+        int grab_write_upto(
+            Span<T>& elems,
+            const size_t max_elems_this_write
+        ) {
+            return grab_write(elems, 1, max_elems_this_write);
+        };
+
+        /**
+         * Release a portion of the buffer for writing
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         */
+        int release_write() {
+            return release_write_partial(elems_grabbed_write);
+        };
+
+        /**
+         * Release the first elems_used elements of the prior grab for
+         * writing, and hand the rest back
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         * Returns EINVAL if elems_used is more than was grabbed
+         */
+        int release_write_partial(const size_t elems_used) {
+            if(elems_grabbed_write == 0) {
+                return EBUSY;
+            }
+            if(elems_used > elems_grabbed_write) {
+                return EINVAL;
+            }
+            const size_t index = write_index.load(std::memory_order_relaxed);
+            write_index.store(index + elems_used, std::memory_order_release);
+            elems_grabbed_write = 0;
+            counters.add_written(elems_used * sizeof(T));
+            record_hold(write_hold_start);
+            trace_event(TraceEventType::ReleaseWrite, TRACE_NO_ID, index, elems_used);
+            notify_waiters();
+            return 0;
+        };
+
+        /**
+         * Grab a portion of the buffer for reading
+         *
+         * elems span in buffer which you can then read
+         * elems_this_read number of elements you are responsible for reading
+         * timeout number of microseconds to wait for data
+         *
+         * Returns 0 if successful.
+         * Returns ENOMSG if insufficient data arrived before the timeout
+         * Returns EBUSY if the prior grab hasn't been released
+         * Returns EMSGSIZE if elems_this_read > max_elems_per_read
+         */
+        int grab_read(
+            Span<const T>& elems,
+            const size_t elems_this_read,
+            const std::chrono::microseconds& timeout = std::chrono::microseconds(0)
+        ) {
+            return grab_read(elems, elems_this_read, elems_this_read, timeout);
+        };
+
+        /**
+         * Grab as much of the buffer for reading as is available, up to
+         * max_elems_this_read
+         *
+         * elems span in buffer which you can then read, of at least 1
+         * element
+         * timeout number of microseconds to wait for any data
+         *
+         * Returns the same codes as grab_read
+         */
+        int grab_read_upto(
+            Span<const T>& elems,
+            const size_t max_elems_this_read,
+            const std::chrono::microseconds& timeout = std::chrono::microseconds(0)
+        ) {
+            return grab_read(elems, 1, max_elems_this_read, timeout);
+        };
+
+        /**
+         * Release a portion of the buffer for reading
+         *
+         * Returns 0 if successful.
+         * Returns EBUSY if there is no outstanding grab
+         */
+        int release_read() {
+            if(elems_grabbed_read == 0) {
+                return EBUSY;
+            }
+            const size_t index = read_index.load(std::memory_order_relaxed);
+            read_index.store(index + elems_grabbed_read, std::memory_order_release);
+            counters.add_read(elems_grabbed_read * sizeof(T));
+            record_hold(read_hold_start);
+            trace_event(TraceEventType::ReleaseRead, TRACE_NO_ID, index, elems_grabbed_read);
+            elems_grabbed_read = 0;
+            notify_waiters();
+            return 0;
+        };
+
+        /**
+         * Copy elems_this_write elements into the buffer
+         *
+         * Returns the same codes as grab_write
+         */
+        int write(
+            const T* elems,
+            const size_t elems_this_write
+        ) {
+            Span<T> span;
+            const int rc = grab_write(span, elems_this_write);
+            if(rc != 0) {
+                return rc;
+            }
+            memcpy(span.data, elems, elems_this_write * sizeof(T));
+            return release_write();
+        };
+
+        /**
+         * Copy elems_this_read elements out of the buffer
+         *
+         * Returns the same codes as grab_read
+         */
+        int read(
+            T* elems,
+            const size_t elems_this_read,
+            const std::chrono::microseconds& timeout = std::chrono::microseconds(0)
+        ) {
+            Span<const T> span;
+            const int rc = grab_read(span, elems_this_read, timeout);
+            if(rc != 0) {
+                return rc;
+            }
+            memcpy(elems, span.data, elems_this_read * sizeof(T));
+            return release_read();
+        };
+
+        size_t get_elems_avail_to_read() {
+            return write_index.load(std::memory_order_acquire)
+                - read_index.load(std::memory_order_relaxed);
+        };
+
+        size_t get_elems_avail_to_write() {
+            // never resized, so the size can be read relaxed
+            return num_elems.load(std::memory_order_relaxed) - (
+                write_index.load(std::memory_order_relaxed)
+                - read_index.load(std::memory_order_acquire)
+            );
+        };
+
+    private:
+        int grab_write(
+            Span<T>& elems,
+            const size_t min_elems_this_write,
+            const size_t max_elems_this_write
+        ) {
+            if(max_elems_this_write > max_elems_per_write) {
+                return EMSGSIZE;
+            }
+            if(elems_grabbed_write != 0) {
+                return EBUSY;
+            }
+            const size_t index = write_index.load(std::memory_order_relaxed);
+            const size_t size = num_elems.load(std::memory_order_relaxed);
+            // only touch the reader's cache line if the cached index limits
+            // this grab
+            if(index + max_elems_this_write - cached_read_index > size) {
+                cached_read_index = read_index.load(std::memory_order_acquire);
+                if(index + min_elems_this_write - cached_read_index > size) {
+                    counters.count_full();
+                    trace_event(TraceEventType::WriteFull, TRACE_NO_ID,
+                        index, min_elems_this_write);
+                    return ENOBUFS;
+                }
+            }
+            const size_t count = std::min(
+                max_elems_this_write, size - (index - cached_read_index));
+            elems_grabbed_write = count;
+            write_hold_start = get_hold_start();
+            trace_event(TraceEventType::GrabWrite, TRACE_NO_ID, index, count);
+            counters.record_fill(index + count - cached_read_index);
+            elems = Span<T>(elem_at(index), count);
+            return 0;
+        };
+
+        int grab_read(
+            Span<const T>& elems,
+            const size_t min_elems_this_read,
+            const size_t max_elems_this_read,
+            const std::chrono::microseconds& timeout
+        ) {
+            if(max_elems_this_read > max_elems_per_read) {
+                return EMSGSIZE;
+            }
+            if(elems_grabbed_read != 0) {
+                return EBUSY;
+            }
+            const size_t index = read_index.load(std::memory_order_relaxed);
+            // only touch the writer's cache line if the cached index limits
+            // this grab
+            auto has_data = [&]() {
+                cached_write_index = write_index.load(std::memory_order_acquire);
+                return index + min_elems_this_read <= cached_write_index;
+            };
+            if(index + max_elems_this_read > cached_write_index
+                    && !has_data() && !wait_until_ready(has_data, timeout)) {
+                counters.count_empty();
+                trace_event(TraceEventType::ReadEmpty, TRACE_NO_ID, index, min_elems_this_read);
+                return ENOMSG;
+            }
+            const size_t count = std::min(max_elems_this_read, cached_write_index - index);
+            elems_grabbed_read = count;
+            read_hold_start = get_hold_start();
+            trace_event(TraceEventType::GrabRead, TRACE_NO_ID, index, count);
+            elems = Span<const T>(elem_at(index), count);
+            return 0;
+        };
+
+        T* elem_at(const size_t index) {
+            // with FixedCapacity the mask folds to a constant
+            const size_t elem_mask = Policy::is_fixed() ? Policy::capacity() - 1 : mask;
+            return reinterpret_cast<T*>(buf_ptr.load(std::memory_order_relaxed))
+                + (index & elem_mask);
+        };
+
+        const size_t mask;
+
+        // Writer and reader state, each on its own cache line so the producer
+        // and consumer don't false-share. Each side also caches the other's
+        // index, and only reloads it when the cached value isn't enough.
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_index;
+        size_t elems_grabbed_write;
+        size_t cached_read_index;
+        int64_t write_hold_start;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_index;
+        size_t elems_grabbed_read;
+        size_t cached_write_index;
+        int64_t read_hold_start;
+};
+
+}; // namespace snake_charmer
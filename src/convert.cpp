@@ -0,0 +1,583 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <snake_charmer/convert.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define SNAKE_CHARMER_X86_KERNELS
+  #include <immintrin.h>
+#elif defined(__aarch64__)
+  #define SNAKE_CHARMER_NEON_KERNELS
+  #include <arm_neon.h>
+#endif
+
+
+namespace snake_charmer {
+
+namespace {
+// samples converted per block: the floats in between stay in L1 cache
+const size_t BLOCK_SAMPLES = 256;
+const size_t NUM_FORMATS = 4;
+
+// Convert n samples to floats, multiplying them by scale
+typedef void (*ToFloat)(const char* src, float* dst, size_t n, float scale, bool byteswap);
+// Convert n floats to samples, rounding and saturating
+typedef void (*FromFloat)(const float* src, char* dst, size_t n);
+
+struct Kernels {
+    const char* isa;
+    ToFloat to_float[NUM_FORMATS];
+    FromFloat from_float[NUM_FORMATS];
+};
+
+uint16_t swap16(const uint16_t value) {
+    return static_cast<uint16_t>((value >> 8) | (value << 8));
+}
+
+uint32_t swap32(const uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+// Clamp to [lo, hi], mapping NaN to lo as the SIMD max instructions do
+float clamp(const float value, const float lo, const float hi) {
+    const float above = value > lo ? value : lo;
+    return above < hi ? above : hi;
+}
+
+// Round to nearest even as the SIMD conversions do, for |value| < 2^22,
+// without a libm call
+float round_even(const float value) {
+    const float magic = 12582912.0f; // 1.5 * 2^23
+    return (value + magic) - magic;
+}
+
+// Round to the nearest bfloat16, ties to even
+uint16_t round_to_bf16(uint32_t bits) {
+    return static_cast<uint16_t>((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+}
+
+void int8_to_float(const char* src, float* dst, size_t n, float scale, bool) {
+    const int8_t* samples = reinterpret_cast<const int8_t*>(src);
+    for(size_t i = 0; i < n; i++) {
+        dst[i] = samples[i] * scale;
+    }
+}
+
+void int16_to_float(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    for(size_t i = 0; i < n; i++) {
+        uint16_t bits;
+        memcpy(&bits, src + 2 * i, 2);
+        dst[i] = static_cast<int16_t>(byteswap ? swap16(bits) : bits) * scale;
+    }
+}
+
+void float_to_float(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    for(size_t i = 0; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, src + 4 * i, 4);
+        if(byteswap) {
+            bits = swap32(bits);
+        }
+        float value;
+        memcpy(&value, &bits, 4);
+        dst[i] = value * scale;
+    }
+}
+
+void bf16_to_float(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    for(size_t i = 0; i < n; i++) {
+        uint16_t half;
+        memcpy(&half, src + 2 * i, 2);
+        const uint32_t bits = static_cast<uint32_t>(byteswap ? swap16(half) : half) << 16;
+        float value;
+        memcpy(&value, &bits, 4);
+        dst[i] = value * scale;
+    }
+}
+
+void float_to_int8(const float* src, char* dst, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        const int8_t sample = static_cast<int8_t>(round_even(clamp(src[i], -128.0f, 127.0f)));
+        memcpy(dst + i, &sample, 1);
+    }
+}
+
+void float_to_int16(const float* src, char* dst, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        const int16_t sample = static_cast<int16_t>(
+            round_even(clamp(src[i], -32768.0f, 32767.0f)));
+        memcpy(dst + 2 * i, &sample, 2);
+    }
+}
+
+void float_to_float(const float* src, char* dst, size_t n) {
+    memcpy(dst, src, 4 * n);
+}
+
+void float_to_bf16(const float* src, char* dst, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, src + i, 4);
+        const uint16_t half = round_to_bf16(bits);
+        memcpy(dst + 2 * i, &half, 2);
+    }
+}
+
+const Kernels SCALAR_KERNELS = {
+    "scalar",
+    {int8_to_float, int16_to_float, float_to_float, bf16_to_float},
+    {float_to_int8, float_to_int16, float_to_float, float_to_bf16}
+};
+
+#ifdef SNAKE_CHARMER_X86_KERNELS
+// The SIMD kernels convert whole vectors, and leave the tail to the scalar
+// ones. They're compiled for their instruction set whatever the build's
+// flags, and only chosen once the CPU is known to support it.
+
+__attribute__((target("avx2")))
+void int8_to_float_avx2(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m256 scales = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i,
+            _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(samples)), scales));
+    }
+    int8_to_float(src + i, dst + i, n - i, scale, byteswap);
+}
+
+__attribute__((target("avx2")))
+void int16_to_float_avx2(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256 scales = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+        if(byteswap) {
+            samples = _mm_shuffle_epi8(samples, swap);
+        }
+        _mm256_storeu_ps(dst + i,
+            _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(samples)), scales));
+    }
+    int16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+__attribute__((target("avx2")))
+void float_to_float_avx2(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m256i swap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256 scales = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+        if(byteswap) {
+            samples = _mm256_shuffle_epi8(samples, swap);
+        }
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_castsi256_ps(samples), scales));
+    }
+    float_to_float(src + 4 * i, dst + i, n - i, scale, byteswap);
+}
+
+__attribute__((target("avx2")))
+void bf16_to_float_avx2(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256 scales = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+        if(byteswap) {
+            samples = _mm_shuffle_epi8(samples, swap);
+        }
+        const __m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(samples), 16);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_castsi256_ps(bits), scales));
+    }
+    bf16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+__attribute__((target("avx2")))
+__m256i round_clamped_avx2(const float* src, const __m256 lo, const __m256 hi) {
+    // max before min, so NaN becomes lo
+    return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src), lo), hi));
+}
+
+__attribute__((target("avx2")))
+void float_to_int8_avx2(const float* src, char* dst, size_t n) {
+    const __m256 lo = _mm256_set1_ps(-128.0f);
+    const __m256 hi = _mm256_set1_ps(127.0f);
+    // the packs interleave the 128 bit lanes, so put the 32 bit groups back
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        const __m256i low = _mm256_packs_epi32(
+            round_clamped_avx2(src + i, lo, hi), round_clamped_avx2(src + i + 8, lo, hi));
+        const __m256i high = _mm256_packs_epi32(
+            round_clamped_avx2(src + i + 16, lo, hi), round_clamped_avx2(src + i + 24, lo, hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+            _mm256_permutevar8x32_epi32(_mm256_packs_epi16(low, high), order));
+    }
+    float_to_int8(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void float_to_int16_avx2(const float* src, char* dst, size_t n) {
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m256i samples = _mm256_packs_epi32(
+            round_clamped_avx2(src + i, lo, hi), round_clamped_avx2(src + i + 8, lo, hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i),
+            _mm256_permute4x64_epi64(samples, 0xD8));
+    }
+    float_to_int16(src + i, dst + 2 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+void float_to_bf16_avx2(const float* src, char* dst, size_t n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7FFF);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+        const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+        bits = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(bias, odd)), 16);
+        const __m256i halves = _mm256_permute4x64_epi64(_mm256_packus_epi32(bits, bits), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm256_castsi256_si128(halves));
+    }
+    float_to_bf16(src + i, dst + 2 * i, n - i);
+}
+
+const Kernels AVX2_KERNELS = {
+    "avx2",
+    {int8_to_float_avx2, int16_to_float_avx2, float_to_float_avx2, bf16_to_float_avx2},
+    {float_to_int8_avx2, float_to_int16_avx2, float_to_float, float_to_bf16_avx2}
+};
+
+#define SNAKE_CHARMER_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+SNAKE_CHARMER_AVX512
+void int8_to_float_avx512(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m512 scales = _mm512_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm512_storeu_ps(dst + i,
+            _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(samples)), scales));
+    }
+    int8_to_float(src + i, dst + i, n - i, scale, byteswap);
+}
+
+SNAKE_CHARMER_AVX512
+void int16_to_float_avx512(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m256i swap = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m512 scales = _mm512_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+        if(byteswap) {
+            samples = _mm256_shuffle_epi8(samples, swap);
+        }
+        _mm512_storeu_ps(dst + i,
+            _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(samples)), scales));
+    }
+    int16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+SNAKE_CHARMER_AVX512
+void float_to_float_avx512(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m512i swap = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    const __m512 scales = _mm512_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512i samples = _mm512_loadu_si512(src + 4 * i);
+        if(byteswap) {
+            samples = _mm512_shuffle_epi8(samples, swap);
+        }
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_castsi512_ps(samples), scales));
+    }
+    float_to_float(src + 4 * i, dst + i, n - i, scale, byteswap);
+}
+
+SNAKE_CHARMER_AVX512
+void bf16_to_float_avx512(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    const __m256i swap = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m512 scales = _mm512_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+        if(byteswap) {
+            samples = _mm256_shuffle_epi8(samples, swap);
+        }
+        const __m512i bits = _mm512_slli_epi32(_mm512_cvtepu16_epi32(samples), 16);
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_castsi512_ps(bits), scales));
+    }
+    bf16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+SNAKE_CHARMER_AVX512
+__m512i round_clamped_avx512(const float* src, const __m512 lo, const __m512 hi) {
+    return _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(src), lo), hi));
+}
+
+SNAKE_CHARMER_AVX512
+void float_to_int8_avx512(const float* src, char* dst, size_t n) {
+    const __m512 lo = _mm512_set1_ps(-128.0f);
+    const __m512 hi = _mm512_set1_ps(127.0f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+            _mm512_cvtsepi32_epi8(round_clamped_avx512(src + i, lo, hi)));
+    }
+    float_to_int8(src + i, dst + i, n - i);
+}
+
+SNAKE_CHARMER_AVX512
+void float_to_int16_avx512(const float* src, char* dst, size_t n) {
+    const __m512 lo = _mm512_set1_ps(-32768.0f);
+    const __m512 hi = _mm512_set1_ps(32767.0f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i),
+            _mm512_cvtsepi32_epi16(round_clamped_avx512(src + i, lo, hi)));
+    }
+    float_to_int16(src + i, dst + 2 * i, n - i);
+}
+
+SNAKE_CHARMER_AVX512
+void float_to_bf16_avx512(const float* src, char* dst, size_t n) {
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i bias = _mm512_set1_epi32(0x7FFF);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512i bits = _mm512_castps_si512(_mm512_loadu_ps(src + i));
+        const __m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), one);
+        bits = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(bias, odd)), 16);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i), _mm512_cvtepi32_epi16(bits));
+    }
+    float_to_bf16(src + i, dst + 2 * i, n - i);
+}
+
+#undef SNAKE_CHARMER_AVX512
+
+const Kernels AVX512_KERNELS = {
+    "avx512",
+    {int8_to_float_avx512, int16_to_float_avx512, float_to_float_avx512, bf16_to_float_avx512},
+    {float_to_int8_avx512, float_to_int16_avx512, float_to_float, float_to_bf16_avx512}
+};
+
+bool cpu_supports(const Kernels& kernels) {
+    if(&kernels == &AVX512_KERNELS) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    if(&kernels == &AVX2_KERNELS) {
+        return __builtin_cpu_supports("avx2");
+    }
+    return true;
+}
+
+// widest first
+const Kernels* const ALL_KERNELS[] = {&AVX512_KERNELS, &AVX2_KERNELS, &SCALAR_KERNELS};
+
+#elif defined(SNAKE_CHARMER_NEON_KERNELS)
+// NEON is part of the aarch64 baseline, so needs no detection
+
+void int8_to_float_neon(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const int16x8_t samples = vmovl_s8(vld1_s8(reinterpret_cast<const int8_t*>(src + i)));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(samples)), scale));
+    }
+    int8_to_float(src + i, dst + i, n - i, scale, byteswap);
+}
+
+void int16_to_float_neon(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(src + 2 * i));
+        if(byteswap) {
+            bytes = vrev16q_u8(bytes);
+        }
+        const int16x8_t samples = vreinterpretq_s16_u8(bytes);
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(samples)), scale));
+    }
+    int16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+void float_to_float_neon(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(src + 4 * i));
+        if(byteswap) {
+            bytes = vrev32q_u8(bytes);
+        }
+        vst1q_f32(dst + i, vmulq_n_f32(vreinterpretq_f32_u8(bytes), scale));
+    }
+    float_to_float(src + 4 * i, dst + i, n - i, scale, byteswap);
+}
+
+void bf16_to_float_neon(const char* src, float* dst, size_t n, float scale, bool byteswap) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(src + 2 * i));
+        if(byteswap) {
+            bytes = vrev16q_u8(bytes);
+        }
+        const uint16x8_t halves = vreinterpretq_u16_u8(bytes);
+        vst1q_f32(dst + i, vmulq_n_f32(
+            vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(halves), 16)), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(
+            vreinterpretq_f32_u32(vshll_high_n_u16(halves, 16)), scale));
+    }
+    bf16_to_float(src + 2 * i, dst + i, n - i, scale, byteswap);
+}
+
+int32x4_t round_clamped_neon(const float* src, const float32x4_t lo, const float32x4_t hi) {
+    // maxnm rather than max, so NaN becomes lo as in the scalar kernels
+    return vcvtnq_s32_f32(vminnmq_f32(vmaxnmq_f32(vld1q_f32(src), lo), hi));
+}
+
+void float_to_int8_neon(const float* src, char* dst, size_t n) {
+    const float32x4_t lo = vdupq_n_f32(-128.0f);
+    const float32x4_t hi = vdupq_n_f32(127.0f);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const int16x8_t samples = vcombine_s16(
+            vqmovn_s32(round_clamped_neon(src + i, lo, hi)),
+            vqmovn_s32(round_clamped_neon(src + i + 4, lo, hi)));
+        vst1_s8(reinterpret_cast<int8_t*>(dst + i), vqmovn_s16(samples));
+    }
+    float_to_int8(src + i, dst + i, n - i);
+}
+
+void float_to_int16_neon(const float* src, char* dst, size_t n) {
+    const float32x4_t lo = vdupq_n_f32(-32768.0f);
+    const float32x4_t hi = vdupq_n_f32(32767.0f);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const int16x8_t samples = vcombine_s16(
+            vqmovn_s32(round_clamped_neon(src + i, lo, hi)),
+            vqmovn_s32(round_clamped_neon(src + i + 4, lo, hi)));
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + 2 * i), vreinterpretq_u8_s16(samples));
+    }
+    float_to_int16(src + i, dst + 2 * i, n - i);
+}
+
+void float_to_bf16_neon(const float* src, char* dst, size_t n) {
+    const uint32x4_t one = vdupq_n_u32(1);
+    const uint32x4_t bias = vdupq_n_u32(0x7FFF);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const uint32x4_t bits = vreinterpretq_u32_f32(vld1q_f32(src + i));
+        const uint32x4_t odd = vandq_u32(vshrq_n_u32(bits, 16), one);
+        const uint16x4_t halves = vshrn_n_u32(vaddq_u32(bits, vaddq_u32(bias, odd)), 16);
+        vst1_u8(reinterpret_cast<uint8_t*>(dst + 2 * i), vreinterpret_u8_u16(halves));
+    }
+    float_to_bf16(src + i, dst + 2 * i, n - i);
+}
+
+const Kernels NEON_KERNELS = {
+    "neon",
+    {int8_to_float_neon, int16_to_float_neon, float_to_float_neon, bf16_to_float_neon},
+    {float_to_int8_neon, float_to_int16_neon, float_to_float, float_to_bf16_neon}
+};
+
+bool cpu_supports(const Kernels&) {
+    return true;
+}
+
+const Kernels* const ALL_KERNELS[] = {&NEON_KERNELS, &SCALAR_KERNELS};
+
+#else
+
+bool cpu_supports(const Kernels&) {
+    return true;
+}
+
+const Kernels* const ALL_KERNELS[] = {&SCALAR_KERNELS};
+#endif
+
+/**
+ * Get the kernels in use, initially the widest this CPU supports
+ */
+std::atomic<const Kernels*>& get_kernels() {
+    static std::atomic<const Kernels*> kernels(*std::find_if(
+        std::begin(ALL_KERNELS), std::end(ALL_KERNELS),
+        [](const Kernels* candidate) { return cpu_supports(*candidate); }));
+    return kernels;
+}
+}
+
+size_t get_sample_size(const SampleFormat format) {
+    switch(format) {
+        case SampleFormat::Int8:
+            return 1;
+        case SampleFormat::Int16:
+        case SampleFormat::BFloat16:
+            return 2;
+        case SampleFormat::Float32:
+            return 4;
+    }
+    return 0;
+}
+
+int convert_samples(
+        char* dst,
+        const char* src,
+        const size_t num_samples,
+        const SampleConversion& conversion
+) {
+    const size_t from_size = get_sample_size(conversion.from);
+    const size_t to_size = get_sample_size(conversion.to);
+    if(from_size == 0 || to_size == 0) {
+        return EINVAL;
+    }
+    if(conversion.from == conversion.to && conversion.scale == 1.0f
+            && (!conversion.byteswap || from_size == 1)) {
+        memcpy(dst, src, num_samples * from_size);
+        return 0;
+    }
+    const Kernels* kernels = get_kernels().load(std::memory_order_relaxed);
+    const ToFloat to_float = kernels->to_float[conversion.from];
+    const FromFloat from_float = kernels->from_float[conversion.to];
+    alignas(64) float block[BLOCK_SAMPLES];
+    for(size_t done = 0; done < num_samples; done += BLOCK_SAMPLES) {
+        const size_t samples = std::min(BLOCK_SAMPLES, num_samples - done);
+        to_float(src + done * from_size, block, samples, conversion.scale, conversion.byteswap);
+        from_float(block, dst + done * to_size, samples);
+    }
+    return 0;
+}
+
+std::string get_conversion_isa() {
+    return get_kernels().load()->isa;
+}
+
+int set_conversion_isa(const std::string& isa) {
+    const char* names[] = {"avx512", "avx2", "neon", "scalar"};
+    if(std::find(std::begin(names), std::end(names), isa) == std::end(names)) {
+        return EINVAL;
+    }
+    for(const Kernels* kernels : ALL_KERNELS) {
+        if(isa == kernels->isa) {
+            if(!cpu_supports(*kernels)) {
+                return ENOTSUP;
+            }
+            get_kernels().store(kernels);
+            return 0;
+        }
+    }
+    return ENOTSUP; // not built for this architecture
+}
+
+}; // namespace snake_charmer
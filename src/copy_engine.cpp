@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <snake_charmer/copy_engine.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define SNAKE_CHARMER_STREAMING_STORES
+  #include <emmintrin.h>
+#endif
+
+
+namespace snake_charmer {
+
+namespace {
+const size_t CACHE_LINE_BYTES = 64;
+// Bytes copied between prefetches, and how far ahead of the copy they
+// start: a page, so each chunk is copied while the next one is fetched,
+// rather than prefetching lines about to be copied anyway. Tuned with
+// bench_copy_engine: smaller chunks lost to plain memcpy, as did the
+// non-temporal prefetch hint.
+const size_t PREFETCH_CHUNK = 4096;
+const size_t PREFETCH_DISTANCE = PREFETCH_CHUNK;
+}
+
+void copy_streaming(char* dst, const char* src, const size_t bytes) {
+#ifdef SNAKE_CHARMER_STREAMING_STORES
+    // the stores must be aligned, so copy up to the first aligned line as usual
+    const size_t head = std::min(
+        bytes, (CACHE_LINE_BYTES - reinterpret_cast<uintptr_t>(dst) % CACHE_LINE_BYTES)
+            % CACHE_LINE_BYTES);
+    memcpy(dst, src, head);
+    size_t done = head;
+    for(; done + CACHE_LINE_BYTES <= bytes; done += CACHE_LINE_BYTES) {
+        const __m128i* from = reinterpret_cast<const __m128i*>(src + done);
+        __m128i* to = reinterpret_cast<__m128i*>(dst + done);
+        // whole lines, so the write-combining buffers flush without reads
+        const __m128i a = _mm_loadu_si128(from);
+        const __m128i b = _mm_loadu_si128(from + 1);
+        const __m128i c = _mm_loadu_si128(from + 2);
+        const __m128i d = _mm_loadu_si128(from + 3);
+        _mm_stream_si128(to, a);
+        _mm_stream_si128(to + 1, b);
+        _mm_stream_si128(to + 2, c);
+        _mm_stream_si128(to + 3, d);
+    }
+    memcpy(dst + done, src + done, bytes - done);
+    // streaming stores are weakly ordered, even against a later release
+    _mm_sfence();
+#else
+    memcpy(dst, src, bytes);
+#endif
+}
+
+void copy_prefetching(char* dst, const char* src, const size_t bytes) {
+    for(size_t done = 0; done < bytes; done += PREFETCH_CHUNK) {
+        const size_t ahead = done + PREFETCH_DISTANCE;
+        for(size_t line = ahead; line < ahead + PREFETCH_CHUNK && line < bytes;
+                line += CACHE_LINE_BYTES) {
+#if defined(__GNUC__)
+            __builtin_prefetch(src + line, 0, 3);
+#elif defined(_M_X64)
+            _mm_prefetch(src + line, _MM_HINT_T0);
+#endif
+        }
+        memcpy(dst + done, src + done, std::min(PREFETCH_CHUNK, bytes - done));
+    }
+}
+
+}; // namespace snake_charmer
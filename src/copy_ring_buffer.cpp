@@ -1,21 +1,123 @@
+#include <algorithm>
 #include <spdlog/spdlog.h>
+#include <snake_charmer/copy_engine.h>
 #include <snake_charmer/copy_ring_buffer.h>
 
 
 namespace snake_charmer {
 
 const std::chrono::microseconds CopyRingBuffer::DEFAULT_TIMEOUT(0);
+// Where bench_copy_engine has streaming overtake memcpy even when the reader
+// drains each block straight away. Below it, a block the reader gets to
+// promptly is still cached, and streaming would send it to memory and back.
+const size_t CopyRingBuffer::DEFAULT_COPY_THRESHOLD = 1 << 20;
 
 CopyRingBuffer::CopyRingBuffer(
         const size_t elem_size,
         const size_t max_elems_per_write,
         const size_t max_elems_per_read,
         const size_t slack,
-        std::string loglevel
+        std::string loglevel,
+        const CopyMode mode,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy,
+        const OverflowPolicy overflow
 ) :
-        RingBuffer(elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel),
+        RingBuffer(
+            elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel,
+            page_size, wait_strategy
+        ),
+        mode(mode),
+        overflow(overflow),
         write_index(0),
-        read_index(0) {
+        write_claim(0),
+        read_index(0),
+        pending_skip(0),
+        copy_threshold(DEFAULT_COPY_THRESHOLD) {
+}
+
+size_t CopyRingBuffer::get_elems_avail_to_read() {
+    // read_index first: write_index only grows, so it can't be behind it
+    const size_t index = read_index.load(std::memory_order_acquire);
+    return std::min(
+        std::min(max_elems_per_read, num_elems.load(std::memory_order_acquire)),
+        write_index.load(std::memory_order_acquire) - index
+    );
+}
+
+size_t CopyRingBuffer::get_elems_avail_to_write() {
+    if(overflow == OverflowPolicy::Overwrite) {
+        return max_elems_per_write;
+    }
+    const size_t index = write_index.load(std::memory_order_acquire);
+    const size_t read = read_index.load(std::memory_order_acquire);
+    // a read may have overtaken index since it was loaded
+    const size_t used = index > read ? index - read : 0;
+    return std::min(max_elems_per_write, num_elems.load(std::memory_order_acquire) - used);
+}
+
+void CopyRingBuffer::set_copy_threshold(const size_t bytes) {
+    copy_threshold.store(bytes, std::memory_order_relaxed);
+}
+
+size_t CopyRingBuffer::get_copy_threshold() {
+    return copy_threshold.load(std::memory_order_relaxed);
+}
+
+CopyMode CopyRingBuffer::get_mode() {
+    return mode;
+}
+
+OverflowPolicy CopyRingBuffer::get_overflow_policy() {
+    return overflow;
+}
+
+int CopyRingBuffer::resize(const size_t slack) {
+    if(mode == CopyMode::SPSC) {
+        return ENOTSUP;
+    }
+    std::unique_lock<std::mutex> lock = lock_buffer();
+    // writes drop overwritten elements from read_index, so these are unread
+    const int rc = remap(slack, read_index, write_index);
+    if(rc == 0) {
+        notify_waiters_locked();
+    }
+    return rc;
+}
+
+bool CopyRingBuffer::check_conversion(
+        const SampleConversion& conversion,
+        const SampleFormat buffer_format
+) {
+    if(get_sample_size(conversion.from) == 0 || get_sample_size(conversion.to) == 0
+            || elem_size % get_sample_size(buffer_format) != 0) {
+        logger->error("Can't convert {} byte elements from format {} to {}",
+            elem_size, static_cast<int>(conversion.from), static_cast<int>(conversion.to));
+        return false;
+    }
+    return true;
+}
+
+void CopyRingBuffer::copy_elems(
+        char* dst,
+        const char* src,
+        const size_t elems,
+        const SampleConversion* conversion,
+        const bool into_buffer
+) {
+    if(conversion == nullptr) {
+        const size_t bytes = elem_size * elems;
+        if(bytes < copy_threshold.load(std::memory_order_relaxed)) {
+            memcpy(dst, src, bytes);
+        } else if(into_buffer) {
+            copy_streaming(dst, src, bytes);
+        } else {
+            copy_prefetching(dst, src, bytes);
+        }
+        return;
+    }
+    const size_t sample_size = get_sample_size(into_buffer ? conversion->to : conversion->from);
+    convert_samples(dst, src, elems * (elem_size / sample_size), *conversion);
 }
 
 int CopyRingBuffer::write(
@@ -24,33 +126,127 @@ int CopyRingBuffer::write(
         const std::chrono::microseconds& timeout
     ) {
     if(elems_this_write > max_elems_per_write) {
-        logger->error("requested too many elems this write: {} vs {}",
+        SNAKE_CHARMER_HOT_LOG(logger, error,
+                "requested too many elems this write: {} vs {}",
                 elems_this_write, max_elems_per_write);
         return EMSGSIZE;
     }
-    std::unique_lock<std::mutex> lock(buf_mutex);
-    auto timeout_time  = std::chrono::system_clock::now() + timeout;
-    while(write_index + elems_this_write - read_index > num_elems) {
-        std::cv_status status = buf_cv.wait_until(lock, timeout_time);
-        if (status == std::cv_status::timeout) {
-            return ENOBUFS;
+    if(mode == CopyMode::SPSC) {
+        return write_spsc(elem_ptr, elems_this_write, nullptr, timeout);
+    }
+    return write_locked(elem_ptr, elems_this_write, nullptr, timeout);
+}
+
+int CopyRingBuffer::write(
+        const char* elem_ptr,
+        const size_t elems_this_write,
+        const SampleConversion& conversion,
+        const std::chrono::microseconds& timeout
+    ) {
+    if(elems_this_write > max_elems_per_write) {
+        SNAKE_CHARMER_HOT_LOG(logger, error,
+                "requested too many elems this write: {} vs {}",
+                elems_this_write, max_elems_per_write);
+        return EMSGSIZE;
+    }
+    if(!check_conversion(conversion, conversion.to)) {
+        return EINVAL;
+    }
+    if(mode == CopyMode::SPSC) {
+        return write_spsc(elem_ptr, elems_this_write, &conversion, timeout);
+    }
+    return write_locked(elem_ptr, elems_this_write, &conversion, timeout);
+}
+
+int CopyRingBuffer::write_locked(
+        const char* elem_ptr,
+        const size_t elems_this_write,
+        const SampleConversion* conversion,
+        const std::chrono::microseconds& timeout
+    ) {
+    std::unique_lock<std::mutex> lock = lock_buffer();
+    // resizes hold buf_mutex too, but may happen while waiting
+    auto has_space = [&]() {
+        return write_index + elems_this_write - read_index
+            <= num_elems.load(std::memory_order_relaxed);
+    };
+    if(overflow == OverflowPolicy::Overwrite) {
+        if(!has_space()) {
+            // the readers copy out under buf_mutex too, so the oldest
+            // elements can simply be dropped from under them
+            const size_t overrun = write_index + elems_this_write - read_index
+                - num_elems.load(std::memory_order_relaxed);
+            read_index += overrun;
+            pending_skip += overrun;
+            counters.add_overwritten(overrun);
         }
+    } else if(!wait_until_ready(lock, has_space, timeout)) {
+        counters.count_full();
+        trace_event(TraceEventType::WriteFull, TRACE_NO_ID, write_index, elems_this_write);
+        return ENOBUFS;
     }
-    logger->debug("writing elems {} to {} == byte offsets {} to {} == indices {} to {}",
+    SNAKE_CHARMER_HOT_LOG(logger, debug,
+            "writing elems {} to {} == byte offsets {} to {} == indices {} to {}",
             write_index,
             write_index+elems_this_write,
-            write_index*elem_size % buf_size,
-            (write_index+elems_this_write)*elem_size % buf_size,
+            write_index*elem_size % buf_size.load(std::memory_order_relaxed),
+            (write_index+elems_this_write)*elem_size % buf_size.load(std::memory_order_relaxed),
             write_index*elem_size,
             (write_index+elems_this_write)*elem_size
     );
-    memcpy(
-        buf_ptr + (write_index*elem_size) % buf_size,
+    copy_elems(
+        get_elem_ptr(write_index),
         elem_ptr,
-        elem_size * elems_this_write
+        elems_this_write,
+        conversion,
+        true
     );
+    trace_event(TraceEventType::ReleaseWrite, TRACE_NO_ID, write_index, elems_this_write);
     write_index += elems_this_write;
-    buf_cv.notify_all();
+    counters.add_written(elem_size * elems_this_write);
+    counters.record_fill(write_index - read_index);
+    notify_waiters_locked();
+    return 0;
+}
+
+int CopyRingBuffer::write_spsc(
+        const char* elem_ptr,
+        const size_t elems_this_write,
+        const SampleConversion* conversion,
+        const std::chrono::microseconds& timeout
+    ) {
+    // only this thread advances write_index, so it can be read relaxed
+    const size_t index = write_index.load(std::memory_order_relaxed);
+    // SPSC buffers can't be resized
+    const size_t size = num_elems.load(std::memory_order_relaxed);
+    auto has_space = [&]() {
+        return index + elems_this_write
+            - read_index.load(std::memory_order_acquire) <= size;
+    };
+    if(overflow == OverflowPolicy::Overwrite) {
+        // Claim the space before copying into it, so a reader copying out
+        // the elements being overwritten can tell. The fence keeps the copy
+        // from becoming visible before the claim.
+        write_claim.store(index + elems_this_write, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    } else if(!has_space() && !wait_until_ready(has_space, timeout)) {
+        counters.count_full();
+        trace_event(TraceEventType::WriteFull, TRACE_NO_ID, index, elems_this_write);
+        return ENOBUFS;
+    }
+    copy_elems(
+        get_elem_ptr(index),
+        elem_ptr,
+        elems_this_write,
+        conversion,
+        true
+    );
+    write_index.store(index + elems_this_write, std::memory_order_release);
+    trace_event(TraceEventType::ReleaseWrite, TRACE_NO_ID, index, elems_this_write);
+    counters.add_written(elem_size * elems_this_write);
+    counters.record_fill(std::min(
+        size, index + elems_this_write - read_index.load(std::memory_order_relaxed)));
+    notify_waiters();
     return 0;
 }
 
@@ -60,39 +256,155 @@ int CopyRingBuffer::read(
         const std::chrono::microseconds& timeout,
         const int64_t advance_size
     ) {
+    size_t elems_skipped;
+    return read(elem_ptr, elems_this_read, elems_skipped, timeout, advance_size);
+}
+
+int CopyRingBuffer::read(
+        char* elem_ptr,
+        const size_t elems_this_read,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout,
+        const int64_t advance_size
+    ) {
+    elems_skipped = 0;
     if(elems_this_read> max_elems_per_read) {
-        logger->error("requested too many elems this read: {} vs {}",
+        SNAKE_CHARMER_HOT_LOG(logger, error, "requested too many elems this read: {} vs {}",
                 elems_this_read, max_elems_per_read);
         return EMSGSIZE;
     }
-    std::unique_lock<std::mutex> lock(buf_mutex);
-    auto timeout_time  = std::chrono::system_clock::now() + timeout;
-    while(read_index + elems_this_read > write_index) {
-        std::cv_status status = buf_cv.wait_until(lock, timeout_time);
-        if (status == std::cv_status::timeout) {
-            logger->debug("timeout");
-            return ENOMSG;
-        }
+    if(mode == CopyMode::SPSC) {
+        return read_spsc(elem_ptr, elems_this_read, nullptr, elems_skipped, timeout, advance_size);
+    }
+    return read_locked(elem_ptr, elems_this_read, nullptr, elems_skipped, timeout, advance_size);
+}
+
+int CopyRingBuffer::read(
+        char* elem_ptr,
+        const size_t elems_this_read,
+        const SampleConversion& conversion,
+        const std::chrono::microseconds& timeout
+    ) {
+    if(elems_this_read > max_elems_per_read) {
+        SNAKE_CHARMER_HOT_LOG(logger, error, "requested too many elems this read: {} vs {}",
+                elems_this_read, max_elems_per_read);
+        return EMSGSIZE;
     }
-    logger->debug("reading elems {} to {} == byte offsets {} to {} == indices {} to {}",
+    if(!check_conversion(conversion, conversion.from)) {
+        return EINVAL;
+    }
+    size_t elems_skipped;
+    if(mode == CopyMode::SPSC) {
+        return read_spsc(elem_ptr, elems_this_read, &conversion, elems_skipped, timeout, -1);
+    }
+    return read_locked(elem_ptr, elems_this_read, &conversion, elems_skipped, timeout, -1);
+}
+
+int CopyRingBuffer::read_locked(
+        char* elem_ptr,
+        const size_t elems_this_read,
+        const SampleConversion* conversion,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout,
+        const int64_t advance_size
+    ) {
+    std::unique_lock<std::mutex> lock = lock_buffer();
+    auto has_data = [&]() {
+        return read_index + elems_this_read <= write_index;
+    };
+    if(!wait_until_ready(lock, has_data, timeout)) {
+        SNAKE_CHARMER_HOT_LOG(logger, debug, "timeout");
+        counters.count_empty();
+        trace_event(TraceEventType::ReadEmpty, TRACE_NO_ID, read_index, elems_this_read);
+        return ENOMSG;
+    }
+    SNAKE_CHARMER_HOT_LOG(logger, debug,
+            "reading elems {} to {} == byte offsets {} to {} == indices {} to {}",
             read_index,
             read_index+elems_this_read,
-            read_index*elem_size % buf_size,
-            (read_index+elems_this_read)*elem_size % buf_size,
+            read_index*elem_size % buf_size.load(std::memory_order_relaxed),
+            (read_index+elems_this_read)*elem_size % buf_size.load(std::memory_order_relaxed),
             read_index*elem_size,
             (read_index+elems_this_read)*elem_size
     );
-    memcpy(
+    copy_elems(
         elem_ptr,
-        buf_ptr + (read_index*elem_size) % buf_size,
-        elem_size * elems_this_read
+        get_elem_ptr(read_index),
+        elems_this_read,
+        conversion,
+        false
     );
+    trace_event(TraceEventType::ReleaseRead, TRACE_NO_ID, read_index, elems_this_read);
+    elems_skipped = pending_skip;
+    pending_skip = 0;
     if(advance_size < 0) {
         read_index += elems_this_read;
     } else {
         read_index += advance_size;
     }
-    buf_cv.notify_all();
+    counters.add_read(elem_size * elems_this_read);
+    notify_waiters_locked();
+    return 0;
+}
+
+int CopyRingBuffer::read_spsc(
+        char* elem_ptr,
+        const size_t elems_this_read,
+        const SampleConversion* conversion,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout,
+        const int64_t advance_size
+    ) {
+    // only this thread advances read_index, so it can be read relaxed
+    size_t index = read_index.load(std::memory_order_relaxed);
+    // SPSC buffers can't be resized
+    const size_t size = num_elems.load(std::memory_order_relaxed);
+    auto has_data = [&]() {
+        return index + elems_this_read
+            <= write_index.load(std::memory_order_acquire);
+    };
+    while(true) {
+        if(!has_data() && !wait_until_ready(has_data, timeout)) {
+            // any skip is left to be found again by the next read
+            counters.count_empty();
+            trace_event(TraceEventType::ReadEmpty, TRACE_NO_ID, index, elems_this_read);
+            return ENOMSG;
+        }
+        if(overflow == OverflowPolicy::Overwrite) {
+            const size_t written = write_index.load(std::memory_order_acquire);
+            if(written - index > size) {
+                index = written - size;
+            }
+        }
+        copy_elems(
+            elem_ptr,
+            get_elem_ptr(index),
+            elems_this_read,
+            conversion,
+            false
+        );
+        if(overflow == OverflowPolicy::Block) {
+            break;
+        }
+        // Seqlock-style validation: if the writer had claimed space that
+        // wraps onto what was just copied, the copy may be torn, so skip
+        // past the claim and copy again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const size_t claimed = write_claim.load(std::memory_order_relaxed);
+        if(claimed <= index + size) {
+            break;
+        }
+        index = claimed - size;
+    }
+    elems_skipped = index - read_index.load(std::memory_order_relaxed);
+    if(elems_skipped > 0) {
+        counters.add_overwritten(elems_skipped);
+    }
+    const size_t advance = advance_size < 0 ? elems_this_read : advance_size;
+    read_index.store(index + advance, std::memory_order_release);
+    trace_event(TraceEventType::ReleaseRead, TRACE_NO_ID, index, elems_this_read);
+    counters.add_read(elem_size * elems_this_read);
+    notify_waiters();
     return 0;
 }
 
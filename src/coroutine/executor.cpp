@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/coroutine.h>
+
+
+namespace snake_charmer {
+
+namespace {
+// epoll events handled per epoll_wait()
+const int MAX_EVENTS = 64;
+}
+
+Executor::Executor(std::string loglevel) :
+        epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+        stop_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    logger = get_logger("Executor", loglevel);
+    if(epoll_fd < 0 || stop_fd < 0) {
+        const int rc = errno;
+        if(epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+        if(stop_fd >= 0) {
+            close(stop_fd);
+        }
+        throw std::runtime_error(fmt::format("Can't create executor: {}", strerror(rc)));
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+}
+
+Executor::~Executor() {
+    for(std::coroutine_handle<Task::promise_type> handle : tasks) {
+        handle.destroy();
+    }
+    close(stop_fd);
+    close(epoll_fd);
+}
+
+void Executor::spawn(Task task) {
+    std::coroutine_handle<Task::promise_type> handle = std::exchange(task.handle, nullptr);
+    handle.promise().executor = this;
+    tasks.push_back(handle);
+    ready.push_back(handle);
+}
+
+int Executor::run() {
+    struct epoll_event events[MAX_EVENTS];
+    while(!tasks.empty()) {
+        while(!ready.empty()) {
+            std::coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            resume(handle);
+            if(exception) {
+                std::rethrow_exception(std::exchange(exception, nullptr));
+            }
+        }
+        if(tasks.empty()) {
+            break;
+        }
+        const int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if(num_events < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            const int rc = errno;
+            logger->error("epoll_wait failed: {}", strerror(rc));
+            return rc;
+        }
+        bool stopped = false;
+        for(int n = 0; n < num_events; n++) {
+            const int fd = events[n].data.fd;
+            if(fd == stop_fd) {
+                eventfd_t value;
+                eventfd_read(stop_fd, &value);
+                stopped = true;
+                continue;
+            }
+            wake(fd);
+        }
+        if(stopped) {
+            return ECANCELED;
+        }
+    }
+    return 0;
+}
+
+void Executor::stop() {
+    eventfd_write(stop_fd, 1);
+}
+
+size_t Executor::get_num_tasks() {
+    return tasks.size();
+}
+
+void Executor::wait(RingBuffer& buffer, const bool readable, BufferWaiter& waiter) {
+    int fd = readable ? buffer.get_read_fd() : buffer.get_write_fd();
+    if(fd < 0) {
+        const int rc = buffer.enable_event_fds();
+        if(rc != 0 && rc != EALREADY) {
+            // the awaitables only take buffers that support them
+            throw std::runtime_error(fmt::format(
+                "Can't wait on a buffer without event fds: {}", strerror(rc)));
+        }
+        fd = readable ? buffer.get_read_fd() : buffer.get_write_fd();
+    }
+    auto found = waiting.find(fd);
+    if(found == waiting.end()) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            throw std::runtime_error(fmt::format(
+                "Can't wait on fd {}: {}", fd, strerror(errno)));
+        }
+        found = waiting.emplace(fd, FdWaiters{&buffer, readable, {}}).first;
+    }
+    found->second.waiters.push_back(&waiter);
+}
+
+void Executor::schedule(std::coroutine_handle<> handle) {
+    ready.push_back(handle);
+}
+
+void Executor::resume(std::coroutine_handle<> handle) {
+    handle.resume();
+    if(!handle.done()) {
+        return;
+    }
+    auto task = std::coroutine_handle<Task::promise_type>::from_address(handle.address());
+    if(task.promise().exception && !exception) {
+        exception = task.promise().exception;
+    }
+    tasks.erase(std::find(tasks.begin(), tasks.end(), task));
+    task.destroy();
+}
+
+void Executor::wake(const int fd) {
+    auto found = waiting.find(fd);
+    if(found == waiting.end()) {
+        return;
+    }
+    FdWaiters& fd_waiters = found->second;
+    // Clear the fd before retrying: anything released after the retries
+    // signals it again
+    if(fd_waiters.readable) {
+        fd_waiters.buffer->clear_read_fd();
+    } else {
+        fd_waiters.buffer->clear_write_fd();
+    }
+    std::vector<BufferWaiter*>& waiters = fd_waiters.waiters;
+    auto still_waiting = std::stable_partition(waiters.begin(), waiters.end(),
+        [](BufferWaiter* waiter) { return !waiter->try_complete(); });
+    for(auto waiter = still_waiting; waiter != waiters.end(); waiter++) {
+        ready.push_back((*waiter)->handle);
+    }
+    waiters.erase(still_waiting, waiters.end());
+    if(waiters.empty()) {
+        // a resumed task that has to wait again adds it back
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        waiting.erase(found);
+    }
+}
+
+}; // namespace snake_charmer
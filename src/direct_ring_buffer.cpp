@@ -1,92 +1,415 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include <spdlog/spdlog.h>
 #include <snake_charmer/direct_ring_buffer.h>
 
 
 namespace snake_charmer {
 
-using BufferIndexIter = std::map<size_t, BufferIndexPtr>::iterator;
+const size_t DirectRingBuffer::DEFAULT_MAX_READERS = 64;
+const size_t DirectRingBuffer::DEFAULT_MAX_WRITERS = 16;
+const size_t DirectRingBuffer::PENDING_CURSOR = SIZE_MAX;
+const size_t DirectRingBuffer::REMOVED_INDEX = SIZE_MAX - 1;
+const int64_t DirectRingBuffer::FREE_OWNER = -1;
 
 DirectRingBuffer::DirectRingBuffer(
         const size_t elem_size,
         const size_t max_elems_per_write,
         const size_t max_elems_per_read,
         const size_t slack,
-        std::string loglevel
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy,
+        const OverflowPolicy overflow
 ) :
-        RingBuffer(elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel),
-        next_id(0),
-        min_read_index(0),
-        max_read_index(0)
-{
-    indices.clear();
-    // add a single writer index
-    write_index = std::make_shared<BufferIndex>(
-        next_id++, 0, 0, IndexFunction::Write, false
-    );
+        DirectRingBuffer(
+            elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel,
+            max_readers, read_mode, max_writers, page_size, wait_strategy, overflow, 1
+        )
+{
+}
+
+DirectRingBuffer::DirectRingBuffer(
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy,
+        const OverflowPolicy overflow,
+        const size_t num_planes
+) :
+        RingBuffer(
+            elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel,
+            slack * max_elems_per_read + max_elems_per_write, false, page_size,
+            wait_strategy, num_planes
+        ),
+        read_mode(read_mode),
+        overflow(overflow),
+        max_readers(max_readers),
+        max_writers(max_writers),
+        indices_storage(new char[get_indices_size(max_readers, max_writers) + CACHE_LINE_SIZE]),
+        tag_store(nullptr),
+        resize_epoch(0)
+{
+    char* block = indices_storage.get();
+    block += (CACHE_LINE_SIZE - reinterpret_cast<uintptr_t>(block) % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+    set_indices(block, true);
+}
+
+DirectRingBuffer::DirectRingBuffer(
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const int backing_fd,
+        const size_t backing_offset,
+        char* indices_block,
+        const bool init_indices,
+        const WaitStrategy wait_strategy
+) :
+        RingBuffer(elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel,
+            backing_fd, backing_offset, wait_strategy),
+        read_mode(read_mode),
+        overflow(OverflowPolicy::Block),
+        max_readers(max_readers),
+        max_writers(max_writers),
+        tag_store(nullptr),
+        resize_epoch(0)
+{
+    set_indices(indices_block, init_indices);
 }
 
+size_t DirectRingBuffer::get_indices_size(
+        const size_t max_readers,
+        const size_t max_writers)
+{
+    return sizeof(DirectRingBufferIndices)
+        + (max_readers + max_writers) * sizeof(BufferIndex);
+}
+
+void DirectRingBuffer::set_indices(char* indices_block, const bool init_indices) {
+    indices = reinterpret_cast<DirectRingBufferIndices*>(indices_block);
+    readers = reinterpret_cast<BufferIndex*>(indices_block + sizeof(DirectRingBufferIndices));
+    writers = readers + max_readers;
+    wait_state = &indices->wait_state;
+    if(!init_indices) {
+        return;
+    }
+    new (indices) DirectRingBufferIndices();
+    for(size_t n = 0; n < max_readers; n++) {
+        new (&readers[n]) BufferIndex();
+        if(read_mode == ReadMode::Broadcast) {
+            // a reader's cursor stays pending from when it becomes visible
+            // to update_min_read_index() until add_reader() sets it
+            readers[n].end.store(PENDING_CURSOR);
+        }
+    }
+    for(size_t n = 0; n < max_writers; n++) {
+        new (&writers[n]) BufferIndex();
+    }
+}
+
+bool DirectRingBuffer::claim_free_slot(BufferIndex* slots, const size_t count, size_t& id) {
+    for(id = 0; id < count; id++) {
+        int64_t owner = FREE_OWNER;
+        if(slots[id].owner.load() == FREE_OWNER
+                && slots[id].owner.compare_exchange_strong(owner, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
 
 size_t DirectRingBuffer::add_reader() {
-    std::lock_guard<std::mutex> lock(buf_mutex);
-    BufferIndexPtr index = std::make_shared<BufferIndex>(
-        next_id++, 0, 0, IndexFunction::Read, false
-    );
-    indices[index->id] = index;
-    logger->info("Added reader {}. There are now {} indices. Next ID: {}", index->id, indices.size(), next_id);
-    return index->id;
+    // Reuse a removed reader's slot, or claim the next one. The indices may
+    // be shared with other processes, so this can't rely on buf_mutex.
+    size_t id;
+    if(claim_free_slot(readers, indices->num_readers.load(), id)) {
+        // update_min_read_index() skips the slot while it's still removed,
+        // so it must see a pending cursor before the cursor is set
+        readers[id].end.store(read_mode == ReadMode::Broadcast ? PENDING_CURSOR : 0);
+    } else {
+        id = indices->num_readers.load();
+        do {
+            if(id >= max_readers) {
+                throw std::runtime_error(fmt::format(
+                    "Can't add reader, all {} reader slots are taken", max_readers));
+            }
+        } while(!indices->num_readers.compare_exchange_weak(id, id + 1));
+    }
+    if(read_mode == ReadMode::Broadcast) {
+        // Start the reader at the writer's position. Any min_read_index scan
+        // that missed this reader loaded min_write_index before we did, so it
+        // can't advance past our cursor.
+        readers[id].end.store(indices->min_write_index.load());
+        update_min_read_index();
+    }
+    logger->info("Added reader {}.", id);
+    return id;
+}
+
+int DirectRingBuffer::remove_reader(const size_t id) {
+    if(id >= indices->num_readers.load(std::memory_order_acquire)
+            || readers[id].end.load() == REMOVED_INDEX) {
+        return ENXIO; // invalid ID
+    }
+    readers[id].end.store(REMOVED_INDEX);
+    readers[id].in_use.store(false);
+    update_min_read_index();
+    notify_waiters();
+    // only once it's removed, so add_reader() can't reuse it before then
+    readers[id].owner.store(FREE_OWNER);
+    logger->info("Removed reader {}.", id);
+    return 0;
+}
+
+size_t DirectRingBuffer::add_writer() {
+    size_t id;
+    if(!claim_free_slot(writers, indices->num_writers.load(), id)) {
+        id = indices->num_writers.load();
+        do {
+            if(id >= max_writers) {
+                throw std::runtime_error(fmt::format(
+                    "Can't add writer, all {} writer slots are taken", max_writers));
+            }
+        } while(!indices->num_writers.compare_exchange_weak(id, id + 1));
+    }
+    logger->info("Added writer {}.", id);
+    return id;
 }
 
 int DirectRingBuffer::grab_write(
         char*& elem_ptr,
         const size_t elems_this_write)
 {
-    if(elems_this_write > max_elems_per_write) {
-        logger->error("requested too many elems this write: {} vs {}",
-                elems_this_write, max_elems_per_write);
+    size_t elems_grabbed;
+    return grab_write(
+        elem_ptr, elems_grabbed, elems_this_write, elems_this_write, indices->write_index);
+}
+
+int DirectRingBuffer::grab_write(
+        char*& elem_ptr,
+        const size_t elems_this_write,
+        const size_t id)
+{
+    if(id >= indices->num_writers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    size_t elems_grabbed;
+    return grab_write(
+        elem_ptr, elems_grabbed, elems_this_write, elems_this_write, writers[id]);
+}
+
+int DirectRingBuffer::grab_write_upto(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_write)
+{
+    return grab_write(
+        elem_ptr, elems_grabbed, 1, max_elems_this_write, indices->write_index);
+}
+
+int DirectRingBuffer::grab_write_upto(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_write,
+        const size_t id)
+{
+    if(id >= indices->num_writers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    return grab_write(elem_ptr, elems_grabbed, 1, max_elems_this_write, writers[id]);
+}
+
+int DirectRingBuffer::grab_write(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t min_elems_this_write,
+        const size_t max_elems_this_write,
+        BufferIndex& index)
+{
+    if(max_elems_this_write > max_elems_per_write) {
+        SNAKE_CHARMER_HOT_LOG(logger, error,
+                "requested too many elems this write: {} vs {}",
+                max_elems_this_write, max_elems_per_write);
         return EMSGSIZE;
     }
-    if(write_index->in_use) {
-        logger->error("already in use, must be released before grab");
+    if(index.in_use.load(std::memory_order_relaxed)) {
+        SNAKE_CHARMER_HOT_LOG(logger, error,
+                "already in use, must be released before grab");
         return EBUSY; // already in use, must be released before its grabbed again
     }
 
-    {
-        logger->debug("Trying to lock buffer to write {} elems", elems_this_write);
-        std::lock_guard<std::mutex> lock(buf_mutex);
+    const size_t epoch = resize_epoch.load(std::memory_order_acquire);
+    if(epoch & 1) {
+        return ENOBUFS; // resizing
+    }
+    size_t start = indices->max_write_index.load();
+    bool refreshed = false;
+    // when overwriting, only elements still held by writers are off limits
+    std::atomic<size_t>& oldest_index = overflow == OverflowPolicy::Overwrite
+        ? indices->min_write_index : indices->min_read_index;
+    while(true) {
         // verify that there are sufficient space in buffer for this write
-        size_t buffer_space = this->get_buffer_size_elems() - (
-            write_index->end - min_read_index
+        size_t buffer_space = num_elems.load(std::memory_order_relaxed) - (
+            start - oldest_index.load(std::memory_order_acquire)
         );
-        if(elems_this_write > buffer_space) {
-            return ENOBUFS; // insufficient space
-        }
-        write_index->in_use = true;
-        write_index->start = write_index->end;
-        write_index->end = write_index->start + elems_this_write;
-        logger->debug("Write grab elems {} to {} == byte offsets {} to {} == indices {} to {}",
-                write_index->start, write_index->end,
-                (write_index->start * elem_size) % buf_size, (write_index->end * elem_size) % buf_size,
-                write_index->start * elem_size, write_index->end * elem_size
-        );
-        elem_ptr = buf_ptr + (write_index->start * elem_size) % buf_size;
-        logger->debug("elem_ptr = {}, buf_ptr={}", (void*)(elem_ptr), (void*)(buf_ptr));
+        if(min_elems_this_write > buffer_space) {
+            if(refreshed) {
+                if(index.in_use.load(std::memory_order_relaxed)) {
+                    // A release may have seen the start published by a
+                    // failed reservation and held min_write_index at it, so
+                    // recompute it, or readers could wait forever
+                    index.in_use.store(false);
+                    update_min_write_index();
+                    notify_waiters();
+                }
+                counters.count_full();
+                trace_event(TraceEventType::WriteFull, get_trace_id(index),
+                    start, min_elems_this_write);
+                return ENOBUFS; // insufficient space
+            }
+            // min_read_index is only advanced on release, so it may lag the
+            // readers (e.g. Broadcast readers that were just added); refresh it
+            update_min_read_index();
+            refreshed = true;
+            continue;
+        }
+        elems_grabbed = std::min(max_elems_this_write, buffer_space);
+        // Publish a (conservative) start before reserving, so that a
+        // concurrent update_min_write_index() can't advance past this range.
+        index.start.store(start);
+        index.in_use.store(true);
+        if(resize_epoch.load() != epoch) {
+            // a resize started after buffer_space was computed
+            index.in_use.store(false);
+            update_min_write_index();
+            notify_waiters();
+            return ENOBUFS;
+        }
+        if(indices->max_write_index.compare_exchange_weak(start, start + elems_grabbed)) {
+            break;
+        }
+        // another writer reserved first; start now holds the new max_write_index
     }
-
+    if(overflow == OverflowPolicy::Overwrite) {
+        // keep the writes to the space from becoming visible before the
+        // reservation, which is what readers check for overruns
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    index.end.store(start + elems_grabbed, std::memory_order_relaxed);
+    index.hold_start.store(get_hold_start(), std::memory_order_relaxed);
+    trace_event(TraceEventType::GrabWrite, get_trace_id(index), start, elems_grabbed);
+    counters.record_fill(std::min(num_elems.load(std::memory_order_relaxed),
+        start + elems_grabbed - indices->min_read_index.load(std::memory_order_relaxed)));
+    SNAKE_CHARMER_HOT_LOG(logger, debug,
+            "Write grab elems {} to {} == byte offsets {} to {}",
+            start, start + elems_grabbed,
+            (start * elem_size) % buf_size.load(std::memory_order_relaxed),
+            ((start + elems_grabbed) * elem_size) % buf_size.load(std::memory_order_relaxed)
+    );
+    elem_ptr = get_elem_ptr(start);
     return 0;
 }
 
 int DirectRingBuffer::release_write() {
-    logger->debug("Releasing write grab...");
-    std::lock_guard<std::mutex> lock(buf_mutex);
-    if(!write_index->in_use) {
+    return release_write(indices->write_index);
+}
+
+int DirectRingBuffer::release_write(const size_t id) {
+    if(id >= indices->num_writers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    return release_write(writers[id]);
+}
+
+int DirectRingBuffer::release_write_partial(const size_t elems_used) {
+    return release_write_partial(elems_used, indices->write_index);
+}
+
+int DirectRingBuffer::release_write_partial(const size_t elems_used, const size_t id) {
+    if(id >= indices->num_writers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    return release_write_partial(elems_used, writers[id]);
+}
+
+int DirectRingBuffer::release_write_partial(const size_t elems_used, BufferIndex& index) {
+    if(!index.in_use.load(std::memory_order_relaxed)) {
         return EBUSY; // not in use, must be grabbed before it's released
     }
-    write_index->in_use = false;
-    buf_cv.notify_all();
-    logger->debug("Released write grab.");
+    // once reserved, .start and .end are exactly this grab's range
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    size_t end = index.end.load(std::memory_order_relaxed);
+    if(elems_used > end - start) {
+        return EINVAL;
+    }
+    if(elems_used < end - start) {
+        // Hand the unused tail back. This is only possible while nothing has
+        // been reserved after it.
+        if(!indices->max_write_index.compare_exchange_strong(end, start + elems_used)) {
+            return EAGAIN;
+        }
+        // before .in_use is cleared, so that an update_min_write_index()
+        // that loaded the old max_write_index rescans
+        indices->write_shrinks.fetch_add(1);
+        index.end.store(start + elems_used, std::memory_order_relaxed);
+        TagStore* store = tag_store.load(std::memory_order_acquire);
+        if(store != nullptr) {
+            // the handed back elements will be grabbed again, untagged
+            store->rings[get_tag_ring(index)]->truncate(start + elems_used);
+        }
+    }
+    return release_write(index);
+}
+
+int DirectRingBuffer::release_write(BufferIndex& index) {
+    if(!index.in_use.load(std::memory_order_relaxed)) {
+        return EBUSY; // not in use, must be grabbed before it's released
+    }
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    const size_t elems = index.end.load(std::memory_order_relaxed) - start;
+    counters.add_written(elem_size * elems);
+    record_hold(index.hold_start.load(std::memory_order_relaxed));
+    trace_event(TraceEventType::ReleaseWrite, get_trace_id(index), start, elems);
+    // the seq_cst store also publishes the written elements to whichever
+    // thread's update_min_write_index() observes it
+    index.in_use.store(false);
+    update_min_write_index();
+    notify_waiters();
     return 0;
 }
 
+size_t DirectRingBuffer::release_abandoned_write(BufferIndex& index) {
+    if(!index.in_use.load() || release_write_partial(0, index) == 0) {
+        return 0;
+    }
+    // Readers can't grab it until it's released, so nothing else touches it.
+    // The overlap maps the same pages as the start of each plane.
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    const size_t elems = index.end.load(std::memory_order_relaxed) - start;
+    for(size_t plane = 0; plane < num_planes; plane++) {
+        memset(get_elem_ptr(start) + plane * get_plane_stride(),
+            0, elems * elem_size);
+    }
+    counters.add_lost(elems);
+    release_write(index);
+    return elems;
+}
+
 int DirectRingBuffer::grab_read(
         char*& elem_ptr,
         const size_t elems_this_read,
@@ -94,106 +417,528 @@ int DirectRingBuffer::grab_read(
         const std::chrono::microseconds& timeout
         )
 {
-    if(elems_this_read > max_elems_per_read) {
-        logger->error("requested too many elems this read: {} vs {}",
-                elems_this_read, max_elems_per_read);
-        return EMSGSIZE;
+    size_t elems_grabbed;
+    size_t elems_skipped;
+    return grab_read(elem_ptr, elems_grabbed, elems_this_read, elems_this_read,
+        elems_this_read, id, elems_skipped, timeout);
+}
+
+int DirectRingBuffer::grab_read(
+        char*& elem_ptr,
+        const size_t elems_this_read,
+        const size_t id,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout
+        )
+{
+    size_t elems_grabbed;
+    return grab_read(elem_ptr, elems_grabbed, elems_this_read, elems_this_read,
+        elems_this_read, id, elems_skipped, timeout);
+}
+
+int DirectRingBuffer::grab_read_upto(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_read,
+        const size_t id,
+        const std::chrono::microseconds& timeout
+        )
+{
+    size_t elems_skipped;
+    return grab_read(elem_ptr, elems_grabbed, 1, max_elems_this_read, max_elems_this_read,
+        id, elems_skipped, timeout);
+}
+
+int DirectRingBuffer::grab_read_upto(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_read,
+        const size_t id,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout
+        )
+{
+    return grab_read(elem_ptr, elems_grabbed, 1, max_elems_this_read, max_elems_this_read,
+        id, elems_skipped, timeout);
+}
+
+int DirectRingBuffer::grab_read_window(
+        char*& elem_ptr,
+        const size_t window_elems,
+        const size_t advance_elems,
+        const size_t id,
+        const std::chrono::microseconds& timeout
+        )
+{
+    if(advance_elems == 0 || advance_elems > window_elems) {
+        return EINVAL;
     }
-    BufferIndexIter itr;
-    {
-        std::lock_guard<std::mutex> lock(buf_mutex);
-        // verify that the requested writer exists
-        itr = indices.find(id);
-        if(itr == indices.end()) {
-            return ENXIO; // invalid ID
-        }
+    size_t elems_grabbed;
+    size_t elems_skipped;
+    return grab_read(elem_ptr, elems_grabbed, window_elems, window_elems, advance_elems,
+        id, elems_skipped, timeout);
+}
+
+int DirectRingBuffer::grab_read(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t min_elems_this_read,
+        const size_t max_elems_this_read,
+        const size_t max_advance,
+        const size_t id,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout
+        )
+{
+    elems_skipped = 0;
+    if(max_elems_this_read > max_elems_per_read) {
+        SNAKE_CHARMER_HOT_LOG(logger, error, "requested too many elems this read: {} vs {}",
+                max_elems_this_read, max_elems_per_read);
+        return EMSGSIZE;
     }
-    BufferIndexPtr index = itr->second;
-    if(index->function != IndexFunction::Read) {
-        return EINVAL; // invalid function
+    if(id >= indices->num_readers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
     }
-    if(index->in_use) {
+    BufferIndex& index = readers[id];
+    if(index.in_use.load(std::memory_order_relaxed)) {
         return EBUSY; // already in use, must be released before its grabbed again
     }
+    if(index.end.load(std::memory_order_relaxed) == REMOVED_INDEX) {
+        return ENXIO; // removed
+    }
+    const size_t epoch = resize_epoch.load(std::memory_order_acquire);
+    if(epoch & 1) {
+        auto resized = [&]() {
+            return (resize_epoch.load(std::memory_order_acquire) & 1) == 0;
+        };
+        if(!wait_until_ready(resized, timeout)) {
+            counters.count_empty();
+            return ENOMSG;
+        }
+        return grab_read(elem_ptr, elems_grabbed, min_elems_this_read, max_elems_this_read,
+            max_advance, id, elems_skipped, timeout);
+    }
+    // a resize started after the range was sized, so start again
+    auto undo_grab = [&]() {
+        index.in_use.store(false);
+        update_min_read_index();
+        return grab_read(elem_ptr, elems_grabbed, min_elems_this_read, max_elems_this_read,
+            max_advance, id, elems_skipped, timeout);
+    };
 
-    {
-        std::unique_lock<std::mutex> lock(buf_mutex);
-        // verify that there are sufficient data in buffer for this read
-        size_t min_write_index = write_index->in_use ? write_index->start : write_index->end;
-        while(elems_this_read > min_write_index - max_read_index) {
-            std::cv_status status = buf_cv.wait_for(lock, timeout);
-            if (status == std::cv_status::timeout) {
-                logger->debug("grab_read timeout");
+    size_t start;
+    if(read_mode == ReadMode::Broadcast) {
+        // only this reader advances its cursor
+        const size_t cursor = index.end.load(std::memory_order_relaxed);
+        // the first element to grab, past any that were overwritten
+        auto get_first = [&]() {
+            return overflow == OverflowPolicy::Overwrite
+                ? std::max(cursor, get_oldest_intact_index()) : cursor;
+        };
+        auto has_data = [&]() {
+            const size_t first = get_first();
+            return indices->min_write_index.load(std::memory_order_acquire)
+                - first >= min_elems_this_read;
+        };
+        while(true) {
+            start = get_first();
+            const size_t avail = indices->min_write_index.load(std::memory_order_acquire) - start;
+            if(avail >= min_elems_this_read) {
+                elems_grabbed = std::min(max_elems_this_read, avail);
+                break;
+            }
+            if(!has_data() && !wait_until_ready(has_data, timeout)) {
+                SNAKE_CHARMER_HOT_LOG(logger, debug, "grab_read timeout");
+                counters.count_empty();
+                trace_event(TraceEventType::ReadEmpty, id, start, min_elems_this_read);
                 return ENOMSG;
             }
-            min_write_index = write_index->in_use ? write_index->start : write_index->end;
-            logger->debug(
-                "Checking read available: {} vs {} - {} = {}",
-                elems_this_read, min_write_index, max_read_index,
-                min_write_index - max_read_index);
-        }
-        index->in_use = true;
-        index->start = max_read_index;
-        max_read_index += elems_this_read;
-        index->end = max_read_index;
-        logger->debug("Read grab elems {} to {} == byte offsets {} to {} == indices {} to {}",
-                index->start, index->end,
-                (index->start * elem_size) % buf_size, (index->end * elem_size) % buf_size,
-                index->start * elem_size, index->end * elem_size
-        );
-        elem_ptr = buf_ptr + (index->start * elem_size) % buf_size;
-        logger->debug("elem_ptr = {}, buf_ptr={}", (void*)(elem_ptr), (void*)(buf_ptr));
+        }
+        elems_skipped = start - cursor;
+        // The cursor in .end keeps protecting [start, ...) until .in_use is
+        // set, and only then does .end move on to where the next grab
+        // starts. Nothing may see a later cursor, so that's set here rather
+        // than on release.
+        index.start.store(start);
+        index.in_use.store(true);
+        if(resize_epoch.load() != epoch) {
+            return undo_grab();
+        }
+        index.end.store(start + std::min(elems_grabbed, max_advance));
+        index.window_end.store(start + elems_grabbed, std::memory_order_relaxed);
+        index.hold_start.store(get_hold_start(), std::memory_order_relaxed);
+        if(elems_skipped > 0) {
+            counters.add_overwritten(elems_skipped);
+        }
+        trace_event(TraceEventType::GrabRead, id, start, elems_grabbed);
+        elem_ptr = get_elem_ptr(start);
+        return 0;
     }
 
+    auto has_data = [&]() {
+        return indices->min_write_index.load(std::memory_order_acquire)
+            - indices->max_read_index.load() >= min_elems_this_read;
+    };
+    start = indices->max_read_index.load();
+    size_t first;
+    while(true) {
+        // the first element to grab, past any that were overwritten
+        first = overflow == OverflowPolicy::Overwrite
+            ? std::max(start, get_oldest_intact_index()) : start;
+        const size_t avail = indices->min_write_index.load(std::memory_order_acquire) - first;
+        if(avail < min_elems_this_read) {
+            index.in_use.store(false);
+            if(!has_data() && !wait_until_ready(has_data, timeout)) {
+                SNAKE_CHARMER_HOT_LOG(logger, debug, "grab_read timeout");
+                counters.count_empty();
+                trace_event(TraceEventType::ReadEmpty, id, start, min_elems_this_read);
+                return ENOMSG;
+            }
+            start = indices->max_read_index.load();
+            continue;
+        }
+        elems_grabbed = std::min(max_elems_this_read, avail);
+        // Publish a (conservative) start before claiming, so that a
+        // concurrent update_min_read_index() can't advance past this claim.
+        // Skipping overwritten elements is part of the same claim, so only
+        // one reader counts them. A window only claims what it advances
+        // past; its start keeps the rest of it from being overwritten.
+        index.start.store(start);
+        index.in_use.store(true);
+        if(resize_epoch.load() != epoch) {
+            return undo_grab();
+        }
+        if(indices->max_read_index.compare_exchange_weak(
+                start, first + std::min(elems_grabbed, max_advance))) {
+            break;
+        }
+        // another reader claimed first; start now holds the new max_read_index
+    }
+    if(first != start) {
+        elems_skipped = first - start;
+        counters.add_overwritten(elems_skipped);
+        index.start.store(first);
+        start = first;
+    }
+    index.end.store(start + elems_grabbed, std::memory_order_relaxed);
+    index.window_end.store(start + elems_grabbed, std::memory_order_relaxed);
+    index.hold_start.store(get_hold_start(), std::memory_order_relaxed);
+    trace_event(TraceEventType::GrabRead, id, start, elems_grabbed);
+    SNAKE_CHARMER_HOT_LOG(logger, debug,
+            "Read grab elems {} to {} == byte offsets {} to {}",
+            start, start + elems_grabbed,
+            (start * elem_size) % buf_size.load(std::memory_order_relaxed),
+            ((start + elems_grabbed) * elem_size) % buf_size.load(std::memory_order_relaxed)
+    );
+    elem_ptr = get_elem_ptr(start);
     return 0;
 }
 
 int DirectRingBuffer::release_read(const size_t id) {
-    BufferIndexIter itr;
-    {
-        std::lock_guard<std::mutex> lock(buf_mutex);
-        // verify that the requested writer exists
-        itr = indices.find(id);
-        if(itr == indices.end()) {
-            return ENXIO; // invalid ID
+    if(id >= indices->num_readers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    BufferIndex& index = readers[id];
+    if(!index.in_use.load(std::memory_order_relaxed)) {
+        return EBUSY; // not in use, must be grabbed before it's released
+    }
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    const size_t elems = index.window_end.load(std::memory_order_relaxed) - start;
+    counters.add_read(elem_size * elems);
+    record_hold(index.hold_start.load(std::memory_order_relaxed));
+    trace_event(TraceEventType::ReleaseRead, id, start, elems);
+    int rc = 0;
+    if(overflow == OverflowPolicy::Overwrite) {
+        // Seqlock-style validation: if a writer has reserved space that
+        // wraps onto the grab, whatever the reader saw of it may be torn.
+        // The fence keeps the reader's accesses from moving past the check.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(get_oldest_intact_index() > start) {
+            counters.count_torn_read();
+            rc = EOVERFLOW;
         }
     }
-    BufferIndexPtr index = itr->second;
-    if(index->function != IndexFunction::Read) {
-        return EINVAL; // invalid function
+    index.in_use.store(false);
+    update_min_read_index();
+    notify_waiters();
+    return rc;
+}
+
+int DirectRingBuffer::resize(
+        const size_t slack,
+        const std::chrono::microseconds& timeout
+) {
+    if(!indices_storage) {
+        return ENOTSUP; // other processes' grabs can't be waited for
     }
-    if(!index->in_use) {
-        return EBUSY; // not in use, must be grabbed before it's released
+    std::lock_guard<std::mutex> lock(resize_mutex);
+    resize_epoch.fetch_add(1);
+    // wait for the grabs that started before the epoch changed
+    auto grabs_released = [&]() {
+        if(indices->write_index.in_use.load()) {
+            return false;
+        }
+        const size_t num_writers = indices->num_writers.load();
+        for(size_t n = 0; n < num_writers; n++) {
+            if(writers[n].in_use.load()) {
+                return false;
+            }
+        }
+        const size_t num_readers = indices->num_readers.load();
+        for(size_t n = 0; n < num_readers; n++) {
+            if(readers[n].in_use.load()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    int rc = 0;
+    if(!grabs_released() && !wait_until_ready(grabs_released, timeout)) {
+        logger->warn("Grabs still outstanding after {}us, not resizing", timeout.count());
+        rc = ETIMEDOUT;
+    } else {
+        // with nothing held, these are exactly the unread elements
+        update_min_write_index();
+        update_min_read_index();
+        const size_t end = indices->max_write_index.load();
+        size_t start = indices->min_read_index.load();
+        if(overflow == OverflowPolicy::Overwrite) {
+            start = std::max(start, get_oldest_intact_index());
+        }
+        rc = remap(slack, start, end);
+    }
+    resize_epoch.fetch_add(1);
+    notify_waiters();
+    return rc;
+}
+
+size_t DirectRingBuffer::get_oldest_intact_index() {
+    const size_t reserved = indices->max_write_index.load(std::memory_order_acquire);
+    const size_t elems = num_elems.load(std::memory_order_acquire);
+    return reserved > elems ? reserved - elems : 0;
+}
+
+uint32_t DirectRingBuffer::get_trace_id(const BufferIndex& index) {
+    return &index == &indices->write_index
+        ? TRACE_NO_ID : static_cast<uint32_t>(&index - writers);
+}
+
+size_t DirectRingBuffer::get_tag_ring(const BufferIndex& index) {
+    return &index == &indices->write_index ? 0 : &index - writers + 1;
+}
+
+int DirectRingBuffer::enable_tags(const size_t capacity) {
+    if(!indices_storage) {
+        return ENOTSUP; // another process couldn't see the tags
+    }
+    std::lock_guard<std::mutex> lock(buf_mutex);
+    if(tag_storage) {
+        return EALREADY;
+    }
+    tag_storage.reset(new TagStore(capacity, max_writers + 1, max_readers));
+    tag_store.store(tag_storage.get(), std::memory_order_release);
+    return 0;
+}
+
+int DirectRingBuffer::add_tag_value(
+        const size_t offset,
+        const uint64_t key,
+        const uint64_t value,
+        BufferIndex& index)
+{
+    TagStore* store = tag_store.load(std::memory_order_acquire);
+    if(store == nullptr) {
+        return ENOTSUP;
+    }
+    if(!index.in_use.load(std::memory_order_relaxed)) {
+        return EBUSY; // tags can only be added to an outstanding grab
+    }
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    if(offset >= index.end.load(std::memory_order_relaxed) - start) {
+        return EINVAL;
+    }
+    // no reader can grab below min_read_index, or an overwritten element
+    size_t drop_below = indices->min_read_index.load(std::memory_order_acquire);
+    if(overflow == OverflowPolicy::Overwrite) {
+        drop_below = std::max(drop_below, get_oldest_intact_index());
+    }
+    return store->rings[get_tag_ring(index)]->push(start + offset, key, value, drop_below);
+}
+
+int DirectRingBuffer::get_tags(const size_t id, TagRange& tags) {
+    if(id >= indices->num_readers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    TagStore* store = tag_store.load(std::memory_order_acquire);
+    if(store == nullptr) {
+        return ENOTSUP;
     }
-    
-    {
-        std::lock_guard<std::mutex> lock(buf_mutex);
-        // the end of this index is as upper bound of the min_read_index
-        min_read_index = index->end; 
-        index->in_use = false;
-        for(itr = indices.begin(); itr != indices.end(); itr++) {
-            if(itr->second->function == IndexFunction::Write) {
+    const BufferIndex& index = readers[id];
+    if(!index.in_use.load(std::memory_order_relaxed)) {
+        return EBUSY; // no outstanding grab
+    }
+    const size_t start = index.start.load(std::memory_order_relaxed);
+    const size_t end = index.window_end.load(std::memory_order_relaxed);
+    std::vector<Tag>& collected = store->reader_tags[id];
+    collected.clear();
+    size_t rings_with_tags = 0;
+    const size_t num_rings = indices->num_writers.load(std::memory_order_acquire) + 1;
+    for(size_t n = 0; n < num_rings; n++) {
+        const size_t before = collected.size();
+        store->rings[n]->collect(start, end, collected);
+        if(collected.size() > before) {
+            rings_with_tags++;
+        }
+    }
+    if(rings_with_tags > 1) {
+        std::stable_sort(collected.begin(), collected.end(),
+            [](const Tag& a, const Tag& b) { return a.index < b.index; });
+    }
+    tags.first = collected.data();
+    tags.last = collected.data() + collected.size();
+    return 0;
+}
+
+void DirectRingBuffer::update_min_read_index() {
+    // Nothing can be claimed below max_read_index once it's been loaded, and
+    // any reader that claimed below it published its start first, so the
+    // minimum computed here stays a valid lower bound even if it's stale by
+    // the time it's stored.
+    // In Broadcast mode, cursors only move forward and new readers start at
+    // min_write_index, so the same holds with min_write_index as the bound.
+    size_t new_min;
+    const size_t count = indices->num_readers.load();
+    if(read_mode == ReadMode::Broadcast) {
+        new_min = indices->min_write_index.load();
+        for(size_t n = 0; n < count; n++) {
+            // .end is read first: if this reader then turns out not to be in
+            // use, .end is still a cursor it hasn't read past
+            const size_t cursor = readers[n].end.load();
+            if(cursor == PENDING_CURSOR) {
+                return; // reader is being added, try again on the next release
+            }
+            if(cursor == REMOVED_INDEX) {
                 continue;
             }
-            if(itr->second->in_use) {
-                min_read_index = std::min(min_read_index, itr->second->start);
+            if(readers[n].in_use.load()) {
+                new_min = std::min(new_min, readers[n].start.load());
             } else {
-                min_read_index = std::min(min_read_index, itr->second->end);
+                new_min = std::min(new_min, cursor);
+            }
+        }
+    } else {
+        new_min = indices->max_read_index.load();
+        for(size_t n = 0; n < count; n++) {
+            if(readers[n].in_use.load()) {
+                new_min = std::min(new_min, readers[n].start.load());
             }
         }
     }
-    return 0;
+    // only ever move min_read_index forward
+    size_t current = indices->min_read_index.load(std::memory_order_relaxed);
+    while(current < new_min && !indices->min_read_index.compare_exchange_weak(
+            current, new_min,
+            std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void DirectRingBuffer::update_min_write_index() {
+    // Same reasoning as update_min_read_index(): writers publish their start
+    // before reserving, so nothing below the loaded max_write_index can be
+    // reserved without being seen here.
+    size_t new_min;
+    size_t shrinks;
+    do {
+        shrinks = indices->write_shrinks.load();
+        new_min = indices->max_write_index.load();
+        if(indices->write_index.in_use.load()) {
+            new_min = std::min(new_min, indices->write_index.start.load());
+        }
+        const size_t count = indices->num_writers.load();
+        for(size_t n = 0; n < count; n++) {
+            if(writers[n].in_use.load()) {
+                new_min = std::min(new_min, writers[n].start.load());
+            }
+        }
+        // a partial release may have moved max_write_index back below
+        // new_min during the scan
+    } while(indices->write_shrinks.load() != shrinks);
+    // only ever move min_write_index forward
+    size_t current = indices->min_write_index.load(std::memory_order_relaxed);
+    while(current < new_min && !indices->min_write_index.compare_exchange_weak(
+            current, new_min,
+            std::memory_order_release, std::memory_order_relaxed)) {
+    }
 }
 
 size_t DirectRingBuffer::get_elems_avail_to_read() {
-    std::lock_guard<std::mutex> lock(buf_mutex);
-    size_t min_write_index = write_index->in_use ? write_index->start : write_index->end;
-    return std::min(max_elems_per_read, min_write_index - max_read_index);
+    size_t read_index = get_read_index();
+    if(overflow == OverflowPolicy::Overwrite) {
+        read_index = std::max(read_index, get_oldest_intact_index());
+    }
+    return std::min(
+        max_elems_per_read,
+        indices->min_write_index.load(std::memory_order_acquire) - read_index
+    );
+}
+
+size_t DirectRingBuffer::get_elems_avail_to_read(const size_t id) {
+    if(read_mode != ReadMode::Broadcast || id >= indices->num_readers.load()) {
+        return get_elems_avail_to_read();
+    }
+    size_t cursor = readers[id].end.load();
+    if(cursor == PENDING_CURSOR || cursor == REMOVED_INDEX) {
+        return 0;
+    }
+    if(overflow == OverflowPolicy::Overwrite) {
+        cursor = std::max(cursor, get_oldest_intact_index());
+    }
+    return std::min(
+        max_elems_per_read,
+        indices->min_write_index.load(std::memory_order_acquire) - cursor
+    );
 }
 
 size_t DirectRingBuffer::get_elems_avail_to_write() {
-    std::lock_guard<std::mutex> lock(buf_mutex);
-    return std::min(max_elems_per_write, min_read_index + num_elems - write_index->end);
+    const std::atomic<size_t>& oldest_index = overflow == OverflowPolicy::Overwrite
+        ? indices->min_write_index : indices->min_read_index;
+    return std::min(
+        max_elems_per_write,
+        oldest_index.load(std::memory_order_acquire) + num_elems.load(std::memory_order_acquire)
+            - indices->max_write_index.load()
+    );
+}
+
+size_t DirectRingBuffer::get_read_index() {
+    return read_mode == ReadMode::Broadcast
+        ? indices->min_read_index.load() : indices->max_read_index.load();
+}
+
+int DirectRingBuffer::get_read_grab_index(const size_t id, size_t& index) {
+    if(id >= indices->num_readers.load(std::memory_order_acquire)) {
+        return ENXIO; // invalid ID
+    }
+    if(!readers[id].in_use.load(std::memory_order_relaxed)) {
+        return EBUSY; // no outstanding grab
+    }
+    index = readers[id].start.load(std::memory_order_relaxed);
+    return 0;
+}
+
+ReadMode DirectRingBuffer::get_read_mode() {
+    return read_mode;
+}
+
+OverflowPolicy DirectRingBuffer::get_overflow_policy() {
+    return overflow;
+}
+
+size_t DirectRingBuffer::get_max_readers() {
+    return max_readers;
+}
+
+size_t DirectRingBuffer::get_max_writers() {
+    return max_writers;
 }
 
 }
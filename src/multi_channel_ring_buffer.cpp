@@ -0,0 +1,174 @@
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/multi_channel_ring_buffer.h>
+
+
+namespace snake_charmer {
+
+namespace {
+/**
+ * Get the size of an element: one sample per plane, or one per channel when
+ * interleaved. Checked before the buffer is mapped.
+ */
+size_t get_channel_elem_size(
+        const size_t num_channels,
+        const size_t sample_size,
+        const ChannelLayout layout)
+{
+    if(num_channels == 0 || sample_size == 0) {
+        throw std::runtime_error(fmt::format(
+            "Can't make a buffer of {} channels of {} byte samples",
+            num_channels, sample_size));
+    }
+    return layout == ChannelLayout::Planar ? sample_size : num_channels * sample_size;
+}
+}
+
+MultiChannelRingBuffer::MultiChannelRingBuffer(
+        const size_t num_channels,
+        const size_t sample_size,
+        const ChannelLayout layout,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy,
+        const OverflowPolicy overflow
+) :
+        DirectRingBuffer(
+            get_channel_elem_size(num_channels, sample_size, layout),
+            max_elems_per_write, max_elems_per_read, slack, loglevel,
+            max_readers, read_mode, max_writers, page_size, wait_strategy, overflow,
+            layout == ChannelLayout::Planar ? num_channels : 1
+        ),
+        num_channels(num_channels),
+        sample_size(sample_size),
+        layout(layout)
+{
+}
+
+int MultiChannelRingBuffer::grab_write(
+        ChannelView* channels,
+        const size_t elems_this_write)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_write(elem_ptr, elems_this_write);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+int MultiChannelRingBuffer::grab_write(
+        ChannelView* channels,
+        const size_t elems_this_write,
+        const size_t id)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_write(elem_ptr, elems_this_write, id);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+int MultiChannelRingBuffer::grab_write_upto(
+        ChannelView* channels,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_write)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_write_upto(
+        elem_ptr, elems_grabbed, max_elems_this_write);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+int MultiChannelRingBuffer::grab_write_upto(
+        ChannelView* channels,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_write,
+        const size_t id)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_write_upto(
+        elem_ptr, elems_grabbed, max_elems_this_write, id);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+int MultiChannelRingBuffer::grab_read(
+        ChannelView* channels,
+        const size_t elems_this_read,
+        const size_t id,
+        const std::chrono::microseconds& timeout)
+{
+    size_t elems_skipped;
+    return grab_read(channels, elems_this_read, id, elems_skipped, timeout);
+}
+
+int MultiChannelRingBuffer::grab_read(
+        ChannelView* channels,
+        const size_t elems_this_read,
+        const size_t id,
+        size_t& elems_skipped,
+        const std::chrono::microseconds& timeout)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_read(
+        elem_ptr, elems_this_read, id, elems_skipped, timeout);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+int MultiChannelRingBuffer::grab_read_upto(
+        ChannelView* channels,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_read,
+        const size_t id,
+        const std::chrono::microseconds& timeout)
+{
+    char* elem_ptr;
+    const int rc = DirectRingBuffer::grab_read_upto(
+        elem_ptr, elems_grabbed, max_elems_this_read, id, timeout);
+    if(rc == 0) {
+        set_channels(channels, elem_ptr);
+    }
+    return rc;
+}
+
+void MultiChannelRingBuffer::set_channels(ChannelView* channels, char* elem_ptr) {
+    for(size_t channel = 0; channel < num_channels; channel++) {
+        if(layout == ChannelLayout::Planar) {
+            // the grab can't be held across a resize, so the stride is stable
+            channels[channel].data = elem_ptr + channel * get_plane_stride();
+            channels[channel].stride = sample_size;
+        } else {
+            channels[channel].data = elem_ptr + channel * sample_size;
+            channels[channel].stride = elem_size;
+        }
+    }
+}
+
+size_t MultiChannelRingBuffer::get_num_channels() {
+    return num_channels;
+}
+size_t MultiChannelRingBuffer::get_sample_size() {
+    return sample_size;
+}
+ChannelLayout MultiChannelRingBuffer::get_layout() {
+    return layout;
+}
+
+}; // namespace snake_charmer
@@ -0,0 +1,193 @@
+#ifdef __linux__
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/packet_ingest.h>
+
+
+namespace snake_charmer {
+
+PacketIngest::PacketIngest(
+        DirectRingBuffer& ring_buffer,
+        const int socket_fd,
+        const size_t header_size,
+        const size_t payload_size,
+        const size_t max_packets_per_batch,
+        const unsigned int busy_poll_us,
+        std::string loglevel
+) :
+        ring_buffer(ring_buffer),
+        socket_fd(socket_fd),
+        header_size(header_size),
+        payload_size(payload_size),
+        elems_per_packet(payload_size / ring_buffer.get_elem_size()),
+        max_packets_per_batch(std::min(
+            max_packets_per_batch,
+            elems_per_packet ? ring_buffer.get_max_elems_per_write() / elems_per_packet : 0
+        )),
+        busy_poll(busy_poll_us > 0),
+        headers(header_size * this->max_packets_per_batch),
+        iovecs(2 * this->max_packets_per_batch),
+        messages(this->max_packets_per_batch),
+        packets_received(0),
+        packets_dropped(0)
+{
+    logger = get_logger("PacketIngest", loglevel);
+    if(elems_per_packet == 0 || payload_size % ring_buffer.get_elem_size() != 0) {
+        throw std::runtime_error(fmt::format(
+            "Packet payload of {} bytes isn't a multiple of the {} byte elements",
+            payload_size, ring_buffer.get_elem_size()));
+    }
+    if(this->max_packets_per_batch == 0) {
+        throw std::runtime_error(fmt::format(
+            "Packet payload of {} elements is more than max_elems_per_write {}",
+            elems_per_packet, ring_buffer.get_max_elems_per_write()));
+    }
+    writer_id = ring_buffer.add_writer();
+    if(busy_poll) {
+        const int usecs = busy_poll_us;
+        // raising it above net.core.busy_poll needs CAP_NET_ADMIN
+        if(setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0) {
+            logger->warn("Can't set SO_BUSY_POLL to {}us, spinning in user space only: {}",
+                busy_poll_us, strerror(errno));
+        }
+    }
+    logger->info("Receiving up to {} packets of {} + {} bytes per batch",
+        this->max_packets_per_batch, header_size, payload_size);
+}
+
+bool PacketIngest::wait_readable(const std::chrono::microseconds& timeout) {
+    struct pollfd poll_fd;
+    poll_fd.fd = socket_fd;
+    poll_fd.events = POLLIN;
+    if(busy_poll) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        do {
+            poll_fd.revents = 0;
+            if(poll(&poll_fd, 1, 0) > 0) {
+                return true;
+            }
+            cpu_relax();
+        } while(std::chrono::steady_clock::now() < deadline);
+        return false;
+    }
+    // round up, so a short timeout still waits
+    const int timeout_ms = (timeout.count() + 999) / 1000;
+    int rc;
+    do {
+        rc = poll(&poll_fd, 1, timeout_ms);
+    } while(rc < 0 && errno == EINTR);
+    return rc > 0;
+}
+
+int PacketIngest::ingest(
+        size_t& packets_received,
+        const std::chrono::microseconds& timeout
+) {
+    packets_received = 0;
+    char* elem_ptr;
+    size_t elems_grabbed;
+    int rc = ring_buffer.grab_write_upto(
+        elem_ptr, elems_grabbed, max_packets_per_batch * elems_per_packet, writer_id);
+    if(rc != 0) {
+        return rc;
+    }
+    const size_t max_packets = elems_grabbed / elems_per_packet;
+    if(max_packets == 0) {
+        commit(elem_ptr, elems_grabbed, 0);
+        return ENOBUFS;
+    }
+
+    // scatter each packet's header into the side array and its payload into
+    // the ring buffer, right after the previous payload
+    for(size_t n = 0; n < max_packets; n++) {
+        iovecs[2 * n].iov_base = headers.data() + n * header_size;
+        iovecs[2 * n].iov_len = header_size;
+        iovecs[2 * n + 1].iov_base = elem_ptr + n * payload_size;
+        iovecs[2 * n + 1].iov_len = payload_size;
+        memset(&messages[n], 0, sizeof(struct mmsghdr));
+        messages[n].msg_hdr.msg_iov = &iovecs[2 * n];
+        messages[n].msg_hdr.msg_iovlen = 2;
+    }
+    int received = recvmmsg(socket_fd, messages.data(), max_packets, MSG_DONTWAIT, NULL);
+    if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        received = wait_readable(timeout)
+            ? recvmmsg(socket_fd, messages.data(), max_packets, MSG_DONTWAIT, NULL) : 0;
+    }
+    if(received < 0) {
+        rc = (errno == EAGAIN || errno == EWOULDBLOCK) ? ENOMSG : errno;
+        if(rc != ENOMSG) {
+            logger->error("recvmmsg failed: {}", strerror(rc));
+        }
+        commit(elem_ptr, elems_grabbed, 0);
+        return rc;
+    }
+
+    // drop packets of the wrong size, closing up the gaps they leave
+    size_t kept = 0;
+    for(size_t n = 0; n < static_cast<size_t>(received); n++) {
+        if(messages[n].msg_len != header_size + payload_size
+                || (messages[n].msg_hdr.msg_flags & MSG_TRUNC)) {
+            SNAKE_CHARMER_HOT_LOG(logger, debug,
+                    "Dropped packet of {} bytes", messages[n].msg_len);
+            packets_dropped++;
+            continue;
+        }
+        if(kept != n) {
+            memmove(headers.data() + kept * header_size,
+                headers.data() + n * header_size, header_size);
+            memmove(elem_ptr + kept * payload_size, elem_ptr + n * payload_size, payload_size);
+        }
+        kept++;
+    }
+
+    rc = commit(elem_ptr, elems_grabbed, kept * elems_per_packet);
+    packets_received = kept;
+    this->packets_received += kept;
+    if(rc != 0) {
+        return rc;
+    }
+    return received > 0 ? 0 : ENOMSG;
+}
+
+int PacketIngest::commit(
+        char* elem_ptr,
+        const size_t elems_grabbed,
+        const size_t elems_used
+) {
+    const int rc = ring_buffer.release_write_partial(elems_used, writer_id);
+    if(rc != EAGAIN) {
+        return rc;
+    }
+    // another writer grabbed past us, so the whole grab must be committed
+    const size_t elem_size = ring_buffer.get_elem_size();
+    logger->warn("Zero-filling {} elements another writer grabbed past",
+        elems_grabbed - elems_used);
+    memset(elem_ptr + elems_used * elem_size, 0, (elems_grabbed - elems_used) * elem_size);
+    return ring_buffer.release_write(writer_id);
+}
+
+const char* PacketIngest::get_header(const size_t n) {
+    return headers.data() + n * header_size;
+}
+
+size_t PacketIngest::get_elems_per_packet() {
+    return elems_per_packet;
+}
+
+size_t PacketIngest::get_packets_received() {
+    return packets_received.load();
+}
+
+size_t PacketIngest::get_packets_dropped() {
+    return packets_dropped.load();
+}
+
+}; // namespace snake_charmer
+#endif
@@ -0,0 +1,301 @@
+#ifdef __unix__
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/persistent_ring_buffer.h>
+
+
+namespace snake_charmer {
+
+const uint64_t PersistentDirectRingBuffer::MAGIC = 0x73726550656b616eULL; // "nakePers"
+const uint64_t PersistentDirectRingBuffer::VERSION = 1;
+
+PersistentDirectRingBuffer::PersistentDirectRingBuffer(
+        const std::string& path,
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const WaitStrategy wait_strategy
+) :
+        PersistentDirectRingBuffer(
+            path,
+            open_mapping(
+                path, elem_size, max_elems_per_write, max_elems_per_read, slack,
+                max_readers, read_mode, max_writers
+            ),
+            loglevel,
+            wait_strategy
+        )
+{
+}
+
+PersistentDirectRingBuffer::PersistentDirectRingBuffer(
+        const std::string& path,
+        const Mapping& mapping,
+        std::string loglevel,
+        const WaitStrategy wait_strategy
+) try :
+        DirectRingBuffer(
+            get_header(mapping)->elem_size,
+            get_header(mapping)->max_elems_per_write,
+            get_header(mapping)->max_elems_per_read,
+            get_header(mapping)->slack,
+            loglevel,
+            get_header(mapping)->max_readers,
+            static_cast<ReadMode>(get_header(mapping)->read_mode),
+            get_header(mapping)->max_writers,
+            mapping.fd,
+            mapping.control_size,
+            mapping.control + sizeof(SharedRingBufferHeader),
+            mapping.created,
+            wait_strategy
+        ),
+        path(path),
+        mapping(mapping),
+        header(get_header(mapping))
+{
+    if(mapping.created) {
+        header->buf_size = buf_size.load();
+        header->num_elems = num_elems.load();
+        // from now on the file is reopened rather than created
+        header->magic.store(MAGIC, std::memory_order_release);
+        logger->info("Created persistent ring buffer {}", path);
+    } else {
+        if(header->buf_size != buf_size.load() || header->num_elems != num_elems.load()) {
+            throw std::runtime_error(fmt::format(
+                "Persistent ring buffer {} is {} bytes, but would be {} bytes in this process",
+                path, header->buf_size, buf_size.load()));
+        }
+        recover_grabs();
+        logger->info("Reopened persistent ring buffer {} at element {}",
+            path, indices->min_write_index.load());
+    }
+} catch(...) {
+    munmap(mapping.control, mapping.control_size);
+    close(mapping.fd);
+    if(mapping.created) {
+        unlink(path.c_str());
+    }
+}
+
+PersistentDirectRingBuffer::~PersistentDirectRingBuffer() {
+    munmap(mapping.control, mapping.control_size);
+    // releases the lock
+    close(mapping.fd);
+}
+
+PersistentDirectRingBuffer::Mapping PersistentDirectRingBuffer::open_mapping(
+        const std::string& path,
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers
+) {
+    Mapping mapping;
+    mapping.fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(mapping.fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open persistent ring buffer {}: {}", path, strerror(errno)));
+    }
+    // held until the fd is closed, so a second opener can't recover grabs
+    // that are still in use
+    if(flock(mapping.fd, LOCK_EX | LOCK_NB) != 0) {
+        const int lock_errno = errno;
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format(
+            "Persistent ring buffer {} is in use: {}", path, strerror(lock_errno)));
+    }
+    struct stat file_stat;
+    if(fstat(mapping.fd, &file_stat) != 0) {
+        const int stat_errno = errno;
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format(
+            "Failed to open persistent ring buffer {}: {}", path, strerror(stat_errno)));
+    }
+    mapping.created = file_stat.st_size == 0;
+    mapping.control_size = get_control_size(max_readers, max_writers);
+
+    if(!mapping.created) {
+        // check the sizing before trusting the control block's size
+        void* header_map = MAP_FAILED;
+        if(static_cast<size_t>(file_stat.st_size) >= mapping.control_size) {
+            header_map = mmap(
+                NULL, sizeof(SharedRingBufferHeader), PROT_READ, MAP_SHARED, mapping.fd, 0);
+        }
+        if(header_map == MAP_FAILED) {
+            close(mapping.fd);
+            throw std::runtime_error(fmt::format(
+                "{} isn't a version {} persistent ring buffer", path, VERSION));
+        }
+        const SharedRingBufferHeader* header = static_cast<SharedRingBufferHeader*>(header_map);
+        const uint64_t magic = header->magic.load(std::memory_order_acquire);
+        const bool is_buffer = magic == MAGIC && header->version == VERSION;
+        // the magic is stored last, so without it the creator died part way
+        const bool interrupted = magic == 0 && header->version == VERSION;
+        const bool same_sizing = header->elem_size == elem_size
+            && header->max_elems_per_write == max_elems_per_write
+            && header->max_elems_per_read == max_elems_per_read
+            && header->slack == slack
+            && header->max_readers == max_readers
+            && header->max_writers == max_writers
+            && header->read_mode == static_cast<uint64_t>(read_mode);
+        munmap(header_map, sizeof(SharedRingBufferHeader));
+        if(interrupted && same_sizing) {
+            // Nothing can have been written to it, so create it again. The
+            // lock rules out a creator that's still going.
+            mapping.created = true;
+        } else if(!is_buffer) {
+            close(mapping.fd);
+            throw std::runtime_error(fmt::format(
+                "{} isn't a version {} persistent ring buffer. If creating it was"
+                " interrupted, delete it to create it again", path, VERSION));
+        } else if(!same_sizing) {
+            close(mapping.fd);
+            throw std::runtime_error(fmt::format(
+                "Persistent ring buffer {} was created with different parameters", path));
+        }
+    }
+    // the data is appended when it is mapped. Emptying the file first zeroes
+    // anything left by an interrupted creation.
+    if(mapping.created && (ftruncate(mapping.fd, 0) != 0
+            || ftruncate(mapping.fd, mapping.control_size) != 0)) {
+        const int truncate_errno = errno;
+        close(mapping.fd);
+        unlink(path.c_str());
+        throw std::runtime_error(fmt::format(
+            "Failed to size persistent ring buffer {}: {}", path, strerror(truncate_errno)));
+    }
+    mapping.control = static_cast<char*>(mmap(
+        NULL, mapping.control_size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0));
+    if(mapping.control == MAP_FAILED) {
+        const int map_errno = errno;
+        close(mapping.fd);
+        if(mapping.created) {
+            unlink(path.c_str());
+        }
+        throw std::runtime_error(fmt::format(
+            "Failed to map persistent ring buffer {}: {}", path, strerror(map_errno)));
+    }
+    if(mapping.created) {
+        SharedRingBufferHeader* header = get_header(mapping);
+        header->version = VERSION;
+        header->elem_size = elem_size;
+        header->max_elems_per_write = max_elems_per_write;
+        header->max_elems_per_read = max_elems_per_read;
+        header->slack = slack;
+        header->max_readers = max_readers;
+        header->max_writers = max_writers;
+        header->read_mode = read_mode;
+        header->creator_pid = getpid();
+    }
+    return mapping;
+}
+
+size_t PersistentDirectRingBuffer::get_control_size(
+        const size_t max_readers,
+        const size_t max_writers
+) {
+    // the data that follows must start on a page boundary
+    const size_t page_size = getpagesize();
+    const size_t size = sizeof(SharedRingBufferHeader)
+        + get_indices_size(max_readers, max_writers);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+SharedRingBufferHeader* PersistentDirectRingBuffer::get_header(const Mapping& mapping) {
+    return reinterpret_cast<SharedRingBufferHeader*>(mapping.control);
+}
+
+void PersistentDirectRingBuffer::recover_grabs() {
+    // nothing is waiting any more
+    wait_state->waiters.store(0);
+
+    const size_t num_readers = std::min(indices->num_readers.load(), max_readers);
+    std::vector<size_t> read_grabs;
+    size_t first_start = indices->max_read_index.load();
+    for(size_t id = 0; id < num_readers; id++) {
+        if(!readers[id].in_use.load()) {
+            continue;
+        }
+        const size_t start = readers[id].start.load();
+        if(read_mode == ReadMode::Broadcast) {
+            // move the cursor back, so the grab is read again
+            readers[id].end.store(start);
+        }
+        first_start = std::min(first_start, start);
+        read_grabs.push_back(id);
+    }
+    // Before the grabs are released, so min_read_index can't pass the
+    // elements being handed back
+    if(read_mode == ReadMode::Distribute) {
+        indices->max_read_index.store(first_start);
+    }
+    for(const size_t id : read_grabs) {
+        release_read(id);
+        logger->warn("Handed back read grab of reader {}", id);
+    }
+
+    // Hand the latest write grabs back first, since only a grab with
+    // nothing grabbed after it can be. The built-in writer is num_writers.
+    const size_t num_writers = std::min(indices->num_writers.load(), max_writers);
+    std::vector<std::pair<size_t, size_t>> write_grabs;
+    for(size_t id = 0; id <= num_writers; id++) {
+        const BufferIndex& index = id < num_writers ? writers[id] : indices->write_index;
+        if(index.in_use.load()) {
+            write_grabs.push_back(std::make_pair(index.start.load(), id));
+        }
+    }
+    std::sort(write_grabs.rbegin(), write_grabs.rend());
+    for(const std::pair<size_t, size_t>& grab : write_grabs) {
+        const size_t id = grab.second;
+        const size_t lost = release_abandoned_write(
+            id < num_writers ? writers[id] : indices->write_index);
+        if(lost > 0) {
+            logger->error("Zeroed {} elements of the write grab of writer {}", lost, id);
+        } else {
+            logger->warn("Handed back write grab of writer {}", id);
+        }
+    }
+
+    // The releases above recompute these, but only if there were grabs, and
+    // the process may have died part way through updating them
+    update_min_write_index();
+    update_min_read_index();
+}
+
+int PersistentDirectRingBuffer::sync() {
+    // the overlap maps the same pages as the start of the buffer
+    if(msync(buf_ptr.load(), buf_size.load(), MS_SYNC) != 0
+            || msync(mapping.control, mapping.control_size, MS_SYNC) != 0) {
+        return errno;
+    }
+    return 0;
+}
+
+bool PersistentDirectRingBuffer::is_resumed() {
+    return !mapping.created;
+}
+
+std::string PersistentDirectRingBuffer::get_path() {
+    return path;
+}
+
+}; // namespace snake_charmer
+#endif
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <errno.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/pipeline.h>
+
+
+namespace snake_charmer {
+
+namespace {
+// how long a worker with nothing to do sleeps before scanning again
+const std::chrono::microseconds IDLE_WAIT(100);
+const std::chrono::microseconds NO_WAIT(0);
+}
+
+PipelineBlock::PipelineBlock(
+        const std::string& name,
+        const std::vector<size_t>& input_elem_sizes,
+        const std::vector<size_t>& output_elem_sizes,
+        const size_t input_elems,
+        const size_t output_elems
+) :
+        name(name),
+        input_elem_sizes(input_elem_sizes),
+        output_elem_sizes(output_elem_sizes),
+        input_elems(input_elems),
+        output_elems(output_elems),
+        inputs(input_elem_sizes.size()),
+        outputs(output_elem_sizes.size()),
+        input_ptrs(input_elem_sizes.size()),
+        output_ptrs(output_elem_sizes.size()),
+        running(false),
+        queued(false),
+        finished(false),
+        work_calls(0),
+        elems_consumed(0),
+        elems_produced(0),
+        busy_ns(0)
+{
+    if(inputs.empty() && outputs.empty()) {
+        throw std::runtime_error(fmt::format("PipelineBlock {} has no inputs or outputs", name));
+    }
+    if((!inputs.empty() && input_elems == 0) || (!outputs.empty() && output_elems == 0)) {
+        throw std::runtime_error(fmt::format(
+            "PipelineBlock {} must consume and produce at least one element per call", name));
+    }
+    for(Input& input : inputs) {
+        input.ring_buffer = nullptr;
+        input.reader_id = 0;
+        input.source = nullptr;
+        input.source_output = 0;
+    }
+    for(Output& output : outputs) {
+        output.slack = DEFAULT_EDGE_SLACK;
+    }
+}
+
+PipelineBlock::~PipelineBlock() {
+}
+
+const std::string& PipelineBlock::get_name() {
+    return name;
+}
+
+size_t PipelineBlock::get_num_inputs() {
+    return inputs.size();
+}
+
+size_t PipelineBlock::get_num_outputs() {
+    return outputs.size();
+}
+
+Pipeline::Pipeline(
+        const size_t num_threads,
+        const std::vector<int>& cpus,
+        std::string loglevel
+) :
+        cpus(cpus),
+        started(false),
+        stopping(false),
+        error(0),
+        done(false)
+{
+    logger = get_logger("Pipeline", loglevel);
+    const size_t num_workers = num_threads > 0
+        ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+    for(size_t n = 0; n < num_workers; n++) {
+        workers.emplace_back(new Worker());
+    }
+}
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+void Pipeline::connect(
+        PipelineBlock& from,
+        const size_t from_output,
+        PipelineBlock& to,
+        const size_t to_input,
+        const size_t slack
+) {
+    if(started.load()) {
+        throw std::runtime_error("Can't connect blocks once the pipeline has started");
+    }
+    if(from_output >= from.outputs.size()) {
+        throw std::runtime_error(fmt::format(
+            "PipelineBlock {} has no output {}", from.name, from_output));
+    }
+    if(to_input >= to.inputs.size()) {
+        throw std::runtime_error(fmt::format(
+            "PipelineBlock {} has no input {}", to.name, to_input));
+    }
+    if(from.output_elem_sizes[from_output] != to.input_elem_sizes[to_input]) {
+        throw std::runtime_error(fmt::format(
+            "Output {} of {} has {} byte elements, but input {} of {} has {}",
+            from_output, from.name, from.output_elem_sizes[from_output],
+            to_input, to.name, to.input_elem_sizes[to_input]));
+    }
+    PipelineBlock::Input& input = to.inputs[to_input];
+    if(input.source != nullptr) {
+        throw std::runtime_error(fmt::format(
+            "Input {} of {} is already connected", to_input, to.name));
+    }
+    PipelineBlock::Output& output = from.outputs[from_output];
+    if(output.sinks.empty()) {
+        output.slack = slack;
+    }
+    output.sinks.push_back(&to);
+    input.source = &from;
+    input.source_output = from_output;
+    for(PipelineBlock* block : {&from, &to}) {
+        if(std::find(blocks.begin(), blocks.end(), block) == blocks.end()) {
+            blocks.push_back(block);
+        }
+    }
+}
+
+void Pipeline::start() {
+    if(started.load()) {
+        throw std::runtime_error("The pipeline has already started");
+    }
+    for(PipelineBlock* block : blocks) {
+        for(size_t n = 0; n < block->inputs.size(); n++) {
+            if(block->inputs[n].source == nullptr) {
+                throw std::runtime_error(fmt::format(
+                    "Input {} of {} isn't connected", n, block->name));
+            }
+        }
+        for(size_t n = 0; n < block->outputs.size(); n++) {
+            if(block->outputs[n].sinks.empty()) {
+                throw std::runtime_error(fmt::format(
+                    "Output {} of {} isn't connected", n, block->name));
+            }
+        }
+    }
+
+    for(PipelineBlock* block : blocks) {
+        for(size_t n = 0; n < block->outputs.size(); n++) {
+            PipelineBlock::Output& output = block->outputs[n];
+            size_t max_elems_per_read = 0;
+            for(PipelineBlock* sink : output.sinks) {
+                max_elems_per_read = std::max(max_elems_per_read, sink->input_elems);
+            }
+            const size_t alignment = alignof(DirectRingBuffer);
+            output.ring_buffer_storage.reset(new char[sizeof(DirectRingBuffer) + alignment]);
+            char* storage = output.ring_buffer_storage.get();
+            storage += (alignment - reinterpret_cast<uintptr_t>(storage) % alignment) % alignment;
+            output.ring_buffer.reset(new(storage) DirectRingBuffer(
+                block->output_elem_sizes[n], block->output_elems, max_elems_per_read,
+                output.slack, "", output.sinks.size(),
+                output.sinks.size() == 1 ? ReadMode::Distribute : ReadMode::Broadcast));
+        }
+    }
+    for(PipelineBlock* block : blocks) {
+        for(PipelineBlock::Input& input : block->inputs) {
+            input.ring_buffer = input.source->outputs[input.source_output].ring_buffer.get();
+            input.reader_id = input.ring_buffer->add_reader();
+        }
+    }
+
+    started = true;
+    logger->info("Starting {} blocks on {} workers", blocks.size(), workers.size());
+    size_t next_worker = 0;
+    for(PipelineBlock* block : blocks) {
+        if(block->inputs.empty()) {
+            push(next_worker++ % workers.size(), block);
+        }
+    }
+    for(size_t n = 0; n < workers.size(); n++) {
+        workers[n]->thread = std::thread(&Pipeline::run, this, n);
+    }
+}
+
+int Pipeline::wait(const std::chrono::milliseconds& timeout) {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait_for(lock, timeout, [this]() { return done || error.load() != 0; });
+    const int rc = error.load();
+    if(rc != 0) {
+        return rc;
+    }
+    return done ? 0 : ETIMEDOUT;
+}
+
+int Pipeline::stop() {
+    stopping = true;
+    done_cv.notify_all();
+    for(std::unique_ptr<Worker>& worker : workers) {
+        if(worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    return error.load();
+}
+
+BlockStats Pipeline::get_stats(PipelineBlock& block) {
+    BlockStats stats;
+    stats.work_calls = block.work_calls.load(std::memory_order_relaxed);
+    stats.elems_consumed = block.elems_consumed.load(std::memory_order_relaxed);
+    stats.elems_produced = block.elems_produced.load(std::memory_order_relaxed);
+    stats.busy_time = std::chrono::nanoseconds(block.busy_ns.load(std::memory_order_relaxed));
+    return stats;
+}
+
+void Pipeline::run(const size_t id) {
+    pin_thread(id);
+    while(!stopping.load()) {
+        PipelineBlock* block = find_work(id);
+        if(block == nullptr) {
+            update_finished();
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done_cv.wait_for(lock, IDLE_WAIT, [this]() { return stopping.load(); });
+            continue;
+        }
+        if(!try_run(*block)) {
+            continue;
+        }
+        // upstream has more space and downstream more data. The block itself
+        // goes last, so it runs next, while its data is still in cache.
+        for(PipelineBlock::Input& input : block->inputs) {
+            push(id, input.source);
+        }
+        for(PipelineBlock::Output& output : block->outputs) {
+            for(PipelineBlock* sink : output.sinks) {
+                push(id, sink);
+            }
+        }
+        push(id, block);
+    }
+}
+
+PipelineBlock* Pipeline::find_work(const size_t id) {
+    for(size_t n = 0; n < workers.size(); n++) {
+        Worker& worker = *workers[(id + n) % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.deque_mutex);
+        if(worker.ready.empty()) {
+            continue;
+        }
+        PipelineBlock* block;
+        if(n == 0) {
+            block = worker.ready.back();
+            worker.ready.pop_back();
+        } else {
+            block = worker.ready.front();
+            worker.ready.pop_front();
+        }
+        block->queued = false;
+        return block;
+    }
+    for(PipelineBlock* block : blocks) {
+        if(!block->finished.load() && !block->running.load() && is_ready(*block)) {
+            return block;
+        }
+    }
+    return nullptr;
+}
+
+void Pipeline::push(const size_t id, PipelineBlock* block) {
+    if(block->finished.load() || block->queued.exchange(true)) {
+        return;
+    }
+    Worker& worker = *workers[id];
+    std::lock_guard<std::mutex> lock(worker.deque_mutex);
+    worker.ready.push_back(block);
+}
+
+bool Pipeline::is_ready(PipelineBlock& block) {
+    for(PipelineBlock::Input& input : block.inputs) {
+        if(input.ring_buffer->get_elems_avail_to_read(input.reader_id) < block.input_elems) {
+            return false;
+        }
+    }
+    for(PipelineBlock::Output& output : block.outputs) {
+        if(output.ring_buffer->get_elems_avail_to_write() < block.output_elems) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Pipeline::is_done(PipelineBlock& block) {
+    if(block.finished.load()) {
+        return true;
+    }
+    if(block.inputs.empty()) {
+        return false; // sources finish by returning ENODATA
+    }
+    // check the sources first: once they're finished, they write no more
+    for(PipelineBlock::Input& input : block.inputs) {
+        if(!input.source->finished.load()) {
+            return false;
+        }
+    }
+    for(PipelineBlock::Input& input : block.inputs) {
+        if(input.ring_buffer->get_elems_avail_to_read(input.reader_id) < block.input_elems) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Pipeline::try_run(PipelineBlock& block) {
+    bool expected = false;
+    if(!block.running.compare_exchange_strong(expected, true)) {
+        return false;
+    }
+    if(block.finished.load() || !is_ready(block)) {
+        block.running = false;
+        return false;
+    }
+
+    // only this worker reads the inputs and writes the outputs, so a ready
+    // block's grabs can't fail
+    int rc = 0;
+    size_t inputs_grabbed = 0;
+    size_t outputs_grabbed = 0;
+    while(rc == 0 && inputs_grabbed < block.inputs.size()) {
+        PipelineBlock::Input& input = block.inputs[inputs_grabbed];
+        char* elem_ptr;
+        rc = input.ring_buffer->grab_read(elem_ptr, block.input_elems, input.reader_id, NO_WAIT);
+        if(rc == 0) {
+            block.input_ptrs[inputs_grabbed++] = elem_ptr;
+        }
+    }
+    while(rc == 0 && outputs_grabbed < block.outputs.size()) {
+        rc = block.outputs[outputs_grabbed].ring_buffer->grab_write(
+            block.output_ptrs[outputs_grabbed], block.output_elems);
+        if(rc == 0) {
+            outputs_grabbed++;
+        }
+    }
+    if(rc != 0) {
+        logger->error("Grab for ready block {} failed: {}", block.name, strerror(rc));
+    } else {
+        const auto start = std::chrono::steady_clock::now();
+        rc = block.work(block.input_ptrs, block.output_ptrs);
+        block.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+    }
+
+    for(size_t n = 0; n < outputs_grabbed; n++) {
+        DirectRingBuffer& ring_buffer = *block.outputs[n].ring_buffer;
+        if(rc == 0) {
+            ring_buffer.release_write();
+        } else {
+            ring_buffer.release_write_partial(0);
+        }
+    }
+    for(size_t n = 0; n < inputs_grabbed; n++) {
+        block.inputs[n].ring_buffer->release_read(block.inputs[n].reader_id);
+    }
+
+    bool progress = true;
+    if(rc == 0) {
+        block.work_calls.fetch_add(1, std::memory_order_relaxed);
+        block.elems_produced.fetch_add(
+            block.outputs.size() * block.output_elems, std::memory_order_relaxed);
+    } else if(rc == ENODATA) {
+        logger->debug("PipelineBlock {} is done", block.name);
+        block.finished = true;
+    } else if(rc == ENOMSG) {
+        progress = !block.inputs.empty();
+    } else {
+        logger->error("PipelineBlock {} failed: {}", block.name, strerror(rc));
+        int no_error = 0;
+        error.compare_exchange_strong(no_error, rc);
+        stopping = true;
+        done_cv.notify_all();
+        progress = false;
+    }
+    if(rc == 0 || rc == ENOMSG || rc == ENODATA) {
+        block.elems_consumed.fetch_add(
+            block.inputs.size() * block.input_elems, std::memory_order_relaxed);
+    }
+    block.running = false;
+    return progress;
+}
+
+void Pipeline::update_finished() {
+    // a block's done once its sources are, so repeat until nothing changes
+    bool changed = true;
+    bool all_finished = false;
+    while(changed) {
+        changed = false;
+        all_finished = true;
+        for(PipelineBlock* block : blocks) {
+            if(block->finished.load()) {
+                continue;
+            }
+            bool expected = false;
+            if(block->running.compare_exchange_strong(expected, true)) {
+                if(is_done(*block)) {
+                    logger->debug("PipelineBlock {} is done", block->name);
+                    block->finished = true;
+                    changed = true;
+                }
+                block->running = false;
+            }
+            all_finished = all_finished && block->finished.load();
+        }
+    }
+    if(all_finished && !blocks.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done = true;
+        }
+        stopping = true;
+        done_cv.notify_all();
+    }
+}
+
+void Pipeline::pin_thread(const size_t id) {
+    if(cpus.empty()) {
+        return;
+    }
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus[id % cpus.size()], &cpu_set);
+    const int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if(rc != 0) {
+        logger->warn("Can't pin worker {} to cpu {}: {}",
+            id, cpus[id % cpus.size()], strerror(rc));
+    }
+#else
+    (void)id;
+#endif
+}
+
+}; // namespace snake_charmer
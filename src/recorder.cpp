@@ -0,0 +1,217 @@
+#ifdef __unix__
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/recorder.h>
+
+
+namespace snake_charmer {
+
+namespace {
+// O_DIRECT needs offsets, lengths and addresses aligned to the logical block
+// size; 4096 covers any device in practice
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+// how often an idle worker checks whether it is stopping
+const std::chrono::milliseconds STOP_POLL_INTERVAL(10);
+}
+
+Recorder::Recorder(
+        DirectRingBuffer& ring_buffer,
+        const std::string& path,
+        const size_t elems_per_write,
+        const size_t queue_depth,
+        const bool direct_io,
+        std::string loglevel
+) :
+        ring_buffer(ring_buffer),
+        path(path),
+        elem_size(ring_buffer.get_elem_size()),
+        elems_per_write(elems_per_write),
+        base_index(ring_buffer.get_read_index()),
+        buffered_fd(-1),
+        direct_fd(-1),
+        stopping(false),
+        stopped(false),
+        bytes_written(0),
+        error(0)
+{
+    logger = get_logger("Recorder", loglevel);
+    if(ring_buffer.get_read_mode() == ReadMode::Broadcast) {
+        throw std::runtime_error("Recorder needs a ring buffer in ReadMode::Distribute");
+    }
+    if(elems_per_write == 0 || elems_per_write > ring_buffer.get_max_elems_per_read()) {
+        throw std::runtime_error(fmt::format(
+            "Recorder elems_per_write must be 1 to {}, not {}",
+            ring_buffer.get_max_elems_per_read(), elems_per_write));
+    }
+    if(queue_depth == 0) {
+        throw std::runtime_error("Recorder queue_depth must be at least 1");
+    }
+    open_file(direct_io);
+    try {
+        for(size_t n = 0; n < queue_depth; n++) {
+            reader_ids.push_back(ring_buffer.add_reader());
+        }
+    } catch(...) {
+        for(const size_t id : reader_ids) {
+            ring_buffer.remove_reader(id);
+        }
+        close(buffered_fd);
+        if(direct_fd >= 0) {
+            close(direct_fd);
+        }
+        throw;
+    }
+    for(const size_t id : reader_ids) {
+        workers.emplace_back(&Recorder::run, this, id);
+    }
+    logger->info("Recording to {} with {} writes of {} bytes in flight{}",
+        path, queue_depth, elems_per_write * elem_size,
+        direct_fd >= 0 ? " using O_DIRECT" : "");
+}
+
+Recorder::~Recorder() {
+    stop();
+}
+
+void Recorder::open_file(const bool direct_io) {
+    buffered_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(buffered_fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open {}: {}", path, strerror(errno)));
+    }
+    if(!direct_io) {
+        return;
+    }
+    // the ring buffer is page aligned, so aligned offsets are aligned addresses
+    const size_t write_bytes = elems_per_write * elem_size;
+    if(write_bytes % DIRECT_IO_ALIGNMENT != 0
+            || (base_index * elem_size) % DIRECT_IO_ALIGNMENT != 0
+            || ring_buffer.get_buffer_size_bytes() % DIRECT_IO_ALIGNMENT != 0) {
+        logger->warn("Writes of {} bytes aren't aligned for O_DIRECT, using buffered writes",
+            write_bytes);
+        return;
+    }
+#ifdef O_DIRECT
+    direct_fd = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    if(direct_fd < 0) {
+        logger->warn("Can't open {} with O_DIRECT, using buffered writes: {}",
+            path, strerror(errno));
+    }
+#else
+    logger->warn("O_DIRECT isn't supported, using buffered writes");
+#endif
+}
+
+void Recorder::run(const size_t id) {
+    while(true) {
+        // stop only once a grab finds nothing after stopping was set
+        const bool stop_requested = stopping.load();
+        char* elem_ptr;
+        const int rc = ring_buffer.grab_read(
+            elem_ptr, elems_per_write, id,
+            stop_requested ? std::chrono::microseconds(0) : STOP_POLL_INTERVAL);
+        if(rc == ENOMSG) {
+            if(stop_requested) {
+                return;
+            }
+            continue;
+        }
+        if(rc != 0) {
+            logger->error("Reader {} failed to grab: {}", id, strerror(rc));
+            int no_error = 0;
+            error.compare_exchange_strong(no_error, rc);
+            return;
+        }
+        size_t index = 0;
+        ring_buffer.get_read_grab_index(id, index);
+        write_elems(elem_ptr, elems_per_write, index);
+        // the data may only be overwritten once it is on its way to disk
+        ring_buffer.release_read(id);
+    }
+}
+
+int Recorder::write_elems(const char* elem_ptr, const size_t elems, const size_t index) {
+    int fd = direct_fd >= 0 && elems == elems_per_write ? direct_fd : buffered_fd;
+    const off_t offset = (index - base_index) * elem_size;
+    const size_t bytes = elems * elem_size;
+    size_t done = 0;
+    while(done < bytes) {
+        const ssize_t rc = pwrite(fd, elem_ptr + done, bytes - done, offset + done);
+        if(rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if(rc < 0 && errno == EINVAL && fd == direct_fd) {
+            // some filesystems accept O_DIRECT at open but not on write
+            logger->warn("O_DIRECT write to {} failed, retrying buffered", path);
+            fd = buffered_fd;
+            continue;
+        }
+        if(rc <= 0) {
+            const int write_errno = rc < 0 ? errno : EIO;
+            logger->error("Failed to write {} bytes at {} to {}: {}",
+                bytes - done, offset + done, path, strerror(write_errno));
+            int no_error = 0;
+            error.compare_exchange_strong(no_error, write_errno);
+            return write_errno;
+        }
+        done += rc;
+    }
+    bytes_written += bytes;
+    return 0;
+}
+
+int Recorder::stop() {
+    if(stopped) {
+        return error.load();
+    }
+    stopped = true;
+    stopping.store(true);
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+    // the workers only take whole writes, so pick up the remainder
+    char* elem_ptr;
+    size_t elems_grabbed;
+    while(ring_buffer.grab_read_upto(elem_ptr, elems_grabbed, elems_per_write,
+            reader_ids.front(), std::chrono::microseconds(0)) == 0) {
+        size_t index = 0;
+        ring_buffer.get_read_grab_index(reader_ids.front(), index);
+        write_elems(elem_ptr, elems_grabbed, index);
+        ring_buffer.release_read(reader_ids.front());
+    }
+    for(const int fd : {direct_fd, buffered_fd}) {
+        if(fd >= 0 && fdatasync(fd) != 0) {
+            int no_error = 0;
+            error.compare_exchange_strong(no_error, errno);
+        }
+    }
+    for(const size_t id : reader_ids) {
+        ring_buffer.remove_reader(id);
+    }
+    if(direct_fd >= 0) {
+        close(direct_fd);
+    }
+    close(buffered_fd);
+    logger->info("Recorded {} bytes to {}", bytes_written.load(), path);
+    return error.load();
+}
+
+size_t Recorder::get_bytes_written() {
+    return bytes_written.load();
+}
+
+bool Recorder::is_direct_io() {
+    return direct_fd >= 0;
+}
+
+int Recorder::get_error() {
+    return error.load();
+}
+
+}; // namespace snake_charmer
+#endif
@@ -1,13 +1,24 @@
 #include <algorithm>
 #include <assert.h>
+#include <cerrno>
 #include <cstring>
+#include <map>
+#include <stdexcept>
 #include <stdio.h>
 #ifdef _WIN32
   #include <windows.h>
   #undef max
 #elif __unix__
+  #include <errno.h>
+  #include <limits.h>
   #include <sys/mman.h>
+  #include <sys/stat.h>
   #include <unistd.h>
+  #ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/eventfd.h>
+    #include <sys/syscall.h>
+  #endif
 #else
   #error "Only windows and linux supported"
 #endif
@@ -18,51 +29,147 @@
 
 namespace snake_charmer {
 
+namespace {
+#ifdef __unix__
+// memfd_create(2) encodes the huge page size as log2(bytes) in these bits
+const unsigned int HUGE_PAGE_FLAG_SHIFT = 26;
+#endif
+
+#ifdef __unix__
+/**
+ * Create an unlinked file to back a buffer, with page_size_bytes pages
+ *
+ * Returns the fd, or -1 with errno set
+ */
+int create_backing_file(const size_t page_size_bytes) {
+    if(page_size_bytes != static_cast<size_t>(getpagesize())) {
+        unsigned int log2_bytes = 0;
+        while((size_t(1) << log2_bytes) < page_size_bytes) {
+            log2_bytes++;
+        }
+        return memfd_create(
+            "snake_charmer",
+            MFD_CLOEXEC | MFD_HUGETLB | (log2_bytes << HUGE_PAGE_FLAG_SHIFT)
+        );
+    }
+    FILE* file = tmpfile();
+    if(file == nullptr) {
+        return -1;
+    }
+    const int fd = dup(fileno(file));
+    fclose(file);
+    return fd;
+}
+#endif
+
+size_t gcd(size_t a, size_t b) {
+    while(b != 0) {
+        const size_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+}
+
+RingBuffer::RingBuffer(
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy
+) :
+        RingBuffer(
+            elem_size, max_elems_per_write, max_elems_per_read, slack, loglevel,
+            slack * max_elems_per_read + max_elems_per_write, false, page_size,
+            wait_strategy
+        )
+{
+}
+
 RingBuffer::RingBuffer(
         const size_t elem_size,
         const size_t max_elems_per_write,
         const size_t max_elems_per_read,
         const size_t slack,
-        std::string loglevel
+        std::string loglevel,
+        const size_t min_num_elems,
+        const bool power_of_two,
+        const PageSize page_size,
+        const WaitStrategy wait_strategy,
+        const size_t num_planes
 ) :
         elem_size(elem_size),
         max_elems_per_write(max_elems_per_write),
         max_elems_per_read(max_elems_per_read),
         slack(slack),
-        buf_ptr(nullptr)
+        num_planes(num_planes),
+        buf_ptr(nullptr),
+        wait_state(&local_wait_state),
+        cross_process(false),
+        hold_timing(false),
+        trace(nullptr),
+        event_fds(nullptr)
 {
-    log_sink = std::make_shared<spdlog::sinks::stdout_sink_mt>();
-    logger = std::make_shared<spdlog::logger>("RingBuffer", log_sink);
-    logger->trace("using level {}", loglevel);
-    if(loglevel.empty()) {
-        logger->set_level(spdlog::level::from_str("error"));
-    } else {
-        logger->set_level(spdlog::level::from_str(loglevel));
-    }
-    logger->trace("using level {}", loglevel);
+    logger = get_logger("RingBuffer", loglevel);
+    set_wait_strategy(wait_strategy);
 
-    const size_t min_buffer_size = (slack * max_elems_per_read + max_elems_per_write) * elem_size;
-    logger->debug("Min buffer size: {}", min_buffer_size);
 #ifdef _WIN32
     SYSTEM_INFO sys_info;
     GetSystemInfo(&sys_info);
     logger->debug("dwPageSize: {} vs dwAllocationGranularity: {}",
         sys_info.dwPageSize, sys_info.dwAllocationGranularity);
-    const size_t pagesize_bytes = std::max(sys_info.dwPageSize, sys_info.dwAllocationGranularity);
+    page_size_bytes = std::max(sys_info.dwPageSize, sys_info.dwAllocationGranularity);
+    if(num_planes != 1) {
+        throw std::runtime_error("Buffers with several planes aren't supported on Windows");
+    }
+    if(page_size != PageSize::StandardPages) {
+        // large pages can't back the placeholder mappings used below
+        logger->warn("Huge pages aren't supported on Windows, using {} byte pages",
+            page_size_bytes);
+    }
+    publish(get_sizes(min_num_elems, power_of_two));
 #elif __unix__
-    const size_t pagesize_bytes = getpagesize();
-#endif
-    logger->debug("Page size: {}", pagesize_bytes);
-    // the buffer_size must be a multiple of the page size
-    buf_size = (
-            (min_buffer_size / pagesize_bytes) + 1
-    ) * pagesize_bytes;
-    num_elems = buf_size / elem_size;
-    logger->debug("Actual buffer size: {} bytes = {} elems", buf_size, num_elems);
-    buf_overlap = (
-            std::max(max_elems_per_read, max_elems_per_write)
-            * elem_size / pagesize_bytes + 1
-    ) * pagesize_bytes;
+    Geometry geometry;
+    int fd = -1;
+    if(page_size != PageSize::StandardPages) {
+        const size_t huge_page_bytes = size_t(1) << (
+            page_size == PageSize::HugePages1GB ? 30 : 21);
+        fd = create_backing_file(huge_page_bytes);
+        if(fd >= 0) {
+            page_size_bytes = huge_page_bytes;
+            geometry = get_sizes(min_num_elems, power_of_two);
+            // the huge page pool is only drawn from at mmap time
+            if(!map_buffer(fd, 0, geometry)) {
+                const int map_errno = errno;
+                close(fd);
+                fd = -1;
+                errno = map_errno;
+            }
+        }
+        if(fd < 0) {
+            logger->warn("{} byte huge pages unavailable ({}), falling back to standard pages",
+                huge_page_bytes, strerror(errno));
+        }
+    }
+    if(fd < 0) {
+        page_size_bytes = getpagesize();
+        geometry = get_sizes(min_num_elems, power_of_two);
+        // get a temporary file fd (physical store)
+        fd = create_backing_file(page_size_bytes);
+        if(fd < 0 || !map_buffer(fd, 0, geometry)) {
+            throw std::runtime_error(fmt::format("Failed to map buffer: {}", strerror(errno)));
+        }
+    }
+    // the mappings keep the file alive
+    close(fd);
+    publish(geometry);
+#endif
+    logger->debug("Page size: {}", page_size_bytes);
+    logger->debug("Actual buffer size: {} bytes = {} elems, {} planes",
+        buf_size.load(), num_elems.load(), num_planes);
 
 #ifdef _WIN32
     // following https://learn.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
@@ -169,34 +276,308 @@ RingBuffer::RingBuffer(
         UnmapViewOfFileEx(view2, 0);
     }
     
+#endif
+}
+
+int RingBuffer::remap(const size_t new_slack, const size_t start, const size_t end) {
+#ifdef __unix__
+    if(cross_process) {
+        return ENOTSUP;
+    }
+    const size_t old_num_elems = num_elems.load();
+    const size_t old_stride = get_plane_stride();
+    char* const old_buf_ptr = buf_ptr.load();
+    // Only published once the data is copied, so nothing reading the sizes
+    // meanwhile sees them before the new mapping holds the elements
+    Geometry geometry = get_sizes(new_slack * max_elems_per_read + max_elems_per_write, false);
+    if(end - start > geometry.num_elems) {
+        logger->warn("Can't resize to {} elems, {} elems are unread",
+            geometry.num_elems, end - start);
+        return ENOBUFS;
+    }
+    const int fd = create_backing_file(page_size_bytes);
+    if(fd < 0 || !map_buffer(fd, 0, geometry)) {
+        const int rc = errno;
+        if(fd >= 0) {
+            close(fd);
+        }
+        logger->error("Can't map a {} byte buffer: {}", geometry.buf_size, strerror(rc));
+        return rc;
+    }
+    // the mappings keep the file alive
+    close(fd);
+
+    // Elements live at their absolute index modulo the buffer size, so copy
+    // in chunks that wrap in neither the old buffer nor the new one
+    size_t index = start;
+    while(index < end) {
+        const size_t old_offset = index % old_num_elems;
+        const size_t new_offset = index % geometry.num_elems;
+        const size_t elems = std::min(
+            end - index,
+            std::min(old_num_elems - old_offset, geometry.num_elems - new_offset)
+        );
+        for(size_t plane = 0; plane < num_planes; plane++) {
+            memcpy(geometry.buf_ptr
+                    + plane * (geometry.buf_size + geometry.buf_overlap)
+                    + new_offset * elem_size,
+                old_buf_ptr + plane * old_stride + old_offset * elem_size,
+                elems * elem_size);
+        }
+        index += elems;
+    }
+    publish(geometry);
+    munmap(old_buf_ptr, num_planes * old_stride);
+    logger->info("Resized from {} to {} elems, keeping {} unread",
+        old_num_elems, geometry.num_elems, end - start);
+    slack = new_slack;
+    return 0;
+#else
+    (void)new_slack;
+    (void)start;
+    (void)end;
+    return ENOTSUP;
+#endif
+}
+
+std::shared_ptr<spdlog::logger> get_logger(
+        const std::string& name,
+        const std::string& loglevel
+) {
+    static std::mutex loggers_mutex;
+    static std::map<std::string, std::shared_ptr<spdlog::logger>> loggers;
+    static std::shared_ptr<spdlog::sinks::stdout_sink_mt> log_sink =
+        std::make_shared<spdlog::sinks::stdout_sink_mt>();
+    const std::string level = loglevel.empty() ? "error" : loglevel;
+    std::lock_guard<std::mutex> lock(loggers_mutex);
+    std::shared_ptr<spdlog::logger>& logger = loggers[name + "/" + level];
+    if(!logger) {
+        logger = std::make_shared<spdlog::logger>(name, log_sink);
+        logger->set_level(spdlog::level::from_str(level));
+    }
+    return logger;
+}
+
+void RingBuffer::set_wait_strategy(const WaitStrategy requested) {
+    wait_strategy = requested;
+    if(cross_process && wait_strategy == WaitStrategy::Condvar) {
+        // other processes can't notify buf_cv
+        logger->info("Condvar waits can't be woken by other processes, using Futex");
+        wait_strategy = WaitStrategy::Futex;
+    }
+#ifndef __linux__
+    if(wait_strategy == WaitStrategy::Futex) {
+        logger->warn("Futex waits are only supported on linux, using SpinYield");
+        wait_strategy = WaitStrategy::SpinYield;
+    }
+#endif
+}
+
+RingBuffer::Geometry RingBuffer::get_sizes(const size_t min_num_elems, const bool power_of_two) {
+    const size_t min_buffer_size = min_num_elems * elem_size;
+    logger->debug("Min buffer size: {}", min_buffer_size);
+    Geometry geometry;
+    if(power_of_two) {
+        // The page size is a power of two, so the fewest elements that fill
+        // a whole number of pages is too; any larger power of two does as well
+        geometry.num_elems = page_size_bytes / gcd(elem_size, page_size_bytes);
+        while(geometry.num_elems < min_num_elems) {
+            geometry.num_elems *= 2;
+        }
+        geometry.buf_size = geometry.num_elems * elem_size;
+    } else {
+        // the buffer_size must be a multiple of the page size
+        geometry.buf_size = (
+                (min_buffer_size / page_size_bytes) + 1
+        ) * page_size_bytes;
+        geometry.num_elems = geometry.buf_size / elem_size;
+    }
+    geometry.buf_overlap = (
+            std::max(max_elems_per_read, max_elems_per_write)
+            * elem_size / page_size_bytes + 1
+    ) * page_size_bytes;
+    geometry.buf_ptr = nullptr;
+    return geometry;
+}
+
+void RingBuffer::publish(const Geometry& geometry) {
+    buf_ptr.store(geometry.buf_ptr, std::memory_order_relaxed);
+    buf_size.store(geometry.buf_size, std::memory_order_relaxed);
+    buf_overlap.store(geometry.buf_overlap, std::memory_order_relaxed);
+    num_elems.store(geometry.num_elems, std::memory_order_release);
+}
+
+#ifdef __unix__
+bool RingBuffer::map_buffer(const int fd, const size_t offset, Geometry& geometry) {
+    const size_t buf_size = geometry.buf_size;
+    const size_t buf_overlap = geometry.buf_overlap;
+    // set it's size appropriately. We need exactly buf_size bytes per plane
+    // as underlying memory, after offset. Files that are already big enough
+    // (e.g. shared with another process) are left alone.
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0) {
+        return false;
+    }
+    if(static_cast<size_t>(file_stat.st_size) < offset + num_planes * buf_size
+            && ftruncate(fd, offset + num_planes * buf_size) != 0) {
+        return false;
+    }
+    // get virtual address space of (size = buf_size + buf_overlap) for each
+    // plane, aligned to the page size (huge page mappings must be)
+    const size_t mapped_size = num_planes * (buf_size + buf_overlap);
+    const size_t reserved_size = mapped_size + page_size_bytes;
+    char* reserved = static_cast<char*>(mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(reserved == MAP_FAILED) {
+        return false;
+    }
+    char* aligned = reserved + (
+        page_size_bytes - reinterpret_cast<uintptr_t>(reserved) % page_size_bytes
+    ) % page_size_bytes;
+    if(aligned != reserved) {
+        munmap(reserved, aligned - reserved);
+    }
+    munmap(aligned + mapped_size, reserved + reserved_size - (aligned + mapped_size));
+    // now map first half of each plane to underlying buffer, and similarly
+    // map overlap of each plane
+    for(size_t plane = 0; plane < num_planes; plane++) {
+        char* plane_ptr = aligned + plane * (buf_size + buf_overlap);
+        const size_t plane_offset = offset + plane * buf_size;
+        if(mmap(plane_ptr, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, plane_offset) == MAP_FAILED
+                || mmap(plane_ptr + buf_size, buf_overlap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, plane_offset) == MAP_FAILED) {
+            const int mmap_errno = errno;
+            munmap(aligned, mapped_size);
+            errno = mmap_errno;
+            return false;
+        }
+    }
+    geometry.buf_ptr = aligned;
+    return true;
+}
+#endif
+
+RingBuffer::RingBuffer(
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const int backing_fd,
+        const size_t backing_offset,
+        const WaitStrategy wait_strategy
+) :
+        elem_size(elem_size),
+        max_elems_per_write(max_elems_per_write),
+        max_elems_per_read(max_elems_per_read),
+        slack(slack),
+        num_planes(1),
+        buf_ptr(nullptr),
+        wait_state(&local_wait_state),
+        cross_process(true),
+        hold_timing(false),
+        trace(nullptr),
+        event_fds(nullptr)
+{
+    logger = get_logger("RingBuffer", loglevel);
+    set_wait_strategy(wait_strategy);
+#ifdef _WIN32
+    throw std::runtime_error("Buffers backed by a shared file aren't supported on Windows");
 #elif __unix__
-    // get virtual address space of (size = buf_size + buf_overlap) for our buffer
-    buf_ptr = static_cast<char*>(mmap(NULL, buf_size + buf_overlap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
-    // get a temporary file fd (physical store)
-    const auto fd = fileno(tmpfile ());
-    // set it's size appropriately. We need exactly `sz` bytes as underlying memory
-    ftruncate(fd, buf_size);
-    // now map first half of our buffer to underlying buffer
-    mmap(buf_ptr, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
-    // similarly map overlap of our buffer
-    mmap(buf_ptr + buf_size, buf_overlap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    page_size_bytes = getpagesize();
+    Geometry geometry = get_sizes(slack * max_elems_per_read + max_elems_per_write, false);
+    if(!map_buffer(backing_fd, backing_offset, geometry)) {
+        throw std::runtime_error(fmt::format("Failed to map buffer: {}", strerror(errno)));
+    }
+    publish(geometry);
+    logger->debug("Actual buffer size: {} bytes = {} elems at offset {}",
+        geometry.buf_size, geometry.num_elems, backing_offset);
 #endif
 }
 
 RingBuffer::~RingBuffer() {
 #ifdef _WIN32
-    UnmapViewOfFile(buf_ptr);
+    UnmapViewOfFile(buf_ptr.load());
     UnmapViewOfFile(secondary_view);
 #elif __unix__
-    munmap(buf_ptr, buf_size + buf_overlap);
+    munmap(buf_ptr.load(), num_planes * get_plane_stride());
+#endif
+}
+
+void RingBuffer::notify_waiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    EventFds* events = event_fds.load(std::memory_order_acquire);
+    if(events != nullptr) {
+        signal_event_fds(*events);
+    }
+    if(wait_state->waiters.load(std::memory_order_relaxed) == 0) {
+        return; // Spin and SpinYield waits don't register
+    }
+    if(wait_strategy == WaitStrategy::Condvar) {
+        // taking the lock ensures a waiter between its check and its wait
+        // can't miss this notification
+        std::unique_lock<std::mutex> lock = lock_buffer();
+        buf_cv.notify_all();
+    } else {
+        futex_wake();
+    }
+}
+
+void RingBuffer::notify_waiters_locked() {
+    if(wait_strategy == WaitStrategy::Condvar) {
+        EventFds* events = event_fds.load(std::memory_order_acquire);
+        if(events != nullptr) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            signal_event_fds(*events);
+        }
+        buf_cv.notify_all();
+    } else {
+        notify_waiters();
+    }
+}
+
+void RingBuffer::futex_wait(
+        const uint32_t expected,
+        const std::chrono::steady_clock::duration& timeout
+) {
+#ifdef __linux__
+    const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    struct timespec relative;
+    relative.tv_sec = secs.count();
+    relative.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - secs).count();
+    // the word may be shared with other processes, so only use the faster
+    // private futex when it can't be
+    syscall(
+        SYS_futex, &wait_state->futex_word,
+        cross_process ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+        expected, &relative, NULL, 0
+    );
+#else
+    (void)expected;
+    (void)timeout;
+#endif
+}
+
+void RingBuffer::futex_wake() {
+#ifdef __linux__
+    wait_state->futex_word.fetch_add(1, std::memory_order_release);
+    syscall(
+        SYS_futex, &wait_state->futex_word,
+        cross_process ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+        INT_MAX, NULL, NULL, 0
+    );
 #endif
 }
 
 size_t RingBuffer::get_buffer_size_elems() {
-    return num_elems;
+    return num_elems.load(std::memory_order_acquire);
 }
 size_t RingBuffer::get_buffer_size_bytes() {
-    return buf_size;
+    return buf_size.load();
+}
+size_t RingBuffer::get_page_size() {
+    return page_size_bytes;
+}
+WaitStrategy RingBuffer::get_wait_strategy() {
+    return wait_strategy;
 }
 size_t RingBuffer::get_elem_size() {
     return elem_size;
@@ -208,10 +589,191 @@ size_t RingBuffer::get_max_elems_per_read() {
     return max_elems_per_read;
 }
 
+RingBufferStats RingBuffer::get_stats() {
+    RingBufferStats stats;
+    counters.snapshot(stats);
+    return stats;
+}
+
+void RingBuffer::reset_stats() {
+    counters.reset();
+}
+
+void RingBuffer::set_hold_timing(const bool enabled) {
+    hold_timing.store(enabled, std::memory_order_relaxed);
+}
+
+int RingBuffer::enable_trace(const size_t capacity) {
+    std::lock_guard<std::mutex> lock(buf_mutex);
+    if(trace_storage) {
+        return EALREADY;
+    }
+    trace_storage.reset(new TraceRing(capacity));
+    trace.store(trace_storage.get(), std::memory_order_release);
+    return 0;
+}
+
+std::vector<TraceEvent> RingBuffer::get_trace() {
+    TraceRing* ring = trace.load(std::memory_order_acquire);
+    if(ring == nullptr) {
+        return std::vector<TraceEvent>();
+    }
+    return ring->snapshot();
+}
+
+int RingBuffer::dump_trace(const std::string& path) {
+    static const char* const EVENT_NAMES[] = {
+        "grab_write", "release_write", "grab_read", "release_read",
+        "write_full", "read_empty"
+    };
+    FILE* file = fopen(path.c_str(), "w");
+    if(file == NULL) {
+        return errno;
+    }
+    for(const TraceEvent& event : get_trace()) {
+        fprintf(file, "%llu %s %ld %llu %llu\n",
+            static_cast<unsigned long long>(event.timestamp),
+            EVENT_NAMES[event.type],
+            event.id == TRACE_NO_ID ? -1L : static_cast<long>(event.id),
+            static_cast<unsigned long long>(event.index),
+            static_cast<unsigned long long>(event.count));
+    }
+    return fclose(file) == 0 ? 0 : errno;
+}
+
+EventFds::~EventFds() {
+#ifdef __unix__
+    if(read_fd >= 0) {
+        close(read_fd);
+    }
+    if(write_fd >= 0) {
+        close(write_fd);
+    }
+#endif
+}
+
+int RingBuffer::enable_event_fds(const size_t read_threshold, const size_t write_threshold) {
+#ifdef __linux__
+    if(cross_process) {
+        return ENOTSUP;
+    }
+    if(read_threshold == 0 || read_threshold > max_elems_per_read
+            || write_threshold == 0 || write_threshold > max_elems_per_write) {
+        logger->error("Event fd thresholds must be from 1 to {} and {}, not {} and {}",
+            max_elems_per_read, max_elems_per_write, read_threshold, write_threshold);
+        return EINVAL;
+    }
+    std::lock_guard<std::mutex> lock(buf_mutex);
+    if(event_fds_storage) {
+        return EALREADY;
+    }
+    std::unique_ptr<EventFds> events(new EventFds(read_threshold, write_threshold));
+    events->read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    events->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(events->read_fd < 0 || events->write_fd < 0) {
+        const int rc = errno;
+        logger->error("Can't create event fds: {}", strerror(rc));
+        return rc;
+    }
+    event_fds_storage = std::move(events);
+    event_fds.store(event_fds_storage.get(), std::memory_order_release);
+    // anything already in the buffer won't be released again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    signal_event_fds(*event_fds_storage);
+    return 0;
+#else
+    (void)read_threshold;
+    (void)write_threshold;
+    return ENOTSUP;
+#endif
+}
+
+int RingBuffer::get_read_fd() {
+    EventFds* events = event_fds.load(std::memory_order_acquire);
+    return events != nullptr ? events->read_fd : -1;
+}
+
+int RingBuffer::get_write_fd() {
+    EventFds* events = event_fds.load(std::memory_order_acquire);
+    return events != nullptr ? events->write_fd : -1;
+}
+
+void RingBuffer::clear_read_fd() {
+#ifdef __linux__
+    EventFds* events = event_fds.load(std::memory_order_acquire);
+    if(events == nullptr) {
+        return;
+    }
+    // Drain before clearing the flag, so a signal in between isn't lost. The
+    // fence pairs with notify_waiters(): either the releaser sees the flag
+    // clear and signals, or the caller sees what it released.
+    eventfd_t value;
+    eventfd_read(events->read_fd, &value);
+    events->read_signalled.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+void RingBuffer::clear_write_fd() {
+#ifdef __linux__
+    EventFds* events = event_fds.load(std::memory_order_acquire);
+    if(events == nullptr) {
+        return;
+    }
+    eventfd_t value;
+    eventfd_read(events->write_fd, &value);
+    events->write_signalled.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+void RingBuffer::signal_event_fds(EventFds& events) {
+#ifdef __linux__
+    if(!events.read_signalled.load(std::memory_order_relaxed)
+            && get_elems_avail_to_read() >= events.read_threshold
+            && !events.read_signalled.exchange(true)) {
+        eventfd_write(events.read_fd, 1);
+    }
+    if(!events.write_signalled.load(std::memory_order_relaxed)
+            && get_elems_avail_to_write() >= events.write_threshold
+            && !events.write_signalled.exchange(true)) {
+        eventfd_write(events.write_fd, 1);
+    }
+#else
+    (void)events;
+#endif
+}
+
+std::unique_lock<std::mutex> RingBuffer::lock_buffer() {
+    std::unique_lock<std::mutex> lock(buf_mutex, std::try_to_lock);
+    if(!lock.owns_lock()) {
+        counters.count_contention();
+        lock.lock();
+    }
+    return lock;
+}
+
+int64_t RingBuffer::get_hold_start() {
+    if(!hold_timing.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RingBuffer::record_hold(const int64_t hold_start) {
+    if(hold_start == 0) {
+        return;
+    }
+    counters.hold_time.record(
+        std::chrono::steady_clock::now().time_since_epoch()
+        - std::chrono::nanoseconds(hold_start));
+}
+
 # if TESTING==1
 char* RingBuffer::_direct(const size_t byte_offset) {
     std::unique_lock<std::mutex> lock(buf_mutex);
-    return buf_ptr + byte_offset;
+    return buf_ptr.load() + byte_offset;
 }
 # endif
 
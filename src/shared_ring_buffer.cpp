@@ -0,0 +1,409 @@
+#ifdef __unix__
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <snake_charmer/shared_ring_buffer.h>
+
+
+namespace snake_charmer {
+
+namespace {
+// owner of a slot that's being reaped, so it isn't reused until it's free
+const int64_t REAPING_OWNER = -2;
+const int64_t OWNER_PID_MASK = 0xffffffff;
+const int64_t OWNER_START_TIME_MASK = 0x7fffffff;
+
+/**
+ * Get when process pid started, in clock ticks since boot, or 0 if that
+ * can't be read
+ */
+int64_t get_start_time(const int64_t pid) {
+#ifdef __linux__
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%lld/stat", static_cast<long long>(pid));
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return 0;
+    }
+    char stat[512];
+    const ssize_t length = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if(length <= 0) {
+        return 0;
+    }
+    stat[length] = '\0';
+    // the command name may hold spaces and brackets, so skip past its end.
+    // The start time is the 20th field after it.
+    const char* field = strrchr(stat, ')');
+    for(size_t n = 0; n < 20 && field != nullptr; n++) {
+        field = strchr(field + 1, ' ');
+    }
+    return field != nullptr ? strtoll(field + 1, nullptr, 10) : 0;
+#else
+    (void)pid;
+    return 0;
+#endif
+}
+}
+
+const uint64_t SharedDirectRingBuffer::MAGIC = 0x72616843656b616eULL; // "nakeChar"
+const uint64_t SharedDirectRingBuffer::VERSION = 4;
+
+SharedDirectRingBuffer::SharedDirectRingBuffer(
+        const std::string& name,
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        std::string loglevel,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers,
+        const WaitStrategy wait_strategy
+) :
+        SharedDirectRingBuffer(
+            name,
+            create_mapping(
+                name, elem_size, max_elems_per_write, max_elems_per_read, slack,
+                max_readers, read_mode, max_writers
+            ),
+            loglevel,
+            wait_strategy
+        )
+{
+}
+
+SharedDirectRingBuffer::SharedDirectRingBuffer(
+        const std::string& name,
+        std::string loglevel,
+        const WaitStrategy wait_strategy
+) :
+        SharedDirectRingBuffer(name, attach_mapping(name), loglevel, wait_strategy)
+{
+}
+
+SharedDirectRingBuffer::SharedDirectRingBuffer(
+        const std::string& name,
+        const Mapping& mapping,
+        std::string loglevel,
+        const WaitStrategy wait_strategy
+) try :
+        DirectRingBuffer(
+            get_header(mapping)->elem_size,
+            get_header(mapping)->max_elems_per_write,
+            get_header(mapping)->max_elems_per_read,
+            get_header(mapping)->slack,
+            loglevel,
+            get_header(mapping)->max_readers,
+            static_cast<ReadMode>(get_header(mapping)->read_mode),
+            get_header(mapping)->max_writers,
+            mapping.fd,
+            mapping.control_size,
+            mapping.control + sizeof(SharedRingBufferHeader),
+            mapping.created,
+            wait_strategy
+        ),
+        name(name),
+        mapping(mapping),
+        header(get_header(mapping))
+{
+    if(mapping.created) {
+        header->buf_size = buf_size.load();
+        header->num_elems = num_elems.load();
+        indices->write_index.owner.store(get_owner(getpid()));
+        // attachers may now use the indices
+        header->magic.store(MAGIC, std::memory_order_release);
+        logger->info("Created shared ring buffer {}", name);
+    } else {
+        if(header->buf_size != buf_size.load() || header->num_elems != num_elems.load()) {
+            throw std::runtime_error(fmt::format(
+                "Shared ring buffer {} is {} bytes, but would be {} bytes in this process",
+                name, header->buf_size, buf_size.load()));
+        }
+        logger->info("Attached to shared ring buffer {} created by {}",
+            name, header->creator_pid);
+    }
+    // the mappings keep the shared memory alive
+    close(mapping.fd);
+} catch(...) {
+    munmap(mapping.control, mapping.control_size);
+    close(mapping.fd);
+    if(mapping.created) {
+        shm_unlink(name.c_str());
+    }
+}
+
+SharedDirectRingBuffer::~SharedDirectRingBuffer() {
+    for(const size_t id : own_readers) {
+        DirectRingBuffer::remove_reader(id);
+    }
+    for(const size_t id : own_writers) {
+        release_abandoned_write(writers[id]);
+        writers[id].owner.store(FREE_OWNER);
+    }
+    if(mapping.created) {
+        release_abandoned_write(indices->write_index);
+        indices->write_index.owner.store(FREE_OWNER);
+        shm_unlink(name.c_str());
+    }
+    munmap(mapping.control, mapping.control_size);
+}
+
+SharedDirectRingBuffer::Mapping SharedDirectRingBuffer::create_mapping(
+        const std::string& name,
+        const size_t elem_size,
+        const size_t max_elems_per_write,
+        const size_t max_elems_per_read,
+        const size_t slack,
+        const size_t max_readers,
+        const ReadMode read_mode,
+        const size_t max_writers
+) {
+    Mapping mapping;
+    mapping.created = true;
+    mapping.control_size = get_control_size(max_readers, max_writers);
+    mapping.fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(mapping.fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to create shared memory {}: {}", name, strerror(errno)));
+    }
+    // the data is appended when it is mapped; this zeroes the control block
+    if(ftruncate(mapping.fd, mapping.control_size) == 0) {
+        mapping.control = static_cast<char*>(mmap(
+            NULL, mapping.control_size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0));
+    } else {
+        mapping.control = static_cast<char*>(MAP_FAILED);
+    }
+    if(mapping.control == MAP_FAILED) {
+        const int map_errno = errno;
+        close(mapping.fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error(fmt::format(
+            "Failed to map shared memory {}: {}", name, strerror(map_errno)));
+    }
+    SharedRingBufferHeader* header = get_header(mapping);
+    header->version = VERSION;
+    header->elem_size = elem_size;
+    header->max_elems_per_write = max_elems_per_write;
+    header->max_elems_per_read = max_elems_per_read;
+    header->slack = slack;
+    header->max_readers = max_readers;
+    header->max_writers = max_writers;
+    header->read_mode = read_mode;
+    header->creator_pid = getpid();
+    return mapping;
+}
+
+SharedDirectRingBuffer::Mapping SharedDirectRingBuffer::attach_mapping(
+        const std::string& name
+) {
+    Mapping mapping;
+    mapping.created = false;
+    mapping.fd = shm_open(name.c_str(), O_RDWR, 0);
+    if(mapping.fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open shared memory {}: {}", name, strerror(errno)));
+    }
+    struct stat file_stat;
+    if(fstat(mapping.fd, &file_stat) != 0
+            || static_cast<size_t>(file_stat.st_size) < sizeof(SharedRingBufferHeader)) {
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format("Shared ring buffer {} isn't ready", name));
+    }
+    // read the sizing, which determines the size of the control block
+    void* header_map = mmap(
+        NULL, sizeof(SharedRingBufferHeader), PROT_READ, MAP_SHARED, mapping.fd, 0);
+    if(header_map == MAP_FAILED) {
+        const int map_errno = errno;
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format(
+            "Failed to map shared memory {}: {}", name, strerror(map_errno)));
+    }
+    const SharedRingBufferHeader* header = static_cast<SharedRingBufferHeader*>(header_map);
+    const uint64_t magic = header->magic.load(std::memory_order_acquire);
+    const uint64_t version = header->version;
+    mapping.control_size = get_control_size(header->max_readers, header->max_writers);
+    munmap(header_map, sizeof(SharedRingBufferHeader));
+    if(magic != MAGIC || version != VERSION) {
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format(
+            "{} isn't a ready version {} shared ring buffer", name, VERSION));
+    }
+    mapping.control = static_cast<char*>(mmap(
+        NULL, mapping.control_size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0));
+    if(mapping.control == MAP_FAILED) {
+        const int map_errno = errno;
+        close(mapping.fd);
+        throw std::runtime_error(fmt::format(
+            "Failed to map shared memory {}: {}", name, strerror(map_errno)));
+    }
+    return mapping;
+}
+
+size_t SharedDirectRingBuffer::get_control_size(
+        const size_t max_readers,
+        const size_t max_writers
+) {
+    // the data that follows must start on a page boundary
+    const size_t page_size = getpagesize();
+    const size_t size = sizeof(SharedRingBufferHeader)
+        + get_indices_size(max_readers, max_writers);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+SharedRingBufferHeader* SharedDirectRingBuffer::get_header(const Mapping& mapping) {
+    return reinterpret_cast<SharedRingBufferHeader*>(mapping.control);
+}
+
+int64_t SharedDirectRingBuffer::get_owner(const int64_t pid) {
+    return (get_start_time(pid) & OWNER_START_TIME_MASK) << 32 | pid;
+}
+
+bool SharedDirectRingBuffer::is_alive(const int64_t owner) {
+    const int64_t pid = owner & OWNER_PID_MASK;
+    // EPERM means it exists, but belongs to someone else
+    if(pid != getpid() && kill(pid, 0) != 0 && errno == ESRCH) {
+        return false;
+    }
+    // if the start time differs, the pid has since been given to another
+    // process. Without one to compare, assume it hasn't.
+    const int64_t start_time = owner >> 32;
+    const int64_t current_start_time = get_start_time(pid) & OWNER_START_TIME_MASK;
+    return start_time == 0 || current_start_time == 0 || start_time == current_start_time;
+}
+
+size_t SharedDirectRingBuffer::add_reader() {
+    const size_t id = DirectRingBuffer::add_reader();
+    readers[id].owner.store(get_owner(getpid()));
+    std::lock_guard<std::mutex> lock(buf_mutex);
+    own_readers.push_back(id);
+    return id;
+}
+
+size_t SharedDirectRingBuffer::add_writer() {
+    const size_t id = DirectRingBuffer::add_writer();
+    writers[id].owner.store(get_owner(getpid()));
+    std::lock_guard<std::mutex> lock(buf_mutex);
+    own_writers.push_back(id);
+    return id;
+}
+
+int SharedDirectRingBuffer::remove_reader(const size_t id) {
+    {
+        // so the destructor doesn't remove it again once it's been reused
+        std::lock_guard<std::mutex> lock(buf_mutex);
+        own_readers.erase(std::remove(own_readers.begin(), own_readers.end(), id),
+            own_readers.end());
+    }
+    return DirectRingBuffer::remove_reader(id);
+}
+
+int SharedDirectRingBuffer::grab_read(
+        char*& elem_ptr,
+        const size_t elems_this_read,
+        const size_t id,
+        const std::chrono::microseconds& timeout
+) {
+    int rc = DirectRingBuffer::grab_read(elem_ptr, elems_this_read, id, timeout);
+    if(rc == ENOMSG && !is_writer_alive()) {
+        // a writer may have released more just before it went away
+        rc = DirectRingBuffer::grab_read(
+            elem_ptr, elems_this_read, id, std::chrono::microseconds(0));
+        if(rc == ENOMSG) {
+            return EPIPE;
+        }
+    }
+    return rc;
+}
+
+int SharedDirectRingBuffer::grab_read_upto(
+        char*& elem_ptr,
+        size_t& elems_grabbed,
+        const size_t max_elems_this_read,
+        const size_t id,
+        const std::chrono::microseconds& timeout
+) {
+    int rc = DirectRingBuffer::grab_read_upto(
+        elem_ptr, elems_grabbed, max_elems_this_read, id, timeout);
+    if(rc == ENOMSG && !is_writer_alive()) {
+        // a writer may have released more just before it went away
+        rc = DirectRingBuffer::grab_read_upto(
+            elem_ptr, elems_grabbed, max_elems_this_read, id, std::chrono::microseconds(0));
+        if(rc == ENOMSG) {
+            return EPIPE;
+        }
+    }
+    return rc;
+}
+
+size_t SharedDirectRingBuffer::reap_dead_peers() {
+    size_t reaped = 0;
+    // the CAS ensures only one process reaps each slot, and the slot is only
+    // freed for reuse once it's been reaped
+    const size_t num_readers = std::min(indices->num_readers.load(), max_readers);
+    for(size_t id = 0; id < num_readers; id++) {
+        int64_t owner = readers[id].owner.load();
+        if(owner > 0 && !is_alive(owner)
+                && readers[id].owner.compare_exchange_strong(owner, REAPING_OWNER)) {
+            logger->warn("Reader {} of dead process {} removed",
+                id, owner & OWNER_PID_MASK);
+            DirectRingBuffer::remove_reader(id);
+            reaped++;
+        }
+    }
+    const size_t num_writers = std::min(indices->num_writers.load(), max_writers);
+    for(size_t id = 0; id <= num_writers; id++) {
+        // the last slot checked is the built-in writer
+        BufferIndex& index = id < num_writers ? writers[id] : indices->write_index;
+        int64_t owner = index.owner.load();
+        if(owner > 0 && !is_alive(owner)
+                && index.owner.compare_exchange_strong(owner, REAPING_OWNER)) {
+            const size_t lost = release_abandoned_write(index);
+            if(lost > 0) {
+                logger->error("Zeroed {} elements grabbed by writer {} of dead process {}",
+                    lost, id, owner & OWNER_PID_MASK);
+            } else {
+                logger->warn("Writer {} of dead process {} removed",
+                    id, owner & OWNER_PID_MASK);
+            }
+            index.owner.store(FREE_OWNER);
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+bool SharedDirectRingBuffer::is_writer_alive() {
+    // slots are claimed just before their owner is set, so 0 is a writer
+    // being added
+    auto alive = [](const int64_t owner) {
+        return owner == 0 || (owner > 0 && is_alive(owner));
+    };
+    if(alive(indices->write_index.owner.load())) {
+        return true;
+    }
+    const size_t num_writers = std::min(indices->num_writers.load(), max_writers);
+    for(size_t id = 0; id < num_writers; id++) {
+        if(alive(writers[id].owner.load())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string SharedDirectRingBuffer::get_name() {
+    return name;
+}
+
+}; // namespace snake_charmer
+#endif
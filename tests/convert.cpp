@@ -0,0 +1,154 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/convert.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace snake_charmer;
+
+namespace {
+const std::vector<std::string> ISAS = {"avx512", "avx2", "neon", "scalar"};
+const std::vector<SampleFormat> FORMATS = {
+    SampleFormat::Int8, SampleFormat::Int16, SampleFormat::Float32, SampleFormat::BFloat16};
+
+// Reference conversion of one sample, one step at a time
+void convert_one(const char* src, char* dst, const SampleConversion& conversion) {
+    const size_t from_size = get_sample_size(conversion.from);
+    unsigned char bytes[4];
+    memcpy(bytes, src, from_size);
+    if(conversion.byteswap) {
+        for(size_t n = 0; n < from_size / 2; n++) {
+            std::swap(bytes[n], bytes[from_size - 1 - n]);
+        }
+    }
+    float value = 0;
+    if(conversion.from == SampleFormat::Int8) {
+        int8_t sample;
+        memcpy(&sample, bytes, 1);
+        value = sample;
+    } else if(conversion.from == SampleFormat::Int16) {
+        int16_t sample;
+        memcpy(&sample, bytes, 2);
+        value = sample;
+    } else if(conversion.from == SampleFormat::Float32) {
+        memcpy(&value, bytes, 4);
+    } else {
+        uint16_t half;
+        memcpy(&half, bytes, 2);
+        const uint32_t bits = static_cast<uint32_t>(half) << 16;
+        memcpy(&value, &bits, 4);
+    }
+    value *= conversion.scale;
+    if(conversion.to == SampleFormat::Int8) {
+        const int8_t sample = static_cast<int8_t>(std::nearbyint(
+            std::isnan(value) ? -128.0f : std::min(std::max(value, -128.0f), 127.0f)));
+        memcpy(dst, &sample, 1);
+    } else if(conversion.to == SampleFormat::Int16) {
+        const int16_t sample = static_cast<int16_t>(std::nearbyint(
+            std::isnan(value) ? -32768.0f : std::min(std::max(value, -32768.0f), 32767.0f)));
+        memcpy(dst, &sample, 2);
+    } else if(conversion.to == SampleFormat::Float32) {
+        memcpy(dst, &value, 4);
+    } else {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        const uint16_t half = static_cast<uint16_t>((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+        memcpy(dst, &half, 2);
+    }
+}
+
+// Samples of format covering its range, with rounding ties and saturation
+std::vector<char> make_samples(const SampleFormat format, const size_t num_samples) {
+    const size_t sample_size = get_sample_size(format);
+    std::vector<char> samples(num_samples * sample_size);
+    for(size_t n = 0; n < num_samples; n++) {
+        char* sample = samples.data() + n * sample_size;
+        if(format == SampleFormat::Int8) {
+            const int8_t value = static_cast<int8_t>(n * 37);
+            memcpy(sample, &value, 1);
+        } else if(format == SampleFormat::Int16) {
+            const int16_t value = static_cast<int16_t>(n * 4099);
+            memcpy(sample, &value, 2);
+        } else {
+            // halves and larger than any integer format, both signs
+            const float values[] = {0.5f, -1.5f, 2.5f, 1e6f, -1e6f, 127.4f, -3.75f, 40000.0f,
+                std::numeric_limits<float>::quiet_NaN()};
+            float value = values[n % 9] + (n / 9) * 0.25f;
+            if(format == SampleFormat::Float32) {
+                memcpy(sample, &value, 4);
+            } else {
+                uint32_t bits;
+                memcpy(&bits, &value, 4);
+                const uint16_t half = static_cast<uint16_t>(bits >> 16);
+                memcpy(sample, &half, 2);
+            }
+        }
+    }
+    return samples;
+}
+}
+
+TEST_CASE("testing sample conversions match the reference on every kernel") {
+    CHECK(get_sample_size(SampleFormat::Int8) == 1);
+    CHECK(get_sample_size(SampleFormat::BFloat16) == 2);
+    CHECK(get_sample_size(static_cast<SampleFormat>(4)) == 0);
+    const std::string best_isa = get_conversion_isa();
+    size_t isas_tested = 0;
+    for(const std::string& isa : ISAS) {
+        const int rc = set_conversion_isa(isa);
+        CHECK((rc == 0 || rc == ENOTSUP));
+        if(rc != 0) {
+            continue;
+        }
+        isas_tested++;
+        CHECK(get_conversion_isa() == isa);
+        for(const SampleFormat from : FORMATS) {
+            for(const SampleFormat to : FORMATS) {
+                for(const float scale : {1.0f, 1.0f / 128, 3.0f}) {
+                    for(const bool byteswap : {false, true}) {
+                        const SampleConversion conversion = {from, to, scale, byteswap};
+                        // every tail length, and across a block
+                        for(const size_t num_samples : {0, 1, 7, 15, 16, 17, 31, 33, 65, 600}) {
+                            const std::vector<char> src = make_samples(from, num_samples);
+                            std::vector<char> dst(num_samples * get_sample_size(to));
+                            std::vector<char> expected(dst.size());
+                            CHECK(convert_samples(dst.data(), src.data(), num_samples, conversion) == 0);
+                            for(size_t n = 0; n < num_samples; n++) {
+                                convert_one(src.data() + n * get_sample_size(from),
+                                    expected.data() + n * get_sample_size(to), conversion);
+                            }
+                            CHECK(dst == expected);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    CHECK(isas_tested >= 1);
+    CHECK(set_conversion_isa(best_isa) == 0);
+    CHECK(set_conversion_isa("sse9") == EINVAL);
+    char dst[4];
+    const SampleConversion invalid = {SampleFormat::Int8, static_cast<SampleFormat>(7), 1.0f, false};
+    CHECK(convert_samples(dst, "abcd", 4, invalid) == EINVAL);
+}
+
+TEST_CASE("testing int16 iq normalises to floats") {
+    const std::vector<int16_t> iq = {0, 16384, -32768, 32767, 1, -1};
+    std::vector<float> floats(iq.size());
+    const SampleConversion to_float = {SampleFormat::Int16, SampleFormat::Float32, 1.0f / 32768, false};
+    REQUIRE(convert_samples(reinterpret_cast<char*>(floats.data()),
+        reinterpret_cast<const char*>(iq.data()), iq.size(), to_float) == 0);
+    CHECK(floats == std::vector<float>({0.0f, 0.5f, -1.0f, 32767.0f / 32768, 1.0f / 32768, -1.0f / 32768}));
+
+    // and back, saturating what's out of range
+    floats.push_back(1.5f);
+    std::vector<int16_t> back(floats.size());
+    const SampleConversion from_float = {SampleFormat::Float32, SampleFormat::Int16, 32768.0f, false};
+    REQUIRE(convert_samples(reinterpret_cast<char*>(back.data()),
+        reinterpret_cast<const char*>(floats.data()), floats.size(), from_float) == 0);
+    CHECK(back == std::vector<int16_t>({0, 16384, -32768, 32767, 1, -1, 32767}));
+}
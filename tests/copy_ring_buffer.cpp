@@ -1,10 +1,17 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
+#include <atomic>
 #include <vector>
 #include <spdlog/spdlog.h>
+#include <snake_charmer/copy_engine.h>
 #include <snake_charmer/copy_ring_buffer.h>
 #include <chrono>
 #include <string.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#endif
 
 using namespace snake_charmer;
 
@@ -131,4 +138,472 @@ TEST_CASE("testing the copy_ring_buffer") {
     }
 }
 
+TEST_CASE("testing the copy_ring_buffer in SPSC mode") {
+    size_t elem_size = sizeof(uint64_t);
+    size_t max_elems_per_write = 4;
+    size_t max_elems_per_read = 4;
+    size_t slack = 2;
+    CopyRingBuffer ring_buffer(
+        elem_size,
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        CopyMode::SPSC
+    );
+    CHECK(ring_buffer.get_mode() == CopyMode::SPSC);
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+
+    // Test that the same error codes are returned as in locked mode
+    std::vector<uint64_t> elems(max_elems_per_write + 1);
+    int rc = ring_buffer.write(
+        reinterpret_cast<const char*>(elems.data()),
+        max_elems_per_write + 1
+    );
+    CHECK(rc == EMSGSIZE);
+    rc = ring_buffer.read(reinterpret_cast<char*>(elems.data()), 1);
+    CHECK(rc == ENOMSG);
+    for (uint64_t n = 0; n < num_elems; n++) {
+        rc = ring_buffer.write(reinterpret_cast<const char*>(&n), 1);
+        CHECK(rc == 0);
+    }
+    uint64_t value = 0;
+    rc = ring_buffer.write(reinterpret_cast<const char*>(&value), 1);
+    CHECK(rc == ENOBUFS);
+
+    // Test that the timeout is respected
+    auto start_time = std::chrono::steady_clock::now();
+    rc = ring_buffer.write(reinterpret_cast<const char*>(&value), 1, std::chrono::microseconds(10000));
+    auto end_time = std::chrono::steady_clock::now();
+    CHECK(rc == ENOBUFS);
+    auto elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count();
+    CHECK(elapsed_time > 9000);
+    // loose, since other tests may be loading the machine
+    CHECK(elapsed_time < 1000000);
+
+    // Test that an overlapped read only advances by advance_size
+    rc = ring_buffer.read(reinterpret_cast<char*>(elems.data()), 2, std::chrono::microseconds(0), 1);
+    CHECK(rc == 0);
+    CHECK(elems[0] == 0);
+    CHECK(elems[1] == 1);
+    for (uint64_t n = 1; n < num_elems; n++) {
+        rc = ring_buffer.read(reinterpret_cast<char*>(&value), 1);
+        CHECK(rc == 0);
+        CHECK(value == n);
+    }
+
+    // Test that a blocked producer and consumer stream in order
+    const uint64_t total = 100000;
+    std::thread producer([&]() {
+        std::vector<uint64_t> out(max_elems_per_write);
+        uint64_t next = 0;
+        while (next < total) {
+            size_t count = std::min<uint64_t>(max_elems_per_write, total - next);
+            for (size_t n = 0; n < count; n++) {
+                out[n] = next + n;
+            }
+            int write_rc = ring_buffer.write(
+                reinterpret_cast<const char*>(out.data()),
+                count,
+                std::chrono::microseconds(100000)
+            );
+            if (write_rc == 0) {
+                next += count;
+            }
+        }
+    });
+    std::vector<uint64_t> in(max_elems_per_read);
+    uint64_t expected = 0;
+    bool in_order = true;
+    while (expected < total) {
+        size_t count = std::min<uint64_t>(max_elems_per_read, total - expected);
+        rc = ring_buffer.read(
+            reinterpret_cast<char*>(in.data()),
+            count,
+            std::chrono::microseconds(100000)
+        );
+        if (rc != 0) {
+            continue;
+        }
+        for (size_t n = 0; n < count; n++) {
+            in_order = in_order && (in[n] == expected + n);
+        }
+        expected += count;
+    }
+    producer.join();
+    CHECK(in_order);
+}
+
+TEST_CASE("testing the copy_ring_buffer backed by huge pages") {
+    // Huge pages may not be reserved on this host, in which case the buffer
+    // falls back to standard pages; either way it must stay mirrored
+    size_t elem_size = 1 << 16;
+    size_t max_elems_per_write = 3;
+    size_t max_elems_per_read = 3;
+    size_t slack = 2;
+    CopyRingBuffer ring_buffer(
+        elem_size,
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        CopyMode::Locked,
+        PageSize::HugePages2MB
+    );
+    const size_t page_size = ring_buffer.get_page_size();
+    CHECK((page_size == (1 << 21) || page_size == static_cast<size_t>(getpagesize())));
+    CHECK(ring_buffer.get_buffer_size_bytes() % page_size == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() >= slack * max_elems_per_read + max_elems_per_write);
+
+    # if TESTING==1
+    char* tail = ring_buffer._direct(ring_buffer.get_buffer_size_bytes());
+    char* head = ring_buffer._direct(0);
+    CHECK(reinterpret_cast<uintptr_t>(head) % page_size == 0);
+    *tail = 51;  // arbitrary number
+    CHECK(*head == *tail);
+    # endif
+
+    // Test that elements straddling the end of the buffer read back intact
+    std::vector<uint8_t> elems(elem_size * max_elems_per_write);
+    std::vector<uint8_t> read_elems(elems.size());
+    int rc = 0;
+    uint8_t value = 0;
+    for (size_t n = 0; n < 2 * ring_buffer.get_buffer_size_elems(); n++) {
+        std::fill(elems.begin(), elems.end(), ++value);
+        rc = ring_buffer.write(reinterpret_cast<const char*>(elems.data()), max_elems_per_write);
+        CHECK(rc == 0);
+        rc = ring_buffer.read(reinterpret_cast<char*>(read_elems.data()), max_elems_per_write);
+        CHECK(rc == 0);
+        CHECK(read_elems.front() == value);
+        CHECK(read_elems.back() == value);
+    }
+
+    // Test that unavailable huge pages fall back to standard pages
+    CopyRingBuffer fallback(
+        elem_size,
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "error",
+        CopyMode::Locked,
+        PageSize::HugePages1GB
+    );
+    CHECK(fallback.get_buffer_size_bytes() % fallback.get_page_size() == 0);
+    CHECK(fallback.write(reinterpret_cast<const char*>(elems.data()), 1) == 0);
+}
+
+TEST_CASE("testing the copy_ring_buffer wait strategies") {
+    const WaitStrategy strategies[] = {
+        WaitStrategy::Condvar, WaitStrategy::Spin,
+        WaitStrategy::SpinYield, WaitStrategy::Futex
+    };
+    const CopyMode modes[] = {CopyMode::Locked, CopyMode::SPSC};
+    for (const CopyMode mode : modes) {
+        for (const WaitStrategy strategy : strategies) {
+            CopyRingBuffer ring_buffer(
+                sizeof(uint64_t), 4, 4, 2, "warning", mode,
+                PageSize::StandardPages, strategy
+            );
+            CHECK(ring_buffer.get_wait_strategy() == strategy);
+
+            // Test that the timeout is respected
+            uint64_t value = 0;
+            auto start_time = std::chrono::steady_clock::now();
+            int rc = ring_buffer.read(reinterpret_cast<char*>(&value), 1, std::chrono::microseconds(10000));
+            auto end_time = std::chrono::steady_clock::now();
+            CHECK(rc == ENOMSG);
+            auto elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count();
+            CHECK(elapsed_time >= 10000);
+            // loose, since other tests may be loading the machine
+            CHECK(elapsed_time < 1000000);
 
+            // Test that blocked readers and writers are woken
+            const uint64_t total = 20000;
+            std::thread producer([&]() {
+                uint64_t next = 0;
+                while (next < total) {
+                    if (ring_buffer.write(reinterpret_cast<const char*>(&next), 1,
+                            std::chrono::microseconds(100000)) == 0) {
+                        next++;
+                    }
+                }
+            });
+            uint64_t expected = 0;
+            bool in_order = true;
+            while (expected < total) {
+                if (ring_buffer.read(reinterpret_cast<char*>(&value), 1,
+                        std::chrono::microseconds(100000)) == 0) {
+                    in_order = in_order && value == expected;
+                    expected++;
+                }
+            }
+            producer.join();
+            CHECK(in_order);
+        }
+    }
+}
+
+TEST_CASE("testing the copy_ring_buffer statistics") {
+    for (const CopyMode mode : {CopyMode::Locked, CopyMode::SPSC}) {
+        CopyRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning", mode);
+        const size_t num_elems = ring_buffer.get_buffer_size_elems();
+        uint64_t value = 0;
+        for (size_t n = 0; n < num_elems; n++) {
+            CHECK(ring_buffer.write(reinterpret_cast<const char*>(&value), 1) == 0);
+        }
+        CHECK(ring_buffer.write(reinterpret_cast<const char*>(&value), 1) == ENOBUFS);
+        for (size_t n = 0; n < num_elems; n++) {
+            CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1) == 0);
+        }
+        CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1,
+            std::chrono::microseconds(1000)) == ENOMSG);
+
+        RingBufferStats stats = ring_buffer.get_stats();
+        CHECK(stats.fill_high_water == num_elems);
+        CHECK(stats.buffer_full_count == 1);
+        CHECK(stats.buffer_empty_count == 1);
+        CHECK(stats.bytes_written == num_elems * sizeof(uint64_t));
+        CHECK(stats.bytes_read == num_elems * sizeof(uint64_t));
+        // only the read with a timeout blocked
+        CHECK(stats.wait_time.get_count() == 1);
+        CHECK(stats.wait_time.get_quantile(0.5) >= std::chrono::microseconds(1000));
+
+        ring_buffer.reset_stats();
+        stats = ring_buffer.get_stats();
+        CHECK(stats.fill_high_water == 0);
+        CHECK(stats.bytes_written == 0);
+        CHECK(stats.wait_time.get_count() == 0);
+        CHECK(stats.wait_time.get_quantile(0.5).count() == 0);
+    }
+}
+
+TEST_CASE("testing the copy_ring_buffer in overwrite mode") {
+    for (const CopyMode mode : {CopyMode::Locked, CopyMode::SPSC}) {
+        CopyRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning", mode,
+            PageSize::StandardPages, WaitStrategy::Condvar, OverflowPolicy::Overwrite);
+        CHECK(ring_buffer.get_overflow_policy() == OverflowPolicy::Overwrite);
+        const size_t num_elems = ring_buffer.get_buffer_size_elems();
+
+        // Test that the writer overruns the reader instead of failing
+        for (uint64_t n = 0; n < 3 * num_elems; n++) {
+            CHECK(ring_buffer.write(reinterpret_cast<const char*>(&n), 1) == 0);
+        }
+        uint64_t value;
+        size_t skipped;
+        CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1, skipped) == 0);
+        CHECK(value == 2 * num_elems);
+        CHECK(skipped == 2 * num_elems);
+        CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1, skipped) == 0);
+        CHECK(value == 2 * num_elems + 1);
+        CHECK(skipped == 0);
+        RingBufferStats stats = ring_buffer.get_stats();
+        CHECK(stats.elems_overwritten == 2 * num_elems);
+        CHECK(stats.buffer_full_count == 0);
+        CHECK(stats.fill_high_water == num_elems);
+        for (uint64_t n = 2 * num_elems + 2; n < 3 * num_elems; n++) {
+            CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1, skipped) == 0);
+            CHECK(value == n);
+            CHECK(skipped == 0);
+        }
+        CHECK(ring_buffer.read(reinterpret_cast<char*>(&value), 1, skipped) == ENOMSG);
+
+        // Test that a reader that can't keep up gets whole, contiguous reads,
+        // and accounts for every element it missed
+        const uint64_t total = 200000;
+        std::atomic<bool> done(false);
+        std::thread producer([&]() {
+            std::vector<uint64_t> out(4);
+            for (uint64_t next = 3 * num_elems; next < total; next += out.size()) {
+                for (size_t n = 0; n < out.size(); n++) {
+                    out[n] = next + n;
+                }
+                ring_buffer.write(reinterpret_cast<const char*>(out.data()), out.size());
+            }
+            done.store(true);
+        });
+        std::vector<uint64_t> in(4);
+        uint64_t expected = 3 * num_elems;
+        bool contiguous = true;
+        bool accounted = true;
+        while (true) {
+            int rc = ring_buffer.read(reinterpret_cast<char*>(in.data()), in.size(), skipped,
+                std::chrono::microseconds(1000));
+            if (rc != 0) {
+                if (done.load()) {
+                    break;
+                }
+                continue;
+            }
+            accounted = accounted && in[0] == expected + skipped;
+            for (size_t n = 0; n < in.size(); n++) {
+                contiguous = contiguous && in[n] == in[0] + n;
+            }
+            expected = in[0] + in.size();
+        }
+        producer.join();
+        CHECK(contiguous);
+        CHECK(accounted);
+        CHECK(expected == total);
+    }
+}
+
+TEST_CASE("testing the copy_ring_buffer resize") {
+    // 4 byte elements, so the buffer is 1024 elements per page
+    CopyRingBuffer ring_buffer(sizeof(int), 4, 4, 2, "error");
+    REQUIRE(ring_buffer.get_buffer_size_elems() == 1024);
+    int written = 0;
+    int next = 0;
+    size_t errors = 0;
+    auto write = [&](const int elems) {
+        for(int n = 0; n < elems; n++, written++) {
+            REQUIRE(ring_buffer.write(reinterpret_cast<const char*>(&written), 1) == 0);
+        }
+    };
+    auto read = [&](const int elems) {
+        for(int n = 0; n < elems; n++, next++) {
+            int value;
+            REQUIRE(ring_buffer.read(reinterpret_cast<char*>(&value), 1) == 0);
+            if(value != next) {
+                errors++;
+            }
+        }
+    };
+
+    // the unread elements wrap around the end of the buffer
+    write(1024);
+    read(600);
+    write(600);
+    CHECK(ring_buffer.get_elems_avail_to_write() == 0);
+    CHECK(ring_buffer.resize(300) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() == 2048);
+    write(1000);
+    CHECK(ring_buffer.resize(2) == ENOBUFS);
+    read(1500);
+    CHECK(ring_buffer.resize(2) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() == 1024);
+    read(written - next);
+    write(1000);
+    read(1000);
+    CHECK(errors == 0);
+
+    CopyRingBuffer spsc(sizeof(int), 4, 4, 2, "error", CopyMode::SPSC);
+    CHECK(spsc.resize(300) == ENOTSUP);
+}
+
+TEST_CASE("testing the copy_ring_buffer copies around the cache") {
+    // every alignment and tail of the streaming stores
+    std::vector<char> src(5000);
+    for(size_t n = 0; n < src.size(); n++) {
+        src[n] = static_cast<char>(n * 7);
+    }
+    for(const size_t offset : {0, 1, 15, 63}) {
+        for(const size_t bytes : {0, 1, 63, 64, 65, 200, 4096, 4900}) {
+            std::vector<char> streamed(5000 + 64, 0);
+            std::vector<char> prefetched(5000 + 64, 0);
+            copy_streaming(streamed.data() + offset, src.data(), bytes);
+            copy_prefetching(prefetched.data() + offset, src.data(), bytes);
+            CHECK(memcmp(streamed.data() + offset, src.data(), bytes) == 0);
+            CHECK(memcmp(prefetched.data() + offset, src.data(), bytes) == 0);
+            CHECK(streamed[offset + bytes] == 0);
+            CHECK(prefetched[offset + bytes] == 0);
+        }
+    }
+
+    for(const CopyMode mode : {CopyMode::Locked, CopyMode::SPSC}) {
+        CopyRingBuffer ring_buffer(1000, 3, 3, 2, "error", mode);
+        CHECK(ring_buffer.get_copy_threshold() == CopyRingBuffer::DEFAULT_COPY_THRESHOLD);
+        // everything bypasses the cache, across the wrap too
+        ring_buffer.set_copy_threshold(0);
+        CHECK(ring_buffer.get_copy_threshold() == 0);
+        std::vector<char> elems(3000);
+        std::vector<char> dest(3000);
+        size_t errors = 0;
+        for(size_t n = 0; n < 100; n++) {
+            for(size_t byte = 0; byte < elems.size(); byte++) {
+                elems[byte] = static_cast<char>(n + byte);
+            }
+            REQUIRE(ring_buffer.write(elems.data(), 1 + n % 3) == 0);
+            REQUIRE(ring_buffer.read(dest.data(), 1 + n % 3) == 0);
+            if(memcmp(elems.data(), dest.data(), 1000 * (1 + n % 3)) != 0) {
+                errors++;
+            }
+        }
+        CHECK(errors == 0);
+    }
+}
+
+TEST_CASE("testing the copy_ring_buffer converts samples") {
+    for(const CopyMode mode : {CopyMode::Locked, CopyMode::SPSC}) {
+        // complex float elements, written as big endian int16 IQ
+        CopyRingBuffer ring_buffer(2 * sizeof(float), 64, 64, 2, "error", mode);
+        const SampleConversion from_radio = {SampleFormat::Int16, SampleFormat::Float32,
+            1.0f / 32768, true};
+        const size_t num_elems = 1000;
+        std::vector<uint16_t> iq(2 * num_elems);
+        for(size_t n = 0; n < iq.size(); n++) {
+            const uint16_t sample = static_cast<uint16_t>(n * 64 - 32768);
+            iq[n] = static_cast<uint16_t>((sample >> 8) | (sample << 8));
+        }
+        size_t errors = 0;
+        for(size_t n = 0; n < num_elems; n += 50) {
+            REQUIRE(ring_buffer.write(
+                reinterpret_cast<const char*>(iq.data() + 2 * n), 50, from_radio) == 0);
+            std::vector<float> elems(2 * 50);
+            REQUIRE(ring_buffer.read(reinterpret_cast<char*>(elems.data()), 50) == 0);
+            for(size_t sample = 0; sample < elems.size(); sample++) {
+                const int16_t expected = static_cast<int16_t>((2 * n + sample) * 64 - 32768);
+                if(elems[sample] != expected / 32768.0f) {
+                    errors++;
+                }
+            }
+        }
+        CHECK(errors == 0);
+
+        // reading converts the other way
+        std::vector<float> elems = {0.25f, -0.5f, 1.0f, -2.0f};
+        REQUIRE(ring_buffer.write(reinterpret_cast<const char*>(elems.data()), 2) == 0);
+        std::vector<int8_t> bytes(4);
+        const SampleConversion to_int8 = {SampleFormat::Float32, SampleFormat::Int8, 128.0f, false};
+        REQUIRE(ring_buffer.read(reinterpret_cast<char*>(bytes.data()), 2, to_int8) == 0);
+        CHECK(bytes == std::vector<int8_t>({32, -64, 127, -128}));
+
+        // the elements must be whole samples of the buffer's format
+        CopyRingBuffer odd(6, 4, 4, 2, "off", mode);
+        CHECK(odd.write(reinterpret_cast<const char*>(iq.data()), 1, from_radio) == EINVAL);
+        CHECK(odd.read(reinterpret_cast<char*>(bytes.data()), 1, to_int8) == EINVAL);
+    }
+}
+
+#ifdef __linux__
+TEST_CASE("testing the copy_ring_buffer event fds") {
+    for(const CopyMode mode : {CopyMode::Locked, CopyMode::SPSC}) {
+        CopyRingBuffer ring_buffer(sizeof(int), 4, 4, 2, "error", mode);
+        REQUIRE(ring_buffer.enable_event_fds(2, 4) == 0);
+        struct pollfd poll_fds[2];
+        poll_fds[0].fd = ring_buffer.get_read_fd();
+        poll_fds[1].fd = ring_buffer.get_write_fd();
+        poll_fds[0].events = poll_fds[1].events = POLLIN;
+        CHECK(poll(poll_fds, 2, 0) == 1);
+        CHECK(poll_fds[1].revents == POLLIN);
+        ring_buffer.clear_write_fd();
+
+        const std::vector<int> values = {1, 2, 3, 4};
+        CHECK(ring_buffer.write(reinterpret_cast<const char*>(values.data()), 1) == 0);
+        CHECK(poll(poll_fds, 1, 0) == 0);
+        CHECK(ring_buffer.get_elems_avail_to_read() == 1);
+        CHECK(ring_buffer.write(reinterpret_cast<const char*>(values.data()), 4) == 0);
+        CHECK(poll(poll_fds, 1, 0) == 1);
+        // the buffer is rounded up to a page, so there's still space, and
+        // the writes signalled that too
+        CHECK(ring_buffer.get_elems_avail_to_write() == 4);
+        CHECK(poll(&poll_fds[1], 1, 0) == 1);
+
+        ring_buffer.clear_read_fd();
+        std::vector<int> dest(4);
+        CHECK(ring_buffer.read(reinterpret_cast<char*>(dest.data()), 4) == 0);
+        CHECK(dest == std::vector<int>({1, 1, 2, 3}));
+        // 1 element left is below the threshold
+        CHECK(poll(poll_fds, 1, 0) == 0);
+    }
+}
+#endif
@@ -0,0 +1,180 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/coroutine.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace snake_charmer;
+
+namespace {
+// Writes 0 to num_elems - 1, elems_per_grab at a time
+Task produce(DirectRingBuffer& ring_buffer, const size_t num_elems, const size_t elems_per_grab) {
+    for(size_t n = 0; n < num_elems; n += elems_per_grab) {
+        GrabResult grab = co_await grab_write(ring_buffer, elems_per_grab);
+        REQUIRE(grab.rc == 0);
+        size_t* values = reinterpret_cast<size_t*>(grab.elem_ptr);
+        for(size_t elem = 0; elem < elems_per_grab; elem++) {
+            values[elem] = n + elem;
+        }
+        ring_buffer.release_write();
+    }
+}
+
+// Reads num_elems elements, counting those that aren't in sequence
+Task consume(
+        DirectRingBuffer& ring_buffer,
+        const size_t num_elems,
+        const size_t elems_per_grab,
+        size_t& errors
+) {
+    const size_t id = ring_buffer.add_reader();
+    for(size_t n = 0; n < num_elems; n += elems_per_grab) {
+        GrabResult grab = co_await grab_read(ring_buffer, elems_per_grab, id);
+        REQUIRE(grab.rc == 0);
+        CHECK(grab.elems_grabbed == elems_per_grab);
+        const size_t* values = reinterpret_cast<const size_t*>(grab.elem_ptr);
+        for(size_t elem = 0; elem < elems_per_grab; elem++) {
+            if(values[elem] != n + elem) {
+                errors++;
+            }
+        }
+        ring_buffer.release_read(id);
+    }
+}
+
+Task relay(CopyRingBuffer& from, CopyRingBuffer& to, const size_t num_elems) {
+    for(size_t n = 0; n < num_elems; n++) {
+        int value;
+        CHECK(co_await copy_read(from, reinterpret_cast<char*>(&value), 1) == 0);
+        value *= 2;
+        CHECK(co_await copy_write(to, reinterpret_cast<const char*>(&value), 1) == 0);
+    }
+}
+
+Task fail() {
+    co_await yield_task();
+    throw std::runtime_error("failed");
+}
+}
+
+TEST_CASE("testing many coroutine streams share one executor") {
+    const size_t num_streams = 200;
+    const size_t num_elems = 2000;
+    Executor executor("error");
+    std::vector<std::unique_ptr<DirectRingBuffer>> ring_buffers;
+    std::vector<size_t> errors(num_streams, 0);
+    for(size_t n = 0; n < num_streams; n++) {
+        // small enough that producers fill it and wait on consumers
+        ring_buffers.emplace_back(new DirectRingBuffer(sizeof(size_t), 8, 8, 2, "error"));
+        // consumers first, so they start out waiting for data
+        executor.spawn(consume(*ring_buffers[n], num_elems, 4, errors[n]));
+        executor.spawn(produce(*ring_buffers[n], num_elems, 8));
+    }
+    CHECK(executor.get_num_tasks() == 2 * num_streams);
+    CHECK(executor.run() == 0);
+    CHECK(executor.get_num_tasks() == 0);
+    for(size_t n = 0; n < num_streams; n++) {
+        CHECK(errors[n] == 0);
+    }
+}
+
+TEST_CASE("testing a coroutine waits on a buffer written by another thread") {
+    const size_t num_elems = 100000;
+    Executor executor("error");
+    DirectRingBuffer ring_buffer(sizeof(size_t), 8, 8, 4, "error");
+    size_t errors = 0;
+    executor.spawn(consume(ring_buffer, num_elems, 5, errors));
+    std::thread writer([&]() {
+        char* elem_ptr;
+        for(size_t n = 0; n < num_elems; n++) {
+            while(ring_buffer.grab_write(elem_ptr, 1) != 0) {
+                std::this_thread::yield();
+            }
+            *reinterpret_cast<size_t*>(elem_ptr) = n;
+            ring_buffer.release_write();
+        }
+    });
+    CHECK(executor.run() == 0);
+    writer.join();
+    CHECK(errors == 0);
+}
+
+TEST_CASE("testing an executor serves a buffer made after another was destroyed") {
+    const size_t num_elems = 1000;
+    Executor executor("error");
+    for(size_t round = 0; round < 3; round++) {
+        // each buffer's eventfds are likely to get the last one's numbers
+        DirectRingBuffer ring_buffer(sizeof(size_t), 8, 8, 2, "error");
+        size_t errors = 0;
+        executor.spawn(consume(ring_buffer, num_elems, 4, errors));
+        executor.spawn(produce(ring_buffer, num_elems, 8));
+        // so a task that's never resumed fails the test rather than hanging it
+        std::atomic<bool> done(false);
+        std::thread stopper([&]() {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while(!done && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if(!done) {
+                executor.stop();
+            }
+        });
+        CHECK(executor.run() == 0);
+        done = true;
+        stopper.join();
+        CHECK(executor.get_num_tasks() == 0);
+        CHECK(errors == 0);
+    }
+}
+
+TEST_CASE("testing coroutines copying through copy_ring_buffers") {
+    const size_t num_elems = 10000;
+    Executor executor("error");
+    CopyRingBuffer input(sizeof(int), 4, 4, 2, "error", CopyMode::SPSC);
+    CopyRingBuffer output(sizeof(int), 4, 4, 2, "error");
+    executor.spawn(relay(input, output, num_elems));
+    std::thread writer([&]() {
+        for(int n = 0; n < static_cast<int>(num_elems); n++) {
+            while(input.write(reinterpret_cast<const char*>(&n), 1) != 0) {
+            }
+        }
+    });
+    size_t errors = 0;
+    std::thread reader([&]() {
+        for(int n = 0; n < static_cast<int>(num_elems); n++) {
+            int value;
+            while(output.read(reinterpret_cast<char*>(&value), 1) != 0) {
+            }
+            if(value != 2 * n) {
+                errors++;
+            }
+        }
+    });
+    CHECK(executor.run() == 0);
+    writer.join();
+    reader.join();
+    CHECK(errors == 0);
+}
+
+TEST_CASE("testing an executor stops and rethrows") {
+    Executor executor("off");
+    DirectRingBuffer ring_buffer(sizeof(size_t), 8, 8, 2, "error");
+    size_t errors = 0;
+    // nothing is ever written, so this waits until stopped
+    executor.spawn(consume(ring_buffer, 8, 8, errors));
+    std::thread stopper([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        executor.stop();
+    });
+    CHECK(executor.run() == ECANCELED);
+    stopper.join();
+    CHECK(executor.get_num_tasks() == 1);
+
+    executor.spawn(fail());
+    CHECK_THROWS_AS(executor.run(), std::runtime_error);
+    CHECK(executor.get_num_tasks() == 1);
+}
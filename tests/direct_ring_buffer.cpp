@@ -3,8 +3,16 @@
 #include <vector>
 #include <spdlog/spdlog.h>
 #include <snake_charmer/direct_ring_buffer.h>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <string.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 using namespace snake_charmer;
 
@@ -174,3 +182,1136 @@ TEST_CASE("testing the direct_ring_buffer") {
     }
 }
 
+TEST_CASE("testing the direct_ring_buffer with concurrent readers") {
+    size_t max_elems_per_write = 8;
+    size_t max_elems_per_read = 4;
+    size_t slack = 4;
+    const size_t num_readers = 8;
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t),
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        num_readers
+    );
+    CHECK(ring_buffer.get_max_readers() == num_readers);
+    std::vector<size_t> ids;
+    for (size_t n = 0; n < num_readers; n++) {
+        ids.push_back(ring_buffer.add_reader());
+    }
+    // Test that the fixed number of reader slots is enforced
+    bool threw = false;
+    try {
+        ring_buffer.add_reader();
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    char* buf_ptr;
+    CHECK(ring_buffer.grab_read(buf_ptr, 1, num_readers, std::chrono::microseconds(0)) == ENXIO);
+    CHECK(ring_buffer.release_read(ids[0]) == EBUSY);
+
+    // Test that every element is handed to exactly one reader
+    const uint64_t total = 200000;
+    std::vector<std::atomic<uint32_t>> seen(total);
+    for (auto& count : seen) {
+        count.store(0);
+    }
+    std::atomic<uint64_t> num_read(0);
+    std::atomic<bool> values_match(true);
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < num_readers; r++) {
+        threads.emplace_back([&, r]() {
+            char* read_ptr;
+            size_t elems_this_read = 1 + r % max_elems_per_read;
+            while (num_read.load() < total) {
+                int read_rc = ring_buffer.grab_read(
+                    read_ptr,
+                    elems_this_read,
+                    ids[r],
+                    std::chrono::microseconds(1000)
+                );
+                if (read_rc != 0) {
+                    // the tail may be smaller than this reader's grab size
+                    elems_this_read = 1;
+                    continue;
+                }
+                uint64_t* values = reinterpret_cast<uint64_t*>(read_ptr);
+                for (size_t n = 0; n < elems_this_read; n++) {
+                    if (values[n] >= total) {
+                        values_match.store(false);
+                        continue;
+                    }
+                    seen[values[n]].fetch_add(1);
+                }
+                num_read.fetch_add(elems_this_read);
+                ring_buffer.release_read(ids[r]);
+            }
+        });
+    }
+    uint64_t next = 0;
+    while (next < total) {
+        size_t count = std::min<uint64_t>(max_elems_per_write, total - next);
+        if (ring_buffer.grab_write(buf_ptr, count) != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t* values = reinterpret_cast<uint64_t*>(buf_ptr);
+        for (size_t n = 0; n < count; n++) {
+            values[n] = next + n;
+        }
+        CHECK(ring_buffer.release_write() == 0);
+        next += count;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(values_match.load());
+    CHECK(num_read.load() == total);
+    bool each_once = true;
+    for (auto& count : seen) {
+        each_once = each_once && count.load() == 1;
+    }
+    CHECK(each_once);
+}
+
+TEST_CASE("testing the direct_ring_buffer in broadcast mode") {
+    size_t max_elems_per_write = 8;
+    size_t max_elems_per_read = 4;
+    size_t slack = 4;
+    const size_t num_readers = 3;
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t),
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        num_readers,
+        ReadMode::Broadcast
+    );
+    CHECK(ring_buffer.get_read_mode() == ReadMode::Broadcast);
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+    char* buf_ptr;
+    int rc = 0;
+
+    // Test that the writer is gated by the slowest reader
+    size_t fast_reader = ring_buffer.add_reader();
+    size_t slow_reader = ring_buffer.add_reader();
+    for (uint64_t n = 0; n < num_elems; n++) {
+        CHECK(ring_buffer.grab_write(buf_ptr, 1) == 0);
+        *reinterpret_cast<uint64_t*>(buf_ptr) = n;
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    CHECK(ring_buffer.grab_write(buf_ptr, 1) == ENOBUFS);
+    for (uint64_t n = 0; n < num_elems; n++) {
+        rc = ring_buffer.grab_read(buf_ptr, 1, fast_reader, std::chrono::microseconds(0));
+        CHECK(rc == 0);
+        CHECK(*reinterpret_cast<uint64_t*>(buf_ptr) == n);
+        CHECK(ring_buffer.release_read(fast_reader) == 0);
+    }
+    CHECK(ring_buffer.get_elems_avail_to_read(fast_reader) == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read(slow_reader) == max_elems_per_read);
+    CHECK(ring_buffer.grab_write(buf_ptr, 1) == ENOBUFS);
+    rc = ring_buffer.grab_read(buf_ptr, 2, slow_reader, std::chrono::microseconds(0));
+    CHECK(rc == 0);
+    CHECK(reinterpret_cast<uint64_t*>(buf_ptr)[0] == 0);
+    CHECK(reinterpret_cast<uint64_t*>(buf_ptr)[1] == 1);
+    CHECK(ring_buffer.release_read(slow_reader) == 0);
+    CHECK(ring_buffer.grab_write(buf_ptr, 2) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_write(buf_ptr, 1) == ENOBUFS);
+
+    // Test that a reader added later starts at the writer's position
+    size_t late_reader = ring_buffer.add_reader();
+    CHECK(ring_buffer.get_elems_avail_to_read(late_reader) == 0);
+    rc = ring_buffer.grab_read(buf_ptr, 1, late_reader, std::chrono::microseconds(0));
+    CHECK(rc == ENOMSG);
+}
+
+TEST_CASE("testing the direct_ring_buffer with concurrent broadcast readers") {
+    size_t max_elems_per_write = 8;
+    size_t max_elems_per_read = 4;
+    size_t slack = 4;
+    const size_t num_readers = 4;
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t),
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        num_readers,
+        ReadMode::Broadcast
+    );
+    std::vector<size_t> ids;
+    for (size_t n = 0; n < num_readers; n++) {
+        ids.push_back(ring_buffer.add_reader());
+    }
+
+    // Test that every reader sees every element, in order
+    const uint64_t total = 100000;
+    std::vector<uint64_t> num_read(num_readers, 0);
+    // one flag per reader thread; vector<bool> would pack them into shared words
+    std::vector<int> in_order(num_readers, 1);
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < num_readers; r++) {
+        threads.emplace_back([&, r]() {
+            char* read_ptr;
+            while (num_read[r] < total) {
+                size_t elems_this_read = std::min<uint64_t>(
+                    1 + r % max_elems_per_read, total - num_read[r]);
+                int read_rc = ring_buffer.grab_read(
+                    read_ptr,
+                    elems_this_read,
+                    ids[r],
+                    std::chrono::microseconds(1000)
+                );
+                if (read_rc != 0) {
+                    continue;
+                }
+                uint64_t* values = reinterpret_cast<uint64_t*>(read_ptr);
+                for (size_t n = 0; n < elems_this_read; n++) {
+                    if (values[n] != num_read[r] + n) {
+                        in_order[r] = 0;
+                    }
+                }
+                num_read[r] += elems_this_read;
+                ring_buffer.release_read(ids[r]);
+            }
+        });
+    }
+    char* buf_ptr;
+    uint64_t next = 0;
+    while (next < total) {
+        size_t count = std::min<uint64_t>(max_elems_per_write, total - next);
+        if (ring_buffer.grab_write(buf_ptr, count) != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t* values = reinterpret_cast<uint64_t*>(buf_ptr);
+        for (size_t n = 0; n < count; n++) {
+            values[n] = next + n;
+        }
+        ring_buffer.release_write();
+        next += count;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (size_t r = 0; r < num_readers; r++) {
+        CHECK(num_read[r] == total);
+        CHECK(in_order[r]);
+    }
+}
+
+TEST_CASE("testing the direct_ring_buffer with concurrent writers") {
+    size_t max_elems_per_write = 4;
+    size_t max_elems_per_read = 8;
+    size_t slack = 4;
+    const size_t num_writers = 4;
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t),
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        DirectRingBuffer::DEFAULT_MAX_READERS,
+        ReadMode::Distribute,
+        num_writers
+    );
+    CHECK(ring_buffer.get_max_writers() == num_writers);
+    char* buf_ptr;
+    CHECK(ring_buffer.grab_write(buf_ptr, 1, 0) == ENXIO);
+    std::vector<size_t> ids;
+    for (size_t n = 0; n < num_writers; n++) {
+        ids.push_back(ring_buffer.add_writer());
+    }
+    size_t reader = ring_buffer.add_reader();
+
+    // Test that a range released out of order isn't readable until the
+    // ranges before it are released
+    char* first_ptr;
+    char* second_ptr;
+    CHECK(ring_buffer.grab_write(first_ptr, 2, ids[0]) == 0);
+    CHECK(ring_buffer.grab_write(second_ptr, 2, ids[1]) == 0);
+    CHECK(second_ptr == first_ptr + 2 * sizeof(uint64_t));
+    reinterpret_cast<uint64_t*>(second_ptr)[0] = 2;
+    reinterpret_cast<uint64_t*>(second_ptr)[1] = 3;
+    CHECK(ring_buffer.release_write(ids[1]) == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+    reinterpret_cast<uint64_t*>(first_ptr)[0] = 0;
+    reinterpret_cast<uint64_t*>(first_ptr)[1] = 1;
+    CHECK(ring_buffer.release_write(ids[0]) == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 4);
+    CHECK(ring_buffer.grab_read(buf_ptr, 4, reader, std::chrono::microseconds(0)) == 0);
+    for (uint64_t n = 0; n < 4; n++) {
+        CHECK(reinterpret_cast<uint64_t*>(buf_ptr)[n] == n);
+    }
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that concurrent writers' elements all arrive, each writer's in
+    // order, and that nothing is readable before it has been written
+    const uint64_t per_writer = 50000;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < num_writers; w++) {
+        threads.emplace_back([&, w]() {
+            char* write_ptr;
+            uint64_t next = 0;
+            while (next < per_writer) {
+                size_t count = std::min<uint64_t>(1 + w % max_elems_per_write, per_writer - next);
+                if (ring_buffer.grab_write(write_ptr, count, ids[w]) != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                uint64_t* values = reinterpret_cast<uint64_t*>(write_ptr);
+                for (size_t n = 0; n < count; n++) {
+                    // tag each value with its writer; 0 is never written
+                    values[n] = ((w + 1) << 32) | (next + n);
+                }
+                ring_buffer.release_write(ids[w]);
+                next += count;
+            }
+        });
+    }
+    std::vector<uint64_t> next_expected(num_writers, 0);
+    bool in_order = true;
+    uint64_t num_read = 0;
+    while (num_read < per_writer * num_writers) {
+        if (ring_buffer.grab_read(buf_ptr, 1, reader, std::chrono::microseconds(1000)) != 0) {
+            continue;
+        }
+        uint64_t value = *reinterpret_cast<uint64_t*>(buf_ptr);
+        // invalidate the element, so a stale read would be caught next lap
+        *reinterpret_cast<uint64_t*>(buf_ptr) = 0;
+        size_t w = (value >> 32) - 1;
+        if (w >= num_writers || (value & 0xffffffff) != next_expected[w]) {
+            in_order = false;
+        } else {
+            next_expected[w]++;
+        }
+        num_read++;
+        ring_buffer.release_read(reader);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(in_order);
+    for (size_t w = 0; w < num_writers; w++) {
+        CHECK(next_expected[w] == per_writer);
+    }
+}
+
+TEST_CASE("testing the direct_ring_buffer variable-size grabs") {
+    size_t max_elems_per_write = 8;
+    size_t max_elems_per_read = 8;
+    size_t slack = 2;
+    const size_t num_writers = 2;
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t),
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning",
+        DirectRingBuffer::DEFAULT_MAX_READERS,
+        ReadMode::Distribute,
+        num_writers
+    );
+    size_t reader = ring_buffer.add_reader();
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+    char* buf_ptr;
+    size_t grabbed = 0;
+
+    // Test that an upto grab takes whatever is available
+    CHECK(ring_buffer.grab_read_upto(buf_ptr, grabbed, 4, reader, std::chrono::microseconds(0)) == ENOMSG);
+    CHECK(ring_buffer.grab_read_upto(buf_ptr, grabbed, max_elems_per_read + 1, reader, std::chrono::microseconds(0)) == EMSGSIZE);
+    CHECK(ring_buffer.grab_write(buf_ptr, 3) == 0);
+    for (uint64_t n = 0; n < 3; n++) {
+        reinterpret_cast<uint64_t*>(buf_ptr)[n] = n;
+    }
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read_upto(buf_ptr, grabbed, 8, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(grabbed == 3);
+    CHECK(reinterpret_cast<uint64_t*>(buf_ptr)[2] == 2);
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that a partial release only publishes what was used, and the rest
+    // is grabbed again by the next write
+    CHECK(ring_buffer.grab_write_upto(buf_ptr, grabbed, 8) == 0);
+    CHECK(grabbed == 8);
+    reinterpret_cast<uint64_t*>(buf_ptr)[0] = 3;
+    reinterpret_cast<uint64_t*>(buf_ptr)[1] = 4;
+    CHECK(ring_buffer.release_write_partial(9) == EINVAL);
+    CHECK(ring_buffer.release_write_partial(2) == 0);
+    CHECK(ring_buffer.release_write_partial(2) == EBUSY);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 2);
+    char* next_ptr;
+    CHECK(ring_buffer.grab_write(next_ptr, 1) == 0);
+    CHECK(next_ptr == buf_ptr + 2 * sizeof(uint64_t));
+    reinterpret_cast<uint64_t*>(next_ptr)[0] = 5;
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read_upto(buf_ptr, grabbed, 8, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(grabbed == 3);
+    for (uint64_t n = 0; n < 3; n++) {
+        CHECK(reinterpret_cast<uint64_t*>(buf_ptr)[n] == n + 3);
+    }
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that a partial release can't hand back space another writer has
+    // grabbed past, and that the grab is still outstanding afterwards
+    size_t writer_0 = ring_buffer.add_writer();
+    size_t writer_1 = ring_buffer.add_writer();
+    CHECK(ring_buffer.grab_write_upto(buf_ptr, grabbed, 4, writer_0) == 0);
+    CHECK(ring_buffer.grab_write(next_ptr, 1, writer_1) == 0);
+    CHECK(ring_buffer.release_write_partial(1, writer_0) == EAGAIN);
+    CHECK(ring_buffer.release_write(writer_1) == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+    CHECK(ring_buffer.release_write_partial(4, writer_0) == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 5);
+    CHECK(ring_buffer.grab_read_upto(buf_ptr, grabbed, 8, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(grabbed == 5);
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that an upto write is limited by the free space
+    size_t written = 0;
+    while (written + max_elems_per_write <= num_elems) {
+        CHECK(ring_buffer.grab_write(buf_ptr, max_elems_per_write) == 0);
+        CHECK(ring_buffer.release_write() == 0);
+        written += max_elems_per_write;
+    }
+    if (written < num_elems) {
+        CHECK(ring_buffer.grab_write_upto(buf_ptr, grabbed, max_elems_per_write) == 0);
+        CHECK(grabbed == num_elems - written);
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    CHECK(ring_buffer.grab_write_upto(buf_ptr, grabbed, max_elems_per_write) == ENOBUFS);
+
+    // Test that concurrent partial releases from several writers arrive intact
+    CHECK(ring_buffer.get_elems_avail_to_read() > 0);
+    while (ring_buffer.grab_read_upto(buf_ptr, grabbed, max_elems_per_read, reader, std::chrono::microseconds(0)) == 0) {
+        ring_buffer.release_read(reader);
+    }
+    const uint64_t per_writer = 50000;
+    const size_t ids[] = {writer_0, writer_1};
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < num_writers; w++) {
+        threads.emplace_back([&, w]() {
+            char* write_ptr;
+            size_t write_grabbed;
+            uint64_t next = 0;
+            while (next < per_writer) {
+                if (ring_buffer.grab_write_upto(write_ptr, write_grabbed, max_elems_per_write, ids[w]) != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // use a varying part of the grab, as recv() would
+                const size_t used = std::min<uint64_t>(1 + next % write_grabbed, per_writer - next);
+                uint64_t* values = reinterpret_cast<uint64_t*>(write_ptr);
+                for (size_t n = 0; n < write_grabbed; n++) {
+                    values[n] = n < used ? ((w + 1) << 32) | (next + n) : 0;
+                }
+                if (ring_buffer.release_write_partial(used, ids[w]) == EAGAIN) {
+                    // another writer is past us, so publish the padding too
+                    ring_buffer.release_write(ids[w]);
+                }
+                next += used;
+            }
+        });
+    }
+    std::vector<uint64_t> next_expected(num_writers, 0);
+    bool in_order = true;
+    while (next_expected[0] < per_writer || next_expected[1] < per_writer) {
+        if (ring_buffer.grab_read_upto(buf_ptr, grabbed, max_elems_per_read, reader, std::chrono::microseconds(1000)) != 0) {
+            continue;
+        }
+        for (size_t n = 0; n < grabbed; n++) {
+            uint64_t value = reinterpret_cast<uint64_t*>(buf_ptr)[n];
+            if (value == 0) {
+                continue; // padding
+            }
+            size_t w = (value >> 32) - 1;
+            if (w >= num_writers || (value & 0xffffffff) != next_expected[w]) {
+                in_order = false;
+            } else {
+                next_expected[w]++;
+            }
+        }
+        ring_buffer.release_read(reader);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(in_order);
+}
+
+TEST_CASE("testing the direct_ring_buffer sliding windows") {
+    for (const ReadMode read_mode : {ReadMode::Distribute, ReadMode::Broadcast}) {
+        DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 8, 2, "warning", 4, read_mode);
+        const size_t num_elems = ring_buffer.get_buffer_size_elems();
+        const size_t first = ring_buffer.add_reader();
+        const size_t second = ring_buffer.add_reader();
+        char* elem_ptr;
+        for (uint64_t n = 0; n < num_elems; n++) {
+            REQUIRE(ring_buffer.grab_write(elem_ptr, 1) == 0);
+            memcpy(elem_ptr, &n, sizeof(n));
+            CHECK(ring_buffer.release_write() == 0);
+        }
+        CHECK(ring_buffer.grab_read_window(elem_ptr, 8, 0, first,
+            std::chrono::microseconds(0)) == EINVAL);
+        CHECK(ring_buffer.grab_read_window(elem_ptr, 8, 9, first,
+            std::chrono::microseconds(0)) == EINVAL);
+        CHECK(ring_buffer.grab_read_window(elem_ptr, 9, 4, first,
+            std::chrono::microseconds(0)) == EMSGSIZE);
+
+        // Test that each window overlaps the last by window - advance
+        size_t index;
+        for (uint64_t start = 0; start < 12; start += 4) {
+            REQUIRE(ring_buffer.grab_read_window(elem_ptr, 8, 4, first,
+                std::chrono::microseconds(0)) == 0);
+            CHECK(ring_buffer.get_read_grab_index(first, index) == 0);
+            CHECK(index == start);
+            const uint64_t* window = reinterpret_cast<const uint64_t*>(elem_ptr);
+            CHECK(window[0] == start);
+            CHECK(window[7] == start + 7);
+            CHECK(ring_buffer.release_read(first) == 0);
+        }
+
+        // Test that an outstanding window keeps its shared tail from being
+        // overwritten, even after the window it overlaps is released
+        CHECK(ring_buffer.grab_read_window(elem_ptr, 8, 4, first,
+            std::chrono::microseconds(0)) == 0);
+        if (read_mode == ReadMode::Distribute) {
+            // the next window goes to whichever reader grabs next
+            CHECK(ring_buffer.grab_read_window(elem_ptr, 8, 4, second,
+                std::chrono::microseconds(0)) == 0);
+            CHECK(ring_buffer.get_read_grab_index(second, index) == 0);
+            CHECK(index == 16);
+            CHECK(ring_buffer.release_read(first) == 0);
+            CHECK(ring_buffer.get_elems_avail_to_write() == 4);
+            size_t written = 0;
+            while (ring_buffer.grab_write(elem_ptr, 1) == 0) {
+                CHECK(ring_buffer.release_write() == 0);
+                written++;
+            }
+            // nothing past the second window's start
+            CHECK(written == 16);
+            CHECK(ring_buffer.release_read(second) == 0);
+        } else {
+            // the second reader still holds everything back from its cursor
+            CHECK(ring_buffer.grab_read(elem_ptr, 4, second,
+                std::chrono::microseconds(0)) == 0);
+            CHECK(*reinterpret_cast<uint64_t*>(elem_ptr) == 0);
+            CHECK(ring_buffer.release_read(second) == 0);
+            CHECK(ring_buffer.release_read(first) == 0);
+            // the first reader's cursor only advanced to 16, where its next
+            // window starts
+            CHECK(ring_buffer.grab_read(elem_ptr, 1, first,
+                std::chrono::microseconds(0)) == 0);
+            CHECK(*reinterpret_cast<uint64_t*>(elem_ptr) == 16);
+            CHECK(ring_buffer.release_read(first) == 0);
+        }
+    }
+}
+
+TEST_CASE("testing the direct_ring_buffer in overwrite mode") {
+    for (const ReadMode read_mode : {ReadMode::Distribute, ReadMode::Broadcast}) {
+        DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning", 4, read_mode,
+            DirectRingBuffer::DEFAULT_MAX_WRITERS, PageSize::StandardPages,
+            WaitStrategy::Condvar, OverflowPolicy::Overwrite);
+        CHECK(ring_buffer.get_overflow_policy() == OverflowPolicy::Overwrite);
+        const size_t num_elems = ring_buffer.get_buffer_size_elems();
+        const size_t reader = ring_buffer.add_reader();
+        char* elem_ptr;
+        auto write_values = [&](const uint64_t from, const uint64_t to) {
+            for (uint64_t n = from; n < to; n++) {
+                CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+                memcpy(elem_ptr, &n, sizeof(n));
+                CHECK(ring_buffer.release_write() == 0);
+            }
+        };
+
+        // Test that the writer overruns the reader instead of failing
+        write_values(0, 3 * num_elems);
+        CHECK(ring_buffer.get_elems_avail_to_write() == 4);
+        CHECK(ring_buffer.get_elems_avail_to_read(reader) == 4);
+        size_t skipped;
+        CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, skipped,
+            std::chrono::microseconds(0)) == 0);
+        CHECK(*reinterpret_cast<uint64_t*>(elem_ptr) == 2 * num_elems);
+        CHECK(skipped == 2 * num_elems);
+        CHECK(ring_buffer.release_read(reader) == 0);
+
+        // Test that a grab is only reported overrun once a writer reaches it
+        size_t index;
+        size_t elems_grabbed;
+        CHECK(ring_buffer.grab_read_upto(elem_ptr, elems_grabbed, 4, reader, skipped,
+            std::chrono::microseconds(0)) == 0);
+        CHECK(elems_grabbed == 4);
+        CHECK(skipped == 0);
+        CHECK(ring_buffer.get_read_grab_index(reader, index) == 0);
+        CHECK(index == 2 * num_elems + 1);
+        write_values(3 * num_elems, 3 * num_elems + 1);
+        CHECK(ring_buffer.release_read(reader) == 0);
+        write_values(3 * num_elems + 1, 4 * num_elems + 2);
+        CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, skipped,
+            std::chrono::microseconds(0)) == 0);
+        CHECK(ring_buffer.get_read_grab_index(reader, index) == 0);
+        CHECK(index == 3 * num_elems + 2);
+        CHECK(skipped == num_elems - 3);
+        write_values(4 * num_elems + 2, 4 * num_elems + 3);
+        CHECK(ring_buffer.release_read(reader) == EOVERFLOW);
+
+        RingBufferStats stats = ring_buffer.get_stats();
+        CHECK(stats.elems_overwritten == 3 * num_elems - 3);
+        CHECK(stats.torn_read_count == 1);
+        CHECK(stats.buffer_full_count == 0);
+        CHECK(stats.fill_high_water == num_elems);
+    }
+
+    // Test that a reader that can't keep up gets whole, contiguous grabs, and
+    // accounts for every element it missed
+    DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning", 4,
+        ReadMode::Distribute, DirectRingBuffer::DEFAULT_MAX_WRITERS,
+        PageSize::StandardPages, WaitStrategy::Condvar, OverflowPolicy::Overwrite);
+    const size_t reader = ring_buffer.add_reader();
+    const uint64_t total = 200000;
+    std::atomic<bool> done(false);
+    std::thread producer([&]() {
+        char* elem_ptr;
+        for (uint64_t next = 0; next < total; next += 4) {
+            REQUIRE(ring_buffer.grab_write(elem_ptr, 4) == 0);
+            for (uint64_t n = 0; n < 4; n++) {
+                const uint64_t value = next + n;
+                memcpy(elem_ptr + n * sizeof(value), &value, sizeof(value));
+            }
+            ring_buffer.release_write();
+        }
+        done.store(true);
+    });
+    uint64_t in[4];
+    uint64_t expected = 0;
+    size_t torn = 0;
+    bool contiguous = true;
+    bool accounted = true;
+    char* elem_ptr;
+    size_t skipped;
+    while (true) {
+        int rc = ring_buffer.grab_read(elem_ptr, 4, reader, skipped,
+            std::chrono::microseconds(1000));
+        if (rc != 0) {
+            if (done.load()) {
+                break;
+            }
+            continue;
+        }
+        size_t index;
+        ring_buffer.get_read_grab_index(reader, index);
+        accounted = accounted && index == expected + skipped;
+        expected = index + 4;
+        memcpy(in, elem_ptr, sizeof(in));
+        if (ring_buffer.release_read(reader) == EOVERFLOW) {
+            torn++;
+            continue;
+        }
+        for (size_t n = 0; n < 4; n++) {
+            contiguous = contiguous && in[n] == index + n;
+        }
+    }
+    producer.join();
+    CHECK(contiguous);
+    CHECK(accounted);
+    CHECK(expected == total);
+    CHECK(ring_buffer.get_stats().torn_read_count == torn);
+}
+
+TEST_CASE("testing the direct_ring_buffer tags") {
+    const uint64_t TIMESTAMP = 1;
+    const uint64_t GAIN = 2;
+    DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 8, 2, "warning");
+    const size_t reader = ring_buffer.add_reader();
+    const size_t writer = ring_buffer.add_writer();
+    TagRange tags;
+    char* elem_ptr;
+    CHECK(ring_buffer.add_tag(0, TIMESTAMP, uint64_t(1000)) == ENOTSUP);
+    CHECK(ring_buffer.get_tags(reader, tags) == ENOTSUP);
+    CHECK(ring_buffer.enable_tags(4) == 0);
+    CHECK(ring_buffer.enable_tags(4) == EALREADY);
+    CHECK(ring_buffer.add_tag(0, TIMESTAMP, uint64_t(1000)) == EBUSY);
+    CHECK(ring_buffer.get_tags(reader, tags) == EBUSY);
+    CHECK(ring_buffer.get_tags(reader + 1, tags) == ENXIO);
+
+    // Test that tags from several writers come back in index order
+    CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+    CHECK(ring_buffer.add_tag(0, TIMESTAMP, uint64_t(1000)) == 0);
+    CHECK(ring_buffer.add_tag(2, GAIN, 2.5) == 0);
+    CHECK(ring_buffer.add_tag(4, GAIN, 3.5) == EINVAL);
+    CHECK(ring_buffer.add_tag(1, GAIN, 3.5) == EINVAL);
+    CHECK(ring_buffer.grab_write(elem_ptr, 4, writer) == 0);
+    CHECK(ring_buffer.add_tag(1, TIMESTAMP, uint64_t(2000), writer) == 0);
+    CHECK(ring_buffer.add_tag(1, TIMESTAMP, uint64_t(2000), writer + 1) == ENXIO);
+    CHECK(ring_buffer.release_write(writer) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 8, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_tags(reader, tags) == 0);
+    REQUIRE(tags.size() == 3);
+    const Tag* tag = tags.begin();
+    CHECK(tag[0].index == 0);
+    CHECK(tag[0].key == TIMESTAMP);
+    CHECK(tag[0].get_value<uint64_t>() == 1000);
+    CHECK(tag[1].index == 2);
+    CHECK(tag[1].key == GAIN);
+    CHECK(tag[1].get_value<double>() == 2.5);
+    CHECK(tag[2].index == 5);
+    CHECK(tag[2].get_value<uint64_t>() == 2000);
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that tags on elements handed back by a partial release are dropped
+    CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+    CHECK(ring_buffer.add_tag(1, GAIN, 1.0) == 0);
+    CHECK(ring_buffer.add_tag(3, GAIN, 2.0) == 0);
+    CHECK(ring_buffer.release_write_partial(2) == 0);
+    CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+    CHECK(ring_buffer.add_tag(0, GAIN, 3.0) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 6, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_tags(reader, tags) == 0);
+    REQUIRE(tags.size() == 2);
+    CHECK(tags.begin()[0].index == 9);
+    CHECK(tags.begin()[1].index == 10);
+    CHECK(tags.begin()[1].get_value<double>() == 3.0);
+    CHECK(ring_buffer.release_read(reader) == 0);
+
+    // Test that tags readers may still need aren't dropped to make room
+    CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+    for (size_t n = 0; n < 4; n++) {
+        CHECK(ring_buffer.add_tag(0, TIMESTAMP, n) == 0);
+    }
+    CHECK(ring_buffer.add_tag(1, TIMESTAMP, 4) == ENOBUFS);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 4, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_tags(reader, tags) == 0);
+    CHECK(tags.size() == 4);
+    size_t n = 0;
+    for (const Tag& timestamp : tags) {
+        CHECK(timestamp.get_value<size_t>() == n++);
+    }
+    CHECK(ring_buffer.release_read(reader) == 0);
+    CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+    CHECK(ring_buffer.add_tag(0, TIMESTAMP, 4) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+
+    // Test that a concurrent reader sees exactly the tags on what it grabbed,
+    // with enough capacity for every tag in the buffer
+    DirectRingBuffer concurrent_buffer(sizeof(uint64_t), 4, 8, 2, "warning");
+    CHECK(concurrent_buffer.enable_tags(concurrent_buffer.get_buffer_size_elems() / 7 + 1) == 0);
+    const size_t concurrent_reader = concurrent_buffer.add_reader();
+    const uint64_t total = 100000;
+    std::thread producer([&]() {
+        char* write_ptr;
+        for (uint64_t next = 0; next < total; next += 4) {
+            while (concurrent_buffer.grab_write(write_ptr, 4) != 0) {
+                std::this_thread::yield();
+            }
+            for (uint64_t offset = 0; offset < 4; offset++) {
+                if ((next + offset) % 7 == 0) {
+                    concurrent_buffer.add_tag(offset, TIMESTAMP, next + offset);
+                }
+            }
+            concurrent_buffer.release_write();
+        }
+    });
+    uint64_t expected = 0;
+    bool tags_match = true;
+    while (expected < total) {
+        size_t elems_grabbed;
+        if (concurrent_buffer.grab_read_upto(elem_ptr, elems_grabbed, 8, concurrent_reader,
+                std::chrono::microseconds(1000)) != 0) {
+            continue;
+        }
+        concurrent_buffer.get_tags(concurrent_reader, tags);
+        const Tag* next_tag = tags.begin();
+        for (uint64_t index = expected; index < expected + elems_grabbed; index++) {
+            if (index % 7 == 0) {
+                tags_match = tags_match && next_tag != tags.end()
+                    && next_tag->index == index && next_tag->get_value<uint64_t>() == index;
+                next_tag++;
+            }
+        }
+        tags_match = tags_match && next_tag == tags.end();
+        expected += elems_grabbed;
+        concurrent_buffer.release_read(concurrent_reader);
+    }
+    producer.join();
+    CHECK(tags_match);
+}
+
+TEST_CASE("testing the direct_ring_buffer statistics") {
+    DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning");
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+    const size_t reader = ring_buffer.add_reader();
+    ring_buffer.set_hold_timing(true);
+    char* elem_ptr;
+    for (size_t n = 0; n < num_elems; n += 4) {
+        CHECK(ring_buffer.grab_write(elem_ptr, 4) == 0);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    CHECK(ring_buffer.grab_write(elem_ptr, 1) == ENOBUFS);
+    size_t elems_grabbed;
+    CHECK(ring_buffer.grab_read_upto(elem_ptr, elems_grabbed, 4, reader,
+        std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader) == 0);
+    ring_buffer.set_hold_timing(false);
+    while (ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == 0) {
+        CHECK(ring_buffer.release_read(reader) == 0);
+    }
+
+    const RingBufferStats stats = ring_buffer.get_stats();
+    CHECK(stats.fill_high_water == num_elems);
+    CHECK(stats.buffer_full_count == 1);
+    CHECK(stats.buffer_empty_count == 1);
+    CHECK(stats.bytes_written == num_elems * sizeof(uint64_t));
+    CHECK(stats.bytes_read == num_elems * sizeof(uint64_t));
+    // the writes and the first read were timed, the other reads weren't
+    CHECK(stats.hold_time.get_count() == num_elems / 4 + 1);
+    CHECK(stats.hold_time.get_quantile(0.5) >= std::chrono::microseconds(100));
+    CHECK(stats.wait_time.get_count() == 0);
+    CHECK(stats.mutex_contention_count == 0);
+}
+
+TEST_CASE("testing the direct_ring_buffer trace") {
+    DirectRingBuffer ring_buffer(sizeof(uint64_t), 4, 4, 2, "warning");
+    const size_t reader = ring_buffer.add_reader();
+    const size_t writer = ring_buffer.add_writer();
+    char* elem_ptr;
+    // nothing is recorded until the trace is started
+    CHECK(ring_buffer.grab_write(elem_ptr, 2) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.get_trace().empty());
+
+    CHECK(ring_buffer.enable_trace(6) == 0);
+    CHECK(ring_buffer.enable_trace(6) == EALREADY);
+    CHECK(ring_buffer.grab_write(elem_ptr, 3, writer) == 0);
+    CHECK(ring_buffer.release_write(writer) == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 4, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader) == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 2, reader, std::chrono::microseconds(0)) == ENOMSG);
+
+    std::vector<TraceEvent> events = ring_buffer.get_trace();
+    REQUIRE(events.size() == 5);
+    const TraceEventType types[] = {
+        TraceEventType::GrabWrite, TraceEventType::ReleaseWrite,
+        TraceEventType::GrabRead, TraceEventType::ReleaseRead, TraceEventType::ReadEmpty
+    };
+    for (size_t n = 0; n < events.size(); n++) {
+        CHECK(events[n].type == types[n]);
+        if (n > 0) {
+            CHECK(events[n].timestamp >= events[n - 1].timestamp);
+        }
+    }
+    CHECK(events[0].id == writer);
+    CHECK(events[0].index == 2);
+    CHECK(events[0].count == 3);
+    CHECK(events[2].id == reader);
+    CHECK(events[2].index == 0);
+    CHECK(events[2].count == 4);
+    CHECK(events[4].index == 4);
+
+    // the capacity was rounded up to 8, and only the newest events are kept
+    for (size_t n = 0; n < 4; n++) {
+        CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    events = ring_buffer.get_trace();
+    REQUIRE(events.size() == 8);
+    CHECK(events[0].type == TraceEventType::GrabWrite);
+    CHECK(events[0].index == 5);
+    CHECK(events[7].type == TraceEventType::ReleaseWrite);
+    CHECK(events[7].id == TRACE_NO_ID);
+    CHECK(events[7].index == 8);
+
+    const std::string path = "/tmp/snake_charmer_trace_" + std::to_string(getpid());
+    CHECK(ring_buffer.dump_trace(path) == 0);
+    std::ifstream dump(path);
+    std::string line, last_line;
+    size_t lines = 0;
+    while (std::getline(dump, line)) {
+        last_line = line;
+        lines++;
+    }
+    CHECK(lines == 8);
+    CHECK(last_line.find(" release_write -1 8 1") != std::string::npos);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("testing the trace ring doesn't tear records") {
+    // a tiny ring, so writers lap each other constantly
+    TraceRing ring(2);
+    const uint32_t num_writers = 4;
+    std::vector<std::thread> writers;
+    for (uint32_t id = 0; id < num_writers; id++) {
+        writers.emplace_back([&ring, id]() {
+            for (uint64_t n = 0; n < 200000; n++) {
+                // every field of a record is derived from the same value
+                const uint64_t value = n * num_writers + id;
+                ring.record(TraceEventType::GrabWrite, id, value, value);
+            }
+        });
+    }
+    // snapshot while they're recording
+    size_t torn = 0;
+    for (size_t n = 0; n < 20000; n++) {
+        for (const TraceEvent& event : ring.snapshot()) {
+            if (event.index != event.count || event.index % num_writers != event.id) {
+                torn++;
+            }
+        }
+    }
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    CHECK(torn == 0);
+    CHECK(ring.snapshot().size() <= ring.get_capacity());
+}
+
+#ifdef __linux__
+namespace {
+// Returns true if fd is readable, without waiting
+bool is_signalled(const int fd) {
+    const int epoll_fd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    const int ready = epoll_wait(epoll_fd, &event, 1, 0);
+    close(epoll_fd);
+    return ready == 1;
+}
+}
+
+TEST_CASE("testing the direct_ring_buffer event fds") {
+    DirectRingBuffer ring_buffer(sizeof(size_t), 8, 8, 4, "error");
+    const size_t reader_id = ring_buffer.add_reader();
+    CHECK(ring_buffer.get_read_fd() == -1);
+    CHECK(ring_buffer.enable_event_fds(0, 1) == EINVAL);
+    CHECK(ring_buffer.enable_event_fds(4, 9) == EINVAL);
+    REQUIRE(ring_buffer.enable_event_fds(4, 8) == 0);
+    CHECK(ring_buffer.enable_event_fds() == EALREADY);
+    const int read_fd = ring_buffer.get_read_fd();
+    const int write_fd = ring_buffer.get_write_fd();
+    REQUIRE(read_fd >= 0);
+    REQUIRE(write_fd >= 0);
+
+    // the empty buffer is writable from the start
+    CHECK(!is_signalled(read_fd));
+    CHECK(is_signalled(write_fd));
+    ring_buffer.clear_write_fd();
+    CHECK(!is_signalled(write_fd));
+
+    // below the read threshold
+    char* elem_ptr;
+    CHECK(ring_buffer.grab_write(elem_ptr, 3) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(!is_signalled(read_fd));
+    CHECK(ring_buffer.grab_write(elem_ptr, 8) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(is_signalled(read_fd));
+    // signalled once per wakeup, not per release
+    CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    uint64_t count;
+    CHECK(read(read_fd, &count, sizeof(count)) == sizeof(count));
+    CHECK(count == 1);
+    CHECK(!is_signalled(read_fd));
+
+    // the reader clears, then drains until it's below the threshold
+    ring_buffer.clear_read_fd();
+    CHECK(ring_buffer.grab_read(elem_ptr, 8, reader_id, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader_id) == 0);
+    CHECK(is_signalled(read_fd)); // 4 elements are left
+    CHECK(is_signalled(write_fd));
+    ring_buffer.clear_read_fd();
+    CHECK(ring_buffer.grab_read(elem_ptr, 4, reader_id, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader_id) == 0);
+    CHECK(!is_signalled(read_fd));
+
+    // an event loop receives everything a writer thread sends
+    const size_t num_elems = 100000;
+    std::thread writer([&]() {
+        size_t n = 0;
+        while(n < num_elems) {
+            size_t elems_grabbed;
+            if(ring_buffer.grab_write_upto(elem_ptr, elems_grabbed,
+                    std::min<size_t>(num_elems - n, 8)) != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            size_t* values = reinterpret_cast<size_t*>(elem_ptr);
+            for(size_t elem = 0; elem < elems_grabbed; elem++) {
+                values[elem] = n++;
+            }
+            ring_buffer.release_write();
+        }
+    });
+    const int epoll_fd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = read_fd;
+    REQUIRE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, read_fd, &event) == 0);
+    size_t next = 0;
+    size_t errors = 0;
+    while(num_elems - next >= 4) {
+        if(epoll_wait(epoll_fd, &event, 1, 10000) != 1) {
+            break;
+        }
+        ring_buffer.clear_read_fd();
+        size_t elems_grabbed;
+        char* read_ptr;
+        while(ring_buffer.get_elems_avail_to_read() >= 4 && ring_buffer.grab_read_upto(
+                read_ptr, elems_grabbed, 8, reader_id, std::chrono::microseconds(0)) == 0) {
+            const size_t* values = reinterpret_cast<const size_t*>(read_ptr);
+            for(size_t elem = 0; elem < elems_grabbed; elem++, next++) {
+                if(values[elem] != next) {
+                    errors++;
+                }
+            }
+            ring_buffer.release_read(reader_id);
+        }
+    }
+    writer.join();
+    close(epoll_fd);
+    CHECK(errors == 0);
+    CHECK(num_elems - next < 4);
+}
+#endif
+
+TEST_CASE("testing the direct_ring_buffer resize") {
+    // 8 byte elements, so the buffer is 512 elements per page
+    DirectRingBuffer ring_buffer(
+        sizeof(uint64_t), 8, 8, 4, "error", 2, ReadMode::Broadcast);
+    REQUIRE(ring_buffer.get_buffer_size_elems() == 512);
+    const size_t fast_reader = ring_buffer.add_reader();
+    const size_t slow_reader = ring_buffer.add_reader();
+    char* buf_ptr;
+    uint64_t written = 0;
+    auto write = [&](const size_t elems) {
+        for(size_t n = 0; n < elems; n++, written++) {
+            REQUIRE(ring_buffer.grab_write(buf_ptr, 1) == 0);
+            *reinterpret_cast<uint64_t*>(buf_ptr) = written;
+            CHECK(ring_buffer.release_write() == 0);
+        }
+    };
+    auto read = [&](const size_t id, const uint64_t from, const uint64_t to) {
+        size_t errors = 0;
+        for(uint64_t n = from; n < to; n++) {
+            REQUIRE(ring_buffer.grab_read(buf_ptr, 1, id, std::chrono::microseconds(0)) == 0);
+            if(*reinterpret_cast<uint64_t*>(buf_ptr) != n) {
+                errors++;
+            }
+            CHECK(ring_buffer.release_read(id) == 0);
+        }
+        CHECK(errors == 0);
+    };
+
+    // the unread elements wrap around the end of the buffer
+    write(512);
+    read(fast_reader, 0, 300);
+    read(slow_reader, 0, 100);
+    write(96);
+    CHECK(ring_buffer.grab_write(buf_ptr, 8) == ENOBUFS);
+
+    // growing keeps them, and each reader's place
+    CHECK(ring_buffer.resize(100, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() == 1024);
+    write(400);
+    CHECK(ring_buffer.get_elems_avail_to_write() == 8);
+    // 908 elements are unread
+    CHECK(ring_buffer.resize(4, std::chrono::microseconds(0)) == ENOBUFS);
+    CHECK(ring_buffer.get_buffer_size_elems() == 1024);
+    read(fast_reader, 300, written);
+    read(slow_reader, 100, 700);
+
+    // a grab keeps it from resizing
+    REQUIRE(ring_buffer.grab_read(buf_ptr, 8, slow_reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.resize(4, std::chrono::microseconds(1000)) == ETIMEDOUT);
+    CHECK(ring_buffer.release_read(slow_reader) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() == 1024);
+    read(slow_reader, 708, 800);
+
+    // shrinking once they fit
+    CHECK(ring_buffer.resize(4, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() == 512);
+    read(slow_reader, 800, written);
+    write(500);
+    read(fast_reader, written - 500, written);
+    read(slow_reader, written - 500, written);
+}
+
+TEST_CASE("testing the direct_ring_buffer resizes under concurrent use") {
+    DirectRingBuffer ring_buffer(sizeof(uint64_t), 8, 8, 4, "error");
+    const size_t reader_id = ring_buffer.add_reader();
+    const uint64_t num_elems = 200000;
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+        uint64_t n = 0;
+        while(n < num_elems) {
+            char* elem_ptr;
+            size_t elems_grabbed;
+            if(ring_buffer.grab_write_upto(elem_ptr, elems_grabbed,
+                    std::min<uint64_t>(num_elems - n, 8)) != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            uint64_t* values = reinterpret_cast<uint64_t*>(elem_ptr);
+            for(size_t elem = 0; elem < elems_grabbed; elem++) {
+                values[elem] = n++;
+            }
+            ring_buffer.release_write();
+        }
+    });
+    size_t errors = 0;
+    std::thread reader([&]() {
+        uint64_t next = 0;
+        while(next < num_elems) {
+            char* elem_ptr;
+            size_t elems_grabbed;
+            if(ring_buffer.grab_read_upto(elem_ptr, elems_grabbed, 8, reader_id,
+                    std::chrono::microseconds(10000)) != 0) {
+                continue;
+            }
+            const uint64_t* values = reinterpret_cast<const uint64_t*>(elem_ptr);
+            for(size_t elem = 0; elem < elems_grabbed; elem++, next++) {
+                if(values[elem] != next) {
+                    errors++;
+                }
+            }
+            ring_buffer.release_read(reader_id);
+        }
+        done = true;
+    });
+    // the size can be read at any time
+    size_t bad_sizes = 0;
+    std::thread monitor([&]() {
+        while(!done) {
+            const size_t size = ring_buffer.get_buffer_size_elems();
+            if(size != 512 && size != 1024) {
+                bad_sizes++;
+            }
+        }
+    });
+    size_t resizes = 0;
+    for(size_t n = 0; !done; n++) {
+        // shrinking fails if more than 512 elements are unread
+        const int rc = ring_buffer.resize(n % 2 ? 4 : 100, std::chrono::microseconds(1000000));
+        CHECK((rc == 0 || rc == ENOBUFS));
+        if(rc == 0) {
+            resizes++;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    writer.join();
+    reader.join();
+    monitor.join();
+    CHECK(errors == 0);
+    CHECK(bad_sizes == 0);
+    CHECK(resizes > 0);
+}
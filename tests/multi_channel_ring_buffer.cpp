@@ -0,0 +1,175 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/multi_channel_ring_buffer.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace snake_charmer;
+
+namespace {
+uint32_t sample_value(const size_t channel, const size_t index) {
+    return static_cast<uint32_t>(channel << 24 | (index & 0xFFFFFF));
+}
+
+void write_samples(const std::vector<ChannelView>& channels, const size_t start, const size_t elems) {
+    for(size_t channel = 0; channel < channels.size(); channel++) {
+        for(size_t n = 0; n < elems; n++) {
+            const uint32_t value = sample_value(channel, start + n);
+            memcpy(channels[channel].sample(n), &value, sizeof(value));
+        }
+    }
+}
+
+// Returns the number of samples that don't match
+size_t check_samples(const std::vector<ChannelView>& channels, const size_t start, const size_t elems) {
+    size_t errors = 0;
+    for(size_t channel = 0; channel < channels.size(); channel++) {
+        for(size_t n = 0; n < elems; n++) {
+            uint32_t value;
+            memcpy(&value, channels[channel].sample(n), sizeof(value));
+            if(value != sample_value(channel, start + n)) {
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+}
+
+TEST_CASE("testing the multi_channel_ring_buffer keeps channels aligned") {
+    const size_t num_channels = 8;
+    for(const ChannelLayout layout : {ChannelLayout::Planar, ChannelLayout::Interleaved}) {
+        MultiChannelRingBuffer ring_buffer(
+            num_channels, sizeof(uint32_t), layout, 100, 100, 10, "error", 2, ReadMode::Broadcast);
+        CHECK(ring_buffer.get_num_channels() == num_channels);
+        CHECK(ring_buffer.get_sample_size() == sizeof(uint32_t));
+        CHECK(ring_buffer.get_layout() == layout);
+        CHECK(ring_buffer.get_elem_size() ==
+            (layout == ChannelLayout::Planar ? 1 : num_channels) * sizeof(uint32_t));
+        const size_t readers[] = {ring_buffer.add_reader(), ring_buffer.add_reader()};
+
+        std::vector<ChannelView> channels(num_channels);
+        std::vector<ptrdiff_t> plane_offsets(num_channels);
+        size_t written = 0;
+        size_t read = 0;
+        size_t errors = 0;
+        size_t misplaced = 0;
+        // enough to wrap several times
+        for(size_t n = 0; n < 500; n++) {
+            const size_t elems = 1 + n * 7 % 100;
+            REQUIRE(ring_buffer.grab_write(channels.data(), elems) == 0);
+            for(size_t channel = 0; channel < num_channels; channel++) {
+                const ptrdiff_t offset = channels[channel].data - channels[0].data;
+                if(layout == ChannelLayout::Interleaved) {
+                    CHECK(channels[channel].stride == num_channels * sizeof(uint32_t));
+                    CHECK(offset == static_cast<ptrdiff_t>(channel * sizeof(uint32_t)));
+                } else {
+                    CHECK(channels[channel].stride == sizeof(uint32_t));
+                    // every grab is at the same place in each plane
+                    if(n > 0 && offset != plane_offsets[channel]) {
+                        misplaced++;
+                    }
+                    plane_offsets[channel] = offset;
+                }
+            }
+            write_samples(channels, written, elems);
+            REQUIRE(ring_buffer.release_write() == 0);
+            written += elems;
+
+            // every reader sees every channel of every element
+            size_t elems_grabbed = 0;
+            for(const size_t id : readers) {
+                REQUIRE(ring_buffer.grab_read_upto(channels.data(), elems_grabbed, 100, id,
+                    std::chrono::microseconds(0)) == 0);
+                errors += check_samples(channels, read, elems_grabbed);
+                REQUIRE(ring_buffer.release_read(id) == 0);
+            }
+            read += elems_grabbed;
+        }
+        CHECK(read == written);
+        CHECK(errors == 0);
+        CHECK(misplaced == 0);
+        CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+    }
+
+    CHECK_THROWS_AS(MultiChannelRingBuffer(0, 4, ChannelLayout::Planar, 10, 10, 4, "error"),
+        std::runtime_error);
+    CHECK_THROWS_AS(MultiChannelRingBuffer(4, 0, ChannelLayout::Interleaved, 10, 10, 4, "error"),
+        std::runtime_error);
+}
+
+TEST_CASE("testing the multi_channel_ring_buffer between threads") {
+    const size_t num_channels = 16;
+    const size_t num_elems = 200000;
+    for(const ChannelLayout layout : {ChannelLayout::Planar, ChannelLayout::Interleaved}) {
+        MultiChannelRingBuffer ring_buffer(
+            num_channels, sizeof(uint32_t), layout, 64, 64, 8, "error");
+        const size_t id = ring_buffer.add_reader();
+        size_t errors = 0;
+        std::thread reader([&]() {
+            std::vector<ChannelView> channels(num_channels);
+            size_t read = 0;
+            while(read < num_elems) {
+                size_t elems_grabbed;
+                if(ring_buffer.grab_read_upto(channels.data(), elems_grabbed, 64, id,
+                        std::chrono::microseconds(100000)) != 0) {
+                    continue;
+                }
+                errors += check_samples(channels, read, elems_grabbed);
+                ring_buffer.release_read(id);
+                read += elems_grabbed;
+            }
+        });
+        std::vector<ChannelView> channels(num_channels);
+        size_t written = 0;
+        while(written < num_elems) {
+            size_t elems_grabbed;
+            if(ring_buffer.grab_write_upto(
+                    channels.data(), elems_grabbed, std::min<size_t>(64, num_elems - written)) != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            write_samples(channels, written, elems_grabbed);
+            ring_buffer.release_write();
+            written += elems_grabbed;
+        }
+        reader.join();
+        CHECK(errors == 0);
+    }
+}
+
+TEST_CASE("testing resizing a multi_channel_ring_buffer") {
+    const size_t num_channels = 4;
+    MultiChannelRingBuffer ring_buffer(
+        num_channels, sizeof(uint32_t), ChannelLayout::Planar, 1000, 1000, 1, "error");
+    const size_t id = ring_buffer.add_reader();
+    std::vector<ChannelView> channels(num_channels);
+    size_t written = 0;
+    size_t read = 0;
+    // leave unread elements across the wrap in every plane
+    for(size_t n = 0; n < 4; n++) {
+        REQUIRE(ring_buffer.grab_write(channels.data(), 900) == 0);
+        write_samples(channels, written, 900);
+        REQUIRE(ring_buffer.release_write() == 0);
+        written += 900;
+        REQUIRE(ring_buffer.grab_read(channels.data(), n < 3 ? 900 : 500, id,
+            std::chrono::microseconds(0)) == 0);
+        REQUIRE(ring_buffer.release_read(id) == 0);
+        read += n < 3 ? 900 : 500;
+    }
+    const size_t old_size = ring_buffer.get_buffer_size_elems();
+    REQUIRE(ring_buffer.resize(8, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.get_buffer_size_elems() > old_size);
+
+    size_t elems_grabbed;
+    REQUIRE(ring_buffer.grab_read_upto(channels.data(), elems_grabbed, 1000, id,
+        std::chrono::microseconds(0)) == 0);
+    CHECK(elems_grabbed == written - read);
+    CHECK(check_samples(channels, read, elems_grabbed) == 0);
+    REQUIRE(ring_buffer.release_read(id) == 0);
+}
@@ -0,0 +1,113 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/packet_ingest.h>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+using namespace snake_charmer;
+
+namespace {
+// Bind a UDP socket to an ephemeral loopback port
+int bind_loopback(struct sockaddr_in& addr) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    return fd;
+}
+
+// Send a packet with a header holding seq, and payload_size bytes of seq
+void send_packet(
+        const int fd,
+        const struct sockaddr_in& addr,
+        const uint64_t seq,
+        const size_t payload_size
+) {
+    std::vector<char> packet(sizeof(seq) + payload_size, static_cast<char>(seq));
+    memcpy(packet.data(), &seq, sizeof(seq));
+    sendto(fd, packet.data(), packet.size(), 0,
+        reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr));
+}
+}
+
+TEST_CASE("testing packet_ingest over loopback") {
+    const size_t elem_size = 64;
+    const size_t payload_size = 4 * elem_size;
+    DirectRingBuffer ring_buffer(elem_size, 64, 64, 64, "error");
+    struct sockaddr_in addr;
+    const int recv_fd = bind_loopback(addr);
+    const int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    REQUIRE(recv_fd >= 0);
+    REQUIRE(send_fd >= 0);
+
+    CHECK_THROWS_AS(PacketIngest(ring_buffer, recv_fd, 8, 100), std::runtime_error);
+    CHECK_THROWS_AS(PacketIngest(ring_buffer, recv_fd, 8, 65 * elem_size), std::runtime_error);
+    PacketIngest ingest(ring_buffer, recv_fd, sizeof(uint64_t), payload_size);
+    CHECK(ingest.get_elems_per_packet() == 4);
+
+    size_t packets;
+    CHECK(ingest.ingest(packets, std::chrono::milliseconds(1)) == ENOMSG);
+    CHECK(packets == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+
+    const size_t reader = ring_buffer.add_reader();
+    uint64_t seq = 0;
+    for(size_t round = 0; round < 50; round++) {
+        // a batch is at most 16 packets; the odd sizes are dropped
+        const size_t num_packets = 1 + round % 16;
+        for(size_t n = 0; n < num_packets; n++) {
+            if(n == 2) {
+                send_packet(send_fd, addr, 0xff, payload_size - 1);
+                send_packet(send_fd, addr, 0xff, payload_size + 1);
+            }
+            send_packet(send_fd, addr, seq + n, payload_size);
+        }
+        size_t total = 0;
+        while(total < num_packets) {
+            REQUIRE(ingest.ingest(packets, std::chrono::seconds(1)) == 0);
+            for(size_t n = 0; n < packets; n++) {
+                uint64_t header;
+                memcpy(&header, ingest.get_header(n), sizeof(header));
+                CHECK(header == seq + total + n);
+            }
+            total += packets;
+        }
+        CHECK(total == num_packets);
+
+        // only the payloads are in the buffer
+        char* elem_ptr;
+        REQUIRE(ring_buffer.grab_read(elem_ptr, num_packets * 4, reader,
+            std::chrono::microseconds(0)) == 0);
+        for(size_t n = 0; n < num_packets; n++) {
+            const char* payload = elem_ptr + n * payload_size;
+            CHECK(payload[0] == static_cast<char>(seq + n));
+            CHECK(payload[payload_size - 1] == static_cast<char>(seq + n));
+        }
+        CHECK(ring_buffer.release_read(reader) == 0);
+        CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+        seq += num_packets;
+    }
+    CHECK(ingest.get_packets_received() == seq);
+    CHECK(ingest.get_packets_dropped() == 2 * 42);
+    close(recv_fd);
+
+    // busy polling spins for the packet rather than sleeping
+    const int busy_fd = bind_loopback(addr);
+    PacketIngest busy_ingest(ring_buffer, busy_fd, sizeof(uint64_t), payload_size, 16, 50);
+    CHECK(busy_ingest.ingest(packets, std::chrono::microseconds(100)) == ENOMSG);
+    send_packet(send_fd, addr, seq, payload_size);
+    CHECK(busy_ingest.ingest(packets, std::chrono::seconds(1)) == 0);
+    CHECK(packets == 1);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 4);
+    close(busy_fd);
+    close(send_fd);
+}
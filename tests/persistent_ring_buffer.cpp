@@ -0,0 +1,220 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/persistent_ring_buffer.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace snake_charmer;
+
+namespace {
+std::string test_path(const std::string& suffix) {
+    return "/tmp/snake_charmer_test_" + std::to_string(getpid()) + "_" + suffix;
+}
+
+// Write count elements numbered from first with the built-in writer
+int write_elems(PersistentDirectRingBuffer& ring_buffer, const size_t first, const size_t count) {
+    char* elem_ptr;
+    const int rc = ring_buffer.grab_write(elem_ptr, count);
+    if(rc != 0) {
+        return rc;
+    }
+    for(size_t n = 0; n < count; n++) {
+        reinterpret_cast<size_t*>(elem_ptr)[n] = first + n;
+    }
+    return ring_buffer.release_write();
+}
+
+// Returns the first element grabbed, or -1 if the grab failed or isn't in order
+long read_elems(PersistentDirectRingBuffer& ring_buffer, const size_t count, const size_t id) {
+    char* elem_ptr;
+    if(ring_buffer.grab_read(elem_ptr, count, id, std::chrono::microseconds(0)) != 0) {
+        return -1;
+    }
+    const size_t* elems = reinterpret_cast<const size_t*>(elem_ptr);
+    for(size_t n = 1; n < count; n++) {
+        if(elems[n] != elems[0] + n) {
+            return -1;
+        }
+    }
+    const long first = elems[0];
+    return ring_buffer.release_read(id) == 0 ? first : -1;
+}
+
+// Returns the exit code of the child, or -1 if it didn't exit normally
+int wait_child(const pid_t pid) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+}
+
+TEST_CASE("testing reopening a persistent_ring_buffer") {
+    const std::string path = test_path("reopen");
+    for(const ReadMode read_mode : {ReadMode::Distribute, ReadMode::Broadcast}) {
+        size_t reader;
+        {
+            PersistentDirectRingBuffer ring_buffer(
+                path, sizeof(size_t), 100, 100, 8, "error", 2, read_mode);
+            CHECK(!ring_buffer.is_resumed());
+            CHECK(ring_buffer.get_path() == path);
+            CHECK(ring_buffer.enable_event_fds() == ENOTSUP);
+            CHECK(ring_buffer.resize(16, std::chrono::microseconds(0)) == ENOTSUP);
+            // only one process at a time
+            CHECK_THROWS_AS(PersistentDirectRingBuffer(
+                path, sizeof(size_t), 100, 100, 8, "error", 2, read_mode), std::runtime_error);
+            reader = ring_buffer.add_reader();
+            // wrap a few times before stopping
+            for(size_t n = 0; n < 50; n++) {
+                REQUIRE(write_elems(ring_buffer, n * 100, 100) == 0);
+                if(n < 49) {
+                    REQUIRE(read_elems(ring_buffer, 100, reader) == static_cast<long>(n * 100));
+                }
+            }
+            CHECK(ring_buffer.sync() == 0);
+        }
+
+        // the sizing must match
+        CHECK_THROWS_AS(PersistentDirectRingBuffer(
+            path, sizeof(size_t), 100, 100, 4, "error", 2, read_mode), std::runtime_error);
+
+        PersistentDirectRingBuffer ring_buffer(
+            path, sizeof(size_t), 100, 100, 8, "error", 2, read_mode);
+        CHECK(ring_buffer.is_resumed());
+        // the reader resumes where it left off, and so does the writer
+        CHECK(ring_buffer.get_elems_avail_to_read(reader) == 100);
+        CHECK(read_elems(ring_buffer, 100, reader) == 4900);
+        REQUIRE(write_elems(ring_buffer, 5000, 100) == 0);
+        CHECK(read_elems(ring_buffer, 100, reader) == 5000);
+        remove(path.c_str());
+    }
+}
+
+TEST_CASE("testing recovering grabs of a crashed persistent_ring_buffer") {
+    const std::string path = test_path("crash");
+    for(const ReadMode read_mode : {ReadMode::Distribute, ReadMode::Broadcast}) {
+        const pid_t pid = fork();
+        if(pid == 0) {
+            int rc = 1;
+            try {
+                PersistentDirectRingBuffer ring_buffer(
+                    path, sizeof(size_t), 100, 100, 8, "error", 2, read_mode, 2);
+                const size_t reader = ring_buffer.add_reader();
+                const size_t writer = ring_buffer.add_writer();
+                char* elem_ptr;
+                rc = write_elems(ring_buffer, 0, 100);
+                rc |= write_elems(ring_buffer, 100, 100);
+                // crash holding a read grab and both write grabs
+                rc |= read_elems(ring_buffer, 100, reader) == 0 ? 0 : 1;
+                rc |= ring_buffer.grab_read(elem_ptr, 50, reader, std::chrono::microseconds(0));
+                rc |= ring_buffer.grab_write(elem_ptr, 30, writer);
+                rc |= ring_buffer.grab_write(elem_ptr, 20);
+            } catch(const std::exception& e) {
+                fprintf(stderr, "child failed: %s\n", e.what());
+            }
+            _exit(rc);
+        }
+        REQUIRE(wait_child(pid) == 0);
+
+        PersistentDirectRingBuffer ring_buffer(
+            path, sizeof(size_t), 100, 100, 8, "error", 2, read_mode, 2);
+        CHECK(ring_buffer.is_resumed());
+        // the read grab is read again, and the write grabs are handed back
+        CHECK(ring_buffer.get_elems_avail_to_read(0) == 100);
+        CHECK(read_elems(ring_buffer, 100, 0) == 100);
+        CHECK(ring_buffer.get_elems_avail_to_read(0) == 0);
+        REQUIRE(write_elems(ring_buffer, 200, 100) == 0);
+        CHECK(read_elems(ring_buffer, 100, 0) == 200);
+        remove(path.c_str());
+    }
+}
+
+TEST_CASE("testing a persistent_ring_buffer zeroes write grabs it can't hand back") {
+    const std::string path = test_path("lost");
+    const pid_t pid = fork();
+    if(pid == 0) {
+        int rc = 1;
+        try {
+            PersistentDirectRingBuffer ring_buffer(
+                path, sizeof(size_t), 100, 100, 8, "error", 2, ReadMode::Distribute, 2);
+            ring_buffer.add_reader();
+            const size_t writer = ring_buffer.add_writer();
+            char* elem_ptr;
+            // crash holding a write grab the built-in writer committed past
+            rc = ring_buffer.grab_write(elem_ptr, 30, writer);
+            rc |= write_elems(ring_buffer, 30, 20);
+        } catch(const std::exception& e) {
+            fprintf(stderr, "child failed: %s\n", e.what());
+        }
+        _exit(rc);
+    }
+    REQUIRE(wait_child(pid) == 0);
+
+    PersistentDirectRingBuffer ring_buffer(
+        path, sizeof(size_t), 100, 100, 8, "error", 2, ReadMode::Distribute, 2);
+    CHECK(ring_buffer.get_stats().elems_lost == 30);
+    // the lost elements read as zero, followed by those committed after them
+    char* elem_ptr;
+    REQUIRE(ring_buffer.grab_read(elem_ptr, 50, 0, std::chrono::microseconds(0)) == 0);
+    const size_t* elems = reinterpret_cast<const size_t*>(elem_ptr);
+    CHECK(std::count(elems, elems + 30, 0) == 30);
+    CHECK(elems[30] == 30);
+    CHECK(elems[49] == 49);
+    CHECK(ring_buffer.release_read(0) == 0);
+    remove(path.c_str());
+}
+
+TEST_CASE("testing reopening a persistent_ring_buffer whose creation was interrupted") {
+    const std::string path = test_path("interrupted");
+    {
+        PersistentDirectRingBuffer ring_buffer(path, sizeof(size_t), 100, 100, 8, "error");
+        REQUIRE(write_elems(ring_buffer, 0, 100) == 0);
+    }
+    // as if the creator died before storing the magic
+    const int fd = open(path.c_str(), O_RDWR);
+    REQUIRE(fd >= 0);
+    const uint64_t magic = 0;
+    CHECK(pwrite(fd, &magic, sizeof(magic), 0) == sizeof(magic));
+    close(fd);
+
+    // with other parameters it's refused, saying to delete it
+    std::string error;
+    try {
+        PersistentDirectRingBuffer(path, sizeof(size_t), 100, 100, 4, "error");
+    } catch(const std::runtime_error& e) {
+        error = e.what();
+    }
+    CHECK(error.find("delete it") != std::string::npos);
+
+    // with the same ones it's created again
+    PersistentDirectRingBuffer ring_buffer(path, sizeof(size_t), 100, 100, 8, "error");
+    CHECK(!ring_buffer.is_resumed());
+    const size_t reader = ring_buffer.add_reader();
+    CHECK(ring_buffer.get_elems_avail_to_read(reader) == 0);
+    REQUIRE(write_elems(ring_buffer, 0, 100) == 0);
+    CHECK(read_elems(ring_buffer, 100, reader) == 0);
+    remove(path.c_str());
+}
+
+TEST_CASE("testing persistent_ring_buffer refuses other files") {
+    const std::string path = test_path("other");
+    FILE* file = fopen(path.c_str(), "w");
+    REQUIRE(file != nullptr);
+    fputs("not a ring buffer", file);
+    fclose(file);
+    CHECK_THROWS_AS(PersistentDirectRingBuffer(path, sizeof(size_t), 100, 100, 8, "error"),
+        std::runtime_error);
+    // and leaves them alone
+    file = fopen(path.c_str(), "r");
+    REQUIRE(file != nullptr);
+    char contents[32] = {0};
+    CHECK(fgets(contents, sizeof(contents), file) != nullptr);
+    CHECK(std::string(contents) == "not a ring buffer");
+    fclose(file);
+    remove(path.c_str());
+}
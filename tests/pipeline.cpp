@@ -0,0 +1,180 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/pipeline.h>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace snake_charmer;
+
+namespace {
+const std::chrono::milliseconds TEST_TIMEOUT(10000);
+
+// Counts from 0 to num_elems - 1, then finishes
+class Counter : public PipelineBlock {
+    public:
+        Counter(const size_t num_elems, const size_t elems_per_call) :
+                PipelineBlock("counter", {}, {sizeof(size_t)}, 0, elems_per_call),
+                num_elems(num_elems),
+                elems_per_call(elems_per_call),
+                next(0) {};
+
+        int work(const std::vector<const char*>&, const std::vector<char*>& outputs) override {
+            if(next >= num_elems) {
+                return ENODATA;
+            }
+            size_t* values = reinterpret_cast<size_t*>(outputs[0]);
+            for(size_t n = 0; n < elems_per_call; n++) {
+                values[n] = next++;
+            }
+            return 0;
+        };
+
+        const size_t num_elems;
+        const size_t elems_per_call;
+        size_t next;
+};
+
+// Keeps the first element of every factor
+class Decimator : public PipelineBlock {
+    public:
+        explicit Decimator(const size_t factor) :
+                PipelineBlock("decimator", {sizeof(size_t)}, {sizeof(size_t)}, factor, 1) {};
+
+        int work(
+                const std::vector<const char*>& inputs,
+                const std::vector<char*>& outputs
+        ) override {
+            memcpy(outputs[0], inputs[0], sizeof(size_t));
+            return 0;
+        };
+};
+
+// Checks its input counts up by step
+class Checker : public PipelineBlock {
+    public:
+        Checker(const std::string& name, const size_t step, const size_t elems_per_call) :
+                PipelineBlock(name, {sizeof(size_t)}, {}, elems_per_call, 0),
+                step(step),
+                elems_per_call(elems_per_call),
+                next(0),
+                errors(0) {};
+
+        int work(const std::vector<const char*>& inputs, const std::vector<char*>&) override {
+            const size_t* values = reinterpret_cast<const size_t*>(inputs[0]);
+            for(size_t n = 0; n < elems_per_call; n++, next += step) {
+                if(values[n] != next) {
+                    errors++;
+                }
+            }
+            return 0;
+        };
+
+        const size_t step;
+        const size_t elems_per_call;
+        size_t next;
+        size_t errors;
+};
+
+// Fails on element 100
+class Failer : public PipelineBlock {
+    public:
+        Failer() : PipelineBlock("failer", {sizeof(size_t)}, {}, 1, 0) {};
+
+        int work(const std::vector<const char*>& inputs, const std::vector<char*>&) override {
+            return *reinterpret_cast<const size_t*>(inputs[0]) == 100 ? EIO : 0;
+        };
+};
+}
+
+TEST_CASE("testing a pipeline decimates and fans out") {
+    const size_t num_elems = 100000;
+    for(const size_t num_threads : {1, 4}) {
+        // the counter writes 7 at a time, so the decimator straddles calls
+        Counter counter(num_elems, 7);
+        Decimator decimator(4);
+        Checker all("all", 1, 5);
+        Checker decimated("decimated", 4, 3);
+        Pipeline pipeline(num_threads, std::vector<int>(), "error");
+        pipeline.connect(counter, 0, decimator, 0);
+        pipeline.connect(counter, 0, all, 0);
+        pipeline.connect(decimator, 0, decimated, 0, 2);
+        pipeline.start();
+        CHECK(pipeline.wait(TEST_TIMEOUT) == 0);
+        CHECK(pipeline.stop() == 0);
+
+        // the last partial calls are left unconsumed
+        const size_t elems_written = (num_elems + 6) / 7 * 7;
+        CHECK(all.errors == 0);
+        CHECK(all.next == elems_written / 5 * 5);
+        CHECK(decimated.errors == 0);
+        CHECK(decimated.next == elems_written / 4 / 3 * 3 * 4);
+
+        const BlockStats stats = pipeline.get_stats(decimator);
+        CHECK(stats.work_calls == elems_written / 4);
+        CHECK(stats.elems_consumed == elems_written / 4 * 4);
+        CHECK(stats.elems_produced == elems_written / 4);
+        CHECK(pipeline.get_stats(counter).elems_produced == elems_written);
+        CHECK(pipeline.get_stats(all).elems_produced == 0);
+        CHECK(pipeline.get_stats(all).get_throughput() > 0);
+    }
+}
+
+TEST_CASE("testing a block's error stops the pipeline") {
+    Counter counter(SIZE_MAX, 8);
+    Failer failer;
+    Pipeline pipeline(2, std::vector<int>(), "off");
+    pipeline.connect(counter, 0, failer, 0);
+    pipeline.start();
+    CHECK(pipeline.wait(TEST_TIMEOUT) == EIO);
+    CHECK(pipeline.stop() == EIO);
+    CHECK(pipeline.get_stats(failer).work_calls == 100);
+}
+
+TEST_CASE("testing a pipeline times out while running") {
+    Counter counter(SIZE_MAX, 8);
+    Checker checker("checker", 1, 8);
+    Pipeline pipeline(1, std::vector<int>(), "error");
+    pipeline.connect(counter, 0, checker, 0);
+    pipeline.start();
+    CHECK(pipeline.wait(std::chrono::milliseconds(20)) == ETIMEDOUT);
+    CHECK(pipeline.stop() == 0);
+    CHECK(checker.errors == 0);
+    CHECK(checker.next > 0);
+}
+
+TEST_CASE("testing a pipeline rejects invalid graphs") {
+    struct Empty : public PipelineBlock {
+        Empty() : PipelineBlock("empty", {}, {}, 0, 0) {};
+        int work(const std::vector<const char*>&, const std::vector<char*>&) override {
+            return 0;
+        };
+    };
+    CHECK_THROWS_AS(Empty(), std::runtime_error);
+
+    Counter counter(10, 1);
+    Decimator decimator(2);
+    Checker checker("checker", 1, 1);
+    Pipeline pipeline(1, std::vector<int>(), "off");
+    CHECK_THROWS_AS(pipeline.connect(counter, 1, decimator, 0), std::runtime_error);
+    CHECK_THROWS_AS(pipeline.connect(counter, 0, decimator, 1), std::runtime_error);
+    pipeline.connect(counter, 0, decimator, 0);
+    CHECK_THROWS_AS(pipeline.connect(counter, 0, decimator, 0), std::runtime_error);
+    // the decimator's output isn't connected
+    CHECK_THROWS_AS(pipeline.start(), std::runtime_error);
+    pipeline.connect(decimator, 0, checker, 0);
+    pipeline.start();
+    CHECK_THROWS_AS(pipeline.start(), std::runtime_error);
+    CHECK_THROWS_AS(pipeline.connect(counter, 0, checker, 0), std::runtime_error);
+    CHECK(pipeline.wait(TEST_TIMEOUT) == 0);
+
+    struct Bytes : public PipelineBlock {
+        Bytes() : PipelineBlock("bytes", {1}, {}, 1, 0) {};
+        int work(const std::vector<const char*>&, const std::vector<char*>&) override {
+            return 0;
+        };
+    } bytes;
+    Pipeline mismatched(1, std::vector<int>(), "off");
+    CHECK_THROWS_AS(mismatched.connect(counter, 0, bytes, 0), std::runtime_error);
+}
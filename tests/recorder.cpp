@@ -0,0 +1,92 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/recorder.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace snake_charmer;
+
+namespace {
+std::string test_path(const std::string& suffix) {
+    return "/tmp/snake_charmer_test_" + std::to_string(getpid()) + "_" + suffix;
+}
+
+// Write num_elems elements, each filled with its index
+void write_pattern(DirectRingBuffer& ring_buffer, const size_t num_elems) {
+    const size_t elem_size = ring_buffer.get_elem_size();
+    const size_t words = elem_size / sizeof(size_t);
+    char* elem_ptr;
+    size_t n = 0;
+    while(n < num_elems) {
+        size_t elems_grabbed;
+        if(ring_buffer.grab_write_upto(elem_ptr, elems_grabbed,
+                std::min(num_elems - n, ring_buffer.get_max_elems_per_write())) != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for(size_t elem = 0; elem < elems_grabbed; elem++, n++) {
+            size_t* values = reinterpret_cast<size_t*>(elem_ptr + elem * elem_size);
+            std::fill(values, values + words, n);
+        }
+        ring_buffer.release_write();
+    }
+}
+
+// Returns the number of elements in path that don't match the pattern, or
+// SIZE_MAX if it's the wrong size
+size_t check_pattern(const std::string& path, const size_t elem_size, const size_t num_elems) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> contents(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(contents.size() != elem_size * num_elems) {
+        return SIZE_MAX;
+    }
+    size_t mismatches = 0;
+    for(size_t n = 0; n < num_elems; n++) {
+        const size_t* values = reinterpret_cast<const size_t*>(&contents[n * elem_size]);
+        if(values[0] != n || values[elem_size / sizeof(size_t) - 1] != n) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+}
+
+TEST_CASE("testing the recorder drains a direct_ring_buffer to disk") {
+    const size_t elem_size = 512;
+    // not a multiple of elems_per_write, so stop() writes a tail
+    const size_t num_elems = 20003;
+    for(const bool direct_io : {true, false}) {
+        const std::string path = test_path(direct_io ? "direct" : "buffered");
+        DirectRingBuffer ring_buffer(elem_size, 16, 16, 64, "error");
+        // 8 elements is 4096 bytes, so O_DIRECT can be used
+        Recorder recorder(ring_buffer, path, 8, 4, direct_io);
+        CHECK((recorder.is_direct_io() == false || direct_io));
+        std::thread writer(write_pattern, std::ref(ring_buffer), num_elems);
+        writer.join();
+        CHECK(recorder.stop() == 0);
+        CHECK(recorder.get_error() == 0);
+        CHECK(recorder.get_bytes_written() == num_elems * elem_size);
+        CHECK(check_pattern(path, elem_size, num_elems) == 0);
+        CHECK(ring_buffer.get_elems_avail_to_read() == 0);
+        std::remove(path.c_str());
+    }
+}
+
+TEST_CASE("testing the recorder rejects unusable configurations") {
+    const std::string path = test_path("invalid");
+    DirectRingBuffer broadcast(512, 8, 8, 8, "error", 4, ReadMode::Broadcast);
+    CHECK_THROWS_AS(Recorder(broadcast, path, 8), std::runtime_error);
+    DirectRingBuffer ring_buffer(512, 8, 8, 8, "error", 4);
+    CHECK_THROWS_AS(Recorder(ring_buffer, path, 0), std::runtime_error);
+    CHECK_THROWS_AS(Recorder(ring_buffer, path, 9), std::runtime_error);
+    CHECK_THROWS_AS(Recorder(ring_buffer, path, 8, 5), std::runtime_error);
+    CHECK_THROWS_AS(Recorder(ring_buffer, "/nonexistent/recording", 8), std::runtime_error);
+    std::remove(path.c_str());
+}
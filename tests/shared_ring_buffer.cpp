@@ -0,0 +1,215 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <snake_charmer/shared_ring_buffer.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace snake_charmer;
+
+namespace {
+std::string test_name(const std::string& suffix) {
+    return "/snake_charmer_test_" + std::to_string(getpid()) + "_" + suffix;
+}
+
+// Run child in a forked process. doctest checks don't work across the fork,
+// so the child reports through its exit code instead. Children simulating a
+// crash call _exit() themselves, skipping their destructors.
+pid_t fork_child(const std::function<int()>& child) {
+    const pid_t pid = fork();
+    if(pid == 0) {
+        int rc = 1;
+        try {
+            rc = child();
+        } catch(const std::exception& e) {
+            fprintf(stderr, "child failed: %s\n", e.what());
+        }
+        // skip destructors, like a crash would
+        _exit(rc);
+    }
+    return pid;
+}
+
+// Returns the exit code of the child, or -1 if it didn't exit normally
+int wait_child(const pid_t pid) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+}
+
+TEST_CASE("testing attaching to a shared_ring_buffer from another process") {
+    const std::string name = test_name("attach");
+    const size_t elem_size = sizeof(size_t);
+    const size_t num_elems = 10000;
+    SharedDirectRingBuffer ring_buffer(name, elem_size, 4, 4, 8, "error");
+    CHECK(ring_buffer.get_name() == name);
+    CHECK_THROWS_AS(SharedDirectRingBuffer(name, elem_size, 4, 4, 8, "error"), std::runtime_error);
+    CHECK_THROWS_AS(SharedDirectRingBuffer(test_name("missing"), "error"), std::runtime_error);
+    // another process's releases couldn't signal this one's eventfds
+    CHECK(ring_buffer.enable_event_fds() == ENOTSUP);
+    // nor could it wait for another process's grabs before resizing
+    CHECK(ring_buffer.resize(16, std::chrono::microseconds(0)) == ENOTSUP);
+
+    // the child only learns the sizing from the shared memory
+    const pid_t pid = fork_child([&]() {
+        SharedDirectRingBuffer attached(name, "error");
+        if(attached.get_elem_size() != elem_size
+                || attached.get_buffer_size_elems() != ring_buffer.get_buffer_size_elems()) {
+            return 2;
+        }
+        const size_t reader = attached.add_reader();
+        char* elem_ptr;
+        for(size_t n = 0; n < num_elems; n++) {
+            if(attached.grab_read(elem_ptr, 1, reader, std::chrono::seconds(5)) != 0
+                    || *reinterpret_cast<size_t*>(elem_ptr) != n) {
+                return 3;
+            }
+            attached.release_read(reader);
+        }
+        return 0;
+    });
+    char* elem_ptr;
+    for(size_t n = 0; n < num_elems; n++) {
+        while(ring_buffer.grab_write(elem_ptr, 1) == ENOBUFS) {
+            std::this_thread::yield();
+        }
+        *reinterpret_cast<size_t*>(elem_ptr) = n;
+        ring_buffer.release_write();
+    }
+    CHECK(wait_child(pid) == 0);
+}
+
+TEST_CASE("testing a shared_ring_buffer reaps a dead reader") {
+    const std::string name = test_name("dead_reader");
+    SharedDirectRingBuffer ring_buffer(name, 64, 1, 1, 4, "error", 4, ReadMode::Broadcast);
+    const pid_t pid = fork_child([&]() {
+        SharedDirectRingBuffer attached(name, "error");
+        attached.add_reader();
+        _exit(0);
+        return 1;
+    });
+    CHECK(wait_child(pid) == 0);
+    // the dead reader never reads, so the buffer fills
+    char* elem_ptr;
+    size_t written = 0;
+    while(ring_buffer.grab_write(elem_ptr, 1) == 0) {
+        ring_buffer.release_write();
+        written++;
+    }
+    CHECK(written == ring_buffer.get_buffer_size_elems());
+    CHECK(ring_buffer.reap_dead_peers() == 1);
+    CHECK(ring_buffer.reap_dead_peers() == 0);
+    CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    // the dead reader's slot is reused
+    const size_t reader = ring_buffer.add_reader();
+    CHECK(reader == 0);
+    CHECK(ring_buffer.get_elems_avail_to_read(reader) == 0);
+    CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader) == 0);
+    CHECK(ring_buffer.remove_reader(reader) == 0);
+    CHECK(ring_buffer.add_reader() == reader);
+}
+
+TEST_CASE("testing a shared_ring_buffer reaps a dead writer") {
+    const std::string name = test_name("dead_writer");
+    SharedDirectRingBuffer ring_buffer(name, 64, 1, 1, 4, "error");
+    const size_t reader = ring_buffer.add_reader();
+    const pid_t pid = fork_child([&]() {
+        SharedDirectRingBuffer attached(name, "error");
+        const size_t writer = attached.add_writer();
+        char* elem_ptr;
+        // die while holding the grab
+        _exit(attached.grab_write(elem_ptr, 1, writer));
+        return 1;
+    });
+    CHECK(wait_child(pid) == 0);
+    char* elem_ptr;
+    CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == ENOMSG);
+    CHECK(ring_buffer.reap_dead_peers() == 1);
+    // nothing was grabbed after it, so the grab was handed back
+    CHECK(ring_buffer.get_stats().elems_lost == 0);
+    CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+    CHECK(ring_buffer.release_write() == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(ring_buffer.release_read(reader) == 0);
+    CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == ENOMSG);
+    // and the dead writer's slot is reused
+    CHECK(ring_buffer.add_writer() == 0);
+}
+
+TEST_CASE("testing a shared_ring_buffer zeroes a dead writer's grab") {
+    const std::string name = test_name("lost_grab");
+    SharedDirectRingBuffer ring_buffer(name, sizeof(size_t), 1, 2, 4, "error", 4,
+        ReadMode::Distribute, 4);
+    const size_t reader = ring_buffer.add_reader();
+    const pid_t pid = fork_child([&]() {
+        SharedDirectRingBuffer attached(name, "error");
+        const size_t writers[] = {attached.add_writer(), attached.add_writer()};
+        char* elem_ptr;
+        int rc = attached.grab_write(elem_ptr, 1, writers[0]);
+        *reinterpret_cast<size_t*>(elem_ptr) = 1;
+        // a later writer releases past the grab, and then the process dies
+        char* later_ptr;
+        rc |= attached.grab_write(later_ptr, 1, writers[1]);
+        *reinterpret_cast<size_t*>(later_ptr) = 2;
+        rc |= attached.release_write(writers[1]);
+        _exit(rc);
+        return 1;
+    });
+    CHECK(wait_child(pid) == 0);
+    char* elem_ptr;
+    CHECK(ring_buffer.grab_read(elem_ptr, 1, reader, std::chrono::microseconds(0)) == ENOMSG);
+    CHECK(ring_buffer.reap_dead_peers() == 2);
+    CHECK(ring_buffer.get_stats().elems_lost == 1);
+    // the half-written element reads as zero, and the later one is intact
+    REQUIRE(ring_buffer.grab_read(elem_ptr, 2, reader, std::chrono::microseconds(0)) == 0);
+    CHECK(reinterpret_cast<size_t*>(elem_ptr)[0] == 0);
+    CHECK(reinterpret_cast<size_t*>(elem_ptr)[1] == 2);
+    CHECK(ring_buffer.release_read(reader) == 0);
+}
+
+TEST_CASE("testing a shared_ring_buffer reader sees its writers go away") {
+    const std::string name = test_name("writer_gone");
+    int ready[2];
+    REQUIRE(pipe(ready) == 0);
+    pid_t pid;
+    {
+        SharedDirectRingBuffer ring_buffer(name, 64, 1, 1, 4, "error");
+        pid = fork_child([&]() {
+            SharedDirectRingBuffer attached(name, "error");
+            const size_t reader = attached.add_reader();
+            char byte = 0;
+            if(write(ready[1], &byte, 1) != 1) {
+                return 2;
+            }
+            // the data released before the creator went away is still there
+            char* elem_ptr;
+            if(attached.grab_read(elem_ptr, 1, reader, std::chrono::seconds(5)) != 0) {
+                return 3;
+            }
+            attached.release_read(reader);
+            int rc = ENOMSG;
+            for(size_t n = 0; n < 500 && rc == ENOMSG; n++) {
+                rc = attached.grab_read(elem_ptr, 1, reader, std::chrono::milliseconds(10));
+            }
+            return rc == EPIPE && !attached.is_writer_alive() ? 0 : 4;
+        });
+        char byte;
+        REQUIRE(read(ready[0], &byte, 1) == 1);
+        char* elem_ptr;
+        CHECK(ring_buffer.grab_write(elem_ptr, 1) == 0);
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    CHECK(wait_child(pid) == 0);
+    close(ready[0]);
+    close(ready[1]);
+}
@@ -0,0 +1,171 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <snake_charmer/typed_ring_buffer.h>
+#include <chrono>
+#include <thread>
+
+using namespace snake_charmer;
+
+struct Sample {
+    int32_t i;
+    int32_t q;
+    uint32_t seq;
+};
+
+TEST_CASE("testing the typed_ring_buffer") {
+    // 12 byte elements aren't a power of two, but the number of them is
+    size_t max_elems_per_write = 16;
+    size_t max_elems_per_read = 16;
+    size_t slack = 4;
+    TypedRingBuffer<Sample> ring_buffer(
+        max_elems_per_write,
+        max_elems_per_read,
+        slack,
+        "warning"
+    );
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+    CHECK((num_elems & (num_elems - 1)) == 0);
+    CHECK(num_elems >= slack * max_elems_per_read + max_elems_per_write);
+    CHECK(ring_buffer.get_buffer_size_bytes() == num_elems * sizeof(Sample));
+    CHECK(ring_buffer.get_elem_size() == sizeof(Sample));
+
+    Span<Sample> write_span;
+    Span<const Sample> read_span;
+    CHECK(ring_buffer.grab_write(write_span, max_elems_per_write + 1) == EMSGSIZE);
+    CHECK(ring_buffer.release_write() == EBUSY);
+    CHECK(ring_buffer.grab_read(read_span, 1) == ENOMSG);
+
+    // Test that the timeout is respected
+    auto start_time = std::chrono::steady_clock::now();
+    CHECK(ring_buffer.grab_read(read_span, 1, std::chrono::microseconds(10000)) == ENOMSG);
+    auto elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+    CHECK(elapsed_time > 9000);
+    // loose, since other tests may be loading the machine
+    CHECK(elapsed_time < 1000000);
+
+    // Test that we can fill the buffer, and no more
+    uint32_t seq = 0;
+    while (ring_buffer.get_elems_avail_to_write() >= max_elems_per_write) {
+        CHECK(ring_buffer.grab_write(write_span, max_elems_per_write) == 0);
+        CHECK(write_span.size == max_elems_per_write);
+        CHECK(ring_buffer.grab_write(write_span, 1) == EBUSY);
+        for (auto& sample : write_span) {
+            sample.i = seq;
+            sample.q = -static_cast<int32_t>(seq);
+            sample.seq = seq++;
+        }
+        CHECK(ring_buffer.release_write() == 0);
+    }
+    CHECK(ring_buffer.get_elems_avail_to_read() == seq);
+    CHECK(ring_buffer.grab_write(write_span, ring_buffer.get_elems_avail_to_write() + 1) == ENOBUFS);
+
+    std::vector<Sample> samples(max_elems_per_read);
+    CHECK(ring_buffer.read(samples.data(), 1) == 0);
+    CHECK(samples[0].seq == 0);
+
+    // Test that spans straddling the end of the buffer are contiguous
+    uint32_t expected = 1;
+    for (size_t lap = 0; lap < 3 * num_elems; lap += max_elems_per_read) {
+        while (ring_buffer.get_elems_avail_to_write() >= max_elems_per_write) {
+            CHECK(ring_buffer.grab_write(write_span, max_elems_per_write) == 0);
+            for (auto& sample : write_span) {
+                sample.seq = seq++;
+            }
+            CHECK(ring_buffer.release_write() == 0);
+        }
+        CHECK(ring_buffer.grab_read(read_span, max_elems_per_read) == 0);
+        for (size_t n = 0; n < read_span.size; n++) {
+            CHECK(read_span[n].seq == expected++);
+        }
+        CHECK(ring_buffer.release_read() == 0);
+    }
+}
+
+TEST_CASE("testing the typed_ring_buffer with a fixed capacity") {
+    const size_t capacity = 1024;
+    TypedRingBuffer<uint64_t, FixedCapacity<capacity>> ring_buffer(64, 64, 8, "warning");
+    CHECK(ring_buffer.get_buffer_size_elems() == capacity);
+
+    // Test that the capacity is checked against the slack
+    bool threw = false;
+    try {
+        TypedRingBuffer<uint64_t, FixedCapacity<capacity>> too_small(64, 64, 16, "warning");
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // Test that a producer and consumer stream in order
+    const uint64_t total = 1000000;
+    std::thread producer([&]() {
+        std::vector<uint64_t> out(64);
+        uint64_t next = 0;
+        while (next < total) {
+            size_t count = std::min<uint64_t>(out.size(), total - next);
+            for (size_t n = 0; n < count; n++) {
+                out[n] = next + n;
+            }
+            if (ring_buffer.write(out.data(), count) == 0) {
+                next += count;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    Span<const uint64_t> span;
+    uint64_t expected = 0;
+    bool in_order = true;
+    while (expected < total) {
+        size_t count = std::min<uint64_t>(32, total - expected);
+        if (ring_buffer.grab_read(span, count, std::chrono::microseconds(1000)) != 0) {
+            continue;
+        }
+        for (const uint64_t value : span) {
+            in_order = in_order && value == expected++;
+        }
+        ring_buffer.release_read();
+    }
+    producer.join();
+    CHECK(in_order);
+}
+
+TEST_CASE("testing the typed_ring_buffer variable-size grabs") {
+    TypedRingBuffer<uint32_t> ring_buffer(8, 8, 2, "warning");
+    const size_t num_elems = ring_buffer.get_buffer_size_elems();
+    Span<uint32_t> write_span;
+    Span<const uint32_t> read_span;
+    CHECK(ring_buffer.grab_read_upto(read_span, 8) == ENOMSG);
+    CHECK(ring_buffer.grab_write_upto(write_span, 9) == EMSGSIZE);
+
+    // Test that a partial release only publishes what was used
+    CHECK(ring_buffer.grab_write_upto(write_span, 8) == 0);
+    CHECK(write_span.size == 8);
+    write_span[0] = 10;
+    write_span[1] = 11;
+    CHECK(ring_buffer.release_write_partial(9) == EINVAL);
+    CHECK(ring_buffer.release_write_partial(2) == 0);
+    CHECK(ring_buffer.release_write_partial(2) == EBUSY);
+    CHECK(ring_buffer.get_elems_avail_to_read() == 2);
+
+    // Test that an upto read takes whatever is available
+    CHECK(ring_buffer.grab_read_upto(read_span, 8) == 0);
+    CHECK(read_span.size == 2);
+    CHECK(read_span[1] == 11);
+    CHECK(ring_buffer.release_read() == 0);
+
+    // Test that an upto write is limited by the free space
+    std::vector<uint32_t> elems(8);
+    size_t written = 0;
+    while (written + 8 <= num_elems - 3) {
+        CHECK(ring_buffer.write(elems.data(), 8) == 0);
+        written += 8;
+    }
+    CHECK(ring_buffer.write(elems.data(), 3) == 0);
+    written += 3;
+    CHECK(ring_buffer.grab_write_upto(write_span, 8) == 0);
+    CHECK(write_span.size == std::min<size_t>(8, num_elems - written));
+    CHECK(ring_buffer.release_write() == 0);
+}